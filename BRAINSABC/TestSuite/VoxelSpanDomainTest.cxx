@@ -0,0 +1,330 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "VoxelSpanDomain.h"
+#include "BRAINSComputeLabels.h"
+#include "itkImage.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Check VoxelSpanDomain::Build against a serial scan of a small mask with a
+// non-zero start index, and check that ParallelForEachSpan and
+// ParallelReduceSpans visit every masked voxel exactly once.  Also check that
+// a domain restricted to another domain holds the voxels of both masks, and
+// that labels computed over a domain match the labels of the mask test.
+
+namespace
+{
+using MaskImageType = itk::Image< unsigned char, 3 >;
+
+MaskImageType::Pointer
+CreateMask( const bool empty )
+{
+  MaskImageType::IndexType start;
+  start[0] = 2;
+  start[1] = -3;
+  start[2] = 5;
+  MaskImageType::SizeType size;
+  size[0] = 37;
+  size[1] = 11;
+  size[2] = 7;
+  MaskImageType::Pointer mask = MaskImageType::New();
+  mask->SetRegions( MaskImageType::RegionType( start, size ) );
+  mask->Allocate();
+  mask->FillBuffer( 0 );
+  if ( empty )
+  {
+    return mask;
+  }
+
+  itk::ImageRegionIteratorWithIndex< MaskImageType > it( mask, mask->GetBufferedRegion() );
+  for ( ; !it.IsAtEnd(); ++it )
+  {
+    const MaskImageType::OffsetType index = it.GetIndex() - start;
+    // the third slice is empty, the first row of every other slice is full
+    // and the rest holds short runs, some of them touching the row ends
+    if ( index[2] == 2 )
+    {
+      continue;
+    }
+    if ( index[1] == 0 || ( index[0] * 7 + index[1] * 3 + index[2] * 5 ) % 11 < 4 )
+    {
+      it.Set( 1 + static_cast< unsigned char >( index[0] % 3 ) );
+    }
+  }
+  return mask;
+}
+
+/** The spans of the mask found one voxel at a time. */
+VoxelSpanDomain::SpanVectorType
+SerialSpans( const MaskImageType * mask )
+{
+  VoxelSpanDomain::SpanVectorType                         spans;
+  itk::ImageRegionConstIteratorWithIndex< MaskImageType > it( mask, mask->GetBufferedRegion() );
+  const itk::IndexValueType                               rowStart = mask->GetBufferedRegion().GetIndex()[0];
+  bool                                                    inSpan = false;
+  for ( ; !it.IsAtEnd(); ++it )
+  {
+    const MaskImageType::IndexType index = it.GetIndex();
+    if ( index[0] == rowStart )
+    {
+      inSpan = false;
+    }
+    if ( it.Get() == 0 )
+    {
+      inSpan = false;
+      continue;
+    }
+    if ( !inSpan )
+    {
+      VoxelSpanDomain::Span span;
+      span.start = index;
+      span.offset = mask->ComputeOffset( index );
+      span.length = 0;
+      spans.push_back( span );
+      inSpan = true;
+    }
+    ++spans.back().length;
+  }
+  return spans;
+}
+
+bool
+TestDomain( const MaskImageType * mask )
+{
+  bool passed = true;
+
+  VoxelSpanDomain domain;
+  domain.Build( mask );
+
+  if ( domain.GetRegion() != mask->GetBufferedRegion() )
+  {
+    std::cerr << "Region " << domain.GetRegion() << " differs from the mask region " << mask->GetBufferedRegion()
+              << std::endl;
+    passed = false;
+  }
+
+  const VoxelSpanDomain::SpanVectorType   expected = SerialSpans( mask );
+  const VoxelSpanDomain::SpanVectorType & spans = domain.GetSpans();
+  if ( spans.size() != expected.size() )
+  {
+    std::cerr << spans.size() << " spans, expected " << expected.size() << std::endl;
+    return false;
+  }
+  itk::SizeValueType expectedNumberOfVoxels = 0;
+  for ( size_t s = 0; s < spans.size(); ++s )
+  {
+    expectedNumberOfVoxels += expected[s].length;
+    if ( spans[s].start != expected[s].start || spans[s].offset != expected[s].offset ||
+         spans[s].length != expected[s].length )
+    {
+      std::cerr << "Span " << s << " starts at " << spans[s].start << " (offset " << spans[s].offset << ", length "
+                << spans[s].length << "), expected " << expected[s].start << " (offset " << expected[s].offset
+                << ", length " << expected[s].length << ")" << std::endl;
+      passed = false;
+    }
+  }
+  if ( domain.GetNumberOfVoxels() != expectedNumberOfVoxels )
+  {
+    std::cerr << domain.GetNumberOfVoxels() << " voxels, expected " << expectedNumberOfVoxels << std::endl;
+    passed = false;
+  }
+  if ( domain.empty() != expected.empty() )
+  {
+    std::cerr << "empty() is " << domain.empty() << std::endl;
+    passed = false;
+  }
+
+  // Every masked voxel is visited once, and no other voxel.
+  const itk::SizeValueType         numberOfPixels = mask->GetBufferedRegion().GetNumberOfPixels();
+  std::vector< unsigned int >      visits( numberOfPixels, 0 );
+  const MaskImageType::PixelType * buffer = mask->GetBufferPointer();
+  domain.ParallelForEachSpan( [&visits]( const VoxelSpanDomain::Span & span ) {
+    for ( itk::SizeValueType v = 0; v < span.length; ++v )
+    {
+      ++visits[span.offset + v];
+    }
+  } );
+  for ( itk::SizeValueType p = 0; p < numberOfPixels; ++p )
+  {
+    if ( visits[p] != ( buffer[p] != 0 ? 1u : 0u ) )
+    {
+      std::cerr << "Voxel " << mask->ComputeIndex( p ) << " visited " << visits[p] << " times" << std::endl;
+      passed = false;
+    }
+  }
+
+  // The reduction sees every masked voxel once.
+  itk::SizeValueType expectedSum = 0;
+  for ( itk::SizeValueType p = 0; p < numberOfPixels; ++p )
+  {
+    expectedSum += buffer[p];
+  }
+  const itk::SizeValueType sum = domain.ParallelReduceSpans(
+    itk::SizeValueType( 0 ),
+    [buffer]( const VoxelSpanDomain::Span & span, itk::SizeValueType value ) -> itk::SizeValueType {
+      for ( itk::SizeValueType v = 0; v < span.length; ++v )
+      {
+        value += buffer[span.offset + v];
+      }
+      return value;
+    },
+    []( const itk::SizeValueType a, const itk::SizeValueType b ) -> itk::SizeValueType { return a + b; } );
+  if ( sum != expectedSum )
+  {
+    std::cerr << "Reduced sum " << sum << ", expected " << expectedSum << std::endl;
+    passed = false;
+  }
+  return passed;
+}
+/** A second mask on the lattice of mask: a slab that cuts through its runs. */
+MaskImageType::Pointer
+CreateSlabMask( const MaskImageType * mask )
+{
+  MaskImageType::Pointer slab = MaskImageType::New();
+  slab->CopyInformation( mask );
+  slab->SetRegions( mask->GetBufferedRegion() );
+  slab->Allocate();
+  const MaskImageType::IndexType                     start = mask->GetBufferedRegion().GetIndex();
+  itk::ImageRegionIteratorWithIndex< MaskImageType > it( slab, slab->GetBufferedRegion() );
+  for ( ; !it.IsAtEnd(); ++it )
+  {
+    const MaskImageType::OffsetType index = it.GetIndex() - start;
+    it.Set( ( index[0] >= 5 && index[0] < 29 && index[1] != 4 ) ? 1 : 0 );
+  }
+  return slab;
+}
+
+bool
+TestRestrictedDomain( const MaskImageType * mask )
+{
+  MaskImageType::Pointer slab = CreateSlabMask( mask );
+
+  MaskImageType::Pointer both = MaskImageType::New();
+  both->CopyInformation( mask );
+  both->SetRegions( mask->GetBufferedRegion() );
+  both->Allocate();
+  const itk::SizeValueType numberOfPixels = mask->GetBufferedRegion().GetNumberOfPixels();
+  for ( itk::SizeValueType p = 0; p < numberOfPixels; ++p )
+  {
+    both->GetBufferPointer()[p] = ( mask->GetBufferPointer()[p] != 0 && slab->GetBufferPointer()[p] != 0 ) ? 1 : 0;
+  }
+
+  VoxelSpanDomain outer;
+  outer.Build( mask );
+  VoxelSpanDomain restricted;
+  restricted.Build( slab.GetPointer(), outer );
+
+  const VoxelSpanDomain::SpanVectorType   expected = SerialSpans( both );
+  const VoxelSpanDomain::SpanVectorType & spans = restricted.GetSpans();
+  if ( spans.size() != expected.size() )
+  {
+    std::cerr << "Restricted domain has " << spans.size() << " spans, expected " << expected.size() << std::endl;
+    return false;
+  }
+  bool passed = true;
+  for ( size_t s = 0; s < spans.size(); ++s )
+  {
+    if ( spans[s].start != expected[s].start || spans[s].offset != expected[s].offset ||
+         spans[s].length != expected[s].length )
+    {
+      std::cerr << "Restricted span " << s << " starts at " << spans[s].start << " (length " << spans[s].length
+                << "), expected " << expected[s].start << " (length " << expected[s].length << ")" << std::endl;
+      passed = false;
+    }
+  }
+  if ( restricted.GetRegion() != mask->GetBufferedRegion() )
+  {
+    std::cerr << "Restricted region " << restricted.GetRegion() << " differs from the mask region" << std::endl;
+    passed = false;
+  }
+  return passed;
+}
+
+bool
+TestLabelsInDomain( MaskImageType::Pointer mask )
+{
+  using PosteriorImageType = itk::Image< float, 3 >;
+  constexpr unsigned int numClasses = 3;
+
+  std::vector< PosteriorImageType::Pointer > posteriors( numClasses );
+  for ( unsigned int iclass = 0; iclass < numClasses; ++iclass )
+  {
+    posteriors[iclass] = PosteriorImageType::New();
+    posteriors[iclass]->CopyInformation( mask );
+    posteriors[iclass]->SetRegions( mask->GetBufferedRegion() );
+    posteriors[iclass]->Allocate();
+    const itk::SizeValueType numberOfPixels = mask->GetBufferedRegion().GetNumberOfPixels();
+    for ( itk::SizeValueType p = 0; p < numberOfPixels; ++p )
+    {
+      posteriors[iclass]->GetBufferPointer()[p] = static_cast< float >( ( p * 31 + iclass * 17 ) % 13 ) / 13.0f;
+    }
+  }
+  std::vector< bool > isForeground( numClasses, true );
+  isForeground[numClasses - 1] = false;
+  vnl_vector< unsigned int > labelCodes( numClasses );
+  labelCodes[0] = 1;
+  labelCodes[1] = 2;
+  labelCodes[2] = 4;
+
+  MaskImageType::Pointer dirtyLabels;
+  MaskImageType::Pointer cleanedLabels;
+  ComputeLabels< PosteriorImageType, MaskImageType, double >(
+    posteriors, isForeground, labelCodes, mask, dirtyLabels, cleanedLabels, 0.0, 0 );
+
+  const VoxelSpanDomain  domain( mask.GetPointer() );
+  MaskImageType::Pointer domainDirtyLabels;
+  MaskImageType::Pointer domainCleanedLabels;
+  ComputeLabelsInDomain< PosteriorImageType, MaskImageType, double >(
+    posteriors, isForeground, labelCodes, domain, domainDirtyLabels, domainCleanedLabels, 0.0, 0 );
+
+  bool                     passed = true;
+  const itk::SizeValueType numberOfPixels = mask->GetBufferedRegion().GetNumberOfPixels();
+  for ( itk::SizeValueType p = 0; p < numberOfPixels; ++p )
+  {
+    if ( dirtyLabels->GetBufferPointer()[p] != domainDirtyLabels->GetBufferPointer()[p] ||
+         cleanedLabels->GetBufferPointer()[p] != domainCleanedLabels->GetBufferPointer()[p] )
+    {
+      std::cerr << "Domain labels differ at " << mask->ComputeIndex( p ) << std::endl;
+      passed = false;
+      break;
+    }
+  }
+  return passed;
+}
+} // namespace
+
+int
+main( int, char *[] )
+{
+  bool passed = TestDomain( CreateMask( false ) );
+  passed &= TestDomain( CreateMask( true ) );
+  passed &= TestRestrictedDomain( CreateMask( false ) );
+  passed &= TestRestrictedDomain( CreateMask( true ) );
+  passed &= TestLabelsInDomain( CreateMask( false ) );
+  if ( !passed )
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "VoxelSpanDomain test passed" << std::endl;
+  return EXIT_SUCCESS;
+}
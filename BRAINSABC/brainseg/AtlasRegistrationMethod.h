@@ -46,6 +46,9 @@
 
 #include <vector>
 #include <string>
+#include <sstream>
+#include <exception>
+#include <memory>
 
 #include "BRAINSFitHelper.h"
 #include "BRAINSABCUtilities.h"
@@ -260,6 +263,13 @@ public:
   itkSetMacro( DebugLevel, unsigned int );
   itkGetMacro( DebugLevel, unsigned int );
 
+  // Set/Get the maximum number of intra subject registrations that run at
+  // the same time.  The default 1 runs them one after the other; larger
+  // values (0 chooses one per available thread, up to the number of
+  // registrations) are opt in and divide the thread budget between them.
+  itkSetMacro( NumberOfConcurrentIntraSubjectRegistrations, unsigned int );
+  itkGetMacro( NumberOfConcurrentIntraSubjectRegistrations, unsigned int );
+
   itkGetMacro( UseNonLinearInterpolation, bool );
   itkSetMacro( UseNonLinearInterpolation, bool );
 
@@ -307,9 +317,26 @@ public:
   Update();
 
 protected:
+  /** One rigid registration of an intra subject image to the key image. */
+  struct IntraSubjectRegistrationJob
+  {
+    int                           modalityIndex;
+    unsigned int                  registrationIndex;
+    InternalImagePointer          movingImage;
+    std::string                   transformFileName;
+    GenericTransformType::Pointer transform;
+    int                           numberOfThreads{ -1 }; // <= 0 uses the ITK global default
+    std::ostringstream            log;
+    std::exception_ptr            error;
+  };
+
   void
   RegisterIntraSubjectImages( void );
   void
+  GenerateKeySubjectTissueRegion( void );
+  void
+  RunIntraSubjectRegistration( IntraSubjectRegistrationJob & job );
+  void
   AverageIntraSubjectRegisteredImages( void );
   void
   RegisterAtlasToSubjectImages( void );
@@ -360,6 +387,7 @@ private:
   CompositeTransformPointer m_RestoreState;
 
   unsigned int m_DebugLevel;
+  unsigned int m_NumberOfConcurrentIntraSubjectRegistrations;
 };
 
 #ifndef MU_MANUAL_INSTANTIATION
@@ -40,8 +40,14 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 
 #include "itkBRAINSROIAutoImageFilter.h"
+#include "BRAINSProfiler.h"
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/task_arena.h"
 
 // #include "itkIO.h"
 
@@ -67,6 +73,7 @@ AtlasRegistrationMethod< TOutputPixel, TProbabilityPixel >::AtlasRegistrationMet
   , m_SaveState( "" )
   , m_RestoreState( nullptr )
   , m_DebugLevel( 0 )
+  , m_NumberOfConcurrentIntraSubjectRegistrations( 1 )
 {
   m_InputImageTissueRegion = nullptr;
   m_InputSpatialObjectTissueRegion = nullptr;
@@ -140,8 +147,15 @@ template < typename TOutputPixel, typename TProbabilityPixel >
 void
 AtlasRegistrationMethod< TOutputPixel, TProbabilityPixel >::RegisterIntraSubjectImages()
 {
+  BRAINS_PROFILE_SCOPE( "RegisterIntraSubjectImages" );
   muLogMacro( << "Register Intra subject images" << std::endl );
 
+  // First pass, in order: reuse transforms from disk and identities, and
+  // queue a registration for every other image.  The transform lists keep
+  // their order; queued entries are filled in once the registrations finish.
+  std::vector< std::unique_ptr< IntraSubjectRegistrationJob > > jobs;
+  std::vector< GenericTransformType::Pointer * >                jobTransformSlots;
+
   int i = 0;
   for ( auto mapOfModalImageListsIt = this->m_IntraSubjectOriginalImageList.begin();
         mapOfModalImageListsIt != this->m_IntraSubjectOriginalImageList.end();
@@ -179,130 +193,13 @@ AtlasRegistrationMethod< TOutputPixel, TProbabilityPixel >::RegisterIntraSubject
       }
       else // when m_ImageLinearTransformChoice == "Rigid"
       {
-        using HelperType = itk::BRAINSFitHelper;
-        HelperType::Pointer intraSubjectRegistrationHelper = HelperType::New();
-        intraSubjectRegistrationHelper->SetSamplingPercentage( 0.05 ); // Sample 5% of image
-        intraSubjectRegistrationHelper->SetNumberOfHistogramBins( 50 );
-        std::vector< int > numberOfIterations( 1 );
-        numberOfIterations[0] = 1500;
-        intraSubjectRegistrationHelper->SetNumberOfIterations( numberOfIterations );
-        //
-        //
-        //
-        // intraSubjectRegistrationHelper->SetMaximumStepLength(maximumStepSize);
-        intraSubjectRegistrationHelper->SetTranslationScale( 1000 );
-        intraSubjectRegistrationHelper->SetReproportionScale( 1.0 );
-        intraSubjectRegistrationHelper->SetSkewScale( 1.0 );
-        // Register each intrasubject image mode to first image
-        intraSubjectRegistrationHelper->SetFixedVolume( this->GetModifiableKeySubjectImage() );
-        // INFO: Find way to turn on histogram equalization for same mode images
-        constexpr int dilateSize = 15;
-        constexpr int closingSize = 15;
-        intraSubjectRegistrationHelper->SetMovingVolume( ( *intraImIt ).GetPointer() );
-        muLogMacro( << "Generating MovingImage Mask (Intrasubject  " << i << ")" << std::endl );
-        using ROIAutoType = itk::BRAINSROIAutoImageFilter< InternalImageType, itk::Image< unsigned char, 3 > >;
-        typename ROIAutoType::Pointer ROIFilter = ROIAutoType::New();
-        ROIFilter->SetInput( ( *intraImIt ) );
-        ROIFilter->SetClosingSize( closingSize );
-        ROIFilter->SetDilateSize( dilateSize ); // Only use a very small non-tissue
-                                                // region outside of head during initial
-                                                // runnings
-        ROIFilter->Update();
-        ByteImageType::Pointer movingMaskImage = ROIFilter->GetOutput();
-        intraSubjectRegistrationHelper->SetMovingBinaryVolume( ROIFilter->GetSpatialObjectROI() );
-        if ( this->m_DebugLevel > 7 )
-        {
-          using ByteWriterType = itk::ImageFileWriter< ByteImageType >;
-          ByteWriterType::Pointer writer = ByteWriterType::New();
-          writer->UseCompressionOn();
-
-          std::ostringstream oss;
-          oss << this->m_OutputDebugDir << "IntraSubject_MovingMask_" << i << ".nii.gz" << std::ends;
-          std::string fn = oss.str();
-
-          writer->SetInput( movingMaskImage );
-          writer->SetFileName( fn.c_str() );
-          writer->Update();
-          muLogMacro( << __FILE__ << " " << __LINE__ << " " << std::endl );
-        }
-
-        // Delayed until first use, but only create it once.
-        if ( m_InputImageTissueRegion.IsNull() || m_InputSpatialObjectTissueRegion.IsNull() )
-        {
-          muLogMacro( << "Generating FixedImage Mask (Intrasubject)" << std::endl );
-          using LocalROIAutoType = itk::BRAINSROIAutoImageFilter< InternalImageType, itk::Image< unsigned char, 3 > >;
-          ROIFilter = LocalROIAutoType::New();
-          ROIFilter->SetInput( this->GetModifiableKeySubjectImage() );
-          ROIFilter->SetClosingSize( closingSize );
-          ROIFilter->SetDilateSize( dilateSize ); // Only use a very small non-tissue
-                                                  // region outside of head during
-                                                  // initial runnings
-          ROIFilter->Update();
-          m_InputImageTissueRegion = ROIFilter->GetOutput();
-          m_InputSpatialObjectTissueRegion = ROIFilter->GetSpatialObjectROI();
-          if ( this->m_DebugLevel > 7 )
-          {
-            using ByteWriterType = itk::ImageFileWriter< ByteImageType >;
-            ByteWriterType::Pointer writer = ByteWriterType::New();
-            writer->UseCompressionOn();
-
-            std::ostringstream oss;
-            oss << this->m_OutputDebugDir << "IntraSubject_FixedMask_" << 0 << ".nii.gz" << std::ends;
-            std::string fn = oss.str();
-
-            writer->SetInput( m_InputImageTissueRegion );
-            writer->SetFileName( fn.c_str() );
-            writer->Update();
-            muLogMacro( << __FILE__ << " " << __LINE__ << " " << std::endl );
-          }
-        }
-        intraSubjectRegistrationHelper->SetFixedBinaryVolume( m_InputSpatialObjectTissueRegion );
-
-        muLogMacro( << "Registering (Rigid) image " << i << " to first image." << std::endl );
-        // For better registration, several linear registration methods are run,
-        // but at the end, rigid component is extracted from output linear transform.
-        std::vector< double > minimumStepSize( 4 );
-        minimumStepSize[0] = 0.00005;
-        minimumStepSize[1] = 0.005;
-        minimumStepSize[2] = 0.005;
-        minimumStepSize[3] = 0.005;
-        intraSubjectRegistrationHelper->SetMinimumStepLength( minimumStepSize );
-        std::vector< std::string > transformType( 4 );
-        transformType[0] = "Rigid";
-        transformType[1] = "ScaleVersor3D";
-        transformType[2] = "ScaleSkewVersor3D";
-        transformType[3] = "Affine";
-        intraSubjectRegistrationHelper->SetTransformType( transformType );
-        //
-        // intraSubjectRegistrationHelper->SetBackgroundFillValue(backgroundFillValue);
-        // NOT VALID When using initializeTransformMode
-        //
-        const std::string initializeTransformMode( "useCenterOfHeadAlign" );
-        intraSubjectRegistrationHelper->SetInitializeTransformMode( initializeTransformMode );
-        intraSubjectRegistrationHelper->SetMaskInferiorCutOffFromCenter( 65.0 ); //
-        //
-        // maskInferiorCutOffFromCenter);
-        intraSubjectRegistrationHelper->SetCurrentGenericTransform( nullptr );
-        if ( this->m_DebugLevel > 9 )
-        {
-          static unsigned int IntraSubjectRegistration = 0;
-          std::stringstream   ss;
-          ss << std::setw( 3 ) << std::setfill( '0' ) << IntraSubjectRegistration;
-          intraSubjectRegistrationHelper->PrintCommandLine( true,
-                                                            std::string( "IntraSubjectRegistration" ) + ss.str() );
-          muLogMacro( << __FILE__ << " " << __LINE__ << " " << std::endl );
-          IntraSubjectRegistration++;
-        }
-        intraSubjectRegistrationHelper->Update();
-        const unsigned int actualIterations = intraSubjectRegistrationHelper->GetActualNumberOfIterations();
-        muLogMacro( << "Registration tool " << actualIterations << " iterations." << std::endl );
-        itk::VersorRigid3DTransform< double >::Pointer versorRigid = itk::ComputeRigidTransformFromGeneric(
-          intraSubjectRegistrationHelper->GetCurrentGenericTransform()->GetNthTransform( 0 ).GetPointer() );
-        GenericTransformType::Pointer p = versorRigid.GetPointer();
-        this->m_IntraSubjectTransforms[mapOfModalImageListsIt->first].push_back( p );
-        // Write out intermodal matricies
-        muLogMacro( << "Writing " << ( *isNamesIt ) << "." << std::endl );
-        itk::WriteTransformToDisk< double, float >( p, ( *isNamesIt ) );
+        std::unique_ptr< IntraSubjectRegistrationJob > job( new IntraSubjectRegistrationJob );
+        job->modalityIndex = i;
+        job->registrationIndex = static_cast< unsigned int >( jobs.size() );
+        job->movingImage = *intraImIt;
+        job->transformFileName = *isNamesIt;
+        jobs.push_back( std::move( job ) );
+        m_IntraSubjectTransforms[mapOfModalImageListsIt->first].push_back( nullptr );
       }
       ++currModeImageListIt;
       ++isNamesIt;
@@ -310,12 +207,249 @@ AtlasRegistrationMethod< TOutputPixel, TProbabilityPixel >::RegisterIntraSubject
     }
     i++;
   }
+  // Slots are only taken once the lists stop growing.
+  for ( auto & modalTransforms : this->m_IntraSubjectTransforms )
+  {
+    for ( auto & transform : modalTransforms.second )
+    {
+      if ( transform.IsNull() )
+      {
+        jobTransformSlots.push_back( &transform );
+      }
+    }
+  }
+  if ( jobs.empty() )
+  {
+    return;
+  }
+
+  // The key image mask is the same for every registration, compute it once.
+  this->GenerateKeySubjectTissueRegion();
+
+  const unsigned int totalThreads =
+    std::max( 1u, static_cast< unsigned int >( itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads() ) );
+  unsigned int concurrentRegistrations = ( m_NumberOfConcurrentIntraSubjectRegistrations > 0 )
+                                           ? m_NumberOfConcurrentIntraSubjectRegistrations
+                                           : totalThreads;
+  concurrentRegistrations = std::min( concurrentRegistrations, static_cast< unsigned int >( jobs.size() ) );
+  if ( concurrentRegistrations <= 1 )
+  {
+    // The default: one registration after the other, each with all threads.
+    muLogMacro( << "Running " << jobs.size() << " intra subject registrations one at a time." << std::endl );
+    for ( auto & job : jobs )
+    {
+      try
+      {
+        this->RunIntraSubjectRegistration( *job );
+      }
+      catch ( ... )
+      {
+        job->error = std::current_exception();
+        break;
+      }
+    }
+  }
+  else
+  {
+    // Opt in: run the independent registrations concurrently.  Each one is
+    // limited to its share of the threads through BRAINSFitHelper, so the
+    // ITK global default number of threads is left unchanged.
+    const int threadsPerRegistration = static_cast< int >( std::max( 1u, totalThreads / concurrentRegistrations ) );
+    muLogMacro( << "Running " << jobs.size() << " intra subject registrations, " << concurrentRegistrations
+                << " at a time with " << threadsPerRegistration << " threads each." << std::endl );
+    for ( auto & job : jobs )
+    {
+      job->numberOfThreads = threadsPerRegistration;
+    }
+    // Record the registrations under this stage on the worker threads too.
+    const std::string profileParentPath = BRAINSUtils::Profiler::GetCurrentPath();
+    tbb::task_arena   arena( static_cast< int >( concurrentRegistrations ) );
+    arena.execute( [&] {
+      tbb::parallel_for( tbb::blocked_range< size_t >( 0, jobs.size(), 1 ),
+                         [&]( const tbb::blocked_range< size_t > & r ) {
+                           const BRAINSUtils::ScopedProfileParent profileParent( profileParentPath );
+                           for ( size_t j = r.begin(); j < r.end(); ++j )
+                           {
+                             try
+                             {
+                               this->RunIntraSubjectRegistration( *( jobs[j] ) );
+                             }
+                             catch ( ... )
+                             {
+                               jobs[j]->error = std::current_exception();
+                             }
+                           }
+                         } );
+    } );
+  }
+
+  // Report, store and write the results in the original order.
+  for ( size_t j = 0; j < jobs.size(); ++j )
+  {
+    IntraSubjectRegistrationJob & job = *( jobs[j] );
+    muLogMacro( << job.log.str() );
+    if ( job.error )
+    {
+      std::rethrow_exception( job.error );
+    }
+    *( jobTransformSlots[j] ) = job.transform;
+    // Write out intermodal matricies
+    muLogMacro( << "Writing " << job.transformFileName << "." << std::endl );
+    itk::WriteTransformToDisk< double, float >( job.transform, job.transformFileName );
+  }
+}
+
+template < typename TOutputPixel, typename TProbabilityPixel >
+void
+AtlasRegistrationMethod< TOutputPixel, TProbabilityPixel >::GenerateKeySubjectTissueRegion()
+{
+  // Delayed until first use, but only create it once.
+  if ( m_InputImageTissueRegion.IsNotNull() && m_InputSpatialObjectTissueRegion.IsNotNull() )
+  {
+    return;
+  }
+  constexpr int dilateSize = 15;
+  constexpr int closingSize = 15;
+  muLogMacro( << "Generating FixedImage Mask (Intrasubject)" << std::endl );
+  using LocalROIAutoType = itk::BRAINSROIAutoImageFilter< InternalImageType, itk::Image< unsigned char, 3 > >;
+  typename LocalROIAutoType::Pointer ROIFilter = LocalROIAutoType::New();
+  ROIFilter->SetInput( this->GetModifiableKeySubjectImage() );
+  ROIFilter->SetClosingSize( closingSize );
+  ROIFilter->SetDilateSize( dilateSize ); // Only use a very small non-tissue
+                                          // region outside of head during
+                                          // initial runnings
+  ROIFilter->Update();
+  m_InputImageTissueRegion = ROIFilter->GetOutput();
+  m_InputSpatialObjectTissueRegion = ROIFilter->GetSpatialObjectROI();
+  if ( this->m_DebugLevel > 7 )
+  {
+    using ByteWriterType = itk::ImageFileWriter< ByteImageType >;
+    ByteWriterType::Pointer writer = ByteWriterType::New();
+    writer->UseCompressionOn();
+
+    std::ostringstream oss;
+    oss << this->m_OutputDebugDir << "IntraSubject_FixedMask_" << 0 << ".nii.gz" << std::ends;
+    std::string fn = oss.str();
+
+    writer->SetInput( m_InputImageTissueRegion );
+    writer->SetFileName( fn.c_str() );
+    writer->Update();
+    muLogMacro( << __FILE__ << " " << __LINE__ << " " << std::endl );
+  }
+}
+
+template < typename TOutputPixel, typename TProbabilityPixel >
+void
+AtlasRegistrationMethod< TOutputPixel, TProbabilityPixel >::RunIntraSubjectRegistration(
+  IntraSubjectRegistrationJob & job )
+{
+  BRAINS_PROFILE_SCOPE( "IntraSubjectRegistration" );
+  // Runs concurrently with the other registrations: only job is written, and
+  // messages go to job.log instead of the (shared) log.
+  std::ostringstream & log = job.log;
+
+  // Every registration gets its own image object sharing the key image
+  // pixels, so the pipelines never update the same image meta data.
+  InternalImagePointer fixedImage = InternalImageType::New();
+  fixedImage->CopyInformation( this->m_KeySubjectImage );
+  fixedImage->SetRegions( this->m_KeySubjectImage->GetLargestPossibleRegion() );
+  fixedImage->SetPixelContainer( this->m_KeySubjectImage->GetPixelContainer() );
+
+  using HelperType = itk::BRAINSFitHelper;
+  HelperType::Pointer intraSubjectRegistrationHelper = HelperType::New();
+  intraSubjectRegistrationHelper->SetNumberOfThreads( job.numberOfThreads );
+  intraSubjectRegistrationHelper->SetSamplingPercentage( 0.05 ); // Sample 5% of image
+  intraSubjectRegistrationHelper->SetNumberOfHistogramBins( 50 );
+  std::vector< int > numberOfIterations( 1 );
+  numberOfIterations[0] = 1500;
+  intraSubjectRegistrationHelper->SetNumberOfIterations( numberOfIterations );
+  //
+  //
+  //
+  // intraSubjectRegistrationHelper->SetMaximumStepLength(maximumStepSize);
+  intraSubjectRegistrationHelper->SetTranslationScale( 1000 );
+  intraSubjectRegistrationHelper->SetReproportionScale( 1.0 );
+  intraSubjectRegistrationHelper->SetSkewScale( 1.0 );
+  // Register each intrasubject image mode to first image
+  intraSubjectRegistrationHelper->SetFixedVolume( fixedImage );
+  // INFO: Find way to turn on histogram equalization for same mode images
+  constexpr int dilateSize = 15;
+  constexpr int closingSize = 15;
+  intraSubjectRegistrationHelper->SetMovingVolume( job.movingImage.GetPointer() );
+  log << "Generating MovingImage Mask (Intrasubject  " << job.modalityIndex << ")" << std::endl;
+  using ROIAutoType = itk::BRAINSROIAutoImageFilter< InternalImageType, itk::Image< unsigned char, 3 > >;
+  typename ROIAutoType::Pointer ROIFilter = ROIAutoType::New();
+  ROIFilter->SetInput( job.movingImage );
+  ROIFilter->SetClosingSize( closingSize );
+  ROIFilter->SetDilateSize( dilateSize ); // Only use a very small non-tissue
+                                          // region outside of head during initial
+                                          // runnings
+  ROIFilter->Update();
+  ByteImageType::Pointer movingMaskImage = ROIFilter->GetOutput();
+  intraSubjectRegistrationHelper->SetMovingBinaryVolume( ROIFilter->GetSpatialObjectROI() );
+  if ( this->m_DebugLevel > 7 )
+  {
+    using ByteWriterType = itk::ImageFileWriter< ByteImageType >;
+    ByteWriterType::Pointer writer = ByteWriterType::New();
+    writer->UseCompressionOn();
+
+    std::ostringstream oss;
+    oss << this->m_OutputDebugDir << "IntraSubject_MovingMask_" << job.modalityIndex << ".nii.gz" << std::ends;
+    std::string fn = oss.str();
+
+    writer->SetInput( movingMaskImage );
+    writer->SetFileName( fn.c_str() );
+    writer->Update();
+    log << __FILE__ << " " << __LINE__ << " " << std::endl;
+  }
+
+  intraSubjectRegistrationHelper->SetFixedBinaryVolume( m_InputSpatialObjectTissueRegion );
+
+  log << "Registering (Rigid) image " << job.modalityIndex << " to first image." << std::endl;
+  // For better registration, several linear registration methods are run,
+  // but at the end, rigid component is extracted from output linear transform.
+  std::vector< double > minimumStepSize( 4 );
+  minimumStepSize[0] = 0.00005;
+  minimumStepSize[1] = 0.005;
+  minimumStepSize[2] = 0.005;
+  minimumStepSize[3] = 0.005;
+  intraSubjectRegistrationHelper->SetMinimumStepLength( minimumStepSize );
+  std::vector< std::string > transformType( 4 );
+  transformType[0] = "Rigid";
+  transformType[1] = "ScaleVersor3D";
+  transformType[2] = "ScaleSkewVersor3D";
+  transformType[3] = "Affine";
+  intraSubjectRegistrationHelper->SetTransformType( transformType );
+  //
+  // intraSubjectRegistrationHelper->SetBackgroundFillValue(backgroundFillValue);
+  // NOT VALID When using initializeTransformMode
+  //
+  const std::string initializeTransformMode( "useCenterOfHeadAlign" );
+  intraSubjectRegistrationHelper->SetInitializeTransformMode( initializeTransformMode );
+  intraSubjectRegistrationHelper->SetMaskInferiorCutOffFromCenter( 65.0 ); //
+  //
+  // maskInferiorCutOffFromCenter);
+  intraSubjectRegistrationHelper->SetCurrentGenericTransform( nullptr );
+  if ( this->m_DebugLevel > 9 )
+  {
+    std::stringstream ss;
+    ss << std::setw( 3 ) << std::setfill( '0' ) << job.registrationIndex;
+    intraSubjectRegistrationHelper->PrintCommandLine( true, std::string( "IntraSubjectRegistration" ) + ss.str() );
+    log << __FILE__ << " " << __LINE__ << " " << std::endl;
+  }
+  intraSubjectRegistrationHelper->Update();
+  const unsigned int actualIterations = intraSubjectRegistrationHelper->GetActualNumberOfIterations();
+  log << "Registration tool " << actualIterations << " iterations." << std::endl;
+  itk::VersorRigid3DTransform< double >::Pointer versorRigid = itk::ComputeRigidTransformFromGeneric(
+    intraSubjectRegistrationHelper->GetCurrentGenericTransform()->GetNthTransform( 0 ).GetPointer() );
+  job.transform = versorRigid.GetPointer();
 }
 
 template < typename TOutputPixel, typename TProbabilityPixel >
 void
 AtlasRegistrationMethod< TOutputPixel, TProbabilityPixel >::AverageIntraSubjectRegisteredImages()
 {
+  BRAINS_PROFILE_SCOPE( "AverageIntraSubjectRegisteredImages" );
   muLogMacro( << "Warp intra subject images within one modality to the first image of that modality channel..."
               << std::endl );
 
@@ -375,6 +509,7 @@ template < typename TOutputPixel, typename TProbabilityPixel >
 void
 AtlasRegistrationMethod< TOutputPixel, TProbabilityPixel >::RegisterAtlasToSubjectImages()
 {
+  BRAINS_PROFILE_SCOPE( "RegisterAtlasToSubjectImages" );
   // Sanity Checks
   // currently we have atlases only for T1 and T2 modalities. However, we should still be able to
   // use other available input modality images (e.g. FLAIR, IDWI, PD, etc) for the segmentation process,
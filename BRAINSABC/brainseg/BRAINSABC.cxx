@@ -59,6 +59,9 @@
 #include <StandardizeMaskIntensity.h>
 #include "BRAINSABCCLP.h"
 #include "BRAINSThreadControl.h"
+#include "BRAINSProfiler.h"
+#include "itkIO.h"
+#include "BRAINSAtlasCache.h"
 
 // Use manually instantiated classes for the big program chunks
 #define MU_MANUAL_INSTANTIATION
@@ -181,6 +184,8 @@ CreateTypedMap( const AtlasRegType::StringVector & keys, const AtlasRegType::Str
 
 // For the BRAINSABC program, we also need to minimize num threads used by TBB
 #include "tbb/task_scheduler_init.h"
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
 
 int
 main( int argc, char ** argv )
@@ -188,6 +193,8 @@ main( int argc, char ** argv )
   PARSE_ARGS;
   BRAINSRegisterAlternateIO();
   const BRAINSUtils::StackPushITKDefaultNumberOfThreads TempDefaultNumberOfThreadsHolder( numberOfThreads );
+  const BRAINSUtils::ProfilerSession                    profilerSession( profileOutput );
+  BRAINS_PROFILE_SCOPE( "BRAINSABC" );
   // Construct TBB task scheduler with matching threads to ITK threads
   tbb::task_scheduler_init init( itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads() );
 
@@ -534,6 +541,7 @@ main( int argc, char ** argv )
         const std::string suffixstr = "";
         { // Read subject images needed for atlas registration
           // muLogMacro(<< "Read subject images");
+          BRAINS_PROFILE_SCOPE( "ReadSubjectImages" );
           if ( input_Volumes.size() < 1 )
           {
             muLogMacro( << "No data images specified" << std::endl );
@@ -636,25 +644,21 @@ main( int argc, char ** argv )
 
         { // Read template images needed for atlas registration
           // muLogMacro(<< "Read template images");
+          BRAINS_PROFILE_SCOPE( "ReadAtlasImages" );
           if ( templateVolumes.empty() )
           {
             muLogMacro( << "No data images specified" << std::endl );
             return EXIT_FAILURE;
           }
 
-          using LocalReaderType = itk::ImageFileReader< FloatImageType >;
-          using LocalReaderPointer = LocalReaderType::Pointer;
-
-
           for ( auto mapIt = templateVolumes.begin(); mapIt != templateVolumes.end(); ++mapIt )
           {
             const std::string curAtlasName = FindPathFromAtlasXML( *( mapIt->second.begin() ), atlasDefinitionPath );
             muLogMacro( << "\n***Reading atlas image " << mapIt->first << ": " << curAtlasName << "...\n" );
-            LocalReaderPointer imgreader = LocalReaderType::New();
-            imgreader->SetFileName( curAtlasName.c_str() );
+            FloatImagePointer atlasImage;
             try
             {
-              imgreader->Update();
+              atlasImage = BRAINSUtils::AtlasCache::ReadImage< FloatImageType >( curAtlasName );
             }
             catch ( ... )
             {
@@ -663,7 +667,7 @@ main( int argc, char ** argv )
             }
             muLogMacro( << "Standardizing Intensities: ..." );
             FloatImagePointer img_i =
-              StandardizeMaskIntensity< FloatImageType, ByteImageType >( imgreader->GetOutput(),
+              StandardizeMaskIntensity< FloatImageType, ByteImageType >( atlasImage,
                                                                          atlasBrainMask,
                                                                          0.0005,
                                                                          1.0 - 0.0005,
@@ -856,8 +860,11 @@ main( int argc, char ** argv )
         itk::TimeProbe regtimer;
         regtimer.Start();
         atlasreg->SetOutputDebugDir( outputDir );
+        atlasreg->SetNumberOfConcurrentIntraSubjectRegistrations(
+          static_cast< unsigned int >( std::max( 0, numberOfConcurrentIntraSubjectRegistrations ) ) );
         try
         {
+          BRAINS_PROFILE_SCOPE( "AtlasRegistration" );
           atlasreg->Update();
         }
         catch ( itk::ExceptionObject & e )
@@ -1022,6 +1029,8 @@ main( int argc, char ** argv )
   {
     SegFilterType::Pointer segfilter = SegFilterType::New();
     segfilter->SetUseKNN( useKNN );
+    segfilter->SetUseTissueDomain( useTissueDomain );
+    segfilter->SetProbabilityStorageType( ProbabilityStorageTypeFromString( probabilityStorage ) );
 
     segfilter->SetUsePurePlugs( usePurePlugs );
     segfilter->SetPurePlugsThreshold( purePlugsThreshold );
@@ -1030,17 +1039,28 @@ main( int argc, char ** argv )
 
     std::vector< FloatImagePointer > atlasOriginalPriors( PriorNames.size() );
     unsigned int                     AirIndex = 10000;
+    {
+      BRAINS_PROFILE_SCOPE( "ReadAtlasPriors" );
+      std::vector< std::string > priorFileNames( PriorNames.size() );
+      for ( unsigned int i = 0; i < PriorNames.size(); i++ )
+      {
+        priorFileNames[i] =
+          FindPathFromAtlasXML( atlasDefinitionParser.GetPriorFilename( PriorNames[i] ), atlasDefinitionPath );
+      }
+      // Each prior is a separate gzip stream that can only be inflated
+      // serially, so the priors are read concurrently.  The image IO
+      // factories were registered by the reads of the atlas templates above.
+      tbb::parallel_for( tbb::blocked_range< size_t >( 0, PriorNames.size(), 1 ),
+                         [&]( const tbb::blocked_range< size_t > & r ) {
+                           for ( size_t i = r.begin(); i < r.end(); ++i )
+                           {
+                             // Not read through the AtlasCache: SetPriors normalizes them in place.
+                             atlasOriginalPriors[i] = itkUtil::ReadImage< FloatImageType >( priorFileNames[i] );
+                           }
+                         } );
+    }
     for ( unsigned int i = 0; i < PriorNames.size(); i++ )
     {
-      using LocalReaderType = itk::ImageFileReader< FloatImageType >;
-      using LocalReaderPointer = LocalReaderType::Pointer;
-      LocalReaderPointer priorReader = LocalReaderType::New();
-      const std::string  curPriorAtlasName =
-        FindPathFromAtlasXML( atlasDefinitionParser.GetPriorFilename( PriorNames[i] ), atlasDefinitionPath );
-      priorReader->SetFileName( curPriorAtlasName );
-      priorReader->Update();
-      FloatImageType::Pointer temp = priorReader->GetOutput();
-      atlasOriginalPriors[i] = temp;
       // Set the index for the background values.
       if ( PriorNames[i] == std::string( "AIR" ) )
       {
@@ -1050,6 +1070,7 @@ main( int argc, char ** argv )
     std::cout << "MESSAGE: USING AIR INDEX of :" << AirIndex << std::endl;
     segfilter->SetAirIndex( AirIndex );
     segfilter->SetPriors( atlasOriginalPriors );
+    atlasOriginalPriors.clear(); // The filter holds the priors, in its own storage, from here on.
 
     SegFilterType::RangeDBType myRanges;
     for ( auto & PriorName : PriorNames )
@@ -1111,9 +1132,13 @@ main( int argc, char ** argv )
     }
     segfilter->SetWarpGrid( gridSize[0], gridSize[1], gridSize[2] );
 
-    segfilter->Update();
+    {
+      BRAINS_PROFILE_SCOPE( "EMSegmentation" );
+      segfilter->Update();
+    }
 
     // Write the secondary outputs
+    BRAINS_PROFILE_SCOPE( "WriteOutputs" );
     if ( !writeLess )
     {
       muLogMacro( << "Writing filtered and bias corrected images...\n" );
@@ -36,6 +36,9 @@ DuplicateImageList< ShortImageType >( const std::vector< ShortImageType::Pointer
 template void
 NormalizeProbListInPlace< FloatImageType >( std::vector< FloatImageType::Pointer > & );
 
+template void
+NormalizeProbListInPlace< FloatImageType >( std::vector< FloatImageType::Pointer > &, const VoxelSpanDomain & );
+
 template void
 ZeroNegativeValuesInPlace< FloatImageType >( std::vector< FloatImageType::Pointer > & );
 
@@ -23,6 +23,7 @@
 #define __BRAINSABCUtilities__h__
 
 #include "Log.h"
+#include "VoxelSpanDomain.h"
 
 #include <AtlasDefinition.h>
 #include <BRAINSFitHelper.h>
@@ -212,6 +213,9 @@ DuplicateImageList< ShortImageType >( const std::vector< ShortImageType::Pointer
 extern template void
 NormalizeProbListInPlace< FloatImageType >( std::vector< FloatImageType::Pointer > & );
 
+extern template void
+NormalizeProbListInPlace< FloatImageType >( std::vector< FloatImageType::Pointer > &, const VoxelSpanDomain & );
+
 extern template void
 ZeroNegativeValuesInPlace< FloatImageType >( std::vector< FloatImageType::Pointer > & );
 
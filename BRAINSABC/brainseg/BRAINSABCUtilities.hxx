@@ -110,6 +110,59 @@ NormalizeProbListInPlace( std::vector< typename TProbabilityImage::Pointer > & P
   }
 }
 
+/** Normalize only the voxels of domain, which must share the lattice of the
+ * probability images; the other voxels are left unchanged. */
+template < typename TProbabilityImage >
+void
+NormalizeProbListInPlace( std::vector< typename TProbabilityImage::Pointer > & ProbList,
+                          const VoxelSpanDomain &                              domain )
+{
+  const unsigned int numProbs = ProbList.size();
+  if ( domain.GetRegion() != ProbList[0]->GetBufferedRegion() )
+  {
+    itkGenericExceptionMacro( << "The voxel domain is not on the probability lattice." );
+  }
+
+  std::vector< typename TProbabilityImage::PixelType * > buffers( numProbs );
+  for ( unsigned int iprior = 0; iprior < numProbs; iprior++ )
+  {
+    buffers[iprior] = ProbList[iprior]->GetBufferPointer();
+  }
+  domain.ParallelForEachSpan( [&buffers, numProbs]( const VoxelSpanDomain::Span & span ) {
+    for ( itk::SizeValueType s = 0; s < span.length; ++s )
+    {
+      const itk::OffsetValueType offset = span.offset + s;
+      FloatingPrecision          sumPrior = 0.0;
+      for ( unsigned int iprior = 0; iprior < numProbs; iprior++ )
+      {
+        const FloatingPrecision & ProbListValue = buffers[iprior][offset];
+        CHECK_NAN( ProbListValue,
+                   __FILE__,
+                   __LINE__,
+                   "\n  sumPrior: " << sumPrior << "\n  offset: " << offset << "\n ProbListValue: " << ProbListValue
+                                    << "\n  iprior: " << iprior );
+        sumPrior += ProbListValue;
+      }
+      if ( sumPrior < 1e-20 )
+      {
+        const FloatingPrecision averageValue = 1.0 / static_cast< FloatingPrecision >( numProbs );
+        for ( unsigned int iprior = 0; iprior < numProbs; iprior++ )
+        {
+          buffers[iprior][offset] = averageValue;
+        }
+      }
+      else
+      {
+        const FloatingPrecision invSumPrior = 1.0 / sumPrior;
+        for ( unsigned int iprior = 0; iprior < numProbs; iprior++ )
+        {
+          buffers[iprior][offset] = buffers[iprior][offset] * invSumPrior;
+        }
+      }
+    }
+  } );
+}
+
 template < typename TInputImage >
 std::vector< typename TInputImage::Pointer >
 DuplicateImageList( const std::vector< typename TInputImage::Pointer > & inputList )
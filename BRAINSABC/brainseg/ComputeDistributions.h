@@ -19,6 +19,7 @@
 #ifndef __ComputeDistributions__h_
 #define __ComputeDistributions__h_
 #include "BRAINSABCUtilities.h"
+#include "VoxelSpanDomain.h"
 #include <vector>
 #include <list>
 #include <map>
@@ -43,7 +44,7 @@ CombinedComputeDistributions(
                                                                                                          // an
                                                                                                          //
                                                                                                          // output!
-  const unsigned int DebugLevel, const bool logConvertValues )
+  const unsigned int DebugLevel, const bool logConvertValues, const VoxelSpanDomain * tissueDomain = nullptr )
 {
   using InputImageVector = std::vector< typename TInputImage::Pointer >;
   using MapOfInputImageVectors = orderedmap< std::string, InputImageVector >;
@@ -64,38 +65,47 @@ CombinedComputeDistributions(
     ListOfClassStatistics[iclass].resize( numModalities );
   }
 
-  typename TInputImage::SizeType size = PosteriorsList[0]->GetLargestPossibleRegion().GetSize();
+  // Only the candidate voxels contribute to the statistics, so visit the row
+  // spans of each candidate region instead of testing every voxel of the grid.
+  // Given a tissue domain, only its spans are scanned and the statistics are
+  // restricted to the candidate voxels inside it.
+  std::vector< VoxelSpanDomain > candidateDomains( numClasses );
+  for ( LOOPITERTYPE iclass = 0; iclass < numClasses; iclass++ )
+  {
+    if ( tissueDomain != nullptr )
+    {
+      candidateDomains[iclass].Build( SubjectCandidateRegions[iclass].GetPointer(), *tissueDomain );
+    }
+    else
+    {
+      candidateDomains[iclass].Build( SubjectCandidateRegions[iclass].GetPointer() );
+    }
+    if ( candidateDomains[iclass].GetRegion() != PosteriorsList[iclass]->GetBufferedRegion() )
+    {
+      itkGenericExceptionMacro( << "Candidate region " << iclass << " is not on the posterior lattice." );
+    }
+  }
 
   // Compute sum of posteriors for each class
   tbb::parallel_for(
     tbb::blocked_range< LOOPITERTYPE >( 0, numClasses, 1 ),
-    [=, &ListOfClassStatistics]( const tbb::blocked_range< LOOPITERTYPE > & r ) {
+    [=, &ListOfClassStatistics, &candidateDomains]( const tbb::blocked_range< LOOPITERTYPE > & r ) {
       for ( LOOPITERTYPE iclass = r.begin(); iclass < r.end(); ++iclass )
       {
         const typename TProbabilityImage::ConstPointer currentProbImage = PosteriorsList[iclass].GetPointer();
-        const typename ByteImageType::ConstPointer     currentCandidateRegion =
-          SubjectCandidateRegions[iclass].GetPointer();
+        const VoxelSpanDomain * const                  currentDomain = &candidateDomains[iclass];
 
         // NOTE:  itk::Math:eps is too small itk::Math::eps;
-        CompensatedSummationType tmp_accumC = tbb::parallel_reduce(
-          tbb::blocked_range3d< long >( 0, size[2], 1, 0, size[1], size[1] / 2, 0, size[0], 512 ),
+        // Here pure plugs mask implicitly comes in! as CandidateRegions are multiplied by purePlugsMask!
+        CompensatedSummationType tmp_accumC = currentDomain->ParallelReduceSpans(
           CompensatedSummationType(),
-          [=]( const tbb::blocked_range3d< long > & rng3d, CompensatedSummationType tmp ) -> CompensatedSummationType {
-            for ( long kk = rng3d.pages().begin(); kk < rng3d.pages().end(); ++kk )
+          [=]( const VoxelSpanDomain::Span & span, CompensatedSummationType tmp ) -> CompensatedSummationType {
+            const typename TProbabilityImage::PixelType * probBuffer =
+              currentProbImage->GetBufferPointer() + span.offset;
+            for ( itk::SizeValueType s = 0; s < span.length; ++s )
             {
-              for ( long jj = rng3d.rows().begin(); jj < rng3d.rows().end(); ++jj )
-              {
-                for ( long ii = rng3d.cols().begin(); ii < rng3d.cols().end(); ++ii )
-                {
-                  const typename TProbabilityImage::IndexType currIndex = { { ii, jj, kk } };
-                  // Here pure plugs mask implicitly comes in! as CandidateRegions are multiplied by purePlugsMask!
-                  if ( currentCandidateRegion->GetPixel( currIndex ) )
-                  {
-                    const double currentProbValue = currentProbImage->GetPixel( currIndex );
-                    tmp += currentProbValue;
-                  }
-                }
-              }
+              const double currentProbValue = probBuffer[s];
+              tmp += currentProbValue;
             }
             return tmp;
           },
@@ -110,12 +120,11 @@ CombinedComputeDistributions(
   // Compute the means weighted by the probability of each value.
   tbb::parallel_for(
     tbb::blocked_range< LOOPITERTYPE >( 0, numClasses, 1 ),
-    [=, &ListOfClassStatistics]( const tbb::blocked_range< LOOPITERTYPE > & r ) {
+    [=, &ListOfClassStatistics, &candidateDomains]( const tbb::blocked_range< LOOPITERTYPE > & r ) {
       for ( LOOPITERTYPE iclass = r.begin(); iclass < r.end(); ++iclass )
       {
         const typename TProbabilityImage::ConstPointer currentProbImage = PosteriorsList[iclass].GetPointer();
-        const typename ByteImageType::ConstPointer     currentCandidateRegion =
-          SubjectCandidateRegions[iclass].GetPointer();
+        const VoxelSpanDomain * const                  currentDomain = &candidateDomains[iclass];
         ListOfClassStatistics[iclass].m_Means.clear();
 
         for ( typename MapOfInputImageVectors::const_iterator mapIt = InputImageMap.begin();
@@ -133,41 +142,30 @@ CombinedComputeDistributions(
             typename InputImageNNInterpolationType::Pointer im1Interp = InputImageNNInterpolationType::New();
             im1Interp->SetInputImage( im1 );
 
-            const CompensatedSummationType muSumFinal = tbb::parallel_reduce(
-              tbb::blocked_range3d< long >( 0, size[2], 1, 0, size[1], size[1] / 2, 0, size[0], 512 ),
+            // Here pure plugs mask comes in, since CandidateRegions are multiplied by purePlugsMask!
+            const CompensatedSummationType muSumFinal = currentDomain->ParallelReduceSpans(
               CompensatedSummationType(),
-              [=]( const tbb::blocked_range3d< long > & rng,
-                   CompensatedSummationType             muSum ) -> CompensatedSummationType {
+              [=]( const VoxelSpanDomain::Span & span, CompensatedSummationType muSum ) -> CompensatedSummationType {
                 typename TProbabilityImage::PointType currPoint;
-                for ( long kk = rng.pages().begin(); kk < rng.pages().end(); ++kk )
+                typename TProbabilityImage::IndexType currIndex = span.start;
+                for ( itk::SizeValueType s = 0; s < span.length; ++s, ++currIndex[0] )
                 {
-                  for ( long jj = rng.rows().begin(); jj < rng.rows().end(); ++jj )
+                  // transform probability image index to physical point
+                  PosteriorsList[0]->TransformIndexToPhysicalPoint( currIndex, currPoint );
+                  const double currentProbValue = currentProbImage->GetBufferPointer()[span.offset + s];
+                  // input volumes may have a different voxel lattice than the probability image
+                  double currentInputValue = 1;
+                  if ( im1Interp->IsInsideBuffer( currPoint ) )
                   {
-                    for ( long ii = rng.cols().begin(); ii < rng.cols().end(); ++ii )
-                    {
-                      const typename TProbabilityImage::IndexType currIndex = { { ii, jj, kk } };
-                      // transform probability image index to physical point
-                      PosteriorsList[0]->TransformIndexToPhysicalPoint( currIndex, currPoint );
-                      // Here pure plugs mask comes in, since CandidateRegions are multiplied by purePlugsMask!
-                      if ( currentCandidateRegion->GetPixel( currIndex ) )
-                      {
-                        const double currentProbValue = currentProbImage->GetPixel( currIndex );
-                        // input volumes may have a different voxel lattice than the probability image
-                        double currentInputValue = 1;
-                        if ( im1Interp->IsInsideBuffer( currPoint ) )
-                        {
-                          currentInputValue = im1Interp->Evaluate( currPoint );
-                        }
-                        if ( logConvertValues )
-                        {
-                          muSum += currentProbValue * LOGP( currentInputValue );
-                        }
-                        else
-                        {
-                          muSum += currentProbValue * ( currentInputValue );
-                        }
-                      }
-                    }
+                    currentInputValue = im1Interp->Evaluate( currPoint );
+                  }
+                  if ( logConvertValues )
+                  {
+                    muSum += currentProbValue * LOGP( currentInputValue );
+                  }
+                  else
+                  {
+                    muSum += currentProbValue * ( currentInputValue );
                   }
                 }
                 return muSum;
@@ -214,12 +212,11 @@ CombinedComputeDistributions(
   }
   tbb::parallel_for(
     tbb::blocked_range< LOOPITERTYPE >( 0, numClasses, 1 ),
-    [=, &ListOfClassStatistics]( const tbb::blocked_range< LOOPITERTYPE > & r ) {
+    [=, &ListOfClassStatistics, &candidateDomains]( const tbb::blocked_range< LOOPITERTYPE > & r ) {
       for ( LOOPITERTYPE iclass = r.begin(); iclass < r.end(); ++iclass )
       {
         const typename TProbabilityImage::ConstPointer currentProbImage = PosteriorsList[iclass].GetPointer();
-        const typename ByteImageType::ConstPointer     currentCandidateRegion =
-          SubjectCandidateRegions[iclass].GetPointer();
+        const VoxelSpanDomain * const                  currentDomain = &candidateDomains[iclass];
         //
         // this will end up as a vnl_matrix for assignment to
         // the Class Statistics object after this is computed.
@@ -268,51 +265,40 @@ CombinedComputeDistributions(
                 typename InputImageNNInterpolationType::Pointer im2Interp = InputImageNNInterpolationType::New();
                 im2Interp->SetInputImage( im2 );
 
-                CompensatedSummationType reduced_varC = tbb::parallel_reduce(
-                  tbb::blocked_range3d< long >( 0, size[2], 1, 0, size[1], size[1] / 2, 0, size[0], 512 ),
+                // Here pure plugs mask comes in, since CandidateRegions are multiplied by purePlugsMask!
+                CompensatedSummationType reduced_varC = currentDomain->ParallelReduceSpans(
                   CompensatedSummationType(), /*Initial value of reduction */
-                  [=]( const tbb::blocked_range3d< long > & rng,
-                       CompensatedSummationType             var ) -> CompensatedSummationType {
-                    for ( long kk = rng.pages().begin(); kk < rng.pages().end(); ++kk )
+                  [=]( const VoxelSpanDomain::Span & span, CompensatedSummationType var ) -> CompensatedSummationType {
+                    typename TProbabilityImage::IndexType currIndex = span.start;
+                    for ( itk::SizeValueType s = 0; s < span.length; ++s, ++currIndex[0] )
                     {
-                      for ( long jj = rng.rows().begin(); jj < rng.rows().end(); ++jj )
+                      // transform probability image index to physical point
+                      typename TProbabilityImage::PointType currPoint;
+                      PosteriorsList[0]->TransformIndexToPhysicalPoint( currIndex, currPoint );
+                      const double currentProbValue = currentProbImage->GetBufferPointer()[span.offset + s];
+                      // input image values should be evaluated in physical space.
+                      double inputValue1 = 1;
+                      double inputValue2 = 1;
+                      if ( im1Interp->IsInsideBuffer( currPoint ) )
+                      {
+                        inputValue1 = im1Interp->Evaluate( currPoint );
+                      }
+                      if ( im2Interp->IsInsideBuffer( currPoint ) )
                       {
-                        for ( long ii = rng.cols().begin(); ii < rng.cols().end(); ++ii )
-                        {
-                          const typename TProbabilityImage::IndexType currIndex = { { ii, jj, kk } };
-                          // transform probability image index to physical point
-                          typename TProbabilityImage::PointType currPoint;
-                          PosteriorsList[0]->TransformIndexToPhysicalPoint( currIndex, currPoint );
-                          // Here pure plugs mask comes in, since CandidateRegions are multiplied by purePlugsMask!
-                          if ( currentCandidateRegion->GetPixel( currIndex ) )
-                          {
-                            const double currentProbValue = currentProbImage->GetPixel( currIndex );
-                            // input image values should be evaluated in physical space.
-                            double inputValue1 = 1;
-                            double inputValue2 = 1;
-                            if ( im1Interp->IsInsideBuffer( currPoint ) )
-                            {
-                              inputValue1 = im1Interp->Evaluate( currPoint );
-                            }
-                            if ( im2Interp->IsInsideBuffer( currPoint ) )
-                            {
-                              inputValue2 = im2Interp->Evaluate( currPoint );
-                            }
+                        inputValue2 = im2Interp->Evaluate( currPoint );
+                      }
 
-                            if ( logConvertValues )
-                            {
-                              const double diff1 = LOGP( inputValue1 ) - mu1;
-                              const double diff2 = LOGP( inputValue2 ) - mu2;
-                              var += currentProbValue * ( diff1 * diff2 );
-                            }
-                            else
-                            {
-                              const double diff1 = inputValue1 - mu1;
-                              const double diff2 = inputValue2 - mu2;
-                              var += currentProbValue * ( diff1 * diff2 );
-                            }
-                          }
-                        }
+                      if ( logConvertValues )
+                      {
+                        const double diff1 = LOGP( inputValue1 ) - mu1;
+                        const double diff2 = LOGP( inputValue2 ) - mu2;
+                        var += currentProbValue * ( diff1 * diff2 );
+                      }
+                      else
+                      {
+                        const double diff1 = inputValue1 - mu1;
+                        const double diff2 = inputValue2 - mu2;
+                        var += currentProbValue * ( diff1 * diff2 );
                       }
                     }
                     return var;
@@ -51,6 +51,8 @@ EMSParameters ::EMSParameters()
 
   m_AtlasLinearMapType = "BSpline";
   m_ImageLinearMapType = "Rigid";
+
+  m_ProbabilityStorage = "float";
 }
 
 void
@@ -89,6 +91,7 @@ EMSParameters ::PrintSelf( std::ostream & os, itk::Indent ) const
   os << "Prior 2 = " << m_Prior2 << std::endl;
   os << "Prior 3 = " << m_Prior3 << std::endl;
   os << "Prior 4 = " << m_Prior4 << std::endl;
+  os << "Probability storage = " << m_ProbabilityStorage << std::endl;
   if ( m_DoAtlasWarp )
   {
     os << "Atlas warping, grid = " << m_AtlasWarpGridX << "x" << m_AtlasWarpGridY << "x" << m_AtlasWarpGridZ
@@ -116,6 +116,10 @@ public:
   itkGetConstMacro( ImageLinearMapType, std::string );
   itkSetMacro( ImageLinearMapType, std::string );
 
+  /** float, float16, uint16 or uint8, see ProbabilityStorageType. */
+  itkGetConstMacro( ProbabilityStorage, std::string );
+  itkSetMacro( ProbabilityStorage, std::string );
+
   virtual ~EMSParameters() = default;
 
 protected:
@@ -151,6 +155,8 @@ protected:
 
   std::string m_AtlasLinearMapType;
   std::string m_ImageLinearMapType;
+
+  std::string m_ProbabilityStorage;
 };
 
 #endif
@@ -34,6 +34,8 @@
 #define __EMSegmentationFilter_h
 
 #include "GeneratePurePlugMask.h"
+#include "QuantizedProbabilityImageList.h"
+#include "VoxelSpanDomain.h"
 #include <map>
 #include <list>
 class AtlasDefinition;
@@ -99,6 +101,7 @@ public:
   using ProbabilityImageSizeType = typename ProbabilityImageType::SizeType;
   using ProbabilityImageSpacingType = typename ProbabilityImageType::SpacingType;
   using ProbabilityImageVectorType = std::vector< ProbabilityImagePointer >;
+  using QuantizedProbabilityImageListType = QuantizedProbabilityImageList< ProbabilityImageType >;
 
   using VectorType = vnl_vector< FloatingPrecision >;
   using IntVectorType = vnl_vector< unsigned int >;
@@ -129,6 +132,20 @@ public:
   itkSetMacro( PurePlugsThreshold, float );
   itkGetMacro( PurePlugsThreshold, float );
 
+  /** Run the EM kernels (posteriors, normalization, labels, class statistics
+   * and log-likelihood) only over the tissue region.  Off by default: the
+   * posteriors outside the tissue region are then left at zero, so the
+   * results differ from the full-grid computation. */
+  itkSetMacro( UseTissueDomain, bool );
+  itkGetMacro( UseTissueDomain, bool );
+
+  /** How the atlas priors are held between uses.  Anything but Float trades
+   * a small, bounded quantization error for memory; the posteriors of the
+   * current iteration always stay float. */
+  void
+  SetProbabilityStorageType( const ProbabilityStorageType storageType );
+  itkGetConstMacro( ProbabilityStorageType, ProbabilityStorageType );
+
   void
   SetNumberOfSubSamplesInEachPlugArea( unsigned int nx, unsigned int ny, unsigned int nz )
   {
@@ -308,6 +325,18 @@ protected:
   ByteImageVectorType
   ForceToOne( ProbabilityImageVectorType & WarpedPriorsList );
 
+  /** The per-voxel kernels of ComputePosteriors; protected so that they can be
+   * timed on their own (see Benchmarks/BRAINSToolsBenchmarks.cxx). */
+  void
+  kNNCore( SampleType * trainMatrix, const vnl_vector< FloatingPrecision > & labelVector,
+           const vnl_matrix< FloatingPrecision > & testMatrix, vnl_matrix< FloatingPrecision > & liklihoodMatrix,
+           unsigned int K );
+
+  typename TProbabilityImage::Pointer
+  ComputeOnePosterior( const FloatingPrecision priorScale, const QuantizedProbabilityImageListType & priors,
+                       const size_t classIndex, const vnl_matrix< FloatingPrecision > currCovariance,
+                       typename RegionStats::MeanMapType & currMeans, const MapOfInputImageVectors & intensityImages );
+
 private:
   void
   WritePartitionTable( const unsigned int CurrentEMIteration ) const;
@@ -345,11 +374,6 @@ private:
   void
   InitializePosteriors( void );
 
-  void
-  kNNCore( SampleType * trainMatrix, const vnl_vector< FloatingPrecision > & labelVector,
-           const vnl_matrix< FloatingPrecision > & testMatrix, vnl_matrix< FloatingPrecision > & liklihoodMatrix,
-           unsigned int K );
-
   typename TProbabilityImage::Pointer
   assignVectorToImage( const typename TProbabilityImage::Pointer prior,
                        const vnl_vector< FloatingPrecision > &   vector );
@@ -359,20 +383,15 @@ private:
                         ByteImagePointer & CleanedLabels, const IntVectorType & labelClasses,
                         const std::vector< bool > & priorIsForegroundPriorVector );
 
-  typename TProbabilityImage::Pointer
-  ComputeOnePosterior( const FloatingPrecision priorScale, const typename TProbabilityImage::Pointer prior,
-                       const vnl_matrix< FloatingPrecision > currCovariance,
-                       typename RegionStats::MeanMapType & currMeans, const MapOfInputImageVectors & intensityImages );
-
   std::vector< typename TProbabilityImage::Pointer >
-  ComputeEMPosteriors( const std::vector< typename TProbabilityImage::Pointer > & Priors,
-                       const vnl_vector< FloatingPrecision > &                    PriorWeights,
-                       const MapOfInputImageVectors &                             IntensityImages,
-                       std::vector< RegionStats > &                               ListOfClassStatistics );
+  ComputeEMPosteriors( const QuantizedProbabilityImageListType & Priors,
+                       const vnl_vector< FloatingPrecision > &   PriorWeights,
+                       const MapOfInputImageVectors &            IntensityImages,
+                       std::vector< RegionStats > &              ListOfClassStatistics );
 
   std::vector< typename TProbabilityImage::Pointer >
-  ComputePosteriors( const std::vector< typename TProbabilityImage::Pointer > & Priors,
-                     const vnl_vector< FloatingPrecision > &                    PriorWeights,
+  ComputePosteriors( const QuantizedProbabilityImageListType & Priors,
+                     const vnl_vector< FloatingPrecision > &   PriorWeights,
                      const MapOfInputImageVectors & IntensityImages, std::vector< RegionStats > & ListOfClassStatistics,
                      const IntVectorType & priorLabelCodeVector, std::vector< bool > & priorIsForegroundPriorVector,
                      typename ByteImageType::Pointer & nonAirRegion, const unsigned int IterationID );
@@ -381,6 +400,13 @@ private:
   ComputeDistributions( const ByteImageVectorType &        SubjectCandidateRegions,
                         const ProbabilityImageVectorType & probAllDistributions );
 
+  void
+  NormalizePosteriors( ProbabilityImageVectorType & Posteriors ) const;
+
+  void
+  ComputeEMLabels( ProbabilityImageVectorType & Posteriors, ByteImagePointer & DirtyLabels,
+                   ByteImagePointer & CleanedLabels, const FloatingPrecision InclusionThreshold );
+
   void
   BlendPosteriorsAndPriors( const double blendPosteriorPercentage, const ProbabilityImageVectorType & ProbList1,
                             const ProbabilityImageVectorType & ProbList2,
@@ -389,9 +415,14 @@ private:
   void
   CheckLoopAgainstFilterOutput( ByteImagePointer & loopImg, ByteImagePointer & filterImg );
 
+  QuantizedProbabilityImageListType
+  ReleaseWarpedPriorsForPosteriors();
+
   ProbabilityImageVectorType
-  WarpImageList( ProbabilityImageVectorType & originalList, const typename TInputImage::Pointer referenceOutput,
-                 const BackgroundValueVector & backgroundValues, const GenericTransformType::Pointer warpTransform );
+  WarpImageList( const QuantizedProbabilityImageListType & originalList,
+                 const typename TInputImage::Pointer       referenceOutput,
+                 const BackgroundValueVector &             backgroundValues,
+                 const GenericTransformType::Pointer       warpTransform );
   MapOfInputImageVectors
   WarpImageList( MapOfInputImageVectors & originalList, const InputImagePointer referenceOutput,
                  const GenericTransformType::Pointer warpTransform );
@@ -428,9 +459,10 @@ private:
     return count;
   }
 
-  ProbabilityImageVectorType m_WarpedPriors;
-  ProbabilityImageVectorType m_OriginalSpacePriors;
-  ProbabilityImageVectorType m_Posteriors;
+  ProbabilityImageVectorType        m_WarpedPriors;
+  QuantizedProbabilityImageListType m_OriginalSpacePriors;
+  ProbabilityImageVectorType        m_Posteriors;
+  ProbabilityStorageType            m_ProbabilityStorageType;
 
   std::string m_AtlasTransformType;
 
@@ -453,6 +485,9 @@ private:
   // exclude region from outside image space created by warping an all ones
   // image with zero default value, anded across images
   ByteImagePointer m_NonAirRegion;
+  // the non-zero voxels of m_NonAirRegion, built when m_UseTissueDomain is set
+  VoxelSpanDomain m_TissueDomain;
+  bool            m_UseTissueDomain;
 
   FloatingPrecision m_SampleSpacing;
 
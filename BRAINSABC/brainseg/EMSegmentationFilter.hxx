@@ -66,6 +66,7 @@
 #include "EMSegmentationFilter.h"
 #include "ExtractSingleLargestRegion.h"
 #include "PrettyPrintTable.h"
+#include "BRAINSProfiler.h"
 #include "ComputeDistributions.h"
 
 #include "vnl_index_sort.h"
@@ -213,6 +214,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputekNNPosteriors(
   const std::vector< bool > & priorIsForegroundPriorVector )
 
 {
+  BRAINS_PROFILE_SCOPE( "ComputeKNNPosteriors" );
   // Phase 1: create train sample set, label vector, and the test matrix.
   // Phase 2: pass the above vectors to the "kNNCore" function to create likelihood matrix.
   // Phase 3: create each posterior image from a column of likelihood matrix using "assignVectorToImage" function.
@@ -646,6 +648,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::EMSegmentationFilter()
   // m_PriorLookupTable = IntVectorType(0);
 
   m_NonAirRegion = nullptr;
+  m_UseTissueDomain = false;
 
   m_AtlasTransformType = "SyN"; // "invalid_TransformationTypeNotSet";
 
@@ -654,6 +657,8 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::EMSegmentationFilter()
   m_UsePurePlugs = false;
   m_PurePlugsThreshold = 0.2;
 
+  m_ProbabilityStorageType = ProbabilityStorageType::Float;
+
   m_NumberOfSubSamplesInEachPlugArea[0] = 0;
   m_NumberOfSubSamplesInEachPlugArea[1] = 0;
   m_NumberOfSubSamplesInEachPlugArea[2] = 0;
@@ -787,20 +792,15 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::CheckInput()
     }
   }
 
-  for ( typename ProbabilityImageVectorType::iterator imIt = this->m_OriginalSpacePriors.begin();
-        imIt != this->m_OriginalSpacePriors.end();
-        ++imIt )
+  // All priors share one lattice, QuantizedProbabilityImageList::Store checks that.
+  if ( !this->m_OriginalSpacePriors.empty() )
   {
-    if ( ( *imIt )->GetImageDimension() != 3 )
-    {
-      itkExceptionMacro( << "Prior [" << std::distance( this->m_OriginalSpacePriors.begin(), imIt )
-                         << "] has invalid dimension: only supports 3D images" << std::endl );
-    }
-    const ProbabilityImageSizeType psize = ( *imIt )->GetLargestPossibleRegion().GetSize();
+    const ProbabilityImageSizeType psize =
+      this->m_OriginalSpacePriors.GetReferenceImage()->GetLargestPossibleRegion().GetSize();
     if ( atlasSize != psize )
     {
-      itkExceptionMacro( << "Normalized prior [" << std::distance( this->m_OriginalSpacePriors.begin(), imIt )
-                         << "] and atlas 3D size mismatch" << atlasSize << " != " << psize << "." << std::endl );
+      itkExceptionMacro( << "Normalized priors and atlas 3D size mismatch" << atlasSize << " != " << psize << "."
+                         << std::endl );
     }
   }
 }
@@ -902,14 +902,47 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::SetPriors( ProbabilityIm
 {
   muLogMacro( << "Set and Normalize for segmentation." << std::endl );
   // Need to normalize priors before getting started.
-  this->m_OriginalSpacePriors = priors;
-  ZeroNegativeValuesInPlace< TProbabilityImage >( this->m_OriginalSpacePriors );
-  NormalizeProbListInPlace< TProbabilityImage >( this->m_OriginalSpacePriors );
-  this->m_OriginalSpacePriors = priors;
+  ZeroNegativeValuesInPlace< TProbabilityImage >( priors );
+  NormalizeProbListInPlace< TProbabilityImage >( priors );
+  this->m_OriginalSpacePriors = QuantizedProbabilityImageListType( this->m_ProbabilityStorageType );
+  this->m_OriginalSpacePriors.Store( priors );
+  muLogMacro( << "Holding " << this->m_OriginalSpacePriors.size() << " priors as "
+              << ProbabilityStorageTypeToString( this->m_ProbabilityStorageType ) << " in "
+              << this->m_OriginalSpacePriors.GetBufferSizeInBytes() / ( 1024 * 1024 ) << " MiB." << std::endl );
+  this->Modified();
+  m_UpdateRequired = true;
+}
+
+template < typename TInputImage, typename TProbabilityImage >
+void
+EMSegmentationFilter< TInputImage, TProbabilityImage >::SetProbabilityStorageType(
+  const ProbabilityStorageType storageType )
+{
+  if ( storageType == this->m_ProbabilityStorageType )
+  {
+    return;
+  }
+  this->m_ProbabilityStorageType = storageType;
+  this->m_OriginalSpacePriors.SetStorageType( storageType );
   this->Modified();
   m_UpdateRequired = true;
 }
 
+template < typename TInputImage, typename TProbabilityImage >
+typename EMSegmentationFilter< TInputImage, TProbabilityImage >::QuantizedProbabilityImageListType
+EMSegmentationFilter< TInputImage, TProbabilityImage >::ReleaseWarpedPriorsForPosteriors()
+{
+  // Nothing reads the warped priors after the posteriors are computed (they
+  // are warped again from the original space priors), and the posteriors of
+  // the previous iteration are about to be replaced.  Release both so that
+  // only the compact warped priors and the new posteriors are alive.
+  this->m_Posteriors.clear();
+  QuantizedProbabilityImageListType warpedPriors( this->m_ProbabilityStorageType );
+  warpedPriors.Store( this->m_WarpedPriors );
+  this->m_WarpedPriors.clear();
+  return warpedPriors;
+}
+
 template < typename TInputImage, typename TProbabilityImage >
 void
 EMSegmentationFilter< TInputImage, TProbabilityImage >::SetPriorWeights( VectorType w )
@@ -1082,6 +1115,7 @@ std::vector< RegionStats >
 EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeDistributions(
   const ByteImageVectorType & SubjectCandidateRegions, const ProbabilityImageVectorType & probAllDistributions )
 {
+  BRAINS_PROFILE_SCOPE( "ComputeDistributions" );
   std::cout << "\n^^^^^^^^^^^^^^^^^^^^^^^^^^^" << std::endl;
   muLogMacro( << "Computing Distributions..." << std::endl );
   std::cout << "^^^^^^^^^^^^^^^^^^^^^^^^^^^" << std::endl;
@@ -1120,11 +1154,63 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeDistributions(
   }
 
   CombinedComputeDistributions< TInputImage, TProbabilityImage, MatrixType >(
-    distributionsCandidateRegions, this->m_CorrectedImages, probabilityMaps, outputStats, this->m_DebugLevel, false );
+    distributionsCandidateRegions,
+    this->m_CorrectedImages,
+    probabilityMaps,
+    outputStats,
+    this->m_DebugLevel,
+    false,
+    this->m_UseTissueDomain ? &this->m_TissueDomain : nullptr );
 
   return outputStats;
 }
 
+template < typename TInputImage, typename TProbabilityImage >
+void
+EMSegmentationFilter< TInputImage, TProbabilityImage >::NormalizePosteriors(
+  ProbabilityImageVectorType & Posteriors ) const
+{
+  if ( this->m_UseTissueDomain )
+  {
+    NormalizeProbListInPlace< TProbabilityImage >( Posteriors, this->m_TissueDomain );
+  }
+  else
+  {
+    NormalizeProbListInPlace< TProbabilityImage >( Posteriors );
+  }
+}
+
+template < typename TInputImage, typename TProbabilityImage >
+void
+EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeEMLabels( ProbabilityImageVectorType & Posteriors,
+                                                                         ByteImagePointer &           DirtyLabels,
+                                                                         ByteImagePointer &           CleanedLabels,
+                                                                         const FloatingPrecision InclusionThreshold )
+{
+  if ( this->m_UseTissueDomain )
+  {
+    ComputeLabelsInDomain< TProbabilityImage, ByteImageType, double >( Posteriors,
+                                                                       this->m_PriorIsForegroundPriorVector,
+                                                                       this->m_PriorLabelCodeVector,
+                                                                       this->m_TissueDomain,
+                                                                       DirtyLabels,
+                                                                       CleanedLabels,
+                                                                       InclusionThreshold,
+                                                                       100 );
+  }
+  else
+  {
+    ComputeLabels< TProbabilityImage, ByteImageType, double >( Posteriors,
+                                                               this->m_PriorIsForegroundPriorVector,
+                                                               this->m_PriorLabelCodeVector,
+                                                               this->m_NonAirRegion,
+                                                               DirtyLabels,
+                                                               CleanedLabels,
+                                                               InclusionThreshold,
+                                                               100 );
+  }
+}
+
 static double
 ComputeCovarianceDeterminant( const vnl_matrix< FloatingPrecision > & currCovariance )
 {
@@ -1146,7 +1232,7 @@ ComputeCovarianceDeterminant( const vnl_matrix< FloatingPrecision > & currCovari
 template < typename TInputImage, typename TProbabilityImage >
 typename TProbabilityImage::Pointer
 EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeOnePosterior(
-  const FloatingPrecision priorScale, const typename TProbabilityImage::Pointer prior,
+  const FloatingPrecision priorScale, const QuantizedProbabilityImageListType & priors, const size_t classIndex,
   const vnl_matrix< FloatingPrecision > currCovariance, typename RegionStats::MeanMapType & currMeans,
   const MapOfInputImageVectors & intensityImages )
 {
@@ -1164,9 +1250,11 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeOnePosterior(
   CHECK_NAN( invdenom, __FILE__, __LINE__, "\n  denom:" << denom );
   const MatrixType invcov = MatrixInverseType( currCovariance );
 
+  const QuantizedProbabilityImageListType * const priorList = &priors;
+  const TProbabilityImage *                       priorLattice = priors.GetReferenceImage();
   typename TProbabilityImage::Pointer post = TProbabilityImage::New();
-  post->CopyInformation( prior );
-  post->SetRegions( prior->GetLargestPossibleRegion() );
+  post->CopyInformation( priorLattice );
+  post->SetRegions( priorLattice->GetLargestPossibleRegion() );
   post->Allocate();
 
   // create a map of input image interpolators
@@ -1184,11 +1272,112 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeOnePosterior(
     }
   }
 
+  typename TProbabilityImage::PixelType * const postBuffer = post->GetBufferPointer();
+
+  // The posterior of one voxel; it only reads shared state, so the voxels can
+  // be computed in parallel.
+  const auto computePosterior = [&]( const typename TProbabilityImage::IndexType & currIndex,
+                                     const itk::OffsetValueType                    offset ) {
+    // transform posterior image index to physical point
+    typename TProbabilityImage::PointType currPoint;
+    post->TransformIndexToPhysicalPoint( currIndex, currPoint );
+
+    // At a minimum, every class has at least a 0.001% chance of being
+    // true no matter what.
+    // I realize that this small value makes the priors equal slightly
+    // larger than 100%, but everything
+    // is renormalized anyway, so it is not really that big of a deal as
+    // long as the main priors for
+    // the desired class is significantly higher than 1%.
+    constexpr typename TProbabilityImage::PixelType minPriorValue = 0.0;
+    // The prior is decoded here from whatever storage the list uses.
+    const typename TProbabilityImage::PixelType priorValue =
+      ( priorList->GetValue( classIndex, offset ) + minPriorValue );
+    // MatrixType X(numModalities, 1);
+    // {
+    // for(typename RegionStats::MeanMapType::const_iterator mapIt = currMeans.begin();
+    //     mapIt != currMeans.end(); ++mapIt)
+    //   {
+    //   for(typename RegionStats::VectorType::const_iterator vecIt = mapIt->second.begin();
+    //       vecIt != mapIt->second.end(); ++vecIt, ++ichan)
+    //     {
+    //     X(ichan, 0) =
+    //       tmpIntensityImages[ichan]->GetPixel(currIndex) - (*vecIt);
+    //     }
+    //   }
+    // }
+
+    MatrixType    X( numModalities, 1 );
+    unsigned long zz = 0;
+    for ( typename MapOfInputImageVectors::const_iterator mapIt = intensityImages.begin();
+          mapIt != intensityImages.end();
+          ++mapIt, ++zz )
+    {
+      double       curAvg( 0.0 );
+      const double curMean = currMeans.at( mapIt->first );
+      const double numCurModality = static_cast< double >( mapIt->second.size() );
+      for ( unsigned xx = 0; xx < numCurModality; ++xx )
+      {
+        // Input images should be evaluated in physical space
+        typename InputImageNNInterpolationType::OutputType inputImageValue =
+          0; // the default value here should be one
+        if ( inputImageNNInterpolatorsList.at( mapIt->first )[xx]->IsInsideBuffer( currPoint ) )
+        {
+          inputImageValue = inputImageNNInterpolatorsList.at( mapIt->first )[xx]->Evaluate( currPoint );
+        }
+        curAvg += ( inputImageValue - curMean );
+      }
+      X( zz, 0 ) = curAvg / numCurModality;
+    }
+
+    const MatrixType  Y = invcov * X;
+    FloatingPrecision mahalo = 0.0;
+    for ( unsigned int ichan = 0; ichan < numModalities; ichan++ )
+    {
+      const FloatingPrecision & currVal = X( ichan, 0 ) * Y( ichan, 0 );
+      CHECK_NAN( currVal,
+                 __FILE__,
+                 __LINE__,
+                 "\n  currIndex: " << currIndex << "\n  mahalo: " << mahalo << "\n  ichan: " << ichan
+                                   << "\n  invcov: " << invcov << "\n  X:  " << X << "\n  Y:  " << Y );
+      mahalo += currVal;
+    }
+
+    // Note:  This is the maximum likelyhood estimate as described in
+    // formula at bottom of
+    //       http://en.wikipedia.org/wiki/Maximum_likelihood_estimation
+    const FloatingPrecision likelihood = std::exp( -0.5 * mahalo ) * invdenom;
+
+    const typename TProbabilityImage::PixelType currentPosterior =
+      static_cast< typename TProbabilityImage::PixelType >( ( priorScale * priorValue * likelihood ) );
+    CHECK_NAN( currentPosterior,
+               __FILE__,
+               __LINE__,
+               "\n  currIndex: " << currIndex << "\n  priorScale: " << priorScale << "\n  priorValue: "
+                                 << priorValue << "\n  likelihood: " << likelihood << "\n  mahalo: " << mahalo
+                                 << "\n  invcov: " << invcov << "\n  X:  " << X << "\n  Y:  " << Y );
+    postBuffer[offset] = currentPosterior;
+  };
+
+  if ( this->m_UseTissueDomain )
+  {
+    // Outside the tissue region there is no posterior to compute.
+    post->FillBuffer( 0 );
+    this->m_TissueDomain.ParallelForEachSpan( [&computePosterior]( const VoxelSpanDomain::Span & span ) {
+      typename TProbabilityImage::IndexType currIndex = span.start;
+      for ( itk::SizeValueType s = 0; s < span.length; ++s, ++currIndex[0] )
+      {
+        computePosterior( currIndex, span.offset + s );
+      }
+    } );
+    return post;
+  }
+
   const typename TProbabilityImage::SizeType size = post->GetLargestPossibleRegion().GetSize();
 
   tbb::parallel_for(
     tbb::blocked_range3d< LOOPITERTYPE >( 0, size[2], 1, 0, size[1], size[1] / 2, 0, size[0], 512 ),
-    [=]( const tbb::blocked_range3d< LOOPITERTYPE > & r ) {
+    [=, &computePosterior]( const tbb::blocked_range3d< LOOPITERTYPE > & r ) {
       for ( LOOPITERTYPE kk = r.pages().begin(); kk < r.pages().end(); ++kk )
       {
         for ( LOOPITERTYPE jj = r.rows().begin(); jj < r.rows().end(); ++jj )
@@ -1196,83 +1385,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeOnePosterior(
           for ( LOOPITERTYPE ii = r.cols().begin(); ii < r.cols().end(); ++ii )
           {
             const typename TProbabilityImage::IndexType currIndex = { { ii, jj, kk } };
-            // transform posterior image index to physical point
-            typename TProbabilityImage::PointType currPoint;
-            post->TransformIndexToPhysicalPoint( currIndex, currPoint );
-
-            // At a minimum, every class has at least a 0.001% chance of being
-            // true no matter what.
-            // I realize that this small value makes the priors equal slightly
-            // larger than 100%, but everything
-            // is renormalized anyway, so it is not really that big of a deal as
-            // long as the main priors for
-            // the desired class is significantly higher than 1%.
-            constexpr typename TProbabilityImage::PixelType minPriorValue = 0.0;
-            const typename TProbabilityImage::PixelType priorValue = ( prior->GetPixel( currIndex ) + minPriorValue );
-            // MatrixType X(numModalities, 1);
-            // {
-            // for(typename RegionStats::MeanMapType::const_iterator mapIt = currMeans.begin();
-            //     mapIt != currMeans.end(); ++mapIt)
-            //   {
-            //   for(typename RegionStats::VectorType::const_iterator vecIt = mapIt->second.begin();
-            //       vecIt != mapIt->second.end(); ++vecIt, ++ichan)
-            //     {
-            //     X(ichan, 0) =
-            //       tmpIntensityImages[ichan]->GetPixel(currIndex) - (*vecIt);
-            //     }
-            //   }
-            // }
-
-            MatrixType    X( numModalities, 1 );
-            unsigned long zz = 0;
-            for ( typename MapOfInputImageVectors::const_iterator mapIt = intensityImages.begin();
-                  mapIt != intensityImages.end();
-                  ++mapIt, ++zz )
-            {
-              double       curAvg( 0.0 );
-              const double curMean = currMeans.at( mapIt->first );
-              const double numCurModality = static_cast< double >( mapIt->second.size() );
-              for ( unsigned xx = 0; xx < numCurModality; ++xx )
-              {
-                // Input images should be evaluated in physical space
-                typename InputImageNNInterpolationType::OutputType inputImageValue =
-                  0; // the default value here should be one
-                if ( inputImageNNInterpolatorsList.at( mapIt->first )[xx]->IsInsideBuffer( currPoint ) )
-                {
-                  inputImageValue = inputImageNNInterpolatorsList.at( mapIt->first )[xx]->Evaluate( currPoint );
-                }
-                curAvg += ( inputImageValue - curMean );
-              }
-              X( zz, 0 ) = curAvg / numCurModality;
-            }
-
-            const MatrixType  Y = invcov * X;
-            FloatingPrecision mahalo = 0.0;
-            for ( unsigned int ichan = 0; ichan < numModalities; ichan++ )
-            {
-              const FloatingPrecision & currVal = X( ichan, 0 ) * Y( ichan, 0 );
-              CHECK_NAN( currVal,
-                         __FILE__,
-                         __LINE__,
-                         "\n  currIndex: " << currIndex << "\n  mahalo: " << mahalo << "\n  ichan: " << ichan
-                                           << "\n  invcov: " << invcov << "\n  X:  " << X << "\n  Y:  " << Y );
-              mahalo += currVal;
-            }
-
-            // Note:  This is the maximum likelyhood estimate as described in
-            // formula at bottom of
-            //       http://en.wikipedia.org/wiki/Maximum_likelihood_estimation
-            const FloatingPrecision likelihood = std::exp( -0.5 * mahalo ) * invdenom;
-
-            const typename TProbabilityImage::PixelType currentPosterior =
-              static_cast< typename TProbabilityImage::PixelType >( ( priorScale * priorValue * likelihood ) );
-            CHECK_NAN( currentPosterior,
-                       __FILE__,
-                       __LINE__,
-                       "\n  currIndex: " << currIndex << "\n  priorScale: " << priorScale << "\n  priorValue: "
-                                         << priorValue << "\n  likelihood: " << likelihood << "\n  mahalo: " << mahalo
-                                         << "\n  invcov: " << invcov << "\n  X:  " << X << "\n  Y:  " << Y );
-            post->SetPixel( currIndex, currentPosterior );
+            computePosterior( currIndex, post->ComputeOffset( currIndex ) );
           }
         }
       }
@@ -1283,9 +1396,10 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeOnePosterior(
 template < typename TInputImage, typename TProbabilityImage >
 typename EMSegmentationFilter< TInputImage, TProbabilityImage >::ProbabilityImageVectorType
 EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeEMPosteriors(
-  const ProbabilityImageVectorType & Priors, const vnl_vector< FloatingPrecision > & PriorWeights,
+  const QuantizedProbabilityImageListType & Priors, const vnl_vector< FloatingPrecision > & PriorWeights,
   const MapOfInputImageVectors & IntensityImages, std::vector< RegionStats > & ListOfClassStatistics )
 {
+  BRAINS_PROFILE_SCOPE( "ComputeEMPosteriors" );
   // Compute initial distribution parameters
   muLogMacro( << "ComputeEMPosteriors" << std::endl );
   itk::TimeProbe ComputeEMPosteriorsTimer;
@@ -1302,7 +1416,8 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeEMPosteriors(
     CHECK_NAN( priorScale, __FILE__, __LINE__, "\n  iclass: " << iclass );
 
     Posteriors[iclass] = ComputeOnePosterior( priorScale,
-                                              Priors[iclass],
+                                              Priors,
+                                              iclass,
                                               ListOfClassStatistics[iclass].m_Covariance,
                                               ListOfClassStatistics[iclass].m_Means,
                                               IntensityImages );
@@ -1318,11 +1433,12 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeEMPosteriors(
 template < typename TInputImage, typename TProbabilityImage >
 typename EMSegmentationFilter< TInputImage, TProbabilityImage >::ProbabilityImageVectorType
 EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputePosteriors(
-  const ProbabilityImageVectorType & Priors, const vnl_vector< FloatingPrecision > & PriorWeights,
+  const QuantizedProbabilityImageListType & Priors, const vnl_vector< FloatingPrecision > & PriorWeights,
   const MapOfInputImageVectors & IntensityImages, std::vector< RegionStats > & ListOfClassStatistics,
   const IntVectorType & priorLabelCodeVector, std::vector< bool > & priorIsForegroundPriorVector,
   typename ByteImageType::Pointer & nonAirRegion, const unsigned int IterationID )
 {
+  BRAINS_PROFILE_SCOPE( "ComputePosteriors" );
   std::cout << "\n^^^^^^^^^^^^^^^^^^^^^^^^" << std::endl;
   muLogMacro( << "Computing posteriors..." << std::endl );
   std::cout << "^^^^^^^^^^^^^^^^^^^^^^^^" << std::endl;
@@ -1334,7 +1450,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputePosteriors(
   // Compute EM posteriors
   EMPosteriors = ComputeEMPosteriors( Priors, PriorWeights, IntensityImages, ListOfClassStatistics );
 
-  NormalizeProbListInPlace< TProbabilityImage >( EMPosteriors );
+  this->NormalizePosteriors( EMPosteriors );
   this->WriteDebugPosteriors( IterationID, "EM", EMPosteriors );
 
   // Run KNN on posteriors
@@ -1348,14 +1464,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputePosteriors(
     ByteImagePointer thresholdedLabels = nullptr;
     ByteImagePointer dirtyThresholdedLabels = nullptr; // It is the label image that is used in ComputeKNNPosteriors,
                                                        // since it has all labels (not only foreground region).
-    ComputeLabels< TProbabilityImage, ByteImageType, double >( EMPosteriors,
-                                                               priorIsForegroundPriorVector,
-                                                               priorLabelCodeVector,
-                                                               nonAirRegion,
-                                                               dirtyThresholdedLabels,
-                                                               thresholdedLabels,
-                                                               KNN_InclusionThreshold,
-                                                               100 );
+    this->ComputeEMLabels( EMPosteriors, dirtyThresholdedLabels, thresholdedLabels, KNN_InclusionThreshold );
     if ( this->m_DebugLevel > 6 ) // DEBUG: Write label image to the disk.
     {
       muLogMacro( << "\nWrite ThresholdedLabels for debugging..." << std::endl );
@@ -1380,7 +1489,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputePosteriors(
     muLogMacro( << "Computing KNN posteriors took " << knnElapsedTime << " " << ComputeKNNPosteriorsTimer.GetUnit()
                 << std::endl );
 
-    NormalizeProbListInPlace< TProbabilityImage >( KNNPosteriors );
+    this->NormalizePosteriors( KNNPosteriors );
     this->WriteDebugPosteriors( IterationID, "KNN", KNNPosteriors );
 
     // Merge KNN and EMPosteriors here by averaging.
@@ -1398,9 +1507,12 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputePosteriors(
       sqrtFilter->SetInput( filter->GetOutput() );
       sqrtFilter->Update();
       AveragePosteriors[pp] = sqrtFilter->GetOutput();
+      // Only the average is needed from here on.
+      EMPosteriors[pp] = nullptr;
+      KNNPosteriors[pp] = nullptr;
     }
     // Normalize probability list such that all posterior values will sum up to 1.
-    NormalizeProbListInPlace< TProbabilityImage >( AveragePosteriors );
+    this->NormalizePosteriors( AveragePosteriors );
     this->WriteDebugPosteriors( IterationID, "AVG_KNN_EM", AveragePosteriors );
   }
 
@@ -1490,6 +1602,41 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::ComputeLogLikelihood() c
   const InputImageSizeType size = m_Posteriors[0]->GetLargestPossibleRegion().GetSize();
   const unsigned int       computeInitialNumClasses = m_Posteriors.size();
 
+  if ( this->m_UseTissueDomain )
+  {
+    // We should probably only compute the foreground.
+    std::vector< const typename TProbabilityImage::PixelType * > foregroundBuffers;
+    for ( unsigned int iclass = 0; iclass < computeInitialNumClasses; iclass++ )
+    {
+      if ( this->m_PriorIsForegroundPriorVector[iclass] )
+      {
+        foregroundBuffers.push_back( m_Posteriors[iclass]->GetBufferPointer() );
+      }
+    }
+    return this->m_TissueDomain
+      .ParallelReduceSpans(
+        CompensatedSummationType(),
+        [&foregroundBuffers]( const VoxelSpanDomain::Span & span,
+                              CompensatedSummationType      logLikelihood ) -> CompensatedSummationType {
+          for ( itk::SizeValueType s = 0; s < span.length; ++s )
+          {
+            CompensatedSummationType tmp;
+            tmp += 1e-20;
+            for ( const auto buffer : foregroundBuffers )
+            {
+              tmp += buffer[span.offset + s];
+            }
+            logLikelihood += std::log( tmp.GetSum() );
+          }
+          return logLikelihood;
+        },
+        []( CompensatedSummationType a, const CompensatedSummationType & b ) -> CompensatedSummationType {
+          a += b.GetSum();
+          return a;
+        } )
+      .GetSum();
+  }
+
   const CompensatedSummationType logLikelihoodFinal = tbb::parallel_reduce(
     tbb::blocked_range3d< LOOPITERTYPE >( 0, size[2], 1, 0, size[1], size[1] / 2, 0, size[0], 512 ),
     CompensatedSummationType(),
@@ -1569,9 +1716,10 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::WriteDebugHeadRegion(
 template < typename TInputImage, typename TProbabilityImage >
 typename EMSegmentationFilter< TInputImage, TProbabilityImage >::ProbabilityImageVectorType
 EMSegmentationFilter< TInputImage, TProbabilityImage >::WarpImageList(
-  ProbabilityImageVectorType & originalList, const InputImagePointer referenceOutput,
+  const QuantizedProbabilityImageListType & originalList, const InputImagePointer referenceOutput,
   const BackgroundValueVector & backgroundValues, const GenericTransformType::Pointer warpTransform )
 {
+  BRAINS_PROFILE_SCOPE( "WarpImageList" );
   if ( originalList.size() != backgroundValues.size() )
   {
     itkGenericExceptionMacro( << "ERROR:  originalList and backgroundValues arrays sizes do not match" << std::endl );
@@ -1582,7 +1730,8 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::WarpImageList(
   for ( unsigned int vIndex = 0; vIndex < originalList.size(); vIndex++ )
   {
     typename ResamplerType::Pointer warper = ResamplerType::New();
-    warper->SetInput( originalList[vIndex] );
+    // Compact priors are decoded one class at a time, only for the resampling.
+    warper->SetInput( originalList.GetImage( vIndex ) );
     warper->SetTransform( warpTransform );
 
     // warper->SetInterpolator(linearInt); // Default is linear
@@ -1600,6 +1749,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::WarpImageList(
   MapOfInputImageVectors & originalList, const InputImagePointer referenceOutput,
   const GenericTransformType::Pointer warpTransform )
 {
+  BRAINS_PROFILE_SCOPE( "WarpImageList" );
   using ResamplerType = itk::ResampleImageFilter< TInputImage, TInputImage >;
 
   MapOfInputImageVectors warpedList;
@@ -2074,6 +2224,7 @@ void
 EMSegmentationFilter< TInputImage, TProbabilityImage >::UpdateTransformation(
   const unsigned int /*CurrentEMIteration*/ )
 {
+  BRAINS_PROFILE_SCOPE( "UpdateTransformation" );
   if ( m_AtlasTransformType == "SyN" )
   {
     muLogMacro( << "HACK: " << m_AtlasTransformType << " not instumented for transformation update." << std::endl );
@@ -2247,7 +2398,7 @@ void
 EMSegmentationFilter< TInputImage, TProbabilityImage >::WritePartitionTable(
   const unsigned int CurrentEMIteration ) const
 {
-  const unsigned int numPriors = this->m_WarpedPriors.size();
+  const unsigned int numPriors = this->m_ListOfClassStatistics.size();
 
   muLogMacro( << "\n\nEM iteration " << CurrentEMIteration << std::endl );
   muLogMacro( << "---------------------" << std::endl );
@@ -2337,6 +2488,7 @@ template < typename TInputImage, typename TProbabilityImage >
 void
 EMSegmentationFilter< TInputImage, TProbabilityImage >::EMLoop()
 {
+  BRAINS_PROFILE_SCOPE( "EMLoop" );
   if ( this->m_TemplateGenericTransform.IsNull() )
   {
     itkExceptionMacro( << "ERROR:  Must suppply an intial transformation!" );
@@ -2383,6 +2535,13 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::EMLoop()
   }
 
   this->m_NonAirRegion = ComputeTissueRegion< TInputImage, ByteImageType >( this->GetFirstInputImage(), 3 );
+  if ( this->m_UseTissueDomain )
+  {
+    this->m_TissueDomain.Build( this->m_NonAirRegion.GetPointer() );
+    muLogMacro( << "EM kernels run over " << this->m_TissueDomain.GetNumberOfVoxels() << " of "
+                << this->m_TissueDomain.GetRegion().GetNumberOfPixels() << " voxels in the tissue region"
+                << std::endl );
+  }
   if ( this->m_DebugLevel > 9 )
   {
     this->WriteDebugHeadRegion( 0 );
@@ -2392,6 +2551,10 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::EMLoop()
                                         this->GetFirstInputImage(),
                                         this->m_PriorsBackgroundValues,
                                         this->m_TemplateGenericTransform );
+  if ( this->m_UseTissueDomain && this->m_TissueDomain.GetRegion() != this->m_WarpedPriors[0]->GetBufferedRegion() )
+  {
+    itkExceptionMacro( << "The tissue region is not on the lattice of the warped priors." );
+  }
   if ( this->m_DebugLevel > 9 )
   {
     this->WriteDebugWarpedAtlasPriors( 0 );
@@ -2418,14 +2581,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::EMLoop()
   }
 
   // NOTE:  Labels are only needed if debugging them.
-  ComputeLabels< TProbabilityImage, ByteImageType, double >( this->m_WarpedPriors,
-                                                             this->m_PriorIsForegroundPriorVector,
-                                                             this->m_PriorLabelCodeVector,
-                                                             this->m_NonAirRegion,
-                                                             this->m_DirtyLabels,
-                                                             this->m_CleanedLabels,
-                                                             0.0,
-                                                             100 );
+  this->ComputeEMLabels( this->m_WarpedPriors, this->m_DirtyLabels, this->m_CleanedLabels, 0.0 );
   this->WriteDebugLabels( 0 );
   this->m_ListOfClassStatistics.resize( 0 ); // Reset this to empty for debugging
                                              // purposes to induce failures when
@@ -2491,8 +2647,9 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::EMLoop()
   unsigned int CurrentEMIteration = 1;
   while ( !converged && ( CurrentEMIteration <= m_MaximumIterations ) )
   {
+    BRAINS_PROFILE_SCOPE( "EMIteration" );
     // Recompute posteriors, not at full resolution
-    this->m_Posteriors = this->ComputePosteriors( this->m_WarpedPriors,
+    this->m_Posteriors = this->ComputePosteriors( this->ReleaseWarpedPriorsForPosteriors(),
                                                   this->m_PriorWeights,
                                                   this->m_CorrectedImages,
                                                   this->m_ListOfClassStatistics,
@@ -2501,14 +2658,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::EMLoop()
                                                   this->m_NonAirRegion,
                                                   CurrentEMIteration );
 
-    ComputeLabels< TProbabilityImage, ByteImageType, double >( this->m_Posteriors,
-                                                               this->m_PriorIsForegroundPriorVector,
-                                                               this->m_PriorLabelCodeVector,
-                                                               this->m_NonAirRegion,
-                                                               this->m_DirtyLabels,
-                                                               this->m_CleanedLabels,
-                                                               0.0,
-                                                               100 );
+    this->ComputeEMLabels( this->m_Posteriors, this->m_DirtyLabels, this->m_CleanedLabels, 0.0 );
     this->WriteDebugLabels( CurrentEMIteration );
     this->m_CorrectedImages = CorrectBias( this->m_MaxBiasDegree,
                                            CurrentEMIteration,
@@ -2597,7 +2747,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::EMLoop()
 
   muLogMacro( << "Done computing posteriors with " << CurrentEMIteration << " iterations" << std::endl );
 
-  this->m_Posteriors = this->ComputePosteriors( this->m_WarpedPriors,
+  this->m_Posteriors = this->ComputePosteriors( this->ReleaseWarpedPriorsForPosteriors(),
                                                 this->m_PriorWeights,
                                                 this->m_CorrectedImages,
                                                 this->m_ListOfClassStatistics,
@@ -2606,23 +2756,10 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::EMLoop()
                                                 this->m_NonAirRegion,
                                                 CurrentEMIteration + 100 );
 
-  ComputeLabels< TProbabilityImage, ByteImageType, double >( this->m_Posteriors,
-                                                             this->m_PriorIsForegroundPriorVector,
-                                                             this->m_PriorLabelCodeVector,
-                                                             this->m_NonAirRegion,
-                                                             this->m_DirtyLabels,
-                                                             this->m_CleanedLabels,
-                                                             0.0,
-                                                             100 );
-
-  ComputeLabels< TProbabilityImage, ByteImageType, double >( this->m_Posteriors,
-                                                             this->m_PriorIsForegroundPriorVector,
-                                                             this->m_PriorLabelCodeVector,
-                                                             this->m_NonAirRegion,
-                                                             this->m_DirtyThresholdedLabels,
-                                                             this->m_ThresholdedLabels,
-                                                             KNN_InclusionThreshold,
-                                                             100 );
+  this->ComputeEMLabels( this->m_Posteriors, this->m_DirtyLabels, this->m_CleanedLabels, 0.0 );
+
+  this->ComputeEMLabels(
+    this->m_Posteriors, this->m_DirtyThresholdedLabels, this->m_ThresholdedLabels, KNN_InclusionThreshold );
   this->WriteDebugLabels( CurrentEMIteration + 100 );
 
   // Bias correction at full resolution, still using downsampled images
@@ -2673,6 +2810,7 @@ EMSegmentationFilter< TInputImage, TProbabilityImage >::CorrectBias(
   const BoolVectorType & probUseForBias, const FloatingPrecision sampleSpacing, const int DebugLevel,
   const std::string & OutputDebugDir )
 {
+  BRAINS_PROFILE_SCOPE( "CorrectBias" );
 
   if ( degree == 0 )
   {
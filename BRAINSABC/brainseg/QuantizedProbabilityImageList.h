@@ -0,0 +1,452 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __QuantizedProbabilityImageList_h
+#define __QuantizedProbabilityImageList_h
+
+#include "itkImage.h"
+#include "itkMacro.h"
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * \author Hans J. Johnson
+ * \brief How the probability images of a segmentation are held in memory.
+ *
+ * Float keeps the images untouched.  The other types quantize the values:
+ * - Float16: IEEE half precision, 2 bytes, ~3 significant digits at any scale.
+ * - UInt16:  16 bit fixed point on [0,1], 2 bytes, absolute error <= 7.7e-6.
+ * - UInt8:   8 bit square root companded on [0,1], 1 byte, absolute error
+ *            <= 4e-3 near 1, shrinking with sqrt(p) so small priors survive.
+ */
+enum class ProbabilityStorageType
+{
+  Float,
+  Float16,
+  UInt16,
+  UInt8
+};
+
+inline ProbabilityStorageType
+ProbabilityStorageTypeFromString( const std::string & name )
+{
+  if ( name == "float" )
+  {
+    return ProbabilityStorageType::Float;
+  }
+  if ( name == "float16" )
+  {
+    return ProbabilityStorageType::Float16;
+  }
+  if ( name == "uint16" )
+  {
+    return ProbabilityStorageType::UInt16;
+  }
+  if ( name == "uint8" )
+  {
+    return ProbabilityStorageType::UInt8;
+  }
+  itkGenericExceptionMacro( << "Unknown probability storage type " << name
+                            << ", expected one of float, float16, uint16 or uint8" );
+}
+
+inline std::string
+ProbabilityStorageTypeToString( const ProbabilityStorageType type )
+{
+  switch ( type )
+  {
+    case ProbabilityStorageType::Float16:
+      return "float16";
+    case ProbabilityStorageType::UInt16:
+      return "uint16";
+    case ProbabilityStorageType::UInt8:
+      return "uint8";
+    default:
+      return "float";
+  }
+}
+
+namespace QuantizedProbability
+{
+/** Round to nearest even float to IEEE half conversion. */
+inline uint16_t
+FloatToHalf( const float value )
+{
+  uint32_t bits;
+  std::memcpy( &bits, &value, sizeof( bits ) );
+  const uint32_t sign = ( bits >> 16 ) & 0x8000u;
+  const uint32_t mag = bits & 0x7fffffffu;
+  if ( mag >= 0x7f800000u ) // inf or nan
+  {
+    return static_cast< uint16_t >( sign | ( ( mag > 0x7f800000u ) ? 0x7e00u : 0x7c00u ) );
+  }
+  if ( mag >= 0x477ff000u ) // rounds above the largest half
+  {
+    return static_cast< uint16_t >( sign | 0x7c00u );
+  }
+  if ( mag < 0x38800000u ) // half subnormal range, below 2^-14
+  {
+    if ( mag < 0x33000000u ) // at most half the smallest subnormal
+    {
+      return static_cast< uint16_t >( sign );
+    }
+    const uint32_t shift = 126u - ( mag >> 23 );
+    const uint32_t mantissa = ( mag & 0x7fffffu ) | 0x800000u;
+    uint32_t       half = mantissa >> shift;
+    const uint32_t remainder = mantissa & ( ( 1u << shift ) - 1u );
+    const uint32_t halfway = 1u << ( shift - 1u );
+    if ( remainder > halfway || ( remainder == halfway && ( half & 1u ) ) )
+    {
+      ++half;
+    }
+    return static_cast< uint16_t >( sign | half );
+  }
+  uint32_t       half = ( mag - 0x38000000u ) >> 13;
+  const uint32_t remainder = mag & 0x1fffu;
+  if ( remainder > 0x1000u || ( remainder == 0x1000u && ( half & 1u ) ) )
+  {
+    ++half;
+  }
+  return static_cast< uint16_t >( sign | half );
+}
+
+inline float
+HalfToFloat( const uint16_t half )
+{
+  const uint32_t sign = static_cast< uint32_t >( half & 0x8000u ) << 16;
+  uint32_t       exponent = ( half >> 10 ) & 0x1fu;
+  uint32_t       mantissa = half & 0x3ffu;
+  uint32_t       bits;
+  if ( exponent == 0x1fu )
+  {
+    bits = sign | 0x7f800000u | ( mantissa << 13 );
+  }
+  else if ( exponent == 0 )
+  {
+    if ( mantissa == 0 )
+    {
+      bits = sign;
+    }
+    else
+    {
+      exponent = 113;
+      while ( !( mantissa & 0x400u ) )
+      {
+        mantissa <<= 1;
+        --exponent;
+      }
+      bits = sign | ( exponent << 23 ) | ( ( mantissa & 0x3ffu ) << 13 );
+    }
+  }
+  else
+  {
+    bits = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+  }
+  float value;
+  std::memcpy( &value, &bits, sizeof( value ) );
+  return value;
+}
+
+/** Decoding tables, built once and shared by every list. */
+inline const std::vector< float > &
+HalfDecodeTable()
+{
+  static const std::vector< float > table = []() {
+    std::vector< float > t( 65536 );
+    for ( uint32_t h = 0; h < 65536; ++h )
+    {
+      t[h] = HalfToFloat( static_cast< uint16_t >( h ) );
+    }
+    return t;
+  }();
+  return table;
+}
+
+inline const std::vector< float > &
+UInt8DecodeTable()
+{
+  static const std::vector< float > table = []() {
+    std::vector< float > t( 256 );
+    for ( uint32_t c = 0; c < 256; ++c )
+    {
+      const double root = c / 255.0;
+      t[c] = static_cast< float >( root * root );
+    }
+    return t;
+  }();
+  return table;
+}
+
+inline uint16_t
+EncodeUInt16( const float value )
+{
+  const float clamped = std::min( std::max( value, 0.0F ), 1.0F );
+  return static_cast< uint16_t >( clamped * 65535.0F + 0.5F );
+}
+
+inline float
+DecodeUInt16( const uint16_t code )
+{
+  return code * ( 1.0F / 65535.0F );
+}
+
+inline uint8_t
+EncodeUInt8( const float value )
+{
+  const float clamped = std::min( std::max( value, 0.0F ), 1.0F );
+  return static_cast< uint8_t >( std::sqrt( clamped ) * 255.0F + 0.5F );
+}
+} // namespace QuantizedProbability
+
+/**
+ * \author Hans J. Johnson
+ * \brief A list of probability images that share one voxel lattice, held
+ * either as the float images themselves or as quantized codes.
+ *
+ * GetValue decodes a single voxel, so kernels that only read the
+ * probabilities can work directly on the compact storage.  GetImage decodes
+ * a whole class back into a float image when a filter needs one.  All classes
+ * must share the size of the first one; the geometry is kept in a reference
+ * image that has no buffer.
+ */
+template < typename TProbabilityImage >
+class QuantizedProbabilityImageList
+{
+public:
+  using ProbabilityImageType = TProbabilityImage;
+  using ProbabilityImagePointer = typename ProbabilityImageType::Pointer;
+  using ProbabilityImageVectorType = std::vector< ProbabilityImagePointer >;
+  using PixelType = typename ProbabilityImageType::PixelType;
+  using OffsetValueType = itk::OffsetValueType;
+
+  explicit QuantizedProbabilityImageList( const ProbabilityStorageType storageType = ProbabilityStorageType::Float )
+    : m_StorageType( storageType )
+    , m_NumberOfPixels( 0 )
+  {}
+
+  ProbabilityStorageType
+  GetStorageType() const
+  {
+    return m_StorageType;
+  }
+
+  /** Change the storage type, re-encoding anything already stored. */
+  void
+  SetStorageType( const ProbabilityStorageType storageType )
+  {
+    if ( storageType == m_StorageType )
+    {
+      return;
+    }
+    const ProbabilityImageVectorType images = this->GetImages();
+    m_StorageType = storageType;
+    this->Store( images );
+  }
+
+  size_t
+  size() const
+  {
+    return ( m_StorageType == ProbabilityStorageType::Float ) ? m_Images.size()
+                                                              : std::max( m_HalfCodes.size(), m_ByteCodes.size() );
+  }
+
+  bool
+  empty() const
+  {
+    return this->size() == 0;
+  }
+
+  void
+  clear()
+  {
+    m_Images.clear();
+    m_HalfCodes.clear();
+    m_ByteCodes.clear();
+    m_Reference = nullptr;
+    m_NumberOfPixels = 0;
+  }
+
+  /** Replace the contents with images.  With Float storage the images are
+   * shared, otherwise they are encoded and no reference to them is kept. */
+  void
+  Store( const ProbabilityImageVectorType & images )
+  {
+    this->clear();
+    if ( images.empty() )
+    {
+      return;
+    }
+    m_Reference = ProbabilityImageType::New();
+    m_Reference->CopyInformation( images[0] );
+    m_Reference->SetRegions( images[0]->GetLargestPossibleRegion() );
+    m_NumberOfPixels = images[0]->GetLargestPossibleRegion().GetNumberOfPixels();
+    for ( size_t i = 1; i < images.size(); ++i )
+    {
+      if ( images[i]->GetLargestPossibleRegion() != images[0]->GetLargestPossibleRegion() )
+      {
+        itkGenericExceptionMacro( << "Probability image " << i << " region "
+                                  << images[i]->GetLargestPossibleRegion() << " does not match image 0 region "
+                                  << images[0]->GetLargestPossibleRegion() );
+      }
+    }
+
+    switch ( m_StorageType )
+    {
+      case ProbabilityStorageType::Float:
+        m_Images = images;
+        break;
+      case ProbabilityStorageType::Float16:
+      case ProbabilityStorageType::UInt16:
+        m_HalfCodes.resize( images.size() );
+        for ( size_t i = 0; i < images.size(); ++i )
+        {
+          this->EncodeImage( images[i], m_HalfCodes[i] );
+        }
+        break;
+      case ProbabilityStorageType::UInt8:
+        m_ByteCodes.resize( images.size() );
+        for ( size_t i = 0; i < images.size(); ++i )
+        {
+          this->EncodeImage( images[i], m_ByteCodes[i] );
+        }
+        break;
+    }
+  }
+
+  /** The decoded value of one voxel, offset as from ComputeOffset. */
+  PixelType
+  GetValue( const size_t classIndex, const OffsetValueType offset ) const
+  {
+    switch ( m_StorageType )
+    {
+      case ProbabilityStorageType::Float16:
+        return static_cast< PixelType >( QuantizedProbability::HalfDecodeTable()[m_HalfCodes[classIndex][offset]] );
+      case ProbabilityStorageType::UInt16:
+        return static_cast< PixelType >( QuantizedProbability::DecodeUInt16( m_HalfCodes[classIndex][offset] ) );
+      case ProbabilityStorageType::UInt8:
+        return static_cast< PixelType >( QuantizedProbability::UInt8DecodeTable()[m_ByteCodes[classIndex][offset]] );
+      default:
+        return m_Images[classIndex]->GetBufferPointer()[offset];
+    }
+  }
+
+  /** The lattice shared by all classes; it has no pixel buffer. */
+  const ProbabilityImageType *
+  GetReferenceImage() const
+  {
+    return m_Reference.GetPointer();
+  }
+
+  /** A float image of one class.  With Float storage this is the stored image
+   * itself, otherwise a freshly decoded copy. */
+  ProbabilityImagePointer
+  GetImage( const size_t classIndex ) const
+  {
+    if ( m_StorageType == ProbabilityStorageType::Float )
+    {
+      return m_Images[classIndex];
+    }
+    ProbabilityImagePointer image = ProbabilityImageType::New();
+    image->CopyInformation( m_Reference );
+    image->SetRegions( m_Reference->GetLargestPossibleRegion() );
+    image->Allocate();
+    PixelType * const buffer = image->GetBufferPointer();
+    tbb::parallel_for( tbb::blocked_range< size_t >( 0, m_NumberOfPixels, 1 << 16 ),
+                       [=]( const tbb::blocked_range< size_t > & r ) {
+                         for ( size_t p = r.begin(); p < r.end(); ++p )
+                         {
+                           buffer[p] = this->GetValue( classIndex, static_cast< OffsetValueType >( p ) );
+                         }
+                       } );
+    return image;
+  }
+
+  ProbabilityImageVectorType
+  GetImages() const
+  {
+    ProbabilityImageVectorType images( this->size() );
+    for ( size_t i = 0; i < images.size(); ++i )
+    {
+      images[i] = this->GetImage( i );
+    }
+    return images;
+  }
+
+  /** Bytes held for the pixel values of all classes. */
+  size_t
+  GetBufferSizeInBytes() const
+  {
+    switch ( m_StorageType )
+    {
+      case ProbabilityStorageType::Float16:
+      case ProbabilityStorageType::UInt16:
+        return m_HalfCodes.size() * m_NumberOfPixels * sizeof( uint16_t );
+      case ProbabilityStorageType::UInt8:
+        return m_ByteCodes.size() * m_NumberOfPixels * sizeof( uint8_t );
+      default:
+        return m_Images.size() * m_NumberOfPixels * sizeof( PixelType );
+    }
+  }
+
+private:
+  template < typename TCode >
+  void
+  EncodeImage( const ProbabilityImageType * image, std::vector< TCode > & codes ) const
+  {
+    codes.resize( m_NumberOfPixels );
+    const PixelType * const      buffer = image->GetBufferPointer();
+    TCode * const                codeBuffer = codes.data();
+    const ProbabilityStorageType storageType = m_StorageType;
+    tbb::parallel_for( tbb::blocked_range< size_t >( 0, m_NumberOfPixels, 1 << 16 ),
+                       [=]( const tbb::blocked_range< size_t > & r ) {
+                         for ( size_t p = r.begin(); p < r.end(); ++p )
+                         {
+                           const float value = static_cast< float >( buffer[p] );
+                           switch ( storageType )
+                           {
+                             case ProbabilityStorageType::Float16:
+                               codeBuffer[p] = static_cast< TCode >( QuantizedProbability::FloatToHalf( value ) );
+                               break;
+                             case ProbabilityStorageType::UInt16:
+                               codeBuffer[p] = static_cast< TCode >( QuantizedProbability::EncodeUInt16( value ) );
+                               break;
+                             default:
+                               codeBuffer[p] = static_cast< TCode >( QuantizedProbability::EncodeUInt8( value ) );
+                               break;
+                           }
+                         }
+                       } );
+  }
+
+  ProbabilityStorageType                m_StorageType;
+  ProbabilityImageVectorType            m_Images;
+  std::vector< std::vector< uint16_t > > m_HalfCodes;
+  std::vector< std::vector< uint8_t > >  m_ByteCodes;
+  ProbabilityImagePointer               m_Reference;
+  size_t                                m_NumberOfPixels;
+};
+
+#endif // __QuantizedProbabilityImageList_h
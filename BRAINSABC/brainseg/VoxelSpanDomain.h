@@ -0,0 +1,246 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __VoxelSpanDomain_h
+#define __VoxelSpanDomain_h
+
+#include "itkImage.h"
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * \author Hans J. Johnson
+ * \brief The non-zero voxels of a 3D mask as runs along the fastest axis.
+ *
+ * Built once from a mask, the spans let voxel kernels visit only the masked
+ * voxels, in memory order, without testing the mask.  Each span holds the
+ * index of its first voxel and that voxel's buffer offset, so images on the
+ * mask lattice can be addressed either way.
+ */
+class VoxelSpanDomain
+{
+public:
+  using IndexType = itk::Index< 3 >;
+  using RegionType = itk::ImageRegion< 3 >;
+
+  struct Span
+  {
+    IndexType            start;
+    itk::OffsetValueType offset;
+    itk::SizeValueType   length;
+  };
+  using SpanVectorType = std::vector< Span >;
+
+  VoxelSpanDomain()
+    : m_NumberOfVoxels( 0 )
+  {}
+
+  template < typename TMaskImage >
+  explicit VoxelSpanDomain( const TMaskImage * mask )
+    : m_NumberOfVoxels( 0 )
+  {
+    this->Build( mask );
+  }
+
+  /** Collect the non-zero voxels of the buffered region of mask. */
+  template < typename TMaskImage >
+  void
+  Build( const TMaskImage * mask )
+  {
+    m_Region = mask->GetBufferedRegion();
+    const typename TMaskImage::SizeType size = m_Region.GetSize();
+    const IndexType                     origin = m_Region.GetIndex();
+    const typename TMaskImage::PixelType * const buffer = mask->GetBufferPointer();
+
+    // Slices are scanned in parallel and concatenated in order.
+    std::vector< SpanVectorType > sliceSpans( size[2] );
+    tbb::parallel_for( tbb::blocked_range< itk::SizeValueType >( 0, size[2], 1 ),
+                       [&]( const tbb::blocked_range< itk::SizeValueType > & r ) {
+                         for ( itk::SizeValueType kk = r.begin(); kk < r.end(); ++kk )
+                         {
+                           for ( itk::SizeValueType jj = 0; jj < size[1]; ++jj )
+                           {
+                             const itk::OffsetValueType rowOffset = ( kk * size[1] + jj ) * size[0];
+                             itk::SizeValueType         ii = 0;
+                             while ( ii < size[0] )
+                             {
+                               if ( buffer[rowOffset + ii] == 0 )
+                               {
+                                 ++ii;
+                                 continue;
+                               }
+                               Span span;
+                               span.start[0] = origin[0] + ii;
+                               span.start[1] = origin[1] + jj;
+                               span.start[2] = origin[2] + kk;
+                               span.offset = rowOffset + ii;
+                               while ( ii < size[0] && buffer[rowOffset + ii] != 0 )
+                               {
+                                 ++ii;
+                               }
+                               span.length = rowOffset + ii - span.offset;
+                               sliceSpans[kk].push_back( span );
+                             }
+                           }
+                         }
+                       } );
+
+    m_Spans.clear();
+    m_NumberOfVoxels = 0;
+    for ( const auto & slice : sliceSpans )
+    {
+      for ( const auto & span : slice )
+      {
+        m_NumberOfVoxels += span.length;
+      }
+      m_Spans.insert( m_Spans.end(), slice.begin(), slice.end() );
+    }
+  }
+
+  /** Collect the non-zero voxels of mask that also lie in domain.  Only the
+   * spans of domain are scanned, and mask must share its lattice. */
+  template < typename TMaskImage >
+  void
+  Build( const TMaskImage * mask, const VoxelSpanDomain & domain )
+  {
+    m_Region = domain.GetRegion();
+    if ( mask->GetBufferedRegion() != m_Region )
+    {
+      itkGenericExceptionMacro( << "The mask is not on the lattice of the domain." );
+    }
+    const typename TMaskImage::PixelType * const buffer = mask->GetBufferPointer();
+    const Span * const                           spans = domain.GetSpans().data();
+    constexpr size_t                             spansPerChunk = 256;
+    const size_t numberOfChunks = ( domain.GetSpans().size() + spansPerChunk - 1 ) / spansPerChunk;
+
+    // Chunks of the domain are scanned in parallel and concatenated in order.
+    std::vector< SpanVectorType > chunkSpans( numberOfChunks );
+    tbb::parallel_for( tbb::blocked_range< size_t >( 0, numberOfChunks, 1 ),
+                       [&]( const tbb::blocked_range< size_t > & r ) {
+                         for ( size_t c = r.begin(); c < r.end(); ++c )
+                         {
+                           const size_t last = std::min( ( c + 1 ) * spansPerChunk, domain.GetSpans().size() );
+                           for ( size_t s = c * spansPerChunk; s < last; ++s )
+                           {
+                             const Span &       outer = spans[s];
+                             itk::SizeValueType ii = 0;
+                             while ( ii < outer.length )
+                             {
+                               if ( buffer[outer.offset + ii] == 0 )
+                               {
+                                 ++ii;
+                                 continue;
+                               }
+                               Span span;
+                               span.start = outer.start;
+                               span.start[0] += ii;
+                               span.offset = outer.offset + ii;
+                               while ( ii < outer.length && buffer[outer.offset + ii] != 0 )
+                               {
+                                 ++ii;
+                               }
+                               span.length = outer.offset + ii - span.offset;
+                               chunkSpans[c].push_back( span );
+                             }
+                           }
+                         }
+                       } );
+
+    m_Spans.clear();
+    m_NumberOfVoxels = 0;
+    for ( const auto & chunk : chunkSpans )
+    {
+      for ( const auto & span : chunk )
+      {
+        m_NumberOfVoxels += span.length;
+      }
+      m_Spans.insert( m_Spans.end(), chunk.begin(), chunk.end() );
+    }
+  }
+
+  const SpanVectorType &
+  GetSpans() const
+  {
+    return m_Spans;
+  }
+
+  /** The buffered region of the mask the domain was built from. */
+  const RegionType &
+  GetRegion() const
+  {
+    return m_Region;
+  }
+
+  itk::SizeValueType
+  GetNumberOfVoxels() const
+  {
+    return m_NumberOfVoxels;
+  }
+
+  bool
+  empty() const
+  {
+    return m_Spans.empty();
+  }
+
+  /** Call functor( span ) for every span, in parallel. */
+  template < typename TFunctor >
+  void
+  ParallelForEachSpan( const TFunctor & functor ) const
+  {
+    const Span * const spans = m_Spans.data();
+    tbb::parallel_for( tbb::blocked_range< size_t >( 0, m_Spans.size(), 16 ),
+                       [spans, &functor]( const tbb::blocked_range< size_t > & r ) {
+                         for ( size_t s = r.begin(); s < r.end(); ++s )
+                         {
+                           functor( spans[s] );
+                         }
+                       } );
+  }
+
+  /** Fold value = functor( span, value ) over all spans, in parallel, and
+   * join the partial values with reduction. */
+  template < typename TValue, typename TFunctor, typename TReduction >
+  TValue
+  ParallelReduceSpans( const TValue & identity, const TFunctor & functor, const TReduction & reduction ) const
+  {
+    const Span * const spans = m_Spans.data();
+    return tbb::parallel_reduce( tbb::blocked_range< size_t >( 0, m_Spans.size(), 16 ),
+                                 identity,
+                                 [spans, &functor]( const tbb::blocked_range< size_t > & r, TValue value ) -> TValue {
+                                   for ( size_t s = r.begin(); s < r.end(); ++s )
+                                   {
+                                     value = functor( spans[s], value );
+                                   }
+                                   return value;
+                                 },
+                                 reduction );
+  }
+
+private:
+  RegionType         m_Region;
+  SpanVectorType     m_Spans;
+  itk::SizeValueType m_NumberOfVoxels;
+};
+
+#endif // __VoxelSpanDomain_h
@@ -34,6 +34,7 @@
 #define __ApplicationBase_hxx
 
 #include "ApplicationBase.h"
+#include "BRAINSProfiler.h"
 
 namespace itk
 {
@@ -60,6 +61,7 @@ ApplicationBase< TParser, TPreprocessor, TRegistrator >::Execute()
 
   try
   {
+    BRAINS_PROFILE_SCOPE( "ParseInput" );
     this->InitializeParser();
     m_Parser->Execute();
   }
@@ -86,6 +88,7 @@ ApplicationBase< TParser, TPreprocessor, TRegistrator >::Execute()
 
   try
   {
+    BRAINS_PROFILE_SCOPE( "Preprocess" );
     this->InitializePreprocessor();
     m_Preprocessor->Execute();
   }
@@ -111,6 +114,7 @@ ApplicationBase< TParser, TPreprocessor, TRegistrator >::Execute()
 
   try
   {
+    BRAINS_PROFILE_SCOPE( "Register" );
     this->InitializeRegistrator();
     m_Preprocessor = nullptr;
     m_Parser = nullptr;
@@ -0,0 +1,313 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "BRAINSAtlasCache.h"
+
+#include <itksys/MD5.h>
+#include <itksys/SystemTools.hxx>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+#if defined( _WIN32 )
+#  include <process.h>
+#  define BRAINS_GETPID _getpid
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#  define BRAINS_GETPID getpid
+#endif
+
+namespace BRAINSUtils
+{
+namespace
+{
+const char CacheMagic[] = "BRAINSAtlasCache 1";
+
+std::mutex  g_CacheDirectoryMutex;
+bool        g_CacheDirectoryInitialized = false;
+std::string g_CacheDirectory;
+
+std::string
+Trim( const std::string & text )
+{
+  const std::string::size_type first = text.find_first_not_of( " \t\r\n" );
+  if ( first == std::string::npos )
+  {
+    return std::string();
+  }
+  const std::string::size_type last = text.find_last_not_of( " \t\r\n" );
+  return text.substr( first, last - first + 1 );
+}
+
+// The checksum recorded in a sidecar file, whose first word is the digest.
+std::string
+ReadSidecarChecksum( const std::string & sidecarFileName )
+{
+  std::ifstream sidecar( sidecarFileName.c_str() );
+  std::string   digest;
+  if ( sidecar && ( sidecar >> digest ) )
+  {
+    return Trim( digest );
+  }
+  return std::string();
+}
+} // namespace
+
+std::shared_ptr< MemoryMappedFile >
+MemoryMappedFile::Open( const std::string & fileName )
+{
+  std::shared_ptr< MemoryMappedFile > file( new MemoryMappedFile );
+#if !defined( _WIN32 )
+  const int descriptor = open( fileName.c_str(), O_RDONLY );
+  if ( descriptor < 0 )
+  {
+    return nullptr;
+  }
+  struct stat status;
+  if ( fstat( descriptor, &status ) != 0 || status.st_size <= 0 )
+  {
+    close( descriptor );
+    return nullptr;
+  }
+  void * data = mmap( nullptr, static_cast< std::size_t >( status.st_size ), PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                      descriptor, 0 );
+  close( descriptor );
+  if ( data == MAP_FAILED )
+  {
+    return nullptr;
+  }
+  file->m_Data = static_cast< char * >( data );
+  file->m_Size = static_cast< std::size_t >( status.st_size );
+  file->m_Mapped = true;
+#else
+  std::ifstream input( fileName.c_str(), std::ios::binary | std::ios::ate );
+  if ( !input )
+  {
+    return nullptr;
+  }
+  const std::streamoff length = input.tellg();
+  if ( length <= 0 )
+  {
+    return nullptr;
+  }
+  file->m_ReadBuffer.resize( static_cast< std::size_t >( length ) );
+  input.seekg( 0 );
+  if ( !input.read( file->m_ReadBuffer.data(), length ) )
+  {
+    return nullptr;
+  }
+  file->m_Data = file->m_ReadBuffer.data();
+  file->m_Size = file->m_ReadBuffer.size();
+#endif
+  return file;
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+#if !defined( _WIN32 )
+  if ( m_Mapped )
+  {
+    munmap( m_Data, m_Size );
+  }
+#endif
+}
+
+std::string
+AtlasCache::GetCacheDirectory()
+{
+  std::lock_guard< std::mutex > lock( g_CacheDirectoryMutex );
+  if ( !g_CacheDirectoryInitialized )
+  {
+    const char * const environmentDirectory = std::getenv( "BRAINS_ATLAS_CACHE_DIR" );
+    g_CacheDirectory = ( environmentDirectory != nullptr ) ? Trim( environmentDirectory ) : std::string();
+    g_CacheDirectoryInitialized = true;
+  }
+  if ( !g_CacheDirectory.empty() && !itksys::SystemTools::FileIsDirectory( g_CacheDirectory ) &&
+       !itksys::SystemTools::MakeDirectory( g_CacheDirectory ) )
+  {
+    std::cerr << "WARNING: Can not create atlas cache directory " << g_CacheDirectory << "; caching is disabled."
+              << std::endl;
+    g_CacheDirectory.clear();
+  }
+  return g_CacheDirectory;
+}
+
+void
+AtlasCache::SetCacheDirectory( const std::string & directory )
+{
+  std::lock_guard< std::mutex > lock( g_CacheDirectoryMutex );
+  g_CacheDirectory = directory;
+  g_CacheDirectoryInitialized = true;
+}
+
+std::string
+AtlasCache::GetContentKey( const std::string & fileName )
+{
+  // The ReferenceAtlas installs the checksum it was downloaded with next to
+  // every file, which identifies the content wherever the file is.
+  for ( const char * const extension : { ".md5", ".sha512" } )
+  {
+    const std::string digest = ReadSidecarChecksum( fileName + extension );
+    if ( !digest.empty() )
+    {
+      return digest;
+    }
+  }
+
+  // Without a checksum the file is keyed by its location, size and time of
+  // modification; hashing the whole volume would cost as much as inflating it.
+  if ( !itksys::SystemTools::FileExists( fileName, true ) )
+  {
+    return std::string();
+  }
+  std::ostringstream identity;
+  identity << itksys::SystemTools::CollapseFullPath( fileName ) << "\n"
+           << itksys::SystemTools::FileLength( fileName ) << "\n"
+           << itksys::SystemTools::ModifiedTime( fileName );
+  const std::string identityText = identity.str();
+
+  itksysMD5 * md5 = itksysMD5_New();
+  itksysMD5_Initialize( md5 );
+  itksysMD5_Append( md5, reinterpret_cast< const unsigned char * >( identityText.data() ),
+                    static_cast< int >( identityText.size() ) );
+  char digest[33];
+  itksysMD5_FinalizeHex( md5, digest );
+  digest[32] = '\0';
+  itksysMD5_Delete( md5 );
+  return std::string( digest );
+}
+
+std::string
+AtlasCache::GetCacheFileName( const std::string & fileName, const std::string & componentType,
+                              const unsigned int dimension )
+{
+  const std::string directory = GetCacheDirectory();
+  if ( directory.empty() )
+  {
+    return std::string();
+  }
+  const std::string key = GetContentKey( fileName );
+  if ( key.empty() )
+  {
+    return std::string();
+  }
+  std::ostringstream cacheFileName;
+  cacheFileName << directory << "/" << key << "_" << componentType << "_" << dimension << "D.atlascache";
+  return cacheFileName.str();
+}
+
+bool
+AtlasCache::WriteCacheFile( const std::string & cacheFileName, const CachedImageHeader & header, const char * pixels,
+                            const std::size_t pixelBytes )
+{
+  std::ostringstream text;
+  text << std::setprecision( 17 ) << CacheMagic << "\n"
+       << header.m_ComponentType << "\n"
+       << header.m_Dimension << "\n";
+  for ( const std::size_t size : header.m_Size )
+  {
+    text << size << " ";
+  }
+  text << "\n";
+  for ( const std::vector< double > * values : { &header.m_Spacing, &header.m_Origin, &header.m_Direction } )
+  {
+    for ( const double value : *values )
+    {
+      text << value << " ";
+    }
+    text << "\n";
+  }
+  std::string headerBlock = text.str();
+  if ( headerBlock.size() >= HeaderBytes )
+  {
+    return false;
+  }
+  headerBlock.resize( HeaderBytes, '\0' );
+
+  static std::atomic< unsigned int > counter( 0 );
+  std::ostringstream                 temporaryFileName;
+  temporaryFileName << cacheFileName << ".tmp" << BRAINS_GETPID() << "_" << counter++;
+  {
+    std::ofstream output( temporaryFileName.str().c_str(), std::ios::binary | std::ios::trunc );
+    if ( !output || !output.write( headerBlock.data(), static_cast< std::streamsize >( headerBlock.size() ) ) ||
+         !output.write( pixels, static_cast< std::streamsize >( pixelBytes ) ) )
+    {
+      output.close();
+      itksys::SystemTools::RemoveFile( temporaryFileName.str() );
+      return false;
+    }
+  }
+  // Another process may have filled the entry meanwhile; either copy is complete.
+  if ( std::rename( temporaryFileName.str().c_str(), cacheFileName.c_str() ) != 0 )
+  {
+    itksys::SystemTools::RemoveFile( temporaryFileName.str() );
+    return itksys::SystemTools::FileExists( cacheFileName, true );
+  }
+  return true;
+}
+
+bool
+AtlasCache::ParseCacheHeader( const char * data, const std::size_t length, CachedImageHeader & header )
+{
+  if ( data == nullptr || length < HeaderBytes )
+  {
+    return false;
+  }
+  std::string       headerBlock( data, HeaderBytes );
+  const std::size_t end = headerBlock.find( '\0' );
+  if ( end == std::string::npos )
+  {
+    return false;
+  }
+  headerBlock.resize( end );
+
+  std::istringstream text( headerBlock );
+  std::string        magic;
+  if ( !std::getline( text, magic ) || magic != CacheMagic || !( text >> header.m_ComponentType ) ||
+       !( text >> header.m_Dimension ) || header.m_Dimension == 0 )
+  {
+    return false;
+  }
+  const unsigned int dimension = header.m_Dimension;
+  header.m_Size.resize( dimension );
+  header.m_Spacing.resize( dimension );
+  header.m_Origin.resize( dimension );
+  header.m_Direction.resize( dimension * dimension );
+  for ( std::size_t & size : header.m_Size )
+  {
+    text >> size;
+  }
+  for ( std::vector< double > * values : { &header.m_Spacing, &header.m_Origin, &header.m_Direction } )
+  {
+    for ( double & value : *values )
+    {
+      text >> value;
+    }
+  }
+  return !text.fail();
+}
+} // namespace BRAINSUtils
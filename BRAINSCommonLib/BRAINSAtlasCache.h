@@ -0,0 +1,178 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef BRAINSAtlasCache_h
+#define BRAINSAtlasCache_h
+
+#include "itkImportImageContainer.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace BRAINSUtils
+{
+/**
+ * \author Hans J. Johnson
+ * \brief A read only file mapped into memory.
+ *
+ * The mapping is private (copy on write): pages that are only read are
+ * shared by every process mapping the same file, and a page that is written
+ * becomes a private copy, so the file itself never changes.  Where memory
+ * mapping is not available the file is read into memory instead.
+ */
+class MemoryMappedFile
+{
+public:
+  /** Map fileName; returns nullptr when it can not be opened. */
+  static std::shared_ptr< MemoryMappedFile >
+  Open( const std::string & fileName );
+
+  ~MemoryMappedFile();
+  MemoryMappedFile( const MemoryMappedFile & ) = delete;
+  MemoryMappedFile &
+  operator=( const MemoryMappedFile & ) = delete;
+
+  char *
+  GetData() const
+  {
+    return m_Data;
+  }
+  std::size_t
+  GetSize() const
+  {
+    return m_Size;
+  }
+
+private:
+  MemoryMappedFile() = default;
+
+  char *              m_Data{ nullptr };
+  std::size_t         m_Size{ 0 };
+  bool                m_Mapped{ false };
+  std::vector< char > m_ReadBuffer;
+};
+
+/**
+ * \author Hans J. Johnson
+ * \brief An image pixel container whose elements live in a MemoryMappedFile,
+ * which is kept mapped for as long as the container exists.
+ */
+template < typename TElement >
+class MemoryMappedImageContainer : public itk::ImportImageContainer< itk::SizeValueType, TElement >
+{
+public:
+  using Self = MemoryMappedImageContainer;
+  using Superclass = itk::ImportImageContainer< itk::SizeValueType, TElement >;
+  using Pointer = itk::SmartPointer< Self >;
+  using ConstPointer = itk::SmartPointer< const Self >;
+
+  itkNewMacro( Self );
+  itkTypeMacro( MemoryMappedImageContainer, ImportImageContainer );
+
+  /** Use numberOfElements elements starting offset bytes into mappedFile. */
+  void
+  SetMappedFile( const std::shared_ptr< MemoryMappedFile > & mappedFile, const std::size_t offset,
+                 const itk::SizeValueType numberOfElements )
+  {
+    m_MappedFile = mappedFile;
+    this->SetImportPointer( reinterpret_cast< TElement * >( mappedFile->GetData() + offset ), numberOfElements, false );
+  }
+
+protected:
+  MemoryMappedImageContainer() = default;
+  ~MemoryMappedImageContainer() override = default;
+
+private:
+  std::shared_ptr< MemoryMappedFile > m_MappedFile;
+};
+
+/**
+ * \author Hans J. Johnson
+ * \brief A node wide cache of uncompressed ReferenceAtlas volumes.
+ *
+ * When a cache directory is set (by SetCacheDirectory or the
+ * BRAINS_ATLAS_CACHE_DIR environment variable), ReadImage keys every atlas
+ * file by its checksum -- the content of the ".md5" (or ".sha512") file
+ * installed next to it, or else the MD5 of its full path, size and time of
+ * modification -- and the pixel type requested.  The first process to read a volume decompresses it once and
+ * stores the pixels uncompressed in the cache directory; every read, in
+ * this and all later processes, maps the cached pixels straight into the
+ * image buffer.  Concurrent processes therefore neither decompress the
+ * atlas again nor hold private copies of it.
+ *
+ * Only volumes that are read and never modified, such as the atlas
+ * templates, gain from the cache: the mapping is copy on write, so a volume
+ * that is changed in place (e.g. the BRAINSABC priors, which are normalized
+ * in place) ends up with a private copy of every page anyway.
+ *
+ * Cache entries are written to a temporary name and renamed into place, so
+ * processes racing to fill the cache never see a partial entry.  Without a
+ * cache directory ReadImage is itkUtil::ReadImage.
+ */
+class AtlasCache
+{
+public:
+  /** The cache directory, empty when caching is disabled. */
+  static std::string
+  GetCacheDirectory();
+  static void
+  SetCacheDirectory( const std::string & directory );
+
+  /** The checksum that identifies the content of fileName, empty when the file does not exist. */
+  static std::string
+  GetContentKey( const std::string & fileName );
+
+  /** Read an atlas volume through the cache. */
+  template < typename TImage >
+  static typename TImage::Pointer
+  ReadImage( const std::string & fileName );
+
+  /** The geometry of a cached volume. */
+  struct CachedImageHeader
+  {
+    std::string                m_ComponentType;
+    unsigned int               m_Dimension{ 0 };
+    std::vector< std::size_t > m_Size;
+    std::vector< double >      m_Spacing;
+    std::vector< double >      m_Origin;
+    std::vector< double >      m_Direction;
+  };
+
+  /** Bytes before the pixels of a cache entry; a multiple of the page size. */
+  static constexpr std::size_t HeaderBytes = 4096;
+
+private:
+  static std::string
+  GetCacheFileName( const std::string & fileName, const std::string & componentType, unsigned int dimension );
+  static bool
+  WriteCacheFile( const std::string & cacheFileName, const CachedImageHeader & header, const char * pixels,
+                  std::size_t pixelBytes );
+  static bool
+  ParseCacheHeader( const char * data, std::size_t length, CachedImageHeader & header );
+
+  template < typename TImage >
+  static typename TImage::Pointer
+  MapCachedImage( const std::string & cacheFileName, const std::string & componentType );
+};
+} // namespace BRAINSUtils
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "BRAINSAtlasCache.hxx"
+#endif
+
+#endif // BRAINSAtlasCache_h
@@ -0,0 +1,122 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef BRAINSAtlasCache_hxx
+#define BRAINSAtlasCache_hxx
+
+#include "BRAINSAtlasCache.h"
+#include "itkIO.h"
+#include "itkImageIOBase.h"
+
+namespace BRAINSUtils
+{
+template < typename TImage >
+typename TImage::Pointer
+AtlasCache::MapCachedImage( const std::string & cacheFileName, const std::string & componentType )
+{
+  using PixelType = typename TImage::PixelType;
+  const std::shared_ptr< MemoryMappedFile > mappedFile = MemoryMappedFile::Open( cacheFileName );
+  CachedImageHeader                         header;
+  if ( mappedFile == nullptr || !ParseCacheHeader( mappedFile->GetData(), mappedFile->GetSize(), header ) ||
+       header.m_ComponentType != componentType || header.m_Dimension != TImage::ImageDimension )
+  {
+    return nullptr;
+  }
+
+  typename TImage::RegionType    region;
+  typename TImage::SpacingType   spacing;
+  typename TImage::PointType     origin;
+  typename TImage::DirectionType direction;
+  itk::SizeValueType             numberOfPixels = 1;
+  for ( unsigned int d = 0; d < TImage::ImageDimension; ++d )
+  {
+    region.SetSize( d, header.m_Size[d] );
+    spacing[d] = header.m_Spacing[d];
+    origin[d] = header.m_Origin[d];
+    for ( unsigned int c = 0; c < TImage::ImageDimension; ++c )
+    {
+      direction[d][c] = header.m_Direction[d * TImage::ImageDimension + c];
+    }
+    numberOfPixels *= header.m_Size[d];
+  }
+  if ( mappedFile->GetSize() != HeaderBytes + numberOfPixels * sizeof( PixelType ) )
+  {
+    return nullptr;
+  }
+
+  using ContainerType = MemoryMappedImageContainer< PixelType >;
+  typename ContainerType::Pointer container = ContainerType::New();
+  container->SetMappedFile( mappedFile, HeaderBytes, numberOfPixels );
+
+  typename TImage::Pointer image = TImage::New();
+  image->SetRegions( region );
+  image->SetSpacing( spacing );
+  image->SetOrigin( origin );
+  image->SetDirection( direction );
+  image->SetPixelContainer( container );
+  return image;
+}
+
+template < typename TImage >
+typename TImage::Pointer
+AtlasCache::ReadImage( const std::string & fileName )
+{
+  using PixelType = typename TImage::PixelType;
+  const auto        componentTypeID = itk::ImageIOBase::MapPixelType< PixelType >::CType;
+  const std::string componentType = itk::ImageIOBase::GetComponentTypeAsString( componentTypeID );
+  const std::string cacheFileName = ( componentTypeID == itk::ImageIOBase::UNKNOWNCOMPONENTTYPE )
+                                      ? std::string()
+                                      : GetCacheFileName( fileName, componentType, TImage::ImageDimension );
+  if ( cacheFileName.empty() )
+  {
+    return itkUtil::ReadImage< TImage >( fileName );
+  }
+
+  typename TImage::Pointer image = MapCachedImage< TImage >( cacheFileName, componentType );
+  if ( image.IsNotNull() )
+  {
+    return image;
+  }
+
+  // The first reader of this volume fills the cache entry, then maps it too
+  // so that its pixels are shared with the processes that follow.
+  const typename TImage::Pointer readImage = itkUtil::ReadImage< TImage >( fileName );
+  CachedImageHeader              header;
+  header.m_ComponentType = componentType;
+  header.m_Dimension = TImage::ImageDimension;
+  for ( unsigned int d = 0; d < TImage::ImageDimension; ++d )
+  {
+    header.m_Size.push_back( readImage->GetLargestPossibleRegion().GetSize( d ) );
+    header.m_Spacing.push_back( readImage->GetSpacing()[d] );
+    header.m_Origin.push_back( readImage->GetOrigin()[d] );
+    for ( unsigned int c = 0; c < TImage::ImageDimension; ++c )
+    {
+      header.m_Direction.push_back( readImage->GetDirection()[d][c] );
+    }
+  }
+  const std::size_t pixelBytes = readImage->GetLargestPossibleRegion().GetNumberOfPixels() * sizeof( PixelType );
+  if ( WriteCacheFile(
+         cacheFileName, header, reinterpret_cast< const char * >( readImage->GetBufferPointer() ), pixelBytes ) )
+  {
+    image = MapCachedImage< TImage >( cacheFileName, componentType );
+  }
+  return image.IsNotNull() ? image : readImage;
+}
+} // namespace BRAINSUtils
+
+#endif // BRAINSAtlasCache_hxx
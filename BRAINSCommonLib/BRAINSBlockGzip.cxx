@@ -0,0 +1,597 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "BRAINSBlockGzip.h"
+
+#include "itkMultiThreaderBase.h"
+#include "itk_zlib.h"
+#include <itksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if defined( _WIN32 )
+#  include <process.h>
+#  define BRAINS_GETPID _getpid
+#else
+#  include <unistd.h>
+#  define BRAINS_GETPID getpid
+#endif
+
+namespace BRAINSUtils
+{
+namespace
+{
+const std::size_t GzipHeaderSize = 18; // Fixed header, XLEN and the BC subfield.
+const std::size_t GzipTrailerSize = 8; // CRC32 and ISIZE.
+
+// An empty member; it marks the end of a block gzip stream.
+const unsigned char EndOfStreamMember[28] = { 0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff,
+                                              0x06, 0x00, 0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00,
+                                              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+std::atomic< int > g_DefaultCompressionLevel( -1 );
+
+inline unsigned int
+ReadLittleEndian16( const unsigned char * p )
+{
+  return static_cast< unsigned int >( p[0] ) | ( static_cast< unsigned int >( p[1] ) << 8 );
+}
+
+inline unsigned long
+ReadLittleEndian32( const unsigned char * p )
+{
+  return static_cast< unsigned long >( ReadLittleEndian16( p ) ) |
+         ( static_cast< unsigned long >( ReadLittleEndian16( p + 2 ) ) << 16 );
+}
+
+inline void
+WriteLittleEndian16( unsigned char * p, const unsigned int value )
+{
+  p[0] = static_cast< unsigned char >( value & 0xff );
+  p[1] = static_cast< unsigned char >( ( value >> 8 ) & 0xff );
+}
+
+inline void
+WriteLittleEndian32( unsigned char * p, const unsigned long value )
+{
+  WriteLittleEndian16( p, static_cast< unsigned int >( value & 0xffff ) );
+  WriteLittleEndian16( p + 2, static_cast< unsigned int >( ( value >> 16 ) & 0xffff ) );
+}
+
+/** The layout of one gzip member of a block gzip stream. */
+struct MemberLayout
+{
+  std::size_t m_Offset;     // of the member in the compressed stream
+  std::size_t m_HeaderSize; // bytes before the deflate data
+  std::size_t m_MemberSize; // total bytes of the member
+  std::size_t m_DecompressedOffset;
+  std::size_t m_DecompressedSize;
+};
+
+/**
+ * Parse the header of the member starting at data.  Returns the total size
+ * of the member, or 0 when it is not a block gzip member.
+ */
+std::size_t
+ParseMemberHeader( const unsigned char * data, const std::size_t length, std::size_t & headerSize )
+{
+  if ( length < GzipHeaderSize || data[0] != 0x1f || data[1] != 0x8b || data[2] != 8 || ( data[3] & 0x04 ) == 0 )
+  {
+    return 0;
+  }
+  const std::size_t extraLength = ReadLittleEndian16( data + 10 );
+  if ( 12 + extraLength > length )
+  {
+    return 0;
+  }
+  for ( std::size_t field = 12; field + 4 <= 12 + extraLength; )
+  {
+    const std::size_t fieldLength = ReadLittleEndian16( data + field + 2 );
+    if ( data[field] == 'B' && data[field + 1] == 'C' && fieldLength == 2 && field + 6 <= 12 + extraLength )
+    {
+      headerSize = 12 + extraLength;
+      return ReadLittleEndian16( data + field + 4 ) + 1;
+    }
+    field += 4 + fieldLength;
+  }
+  return 0;
+}
+
+/** The number of blocks compressed or inflated at a time when streaming a file. */
+const std::size_t StreamingBatchBlocks = 256;
+
+bool
+ReadFile( const std::string & fileName, std::vector< char > & contents, const std::size_t maximumSize )
+{
+  std::ifstream in( fileName.c_str(), std::ios::in | std::ios::binary );
+  if ( !in.is_open() )
+  {
+    return false;
+  }
+  in.seekg( 0, std::ios::end );
+  const std::size_t fileSize = static_cast< std::size_t >( in.tellg() );
+  in.seekg( 0, std::ios::beg );
+  contents.resize( std::min( fileSize, maximumSize ) );
+  in.read( contents.data(), static_cast< std::streamsize >( contents.size() ) );
+  return static_cast< std::size_t >( in.gcount() ) == contents.size();
+}
+
+bool
+HasSuffix( const std::string & fileName, const std::string & suffix )
+{
+  const std::string lower = itksys::SystemTools::LowerCase( fileName );
+  return lower.size() >= suffix.size() && lower.compare( lower.size() - suffix.size(), suffix.size(), suffix ) == 0;
+}
+
+bool
+IsNrrdFileName( const std::string & fileName )
+{
+  return HasSuffix( fileName, ".nrrd" );
+}
+
+/**
+ * The size of the attached header of a NRRD file, i.e. the offset of the
+ * byte after the first empty line, or 0 when there is none in data.
+ */
+std::size_t
+NrrdHeaderSize( const char * data, const std::size_t length )
+{
+  const char   separator[] = "\n\n";
+  const char * end = std::search( data, data + length, separator, separator + 2 );
+  return ( end == data + length ) ? 0 : static_cast< std::size_t >( end - data ) + 2;
+}
+/** Replace the value of the "encoding:" line of a NRRD header; false when there is none. */
+bool
+SetNrrdEncoding( std::string & header, const std::string & encoding )
+{
+  std::size_t lineStart = 0;
+  while ( lineStart < header.size() )
+  {
+    std::size_t lineEnd = header.find( '\n', lineStart );
+    if ( lineEnd == std::string::npos )
+    {
+      lineEnd = header.size();
+    }
+    if ( header.compare( lineStart, 9, "encoding:" ) == 0 )
+    {
+      header.replace( lineStart, lineEnd - lineStart, "encoding: " + encoding );
+      return true;
+    }
+    lineStart = lineEnd + 1;
+  }
+  return false;
+}
+
+std::string
+GetNrrdField( const std::string & header, const std::string & field )
+{
+  const std::string key = "\n" + field + ":";
+  const std::size_t start = header.find( key );
+  if ( start == std::string::npos )
+  {
+    return "";
+  }
+  const std::size_t valueStart = header.find_first_not_of( ' ', start + key.size() );
+  if ( valueStart == std::string::npos )
+  {
+    return "";
+  }
+  const std::size_t valueEnd = header.find( '\n', valueStart );
+  return header.substr( valueStart, valueEnd - valueStart );
+}
+
+/**
+ * Deflate data into consecutive block gzip members of at most
+ * BlockGzipMaximumBlockSize uncompressed bytes each, one buffer per member.
+ * The end of stream member is not included.
+ */
+bool
+DeflateBlocks( const char * data, const std::size_t length, const int level,
+               std::vector< std::vector< char > > & blocks )
+{
+  const std::size_t numberOfBlocks = ( length + BlockGzipMaximumBlockSize - 1 ) / BlockGzipMaximumBlockSize;
+  std::atomic< bool > failed( false );
+  blocks.resize( numberOfBlocks );
+
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  threader->ParallelizeArray(
+    0,
+    numberOfBlocks,
+    [&]( const itk::SizeValueType b ) {
+      const std::size_t blockStart = b * BlockGzipMaximumBlockSize;
+      const std::size_t blockLength = std::min( BlockGzipMaximumBlockSize, length - blockStart );
+      const Bytef *     input = reinterpret_cast< const Bytef * >( data + blockStart );
+
+      z_stream stream;
+      std::memset( &stream, 0, sizeof( stream ) );
+      // Negative window bits: raw deflate data, the gzip wrapper is written here.
+      if ( deflateInit2( &stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+      {
+        failed = true;
+        return;
+      }
+      std::vector< char > & block = blocks[b];
+      block.resize( GzipHeaderSize + deflateBound( &stream, blockLength ) + GzipTrailerSize );
+      stream.next_in = const_cast< Bytef * >( input );
+      stream.avail_in = static_cast< uInt >( blockLength );
+      stream.next_out = reinterpret_cast< Bytef * >( block.data() + GzipHeaderSize );
+      stream.avail_out = static_cast< uInt >( block.size() - GzipHeaderSize - GzipTrailerSize );
+      const int status = deflate( &stream, Z_FINISH );
+      const std::size_t deflatedSize = stream.total_out;
+      deflateEnd( &stream );
+      const std::size_t memberSize = GzipHeaderSize + deflatedSize + GzipTrailerSize;
+      if ( status != Z_STREAM_END || memberSize > 0x10000 )
+      {
+        failed = true;
+        return;
+      }
+
+      unsigned char * member = reinterpret_cast< unsigned char * >( block.data() );
+      std::memcpy( member, EndOfStreamMember, 16 ); // The header is the same up to BSIZE.
+      WriteLittleEndian16( member + 16, static_cast< unsigned int >( memberSize - 1 ) );
+      unsigned char * trailer = member + GzipHeaderSize + deflatedSize;
+      WriteLittleEndian32( trailer, crc32( crc32( 0L, Z_NULL, 0 ), input, static_cast< uInt >( blockLength ) ) );
+      WriteLittleEndian32( trailer + 4, static_cast< unsigned long >( blockLength ) );
+      block.resize( memberSize );
+    },
+    nullptr );
+  return !failed;
+}
+
+/**
+ * Lay out at most maximumMembers members of a block gzip stream, starting at
+ * offset, and return the offset after the last of them.  An incomplete
+ * member at the end of stream is left for the next call when partial is
+ * true, and is an error otherwise.  Returns std::string::npos when the
+ * stream is not in the block gzip layout.
+ */
+std::size_t
+LayoutMembers( const unsigned char * stream, std::size_t offset, const std::size_t length, const bool partial,
+               const std::size_t maximumMembers, std::vector< MemberLayout > & members,
+               std::size_t & decompressedSize )
+{
+  members.clear();
+  decompressedSize = 0;
+  while ( offset < length && members.size() < maximumMembers )
+  {
+    MemberLayout member = MemberLayout();
+    member.m_Offset = offset;
+    member.m_MemberSize = ParseMemberHeader( stream + offset, length - offset, member.m_HeaderSize );
+    if ( partial && length - offset < 0x10000 && ( member.m_MemberSize == 0 || offset + member.m_MemberSize > length ) )
+    {
+      break; // The rest of the member has not been read yet.
+    }
+    if ( member.m_MemberSize < member.m_HeaderSize + GzipTrailerSize || offset + member.m_MemberSize > length )
+    {
+      return std::string::npos;
+    }
+    member.m_DecompressedOffset = decompressedSize;
+    member.m_DecompressedSize = ReadLittleEndian32( stream + offset + member.m_MemberSize - 4 );
+    if ( member.m_DecompressedSize > BlockGzipMaximumBlockSize )
+    {
+      return std::string::npos;
+    }
+    decompressedSize += member.m_DecompressedSize;
+    members.push_back( member );
+    offset += member.m_MemberSize;
+  }
+  return offset;
+}
+
+/** Inflate the members laid out by LayoutMembers in parallel into decompressed. */
+bool
+InflateMembers( const unsigned char * stream, const std::vector< MemberLayout > & members, char * decompressed )
+{
+  std::atomic< bool >             failed( false );
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  threader->ParallelizeArray(
+    0,
+    members.size(),
+    [&]( const itk::SizeValueType m ) {
+      const MemberLayout & member = members[m];
+      if ( member.m_DecompressedSize == 0 )
+      {
+        return;
+      }
+      Bytef * output = reinterpret_cast< Bytef * >( decompressed + member.m_DecompressedOffset );
+
+      z_stream zstream;
+      std::memset( &zstream, 0, sizeof( zstream ) );
+      if ( inflateInit2( &zstream, -MAX_WBITS ) != Z_OK )
+      {
+        failed = true;
+        return;
+      }
+      zstream.next_in = const_cast< Bytef * >( stream + member.m_Offset + member.m_HeaderSize );
+      zstream.avail_in = static_cast< uInt >( member.m_MemberSize - member.m_HeaderSize - GzipTrailerSize );
+      zstream.next_out = output;
+      zstream.avail_out = static_cast< uInt >( member.m_DecompressedSize );
+      const int status = inflate( &zstream, Z_FINISH );
+      const std::size_t inflatedSize = zstream.total_out;
+      inflateEnd( &zstream );
+
+      const unsigned long expectedCRC = ReadLittleEndian32( stream + member.m_Offset + member.m_MemberSize - 8 );
+      if ( status != Z_STREAM_END || inflatedSize != member.m_DecompressedSize ||
+           crc32( crc32( 0L, Z_NULL, 0 ), output, static_cast< uInt >( inflatedSize ) ) != expectedCRC )
+      {
+        failed = true;
+      }
+    },
+    nullptr );
+  return !failed;
+}
+
+/**
+ * Inflate the block gzip stream that starts at dataStart in fileName into
+ * outputFileName, after header.  The stream is read and inflated one batch
+ * of members at a time, so neither file is held in memory as a whole.
+ */
+bool
+InflateFile( const std::string & fileName, const std::size_t dataStart, const std::string & header,
+             const std::string & outputFileName )
+{
+  std::ifstream in( fileName.c_str(), std::ios::in | std::ios::binary );
+  if ( !in.is_open() || !in.seekg( static_cast< std::streamoff >( dataStart ) ) )
+  {
+    return false;
+  }
+  std::vector< char >         batch( StreamingBatchBlocks * 0x10000 );
+  std::vector< char >         decompressed( StreamingBatchBlocks * BlockGzipMaximumBlockSize );
+  std::vector< MemberLayout > members;
+  std::ofstream               out( outputFileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+  if ( !out.is_open() )
+  {
+    return false;
+  }
+  out.write( header.data(), static_cast< std::streamsize >( header.size() ) );
+
+  std::size_t batchLength = 0;
+  bool        endOfFile = false;
+  while ( !endOfFile )
+  {
+    in.read( batch.data() + batchLength, static_cast< std::streamsize >( batch.size() - batchLength ) );
+    batchLength += static_cast< std::size_t >( in.gcount() );
+    endOfFile = in.eof();
+    if ( in.bad() )
+    {
+      return false;
+    }
+
+    const unsigned char * stream = reinterpret_cast< const unsigned char * >( batch.data() );
+    std::size_t           offset = 0;
+    while ( offset < batchLength )
+    {
+      std::size_t       decompressedSize = 0;
+      const std::size_t end =
+        LayoutMembers( stream, offset, batchLength, !endOfFile, StreamingBatchBlocks, members, decompressedSize );
+      if ( end == std::string::npos || !InflateMembers( stream, members, decompressed.data() ) )
+      {
+        return false;
+      }
+      out.write( decompressed.data(), static_cast< std::streamsize >( decompressedSize ) );
+      if ( members.empty() )
+      {
+        break;
+      }
+      offset = end;
+    }
+    // Keep the incomplete member at the end of the batch for the next read.
+    std::copy( batch.begin() + offset, batch.begin() + batchLength, batch.begin() );
+    batchLength -= offset;
+  }
+  out.close();
+  return !out.fail();
+}
+} // namespace
+
+bool
+BlockGzipCompress( const char * data, const std::size_t length, const int level, std::vector< char > & compressed )
+{
+  std::vector< std::vector< char > > blocks;
+  if ( !DeflateBlocks( data, length, level, blocks ) )
+  {
+    return false;
+  }
+
+  std::size_t totalSize = sizeof( EndOfStreamMember );
+  for ( const auto & block : blocks )
+  {
+    totalSize += block.size();
+  }
+  compressed.clear();
+  compressed.reserve( totalSize );
+  for ( const auto & block : blocks )
+  {
+    compressed.insert( compressed.end(), block.begin(), block.end() );
+  }
+  compressed.insert( compressed.end(), EndOfStreamMember, EndOfStreamMember + sizeof( EndOfStreamMember ) );
+  return true;
+}
+
+bool
+IsBlockGzipStream( const char * data, const std::size_t length )
+{
+  std::size_t headerSize = 0;
+  return ParseMemberHeader( reinterpret_cast< const unsigned char * >( data ), length, headerSize ) > 0;
+}
+
+bool
+BlockGzipDecompress( const char * compressed, const std::size_t length, std::vector< char > & decompressed )
+{
+  const unsigned char *       stream = reinterpret_cast< const unsigned char * >( compressed );
+  std::vector< MemberLayout > members;
+  std::size_t                 decompressedSize = 0;
+  if ( LayoutMembers( stream, 0, length, false, std::string::npos, members, decompressedSize ) == std::string::npos )
+  {
+    return false;
+  }
+  decompressed.resize( decompressedSize );
+  return InflateMembers( stream, members, decompressed.data() );
+}
+int
+GetDefaultCompressionLevel()
+{
+  int level = g_DefaultCompressionLevel;
+  if ( level < 0 )
+  {
+    level = 6;
+    std::string environmentLevel;
+    if ( itksys::SystemTools::GetEnv( "BRAINS_COMPRESSION_LEVEL", environmentLevel ) )
+    {
+      level = std::max( 0, std::min( 9, std::atoi( environmentLevel.c_str() ) ) );
+    }
+    g_DefaultCompressionLevel = level;
+  }
+  return level;
+}
+
+void
+SetDefaultCompressionLevel( const int level )
+{
+  g_DefaultCompressionLevel = std::max( 0, std::min( 9, level ) );
+}
+
+bool
+IsBlockGzipImageFileName( const std::string & fileName )
+{
+  return HasSuffix( fileName, ".nii.gz" ) || IsNrrdFileName( fileName );
+}
+
+std::string
+GetUncompressedStagingFileName( const std::string & fileName )
+{
+  static std::atomic< unsigned long > counter( 0 );
+
+  std::string directory;
+  if ( !itksys::SystemTools::GetEnv( "TMPDIR", directory ) && !itksys::SystemTools::GetEnv( "TEMP", directory ) &&
+       !itksys::SystemTools::GetEnv( "TMP", directory ) )
+  {
+#if defined( _WIN32 )
+    directory = ".";
+#else
+    directory = "/tmp";
+#endif
+  }
+  std::ostringstream stagingFileName;
+  stagingFileName << directory << "/BRAINSBlockGzip_" << BRAINS_GETPID() << "_" << counter++ << "_"
+                  << itksys::SystemTools::GetFilenameWithoutExtension( fileName )
+                  << ( IsNrrdFileName( fileName ) ? ".nrrd" : ".nii" );
+  return stagingFileName.str();
+}
+
+bool
+WriteBlockGzipImageFile( const std::string & stagingFileName, const std::string & fileName, const int level )
+{
+  std::ifstream in( stagingFileName.c_str(), std::ios::in | std::ios::binary );
+  if ( !in.is_open() )
+  {
+    return false;
+  }
+  // The staging file is read and deflated one batch of blocks at a time.
+  std::vector< char > batch( StreamingBatchBlocks * BlockGzipMaximumBlockSize );
+  in.read( batch.data(), static_cast< std::streamsize >( batch.size() ) );
+  std::size_t batchLength = static_cast< std::size_t >( in.gcount() );
+
+  std::string headerText;
+  std::size_t headerSize = 0;
+  if ( IsNrrdFileName( fileName ) )
+  {
+    headerSize = NrrdHeaderSize( batch.data(), batchLength );
+    headerText.assign( batch.data(), headerSize );
+    // Only a raw attached data section can be compressed in place.
+    if ( headerSize == 0 || GetNrrdField( headerText, "encoding" ) != "raw" ||
+         !GetNrrdField( headerText, "data file" ).empty() || !SetNrrdEncoding( headerText, "gzip" ) )
+    {
+      return false;
+    }
+  }
+
+  std::ofstream out( fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+  if ( !out.is_open() )
+  {
+    return false;
+  }
+  out.write( headerText.data(), static_cast< std::streamsize >( headerText.size() ) );
+  std::vector< std::vector< char > > blocks;
+  bool                               deflated = true;
+  for ( std::size_t dataStart = headerSize; deflated && batchLength > 0; dataStart = 0 )
+  {
+    deflated = DeflateBlocks( batch.data() + dataStart, batchLength - dataStart, level, blocks );
+    for ( std::size_t b = 0; deflated && b < blocks.size(); ++b )
+    {
+      out.write( blocks[b].data(), static_cast< std::streamsize >( blocks[b].size() ) );
+    }
+    in.read( batch.data(), static_cast< std::streamsize >( batch.size() ) );
+    batchLength = static_cast< std::size_t >( in.gcount() );
+  }
+  out.write( reinterpret_cast< const char * >( EndOfStreamMember ), sizeof( EndOfStreamMember ) );
+  out.close();
+  if ( !deflated || in.bad() || out.fail() )
+  {
+    itksys::SystemTools::RemoveFile( fileName );
+    return false;
+  }
+  return true;
+}
+
+bool
+ReadBlockGzipImageFile( const std::string & fileName, const std::string & stagingFileName )
+{
+  if ( !IsBlockGzipImageFileName( fileName ) )
+  {
+    return false;
+  }
+
+  // Decide from the first bytes, so that other files are not read twice.
+  std::vector< char > contents;
+  if ( !ReadFile( fileName, contents, 1 << 16 ) )
+  {
+    return false;
+  }
+  std::string headerText;
+  std::size_t headerSize = 0;
+  if ( IsNrrdFileName( fileName ) )
+  {
+    headerSize = NrrdHeaderSize( contents.data(), contents.size() );
+    headerText.assign( contents.data(), headerSize );
+    const std::string encoding = GetNrrdField( headerText, "encoding" );
+    if ( headerSize == 0 || ( encoding != "gzip" && encoding != "gz" ) ||
+         !GetNrrdField( headerText, "data file" ).empty() || !SetNrrdEncoding( headerText, "raw" ) )
+    {
+      return false;
+    }
+  }
+  if ( !IsBlockGzipStream( contents.data() + headerSize, contents.size() - headerSize ) )
+  {
+    return false;
+  }
+
+  if ( !InflateFile( fileName, headerSize, headerText, stagingFileName ) )
+  {
+    // Do not leave a partial staging file behind.
+    itksys::SystemTools::RemoveFile( stagingFileName );
+    return false;
+  }
+  return true;
+}
+} // namespace BRAINSUtils
@@ -0,0 +1,103 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef BRAINSBlockGzip_h
+#define BRAINSBlockGzip_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace BRAINSUtils
+{
+/**
+ * \author Hans J. Johnson
+ * \brief Parallel gzip compression of image files.
+ *
+ * The data is cut into independent blocks of at most BlockGzipMaximumBlockSize
+ * bytes, every block is deflated on its own thread, and the blocks are written
+ * as consecutive gzip members in the BGZF layout (the compressed size of each
+ * member is stored in a "BC" extra field, and an empty member ends the stream).
+ * A sequence of gzip members is itself a standard gzip stream (RFC 1952), so
+ * gzip, zlib's gzread, NIfTI's znzlib and teem's NRRD reader read these files
+ * unchanged; only readers that know the layout can inflate them in parallel.
+ *
+ * itkUtil::WriteImage and itkUtil::ReadImage use these functions for
+ * ".nii.gz" and ".nrrd" files.
+ */
+
+/** The largest number of uncompressed bytes in one block (the BGZF limit). */
+constexpr std::size_t BlockGzipMaximumBlockSize = 0xff00;
+
+/** Deflate data into a block gzip stream with the given zlib level (0-9). */
+bool
+BlockGzipCompress( const char * data, std::size_t length, int level, std::vector< char > & compressed );
+
+/**
+ * Inflate a block gzip stream.  Returns false when the stream is not in the
+ * block gzip layout or is corrupt, in which case decompressed is undefined.
+ */
+bool
+BlockGzipDecompress( const char * compressed, std::size_t length, std::vector< char > & decompressed );
+
+/** True when data starts with a gzip member in the block gzip layout. */
+bool
+IsBlockGzipStream( const char * data, std::size_t length );
+
+/**
+ * The zlib level used by itkUtil::WriteImage.  It defaults to the value of
+ * the BRAINS_COMPRESSION_LEVEL environment variable, or 6 (zlib's default).
+ */
+int
+GetDefaultCompressionLevel();
+void
+SetDefaultCompressionLevel( int level );
+
+/** True for file names whose compression itkUtil::WriteImage/ReadImage parallelize. */
+bool
+IsBlockGzipImageFileName( const std::string & fileName );
+
+/**
+ * A unique name in the temporary directory (TMPDIR, TEMP or TMP) for an
+ * uncompressed file of the same format as fileName (".nii" for ".nii.gz"),
+ * used to stage the uncompressed image data.
+ */
+std::string
+GetUncompressedStagingFileName( const std::string & fileName );
+
+/**
+ * Compress the uncompressed image file written at stagingFileName into
+ * fileName.  A NIfTI file is compressed as a whole; the data of an attached
+ * header NRRD file is compressed and its encoding changed to gzip.  The
+ * staging file is streamed a batch of blocks at a time.  Returns false, and
+ * removes any partial fileName, when the file can not be compressed.
+ */
+bool
+WriteBlockGzipImageFile( const std::string & stagingFileName, const std::string & fileName, int level );
+
+/**
+ * When fileName is a block gzip compressed image file, write its
+ * uncompressed equivalent to stagingFileName and return true.  Returns
+ * false for any other file, which must then be read as usual; no partial
+ * stagingFileName is left behind.
+ */
+bool
+ReadBlockGzipImageFile( const std::string & fileName, const std::string & stagingFileName );
+} // namespace BRAINSUtils
+
+#endif // BRAINSBlockGzip_h
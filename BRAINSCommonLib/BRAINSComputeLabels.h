@@ -19,6 +19,7 @@
 #ifndef BRAINSComputeLabels_h
 #define BRAINSComputeLabels_h
 
+#include <functional>
 #include <iostream>
 #include <vector>
 #include <itkImage.h>
@@ -33,15 +34,17 @@ using ByteImageType = itk::Image< unsigned char, 3 >;
 extern LabelCountMapType
 GetMinLabelCount( ByteImageType::Pointer & labelsImage, const vnl_vector< unsigned int > & PriorLabelCodeVector );
 // Labeling using maximum a posteriori, also do brain stripping using
-// mathematical morphology and connected component
-template < typename TProbabilityImage, typename TByteImage, typename TFloatingPrecision >
+// mathematical morphology and connected component.  Only the runs of voxels
+// that visitSpans( labelSpan ) passes to labelSpan( offset, length ) as buffer
+// offsets are labeled, all others are set to zero.
+template < typename TProbabilityImage, typename TByteImage, typename TFloatingPrecision, typename TSpanVisitor >
 void
-ComputeLabels( std::vector< typename TProbabilityImage::Pointer > & Posteriors,
-               std::vector< bool > &                                PriorIsForegroundPriorVector,
-               const vnl_vector< unsigned int > & PriorLabelCodeVector, typename TByteImage::Pointer & NonAirRegion,
-               typename TByteImage::Pointer & DirtyLabels, typename TByteImage::Pointer & CleanedLabels,
-               TFloatingPrecision InclusionThreshold, // No thresholding = 0.0F
-               const size_t       minLabelSizeAllowed )     // Allow zero sized labels = 0
+ComputeLabelsForSpans( std::vector< typename TProbabilityImage::Pointer > & Posteriors,
+                       std::vector< bool > &                                PriorIsForegroundPriorVector,
+                       const vnl_vector< unsigned int > & PriorLabelCodeVector, const TSpanVisitor & visitSpans,
+                       typename TByteImage::Pointer & DirtyLabels, typename TByteImage::Pointer & CleanedLabels,
+                       TFloatingPrecision InclusionThreshold, // No thresholding = 0.0F
+                       const size_t       minLabelSizeAllowed )     // Allow zero sized labels = 0
 {
   std::cout << "\nComputing labels..." << std::endl;
 
@@ -74,62 +77,52 @@ ComputeLabels( std::vector< typename TProbabilityImage::Pointer > & Posteriors,
       std::cout << "        Check input images to ensure proper intializaiton was completed." << std::endl;
       exit( -1 );
     }
+    // INFO:  May want to specify this explicitly in the XML file for
+    // the proper background value
     DirtyLabels->FillBuffer( 0 );
     foregroundMask->FillBuffer( 0 );
-    using LocalLOOPITERTYPE = unsigned int;
-    const typename TByteImage::SizeType size = DirtyLabels->GetLargestPossibleRegion().GetSize();
+
+    // The posteriors are replaced below when a label is too small.
+    std::vector< const typename TProbabilityImage::PixelType * > posteriorBuffers( numClasses );
+    for ( unsigned int iclass = 0; iclass < numClasses; iclass++ )
     {
-      for ( LocalLOOPITERTYPE kk = 0; kk < (LocalLOOPITERTYPE)size[2]; kk++ )
+      posteriorBuffers[iclass] = Posteriors[iclass]->GetBufferPointer();
+    }
+    typename TByteImage::PixelType * const dirtyBuffer = DirtyLabels->GetBufferPointer();
+    typename TByteImage::PixelType * const foregroundBuffer = foregroundMask->GetBufferPointer();
+    visitSpans( [&]( const itk::OffsetValueType spanOffset, const itk::SizeValueType spanLength ) {
+      const itk::OffsetValueType spanEnd = spanOffset + static_cast< itk::OffsetValueType >( spanLength );
+      for ( itk::OffsetValueType offset = spanOffset; offset < spanEnd; ++offset )
       {
-        for ( LocalLOOPITERTYPE jj = 0; jj < (LocalLOOPITERTYPE)size[1]; jj++ )
+        TFloatingPrecision maxPosteriorClassValue = posteriorBuffers[0][offset];
+        unsigned int       indexMaxPosteriorClassValue = 0;
+        for ( unsigned int iclass = 1; iclass < numClasses; iclass++ )
         {
-          for ( LocalLOOPITERTYPE ii = 0; ii < (LocalLOOPITERTYPE)size[0]; ii++ )
+          const TFloatingPrecision currentPosteriorClassValue = posteriorBuffers[iclass][offset];
+          if ( currentPosteriorClassValue > maxPosteriorClassValue )
           {
-            const typename TProbabilityImage::IndexType currIndex = { { ii, jj, kk } };
-            if ( NonAirRegion->GetPixel( currIndex ) == 0 ) // If outside the tissue
-            // region, then set to
-            // zero vIndex!
-            {
-              // INFO:  May want to specify this explicitly in the XML file for
-              // the proper background value
-              DirtyLabels->SetPixel( currIndex, 0 ); // This is implied by the
-              // FillBuffer(0) above;
-              continue;
-            }
-
-            TFloatingPrecision maxPosteriorClassValue = Posteriors[0]->GetPixel( currIndex );
-            unsigned int       indexMaxPosteriorClassValue = 0;
-            for ( unsigned int iclass = 1; iclass < numClasses; iclass++ )
-            {
-              const TFloatingPrecision currentPosteriorClassValue = Posteriors[iclass]->GetPixel( currIndex );
-              if ( currentPosteriorClassValue > maxPosteriorClassValue )
-              {
-                maxPosteriorClassValue = currentPosteriorClassValue;
-                indexMaxPosteriorClassValue = iclass;
-              }
-            }
+            maxPosteriorClassValue = currentPosteriorClassValue;
+            indexMaxPosteriorClassValue = iclass;
+          }
+        }
 
-            {
-              bool         fgflag = PriorIsForegroundPriorVector[indexMaxPosteriorClassValue];
-              unsigned int label = 99;
-              if ( maxPosteriorClassValue > InclusionThreshold )
-              {
-                label = PriorLabelCodeVector[indexMaxPosteriorClassValue];
-              }
+        bool         fgflag = PriorIsForegroundPriorVector[indexMaxPosteriorClassValue];
+        unsigned int label = 99;
+        if ( maxPosteriorClassValue > InclusionThreshold )
+        {
+          label = PriorLabelCodeVector[indexMaxPosteriorClassValue];
+        }
 
-              // Only use non-zero probabilities and foreground classes
-              if ( !fgflag || ( maxPosteriorClassValue < 0.001 ) )
-              {
-                fgflag = false; // If priors are zero or negative, then set the
-                // fgflag back to false
-              }
-              DirtyLabels->SetPixel( currIndex, label );
-              foregroundMask->SetPixel( currIndex, fgflag );
-            }
-          }
+        // Only use non-zero probabilities and foreground classes
+        if ( !fgflag || ( maxPosteriorClassValue < 0.001 ) )
+        {
+          fgflag = false; // If priors are zero or negative, then set the
+          // fgflag back to false
         }
+        dirtyBuffer[offset] = label;
+        foregroundBuffer[offset] = fgflag;
       }
-    }
+    } );
     //
     LabelCountMapType currentLabelsMapCounts = GetMinLabelCount( DirtyLabels, PriorLabelCodeVector );
     currentMinLabelSize = currentLabelsMapCounts.begin()->second;
@@ -158,4 +151,81 @@ ComputeLabels( std::vector< typename TProbabilityImage::Pointer > & Posteriors,
   CleanedLabels = ExtractSingleLargestRegionFromMask( foregroundMask, 0, 0, 0, DirtyLabels );
 }
 
+// Labeling using maximum a posteriori inside the non-zero voxels of
+// NonAirRegion, which must share the lattice of the posteriors.
+template < typename TProbabilityImage, typename TByteImage, typename TFloatingPrecision >
+void
+ComputeLabels( std::vector< typename TProbabilityImage::Pointer > & Posteriors,
+               std::vector< bool > &                                PriorIsForegroundPriorVector,
+               const vnl_vector< unsigned int > & PriorLabelCodeVector, typename TByteImage::Pointer & NonAirRegion,
+               typename TByteImage::Pointer & DirtyLabels, typename TByteImage::Pointer & CleanedLabels,
+               TFloatingPrecision InclusionThreshold, // No thresholding = 0.0F
+               const size_t       minLabelSizeAllowed )     // Allow zero sized labels = 0
+{
+  if ( NonAirRegion->GetBufferedRegion() != Posteriors[0]->GetBufferedRegion() )
+  {
+    itkGenericExceptionMacro( << "The non-air region is not on the posterior lattice." );
+  }
+  const typename TByteImage::PixelType * const nonAirBuffer = NonAirRegion->GetBufferPointer();
+  const itk::SizeValueType numberOfVoxels = NonAirRegion->GetBufferedRegion().GetNumberOfPixels();
+  ComputeLabelsForSpans< TProbabilityImage, TByteImage, TFloatingPrecision >(
+    Posteriors,
+    PriorIsForegroundPriorVector,
+    PriorLabelCodeVector,
+    [nonAirBuffer, numberOfVoxels](
+      const std::function< void( itk::OffsetValueType, itk::SizeValueType ) > & labelSpan ) {
+      // Outside the tissue region stays zero
+      itk::SizeValueType offset = 0;
+      while ( offset < numberOfVoxels )
+      {
+        if ( nonAirBuffer[offset] == 0 )
+        {
+          ++offset;
+          continue;
+        }
+        const itk::SizeValueType spanStart = offset;
+        while ( offset < numberOfVoxels && nonAirBuffer[offset] != 0 )
+        {
+          ++offset;
+        }
+        labelSpan( spanStart, offset - spanStart );
+      }
+    },
+    DirtyLabels,
+    CleanedLabels,
+    InclusionThreshold,
+    minLabelSizeAllowed );
+}
+
+// Labeling using maximum a posteriori inside a voxel domain on the lattice of
+// the posteriors.  The domain supplies ParallelForEachSpan( functor ) over
+// spans with a buffer offset and a length, such as BRAINSABC VoxelSpanDomain.
+template < typename TProbabilityImage, typename TByteImage, typename TFloatingPrecision, typename TVoxelDomain >
+void
+ComputeLabelsInDomain( std::vector< typename TProbabilityImage::Pointer > & Posteriors,
+                       std::vector< bool > &                                PriorIsForegroundPriorVector,
+                       const vnl_vector< unsigned int > & PriorLabelCodeVector, const TVoxelDomain & domain,
+                       typename TByteImage::Pointer & DirtyLabels, typename TByteImage::Pointer & CleanedLabels,
+                       TFloatingPrecision InclusionThreshold, // No thresholding = 0.0F
+                       const size_t       minLabelSizeAllowed )     // Allow zero sized labels = 0
+{
+  if ( domain.GetRegion() != Posteriors[0]->GetBufferedRegion() )
+  {
+    itkGenericExceptionMacro( << "The voxel domain is not on the posterior lattice." );
+  }
+  ComputeLabelsForSpans< TProbabilityImage, TByteImage, TFloatingPrecision >(
+    Posteriors,
+    PriorIsForegroundPriorVector,
+    PriorLabelCodeVector,
+    [&domain]( const std::function< void( itk::OffsetValueType, itk::SizeValueType ) > & labelSpan ) {
+      // Every voxel is labeled on its own, so the spans can run in parallel.
+      domain.ParallelForEachSpan(
+        [&labelSpan]( const typename TVoxelDomain::Span & span ) { labelSpan( span.offset, span.length ); } );
+    },
+    DirtyLabels,
+    CleanedLabels,
+    InclusionThreshold,
+    minLabelSizeAllowed );
+}
+
 #endif // BRAINSComputeLabels_h
@@ -28,6 +28,7 @@
 #include "itkKappaStatisticImageToImageMetric.h"
 #include "itkMeanReciprocalSquareDifferenceImageToImageMetric.h"
 #include "itkJointHistogramMutualInformationImageToImageMetricv4.h"
+#include "itkMattesMutualInformationFixedBinImageToImageMetricv4.h"
 #include "itkGradientDifferenceImageToImageMetric.h"
 #include "itkCompareHistogramImageToImageMetric.h"
 #include "itkCorrelationCoefficientHistogramImageToImageMetric.h"
@@ -36,7 +37,10 @@
 #include "itkBinaryThresholdImageFilter.h"
 #include "itkNormalizedMutualInformationHistogramImageToImageMetric.h"
 
+#include <vnl/vnl_sample.h>
+
 #include <algorithm>
+#include <mutex>
 
 // A little dummy function to make it easy to stop the debugger.
 void
@@ -126,6 +130,7 @@ BRAINSFitHelper::BRAINSFitHelper()
   , m_CostFunctionConvergenceFactor( 1e+9 )
   , m_ProjectedGradientTolerance( 1e-5 )
   , m_MaxBSplineDisplacement( 0.0 )
+  , m_NumberOfBSplineGridLevels( 1 )
   , m_ActualNumberOfIterations( 0 )
   , m_PermittedNumberOfIterations( 0 )
   ,
@@ -151,8 +156,13 @@ BRAINSFitHelper::BRAINSFitHelper()
   , m_MaximumNumberOfCorrections( 12 )
   , m_SyNFull( true )
   , m_WriteOutputTransformInFloat( false )
+  , m_NumberOfThreads( -1 )
 {
-  vnl_sample_reseed( 20181112 ); // Trying to get random number generation consistent
+  // Trying to get random number generation consistent.  vnl_sample has one
+  // process-wide generator, so seed it only for the first helper; helpers
+  // constructed concurrently must not reseed it under each other.
+  static std::once_flag reseedOnce;
+  std::call_once( reseedOnce, [] { vnl_sample_reseed( 20181112 ); } );
   m_SplineGridSize[0] = 14;
   m_SplineGridSize[1] = 10;
   m_SplineGridSize[2] = 12;
@@ -421,6 +431,19 @@ BRAINSFitHelper::Update( void )
     this->SetupRegistration< MIMetricType >( metric );
     this->RunRegistration< MIMetricType >();
   }
+  else if ( this->m_CostMetricName == "MMIFB" )
+  {
+    // Mattes MI with the fixed-image Parzen bins cached per sample.
+    using FixedBinMIMetricType = itk::
+      MattesMutualInformationFixedBinImageToImageMetricv4< FixedImageType, MovingImageType, FixedImageType, RealType >;
+    FixedBinMIMetricType::Pointer mutualInformationMetric = FixedBinMIMetricType::New();
+    mutualInformationMetric->SetNumberOfHistogramBins( this->m_NumberOfHistogramBins );
+    mutualInformationMetric->SetUseSampledPointSet( false );
+    metric = mutualInformationMetric;
+
+    this->SetupRegistration< FixedBinMIMetricType >( metric );
+    this->RunRegistration< FixedBinMIMetricType >();
+  }
   else if ( this->m_CostMetricName == "MSE" )
   {
     using MSEMetricType =
@@ -564,6 +587,7 @@ BRAINSFitHelper::PrintSelf( std::ostream & os, Indent indent ) const
     os << this->m_SplineGridSize[q] << " ";
   }
   os << "]" << std::endl;
+  os << indent << "NumberOfBSplineGridLevels:      " << this->m_NumberOfBSplineGridLevels << std::endl;
 
   if ( m_CurrentGenericTransform.IsNotNull() )
   {
@@ -746,6 +770,7 @@ BRAINSFitHelper::PrintCommandLine( const bool dumpTempVolumes, const std::string
   oss << "--reproportionScale " << this->m_ReproportionScale << "  \\" << std::endl;
   oss << "--skewScale " << this->m_SkewScale << "  \\" << std::endl;
   oss << "--maxBSplineDisplacement " << this->m_MaxBSplineDisplacement << " \\" << std::endl;
+  oss << "--numberOfBSplineGridLevels " << this->m_NumberOfBSplineGridLevels << " \\" << std::endl;
   oss << "--projectedGradientTolerance " << this->m_ProjectedGradientTolerance << " \\" << std::endl;
   oss << "--MaximumNumberOfEvaluations " << this->m_MaximumNumberOfEvaluations << " \\" << std::endl;
   oss << "--MaximumNumberOfCorrections " << this->m_MaximumNumberOfCorrections << " \\" << std::endl;
@@ -173,6 +173,8 @@ public:
   itkGetConstMacro( ProjectedGradientTolerance, double );
   itkSetMacro( MaxBSplineDisplacement, double );
   itkGetConstMacro( MaxBSplineDisplacement, double );
+  itkSetClampMacro( NumberOfBSplineGridLevels, unsigned int, 1, 8 );
+  itkGetConstMacro( NumberOfBSplineGridLevels, unsigned int );
   itkSetMacro( BackgroundFillValue, double );
   itkGetConstMacro( BackgroundFillValue, double );
   VECTORitkSetMacro( TransformType, std::vector< std::string > );
@@ -184,6 +186,11 @@ public:
   itkGetConstMacro( MaximumNumberOfEvaluations, int );
   itkSetMacro( MaximumNumberOfCorrections, int );
   itkGetConstMacro( MaximumNumberOfCorrections, int );
+  /** Set/Get the number of work units of this registration's metric,
+   * registration methods and optimizers, without changing the ITK global
+   * default.  Values <= 0 (the default) use the global default. */
+  itkSetMacro( NumberOfThreads, int );
+  itkGetConstMacro( NumberOfThreads, int );
   itkSetMacro( CurrentGenericTransform, CompositeTransformType::Pointer );
   itkGetConstMacro( CurrentGenericTransform, CompositeTransformType::Pointer );
   itkSetMacro( RestoreState, CompositeTransformType::Pointer );
@@ -306,6 +313,7 @@ private:
   double                          m_CostFunctionConvergenceFactor;
   double                          m_ProjectedGradientTolerance;
   double                          m_MaxBSplineDisplacement;
+  unsigned int                    m_NumberOfBSplineGridLevels;
   unsigned int                    m_ActualNumberOfIterations;
   unsigned int                    m_PermittedNumberOfIterations;
   unsigned int                    m_DebugLevel;
@@ -326,6 +334,7 @@ private:
   int                             m_MaximumNumberOfCorrections;
   bool                            m_SyNFull;
   bool                            m_WriteOutputTransformInFloat;
+  int                             m_NumberOfThreads;
 }; // end BRAINSFitHelper class
 
 template < typename TLocalCostMetric >
@@ -341,6 +350,10 @@ BRAINSFitHelper::SetupRegistration( GenericMetricType * costMetric )
   }
 
   localCostMetric->SetVirtualDomainFromImage( this->m_FixedVolume );
+  if ( this->m_NumberOfThreads > 0 )
+  {
+    localCostMetric->SetMaximumNumberOfWorkUnits( this->m_NumberOfThreads );
+  }
 
   localCostMetric->SetFixedImage( this->m_FixedVolume );
   localCostMetric->SetMovingImage( this->m_PreprocessedMovingVolume );
@@ -440,6 +453,7 @@ BRAINSFitHelper::SetupRegistration( GenericMetricType * costMetric )
   myHelper->SetOutputMovingVolumeROI( this->m_OutputMovingVolumeROI );
   myHelper->SetSamplingPercentage( this->m_SamplingPercentage );
   myHelper->SetSamplingStrategy( this->m_SamplingStrategy );
+  myHelper->SetNumberOfThreads( this->m_NumberOfThreads );
   myHelper->SetNumberOfHistogramBins( this->m_NumberOfHistogramBins );
   myHelper->SetNumberOfIterations( this->m_NumberOfIterations );
   myHelper->SetMaximumStepLength( this->m_MaximumStepLength );
@@ -457,6 +471,7 @@ BRAINSFitHelper::SetupRegistration( GenericMetricType * costMetric )
   myHelper->SetCostFunctionConvergenceFactor( this->m_CostFunctionConvergenceFactor );
   myHelper->SetProjectedGradientTolerance( this->m_ProjectedGradientTolerance );
   myHelper->SetMaxBSplineDisplacement( this->m_MaxBSplineDisplacement );
+  myHelper->SetNumberOfBSplineGridLevels( this->m_NumberOfBSplineGridLevels );
   myHelper->SetDisplayDeformedImage( this->m_DisplayDeformedImage );
   myHelper->SetPromptUserAfterDisplay( this->m_PromptUserAfterDisplay );
   myHelper->SetDebugLevel( this->m_DebugLevel );
@@ -125,6 +125,7 @@ public:
   using AffineTransformType = itk::AffineTransform< RealType, MovingImageDimension >;
   using ScalableAffineTransformType = itk::ScalableAffineTransform< RealType, MovingImageDimension >;
   using SamplingStrategyType = typename AffineRegistrationType::MetricSamplingStrategyType;
+  using SampleCacheType = RegistrationSampleCache< FixedImageType, MovingImageType >;
 
   using MatrixOffsetTransformBaseType = typename AffineTransformType::Superclass;
   using MatrixOffsetTransformBasePointer = typename MatrixOffsetTransformBaseType::Pointer;
@@ -194,6 +195,12 @@ public:
   itkGetConstMacro( ProjectedGradientTolerance, double );
   itkSetMacro( MaxBSplineDisplacement, double );
   itkGetConstMacro( MaxBSplineDisplacement, double );
+  /** Number of coarse-to-fine BSpline control grid levels.  Level k (counting
+   * down from the finest) uses images shrunk by 2^k; along each axis its grid
+   * halves the grid of the next finer level when that divides exactly and
+   * leaves at least 3 divisions, so every refinement is exact. */
+  itkSetClampMacro( NumberOfBSplineGridLevels, unsigned int, 1, 8 );
+  itkGetConstMacro( NumberOfBSplineGridLevels, unsigned int );
   itkSetMacro( BackgroundFillValue, double );
   itkGetConstMacro( BackgroundFillValue, double );
   itkSetMacro( InitializeTransformMode, std::string );
@@ -249,6 +256,12 @@ public:
   itkSetMacro( SamplingStrategy, SamplingStrategyType );
   itkGetConstMacro( SamplingStrategy, SamplingStrategyType );
 
+  /** Set/Get the number of work units of the linear and BSpline registration
+   * methods and optimizers.  Values <= 0 leave the ITK global default in
+   * place.  Image preprocessing and SyN still use the global default. */
+  itkSetMacro( NumberOfThreads, int );
+  itkGetConstMacro( NumberOfThreads, int );
+
   itkSetMacro( InitializeRegistrationByCurrentGenericTransform, bool );
 
   itkSetMacro( SyNMetricType, std::string );
@@ -313,6 +326,7 @@ private:
   double                       m_CostFunctionConvergenceFactor;
   double                       m_ProjectedGradientTolerance;
   double                       m_MaxBSplineDisplacement;
+  unsigned int                 m_NumberOfBSplineGridLevels;
   unsigned int                 m_ActualNumberOfIterations;
   unsigned int                 m_PermittedNumberOfIterations;
   unsigned int                 m_DebugLevel;
@@ -325,6 +339,7 @@ private:
   typename MetricType::Pointer m_CostMetricObject;
   bool                         m_UseROIBSpline;
   SamplingStrategyType         m_SamplingStrategy;
+  int                          m_NumberOfThreads;
   bool                         m_InitializeRegistrationByCurrentGenericTransform;
   int                          m_MaximumNumberOfEvaluations;
   int                          m_MaximumNumberOfCorrections;
@@ -333,6 +348,9 @@ private:
   bool                         m_SyNFull;
   // DEBUG OPTION:
   int m_ForceMINumberOfThreads;
+
+  // Metric samples shared by the linear stages, and pyramid levels, of one Update().
+  typename SampleCacheType::Pointer m_SampleCache;
 }; // end BRAINSFitHelperTemplate class
 } // end namespace itk
 
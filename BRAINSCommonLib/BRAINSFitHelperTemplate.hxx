@@ -24,6 +24,7 @@
 #endif
 
 #include "BRAINSFitUtils.h"
+#include "BRAINSProfiler.h"
 #include "itkEuler3DTransform.h"
 #include "itkCheckerBoardImageFilter.h"
 #include "itkOtsuHistogramMatchingImageFilter.h"
@@ -537,6 +538,7 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::BRAINSFitHelperTempl
   , m_CostFunctionConvergenceFactor( 1e+9 )
   , m_ProjectedGradientTolerance( 1e-5 )
   , m_MaxBSplineDisplacement( 0.0 )
+  , m_NumberOfBSplineGridLevels( 1 )
   , m_ActualNumberOfIterations( 0 )
   , m_PermittedNumberOfIterations( 0 )
   , m_DebugLevel( 0 )
@@ -549,6 +551,7 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::BRAINSFitHelperTempl
   , m_CostMetricObject( nullptr )
   , m_UseROIBSpline( 0 )
   , m_SamplingStrategy( AffineRegistrationType::NONE )
+  , m_NumberOfThreads( -1 )
   , m_InitializeRegistrationByCurrentGenericTransform( true )
   , m_MaximumNumberOfEvaluations( 900 )
   , m_MaximumNumberOfCorrections( 12 )
@@ -556,6 +559,7 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::BRAINSFitHelperTempl
   , m_SaveState( "" )
   , m_SyNFull( true )
   , m_ForceMINumberOfThreads( -1 )
+  , m_SampleCache( nullptr )
 {
   m_SplineGridSize[0] = 14;
   m_SplineGridSize[1] = 10;
@@ -583,7 +587,9 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::FitCommonCode(
   appMutualRegistration->SetNumberOfIterations( numberOfIterations );
   appMutualRegistration->SetSamplingStrategy( m_SamplingStrategy );
   appMutualRegistration->SetSamplingPercentage( m_SamplingPercentage );
+  appMutualRegistration->SetNumberOfThreads( m_NumberOfThreads );
   // HACK appMutualRegistration->MetricSamplingReinitializeSeed(121212);
+  appMutualRegistration->SetSampleCache( this->m_SampleCache );
 
   appMutualRegistration->SetRelaxationFactor( m_RelaxationFactor );
   appMutualRegistration->SetMaximumStepLength( m_MaximumStepLength );
@@ -614,11 +620,15 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::FitCommonCode(
    *  with all its inputs in place;
    */
   // initialize the interconnects between components
-  appMutualRegistration->Initialize();
+  {
+    BRAINS_PROFILE_SCOPE( "InitializeRegistration" );
+    appMutualRegistration->Initialize();
+  }
 
   typename CompositeTransformType::Pointer finalTransform;
   try
   {
+    BRAINS_PROFILE_SCOPE( "Optimize" );
     appMutualRegistration->Update();
     finalTransform = appMutualRegistration->GetTransform(); // finalTransform is a composite transform
 
@@ -667,6 +677,7 @@ template < typename FixedImageType, typename MovingImageType >
 void
 BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::Update( void )
 {
+  BRAINS_PROFILE_SCOPE( "BRAINSFitHelper" );
   using MaskImageType = itk::Image< unsigned char, 3 >;
   using ImageMaskSpatialObjectType = itk::ImageMaskSpatialObject< MaskImageType::ImageDimension >;
   using VersorRigid3DTransformType = itk::VersorRigid3DTransform< double >;
@@ -689,6 +700,10 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::Update( void )
     preprocessedMovingImagesList.push_back( m_MovingVolume2 );
   }
 
+  // One sample set per registration: every stage below reuses it until the
+  // fixed mask or the sampling parameters change.
+  this->m_SampleCache = SampleCacheType::New();
+
   if ( this->m_DebugLevel > 3 )
   {
     this->PrintSelf( std::cout, 3 );
@@ -785,6 +800,7 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::Update( void )
         currentTransformIndex++ )
   {
     const std::string currentTransformType( m_TransformType[currentTransformIndex] );
+    BRAINS_PROFILE_SCOPE( currentTransformType.c_str() );
     std::cout << "\n\n\n=============================== "
               << "ITKv4 Registration: Starting Transform Estimations for " << currentTransformType << "("
               << currentTransformIndex + 1 << " of " << m_TransformType.size() << ")."
@@ -1277,11 +1293,30 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::Update( void )
       // Initialize the BSpline transform
       // Using BSplineTransformInitializer
       //
-      BSplineTransformType::MeshSizeType meshSize;
-      for ( unsigned int i = 0; i < SpaceDimension; i++ )
+      // Coarse-to-fine control grid schedule; level 0 is the coarsest.  Along
+      // each axis a level halves the grid of the next finer one when that
+      // divides exactly and leaves at least the 3 divisions BRAINSFit
+      // requires, and keeps it otherwise, so every refinement is an exact
+      // dyadic knot insertion.  Level k (counting down from the finest) runs
+      // on images shrunk by 2^k, so most iterations see few voxels.
+      const unsigned int                                numberOfGridLevels = this->m_NumberOfBSplineGridLevels;
+      std::vector< BSplineTransformType::MeshSizeType > meshSizePerLevel( numberOfGridLevels );
+      std::vector< unsigned int >                       shrinkFactorPerLevel( numberOfGridLevels );
+      for ( unsigned int level = numberOfGridLevels; level-- > 0; )
       {
-        meshSize[i] = m_SplineGridSize[i];
+        shrinkFactorPerLevel[level] = 1U << ( numberOfGridLevels - 1 - level );
+        for ( unsigned int i = 0; i < SpaceDimension; i++ )
+        {
+          if ( level == numberOfGridLevels - 1 )
+          {
+            meshSizePerLevel[level][i] = static_cast< unsigned int >( m_SplineGridSize[i] );
+            continue;
+          }
+          const auto finerSize = static_cast< unsigned int >( meshSizePerLevel[level + 1][i] );
+          meshSizePerLevel[level][i] = ( finerSize % 2 == 0 && finerSize / 2 >= 3 ) ? finerSize / 2 : finerSize;
+        }
       }
+      const BSplineTransformType::MeshSizeType meshSize = meshSizePerLevel[0];
 
       using InitializerType = itk::BSplineTransformInitializer< BSplineTransformType, FixedImageType >;
       typename InitializerType::Pointer transformInitializer = InitializerType::New();
@@ -1320,28 +1355,27 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::Update( void )
       // the parameters to something different than those control points inside the
       // fixed image mask.
 
-      OptimizerBoundSelectionType boundSelect( bsplineTx->GetNumberOfParameters() );
-      if ( std::abs( m_MaxBSplineDisplacement ) < 1e-12 )
-      {
-        boundSelect.Fill( LBFGSBOptimizerType::UNBOUNDED );
-      }
-      else
-      {
-        boundSelect.Fill( LBFGSBOptimizerType::BOTHBOUNDED );
-      }
-      OptimizerBoundValueType upperBound( bsplineTx->GetNumberOfParameters() );
-      upperBound.Fill( m_MaxBSplineDisplacement );
-      OptimizerBoundValueType lowerBound( bsplineTx->GetNumberOfParameters() );
-      lowerBound.Fill( -m_MaxBSplineDisplacement );
-
-      LBFGSBoptimizer->SetBoundSelection( boundSelect );
-      // std::cout << "PRE : " << LBFGSBoptimizer->GetUpperBound().size() << " " << upperBound.size() << std::endl;
-      LBFGSBoptimizer->SetUpperBound( upperBound );
-      // std::cout << "POST: " << LBFGSBoptimizer->GetUpperBound().size() << " " << upperBound.size() << std::endl;
+      // The bounds have to be rebuilt whenever the control grid is refined.
+      const auto setBSplineBounds = [&]( const unsigned int numberOfParameters ) {
+        OptimizerBoundSelectionType boundSelect( numberOfParameters );
+        if ( std::abs( m_MaxBSplineDisplacement ) < 1e-12 )
+        {
+          boundSelect.Fill( LBFGSBOptimizerType::UNBOUNDED );
+        }
+        else
+        {
+          boundSelect.Fill( LBFGSBOptimizerType::BOTHBOUNDED );
+        }
+        OptimizerBoundValueType upperBound( numberOfParameters );
+        upperBound.Fill( m_MaxBSplineDisplacement );
+        OptimizerBoundValueType lowerBound( numberOfParameters );
+        lowerBound.Fill( -m_MaxBSplineDisplacement );
 
-      // std::cout << "PRE : " << LBFGSBoptimizer->GetLowerBound().size() << " " << lowerBound.size() << std::endl;
-      LBFGSBoptimizer->SetLowerBound( lowerBound );
-      // std::cout << "POST: " << LBFGSBoptimizer->GetLowerBound().size() << " " << lowerBound.size() << std::endl;
+        LBFGSBoptimizer->SetBoundSelection( boundSelect );
+        LBFGSBoptimizer->SetUpperBound( upperBound );
+        LBFGSBoptimizer->SetLowerBound( lowerBound );
+      };
+      setBSplineBounds( bsplineTx->GetNumberOfParameters() );
 
       LBFGSBoptimizer->SetCostFunctionConvergenceFactor( m_CostFunctionConvergenceFactor );
       LBFGSBoptimizer->SetGradientConvergenceTolerance( m_ProjectedGradientTolerance );
@@ -1511,7 +1545,9 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::Update( void )
         }
       }
 
-      // we have a 1 level BSpline registration.
+      // Every grid level is run as a 1 level registration on pyramid images
+      // from the shared cache, so the fixed images, moving images and sample
+      // points of a level are built once and reused by later stages.
       constexpr unsigned int numberOfLevels = 1;
 
       typename BSplineRegistrationType::ShrinkFactorsArrayType shrinkFactorsPerLevel;
@@ -1526,24 +1562,81 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::Update( void )
       bsplineRegistration->SetSmoothingSigmasPerLevel( smoothingSigmasPerLevel );
       bsplineRegistration->SetShrinkFactorsPerLevel( shrinkFactorsPerLevel );
       bsplineRegistration->SetSmoothingSigmasAreSpecifiedInPhysicalUnits( true );
-      bsplineRegistration->SetMetricSamplingStrategy(
-        static_cast< typename BSplineRegistrationType::MetricSamplingStrategyType >( m_SamplingStrategy ) );
       bsplineRegistration->SetMetricSamplingPercentage( m_SamplingPercentage );
       bsplineRegistration->SetMetric( this->m_CostMetricObject );
       bsplineRegistration->SetOptimizer( LBFGSBoptimizer );
-
-      try
+      if ( m_NumberOfThreads > 0 )
       {
-        std::cout << "*** Running bspline registration (meshSizeAtBaseLevel = " << meshSize << ") ***" << std::endl
-                  << std::endl;
-        bsplineRegistration->Update();
+        bsplineRegistration->SetNumberOfWorkUnits( m_NumberOfThreads );
+        LBFGSBoptimizer->SetNumberOfWorkUnits( m_NumberOfThreads );
+      }
 
-        std::cout << "Stop condition from LBFGSBoptimizer."
-                  << bsplineRegistration->GetOptimizer()->GetStopConditionDescription() << std::endl;
+      double maximumFixedSpacing = 0.0;
+      for ( unsigned int i = 0; i < SpaceDimension; i++ )
+      {
+        maximumFixedSpacing = std::max( maximumFixedSpacing, static_cast< double >( m_FixedVolume->GetSpacing()[i] ) );
       }
-      catch ( itk::ExceptionObject & e )
+      for ( unsigned int level = 0; level < numberOfGridLevels; ++level )
       {
-        itkGenericExceptionMacro( << "Exception caught: " << e << std::endl );
+        const unsigned int shrinkFactor = shrinkFactorPerLevel[level];
+        // Half a voxel of the shrunk grid, as in the usual 4x2x1 / 2x1x0 schedules.
+        const double smoothingSigma = ( shrinkFactor > 1 ) ? 0.5 * shrinkFactor * maximumFixedSpacing : 0.0;
+        if ( level > 0 )
+        {
+          // Knot insertion: every axis keeps or doubles its grid, so the
+          // refined grid represents the same deformation exactly.
+          using BSplineAdaptorType = itk::BSplineTransformParametersAdaptor< BSplineTransformType >;
+          typename BSplineAdaptorType::Pointer bsplineAdaptor = BSplineAdaptorType::New();
+          bsplineAdaptor->SetTransform( bsplineTx );
+          bsplineAdaptor->SetRequiredTransformDomainOrigin( bsplineTx->GetTransformDomainOrigin() );
+          bsplineAdaptor->SetRequiredTransformDomainDirection( bsplineTx->GetTransformDomainDirection() );
+          bsplineAdaptor->SetRequiredTransformDomainPhysicalDimensions(
+            bsplineTx->GetTransformDomainPhysicalDimensions() );
+          bsplineAdaptor->SetRequiredTransformDomainMeshSize( meshSizePerLevel[level] );
+          bsplineAdaptor->AdaptTransformParameters();
+          setBSplineBounds( bsplineTx->GetNumberOfParameters() );
+        }
+
+        std::vector< FixedImagePointer > levelFixedImagesList;
+        for ( unsigned int n = 0; n < preprocessedFixedImagesList.size(); n++ )
+        {
+          levelFixedImagesList.push_back( this->m_SampleCache->GetPyramidLevel(
+            preprocessedFixedImagesList[n].GetPointer(), shrinkFactor, smoothingSigma ) );
+          bsplineRegistration->SetFixedImage( n, levelFixedImagesList[n] );
+        }
+        // ImageRegistrationMethodv4 would shrink only its virtual domain; here
+        // the fixed images, which define the virtual domain and the samples,
+        // are smoothed and shrunk, and the moving images are only smoothed.
+        for ( unsigned int n = 0; n < preprocessedMovingImagesList.size(); n++ )
+        {
+          MovingImagePointer levelMovingImage =
+            this->m_SampleCache->GetPyramidLevel( preprocessedMovingImagesList[n].GetPointer(), 1, smoothingSigma );
+          bsplineRegistration->SetMovingImage( n, levelMovingImage );
+        }
+
+        // The BSpline stage draws its own samples with ITK's default seed, as
+        // it always has; only the linear stages share the cached sample set.
+        bsplineRegistration->SetMetricSamplingStrategy(
+          static_cast< typename BSplineRegistrationType::MetricSamplingStrategyType >( m_SamplingStrategy ) );
+        // The inputs may be unchanged between levels, but the grid is not.
+        bsplineRegistration->Modified();
+
+        try
+        {
+          std::cout << "*** Running bspline registration level " << level + 1 << " of " << numberOfGridLevels
+                    << " (meshSize = " << meshSizePerLevel[level] << ", shrinkFactor = " << shrinkFactor
+                    << ", parameters = " << bsplineTx->GetNumberOfParameters() << ") ***" << std::endl
+                    << std::endl;
+          BRAINS_PROFILE_SCOPE( "Optimize" );
+          bsplineRegistration->Update();
+
+          std::cout << "Stop condition from LBFGSBoptimizer."
+                    << bsplineRegistration->GetOptimizer()->GetStopConditionDescription() << std::endl;
+        }
+        catch ( itk::ExceptionObject & e )
+        {
+          itkGenericExceptionMacro( << "Exception caught: " << e << std::endl );
+        }
       }
 
       // Add the optimized bspline tranform to the current generic transform
@@ -1563,7 +1656,7 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::Update( void )
       // SyN registration metric
       //
       std::string whichmetric = "cc"; // default value
-      if ( this->m_SyNMetricType == "MMI" )
+      if ( this->m_SyNMetricType == "MMI" || this->m_SyNMetricType == "MMIFB" )
       {
         whichmetric = "mattes";
       }
@@ -1764,6 +1857,7 @@ BRAINSFitHelperTemplate< FixedImageType, MovingImageType >::PrintSelf( std::ostr
     os << this->m_SplineGridSize[q] << " ";
   }
   os << "]" << std::endl;
+  os << indent << "NumberOfBSplineGridLevels:      " << this->m_NumberOfBSplineGridLevels << std::endl;
 
   if ( m_CurrentGenericTransform.IsNotNull() )
   {
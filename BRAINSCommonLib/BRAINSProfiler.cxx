@@ -0,0 +1,373 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "BRAINSProfiler.h"
+#include "PrettyPrintTable.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#if defined( _WIN32 ) || defined( _WIN64 )
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <sys/resource.h>
+#  include <time.h>
+#endif
+
+namespace BRAINSUtils
+{
+namespace
+{
+struct OpenStage
+{
+  const char *                          m_Name;
+  std::string                           m_Path;
+  std::chrono::steady_clock::time_point m_WallStart;
+  double                                m_CPUStart;
+  double                                m_ProcessCPUStart;
+  long                                  m_PeakRSSStartKiB;
+};
+
+// Stages open on this thread, innermost last.
+thread_local std::vector< OpenStage > t_OpenStages;
+// Enclosing path of the stages opened on this thread, see ScopedProfileParent.
+thread_local std::string              t_ParentPath;
+thread_local unsigned long            t_ThreadId = 0;
+thread_local bool                     t_HasThreadId = false;
+
+void
+WriteJSONString( std::ostream & os, const std::string & value )
+{
+  os << '"';
+  for ( const char c : value )
+  {
+    switch ( c )
+    {
+      case '"':
+        os << "\\\"";
+        break;
+      case '\\':
+        os << "\\\\";
+        break;
+      case '\n':
+        os << "\\n";
+        break;
+      case '\t':
+        os << "\\t";
+        break;
+      default:
+        if ( static_cast< unsigned char >( c ) < 0x20 )
+        {
+          os << "\\u" << std::hex << std::setw( 4 ) << std::setfill( '0' ) << static_cast< int >( c ) << std::dec
+             << std::setfill( ' ' );
+        }
+        else
+        {
+          os << c;
+        }
+    }
+  }
+  os << '"';
+}
+} // namespace
+
+std::atomic< bool > Profiler::s_Enabled( false );
+
+Profiler::Profiler()
+  : m_StartTime( ClockType::now() )
+  , m_NumberOfThreads( 0 )
+{}
+
+Profiler &
+Profiler::GetInstance()
+{
+  static Profiler instance;
+  return instance;
+}
+
+void
+Profiler::Enable()
+{
+  {
+    std::lock_guard< std::mutex > lock( m_Mutex );
+    m_StartTime = ClockType::now();
+    m_Stages.clear();
+    m_TraceEvents.clear();
+  }
+  s_Enabled.store( true );
+}
+
+void
+Profiler::Disable()
+{
+  s_Enabled.store( false );
+}
+
+void
+Profiler::Begin( const char * name )
+{
+  OpenStage stage;
+  stage.m_Name = name;
+  const std::string parentPath = GetCurrentPath();
+  stage.m_Path = parentPath.empty() ? std::string( name ) : parentPath + "/" + name;
+  stage.m_PeakRSSStartKiB = GetPeakResidentSetSizeKiB();
+  stage.m_ProcessCPUStart = GetProcessCPUSeconds();
+  stage.m_CPUStart = GetThreadCPUSeconds();
+  stage.m_WallStart = ClockType::now();
+  t_OpenStages.push_back( stage );
+}
+
+void
+Profiler::End()
+{
+  if ( t_OpenStages.empty() )
+  {
+    return;
+  }
+  const ClockType::time_point wallEnd = ClockType::now();
+  const double                cpuEnd = GetThreadCPUSeconds();
+  const double                processCPUEnd = GetProcessCPUSeconds();
+  const long                  peakRSSEndKiB = GetPeakResidentSetSizeKiB();
+  const OpenStage &           stage = t_OpenStages.back();
+
+  const double wallSeconds = std::chrono::duration< double >( wallEnd - stage.m_WallStart ).count();
+  {
+    std::lock_guard< std::mutex > lock( m_Mutex );
+    if ( !t_HasThreadId )
+    {
+      t_ThreadId = m_NumberOfThreads++;
+      t_HasThreadId = true;
+    }
+    StageStatistics & stats = m_Stages[stage.m_Path];
+    ++stats.m_Calls;
+    stats.m_WallSeconds += wallSeconds;
+    stats.m_CPUSeconds += cpuEnd - stage.m_CPUStart;
+    stats.m_ProcessCPUSeconds += processCPUEnd - stage.m_ProcessCPUStart;
+    stats.m_PeakRSSDeltaKiB = std::max( stats.m_PeakRSSDeltaKiB, peakRSSEndKiB - stage.m_PeakRSSStartKiB );
+
+    if ( m_TraceEvents.size() < MaximumNumberOfTraceEvents )
+    {
+      TraceEvent event;
+      event.m_Path = stage.m_Path;
+      event.m_Name = stage.m_Name;
+      event.m_BeginMicroseconds =
+        std::chrono::duration< double, std::micro >( stage.m_WallStart - m_StartTime ).count();
+      event.m_DurationMicroseconds = wallSeconds * 1.0e6;
+      event.m_ThreadId = t_ThreadId;
+      m_TraceEvents.push_back( event );
+    }
+  }
+  t_OpenStages.pop_back();
+}
+
+Profiler::StageMapType
+Profiler::GetStages() const
+{
+  std::lock_guard< std::mutex > lock( m_Mutex );
+  return m_Stages;
+}
+
+std::string
+Profiler::GetCurrentPath()
+{
+  return t_OpenStages.empty() ? t_ParentPath : t_OpenStages.back().m_Path;
+}
+
+std::string
+Profiler::SetThreadParentPath( const std::string & parentPath )
+{
+  std::string previousParentPath = parentPath;
+  std::swap( previousParentPath, t_ParentPath );
+  return previousParentPath;
+}
+
+bool
+Profiler::WriteJSON( const std::string & fileName ) const
+{
+  std::ofstream os( fileName.c_str() );
+  if ( !os.is_open() )
+  {
+    std::cerr << "ERROR: Could not open profile output file " << fileName << std::endl;
+    return false;
+  }
+  this->WriteJSON( os );
+  return os.good();
+}
+
+void
+Profiler::WriteJSON( std::ostream & os ) const
+{
+  std::lock_guard< std::mutex > lock( m_Mutex );
+  os << std::setprecision( 15 );
+  os << "{\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [";
+  for ( size_t i = 0; i < m_TraceEvents.size(); ++i )
+  {
+    const TraceEvent & event = m_TraceEvents[i];
+    os << ( i == 0 ? "\n" : ",\n" ) << "    {\"name\": ";
+    WriteJSONString( os, event.m_Name );
+    os << ", \"cat\": \"stage\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << event.m_ThreadId
+       << ", \"ts\": " << event.m_BeginMicroseconds << ", \"dur\": " << event.m_DurationMicroseconds
+       << ", \"args\": {\"path\": ";
+    WriteJSONString( os, event.m_Path );
+    os << "}}";
+  }
+  os << "\n  ],\n  \"stages\": [";
+  bool first = true;
+  for ( StageMapType::const_iterator it = m_Stages.begin(); it != m_Stages.end(); ++it )
+  {
+    os << ( first ? "\n" : ",\n" ) << "    {\"path\": ";
+    first = false;
+    WriteJSONString( os, it->first );
+    os << ", \"calls\": " << it->second.m_Calls << ", \"wallSeconds\": " << it->second.m_WallSeconds
+       << ", \"cpuSeconds\": " << it->second.m_CPUSeconds
+       << ", \"processCPUSeconds\": " << it->second.m_ProcessCPUSeconds
+       << ", \"peakRSSDeltaKiB\": " << it->second.m_PeakRSSDeltaKiB << "}";
+  }
+  os << "\n  ],\n  \"notes\": {\"cpuSeconds\": \"CPU time of the thread that opened the stage, excluding work it hands to "
+        "other threads\", \"processCPUSeconds\": \"CPU time of the whole process while the stage was open, "
+        "including stages running concurrently on other threads\"},";
+  os << "\n  \"peakRSSKiB\": " << GetPeakResidentSetSizeKiB() << "\n}\n";
+}
+
+void
+Profiler::Print( std::ostream & os ) const
+{
+  const StageMapType stages = this->GetStages();
+  PrettyPrintTable   table;
+  table.add( 0, 0, "Stage" );
+  table.add( 0, 1, "Calls" );
+  table.add( 0, 2, "Wall(s)" );
+  table.add( 0, 3, "CPU(s)" );
+  table.add( 0, 4, "ProcessCPU(s)" );
+  table.add( 0, 5, "PeakRSSDelta(MiB)" );
+  unsigned int row = 1;
+  for ( StageMapType::const_iterator it = stages.begin(); it != stages.end(); ++it, ++row )
+  {
+    table.add( row, 0, it->first );
+    table.add( row, 1, static_cast< int >( it->second.m_Calls ), "%d" );
+    table.add( row, 2, it->second.m_WallSeconds, "%.3f" );
+    table.add( row, 3, it->second.m_CPUSeconds, "%.3f" );
+    table.add( row, 4, it->second.m_ProcessCPUSeconds, "%.3f" );
+    table.add( row, 5, it->second.m_PeakRSSDeltaKiB / 1024.0, "%.1f" );
+  }
+  table.Print( os );
+}
+
+long
+Profiler::GetPeakResidentSetSizeKiB()
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+  PROCESS_MEMORY_COUNTERS counters;
+  if ( GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+  {
+    return static_cast< long >( counters.PeakWorkingSetSize / 1024 );
+  }
+  return 0;
+#else
+  struct rusage usage;
+  if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+  {
+    return 0;
+  }
+#  if defined( __APPLE__ )
+  return static_cast< long >( usage.ru_maxrss / 1024 ); // bytes on macOS
+#  else
+  return static_cast< long >( usage.ru_maxrss ); // KiB on Linux and the BSDs
+#  endif
+#endif
+}
+
+double
+Profiler::GetProcessCPUSeconds()
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+  FILETIME creationTime, exitTime, kernelTime, userTime;
+  if ( !GetProcessTimes( GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime ) )
+  {
+    return 0.0;
+  }
+  const auto toSeconds = []( const FILETIME & t ) -> double {
+    return ( ( static_cast< unsigned long long >( t.dwHighDateTime ) << 32 ) | t.dwLowDateTime ) * 1.0e-7;
+  };
+  return toSeconds( kernelTime ) + toSeconds( userTime );
+#else
+  struct rusage usage;
+  if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+  {
+    return 0.0;
+  }
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1.0e-6 * ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec );
+#endif
+}
+
+double
+Profiler::GetThreadCPUSeconds()
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+  FILETIME creationTime, exitTime, kernelTime, userTime;
+  if ( !GetThreadTimes( GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime ) )
+  {
+    return GetProcessCPUSeconds();
+  }
+  const auto toSeconds = []( const FILETIME & t ) -> double {
+    return ( ( static_cast< unsigned long long >( t.dwHighDateTime ) << 32 ) | t.dwLowDateTime ) * 1.0e-7;
+  };
+  return toSeconds( kernelTime ) + toSeconds( userTime );
+#elif defined( CLOCK_THREAD_CPUTIME_ID )
+  struct timespec now;
+  if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now ) != 0 )
+  {
+    return GetProcessCPUSeconds();
+  }
+  return now.tv_sec + 1.0e-9 * now.tv_nsec;
+#else
+  return GetProcessCPUSeconds();
+#endif
+}
+
+ProfilerSession::ProfilerSession( const std::string & outputFileName )
+  : m_OutputFileName( outputFileName )
+{
+  if ( !m_OutputFileName.empty() )
+  {
+    Profiler::GetInstance().Enable();
+  }
+}
+
+ProfilerSession::~ProfilerSession()
+{
+  if ( m_OutputFileName.empty() )
+  {
+    return;
+  }
+  Profiler & profiler = Profiler::GetInstance();
+  profiler.Disable();
+  profiler.Print( std::cout );
+  if ( profiler.WriteJSON( m_OutputFileName ) )
+  {
+    std::cout << "Wrote profile: " << m_OutputFileName << std::endl;
+  }
+}
+} // namespace BRAINSUtils
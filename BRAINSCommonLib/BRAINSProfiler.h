@@ -0,0 +1,259 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef BRAINSProfiler_h
+#define BRAINSProfiler_h
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace BRAINSUtils
+{
+/**
+ * \author Hans J. Johnson
+ * \brief Process wide, hierarchical record of where a program spends its
+ * time and memory.
+ *
+ * Stages are opened and closed with ScopedProfileStage (usually through
+ * BRAINS_PROFILE_SCOPE).  Each thread keeps its own stack of open stages,
+ * so a stage is identified by the '/' separated path of the stages that
+ * enclose it on that thread (i.e. "EMSegmentation/EMLoop/ComputePosteriors").
+ * Stages opened on worker threads only nest under the stage that started
+ * the work when the task installs its path with ScopedProfileParent;
+ * otherwise they are recorded as top level stages.
+ *
+ * Per path the profiler accumulates the call count, wall time, CPU time and
+ * the largest growth of the peak resident set size seen while the stage was
+ * open.  Two CPU times are kept:
+ *  - m_CPUSeconds is the CPU time of the thread that opened the stage.  It
+ *    does not include work the stage hands to other threads, but it is never
+ *    counted twice.
+ *  - m_ProcessCPUSeconds is the CPU time of the whole process while the
+ *    stage was open.  It includes the worker threads, and also every stage
+ *    running at the same time on another thread, so concurrent stages each
+ *    count the CPU time of the others.
+ *
+ * The profiler is disabled by default; a disabled profiler costs one relaxed
+ * atomic load per stage.  Tools enable it through ProfilerSession, which
+ * writes the result when it goes out of scope.
+ */
+class Profiler
+{
+public:
+  struct StageStatistics
+  {
+    StageStatistics()
+      : m_Calls( 0 )
+      , m_WallSeconds( 0.0 )
+      , m_CPUSeconds( 0.0 )
+      , m_ProcessCPUSeconds( 0.0 )
+      , m_PeakRSSDeltaKiB( 0 )
+    {}
+    unsigned long m_Calls;
+    double        m_WallSeconds;
+    double        m_CPUSeconds;
+    double        m_ProcessCPUSeconds;
+    long          m_PeakRSSDeltaKiB;
+  };
+  using StageMapType = std::map< std::string, StageStatistics >;
+
+  static Profiler &
+  GetInstance();
+
+  static bool
+  IsEnabled()
+  {
+    return s_Enabled.load( std::memory_order_relaxed );
+  }
+
+  /** Start recording; any previous record is discarded. */
+  void
+  Enable();
+  void
+  Disable();
+
+  /** Open a stage on the calling thread; name must stay valid until End. */
+  void
+  Begin( const char * name );
+  /** Close the innermost open stage of the calling thread. */
+  void
+  End();
+
+  StageMapType
+  GetStages() const;
+
+  /** Path of the innermost stage open on the calling thread, or the parent
+   * path installed by ScopedProfileParent, or "" at the top level. */
+  static std::string
+  GetCurrentPath();
+
+  /** Make parentPath the enclosing path of the stages that the calling
+   * thread opens while it has no open stage; returns the previous one. */
+  static std::string
+  SetThreadParentPath( const std::string & parentPath );
+
+  /**
+   * Write the record as JSON.  The file is in the Chrome trace event object
+   * format (chrome://tracing, ui.perfetto.dev) with one complete event per
+   * stage call under "traceEvents"; the per stage totals are under "stages".
+   */
+  bool
+  WriteJSON( const std::string & fileName ) const;
+  void
+  WriteJSON( std::ostream & os ) const;
+
+  /** Print the per stage totals as a table. */
+  void
+  Print( std::ostream & os ) const;
+
+  /** Peak resident set size of this process, 0 when it can not be queried. */
+  static long
+  GetPeakResidentSetSizeKiB();
+  /** CPU time used by all threads of this process. */
+  static double
+  GetProcessCPUSeconds();
+  /** CPU time used by the calling thread, the process CPU time when the
+   * platform can not measure it per thread. */
+  static double
+  GetThreadCPUSeconds();
+
+private:
+  Profiler();
+  Profiler( const Profiler & ) = delete;
+  Profiler &
+  operator=( const Profiler & ) = delete;
+
+  using ClockType = std::chrono::steady_clock;
+
+  struct TraceEvent
+  {
+    std::string   m_Path;
+    std::string   m_Name;
+    double        m_BeginMicroseconds;
+    double        m_DurationMicroseconds;
+    unsigned long m_ThreadId;
+  };
+
+  /** Complete events kept for the trace; the totals are always kept. */
+  static constexpr size_t MaximumNumberOfTraceEvents = 1000000;
+
+  static std::atomic< bool > s_Enabled;
+
+  mutable std::mutex        m_Mutex;
+  ClockType::time_point     m_StartTime;
+  StageMapType              m_Stages;
+  std::vector< TraceEvent > m_TraceEvents;
+  unsigned long             m_NumberOfThreads;
+};
+
+/**
+ * \author Hans J. Johnson
+ * \brief Open a profiler stage for the lifetime of this object.
+ *
+ * Whether the profiler was enabled is sampled once at construction so that
+ * a stage is always closed by the scope that opened it.
+ */
+class ScopedProfileStage
+{
+public:
+  explicit ScopedProfileStage( const char * name )
+    : m_Active( Profiler::IsEnabled() )
+  {
+    if ( m_Active )
+    {
+      Profiler::GetInstance().Begin( name );
+    }
+  }
+  ~ScopedProfileStage()
+  {
+    if ( m_Active )
+    {
+      Profiler::GetInstance().End();
+    }
+  }
+  ScopedProfileStage( const ScopedProfileStage & ) = delete;
+  ScopedProfileStage &
+  operator=( const ScopedProfileStage & ) = delete;
+
+private:
+  const bool m_Active;
+};
+
+/**
+ * \author Hans J. Johnson
+ * \brief Nest the stages of a task run on a worker thread under the stage
+ * that started it.
+ *
+ * Capture Profiler::GetCurrentPath() before handing out the work and
+ * construct one of these at the start of each task:
+ *
+ *   const std::string parentPath = BRAINSUtils::Profiler::GetCurrentPath();
+ *   tbb::parallel_for( ..., [&]( ... ) {
+ *     const BRAINSUtils::ScopedProfileParent profileParent( parentPath );
+ *     ...
+ *   } );
+ */
+class ScopedProfileParent
+{
+public:
+  explicit ScopedProfileParent( const std::string & parentPath )
+    : m_PreviousParentPath( Profiler::SetThreadParentPath( parentPath ) )
+  {}
+  ~ScopedProfileParent() { Profiler::SetThreadParentPath( m_PreviousParentPath ); }
+  ScopedProfileParent( const ScopedProfileParent & ) = delete;
+  ScopedProfileParent &
+  operator=( const ScopedProfileParent & ) = delete;
+
+private:
+  const std::string m_PreviousParentPath;
+};
+
+/**
+ * \author Hans J. Johnson
+ * \brief Enable the profiler for the lifetime of a program's main.
+ *
+ * An empty file name leaves the profiler disabled.  Otherwise the record is
+ * written to the file, and summarized on std::cout, on destruction so that
+ * early returns are covered.
+ */
+class ProfilerSession
+{
+public:
+  explicit ProfilerSession( const std::string & outputFileName );
+  ~ProfilerSession();
+  ProfilerSession( const ProfilerSession & ) = delete;
+  ProfilerSession &
+  operator=( const ProfilerSession & ) = delete;
+
+private:
+  const std::string m_OutputFileName;
+};
+} // namespace BRAINSUtils
+
+#define BRAINS_PROFILE_CONCATENATE_DETAIL( a, b ) a##b
+#define BRAINS_PROFILE_CONCATENATE( a, b ) BRAINS_PROFILE_CONCATENATE_DETAIL( a, b )
+/** Profile the rest of the enclosing scope as stage name. */
+#define BRAINS_PROFILE_SCOPE( name )                                                                                   \
+  const BRAINSUtils::ScopedProfileStage BRAINS_PROFILE_CONCATENATE( brainsProfileStage, __LINE__ )( name )
+
+#endif // BRAINSProfiler_h
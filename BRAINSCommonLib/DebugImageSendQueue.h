@@ -0,0 +1,205 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __DebugImageSendQueue_h
+#define __DebugImageSendQueue_h
+
+#include "itkExceptionObject.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+/** \class DebugImageSendQueue
+ * \author Hans J. Johnson
+ * \brief A bounded queue of messages run in order on one background thread.
+ *
+ * DebugImageViewerClient uses it to move socket transfers off the compute
+ * loop.  Push never waits: when MaxQueueLength messages are already pending
+ * the oldest one is dropped.  A message that throws is reported and counted,
+ * and the sender goes on with the next one.
+ */
+class DebugImageSendQueue
+{
+public:
+  using MessageType = std::function< void() >;
+
+  DebugImageSendQueue()
+    : m_MaxQueueLength( 8 )
+    , m_NumberOfDroppedMessages( 0 )
+    , m_NumberOfFailedMessages( 0 )
+    , m_Running( false )
+    , m_Busy( false )
+  {}
+
+  ~DebugImageSendQueue() { this->Stop(); }
+
+  DebugImageSendQueue( const DebugImageSendQueue & ) = delete;
+  DebugImageSendQueue &
+  operator=( const DebugImageSendQueue & ) = delete;
+
+  /** Number of messages allowed to wait before the oldest is dropped. */
+  void
+  SetMaxQueueLength( unsigned int x )
+  {
+    std::lock_guard< std::mutex > lock( m_Mutex );
+    m_MaxQueueLength = std::max( x, 1U );
+  }
+
+  unsigned int
+  GetMaxQueueLength() const
+  {
+    std::lock_guard< std::mutex > lock( m_Mutex );
+    return m_MaxQueueLength;
+  }
+
+  /** Number of messages discarded because the sender could not keep up. */
+  unsigned long
+  GetNumberOfDroppedMessages() const
+  {
+    return m_NumberOfDroppedMessages;
+  }
+
+  /** Number of messages that threw while being sent. */
+  unsigned long
+  GetNumberOfFailedMessages() const
+  {
+    return m_NumberOfFailedMessages;
+  }
+
+  /** Start the sender thread.  Does nothing if it is already running. */
+  void
+  Start()
+  {
+    std::lock_guard< std::mutex > lock( m_Mutex );
+    if ( m_Running )
+    {
+      return;
+    }
+    m_Running = true;
+    m_Sender = std::thread( &DebugImageSendQueue::SenderLoop, this );
+  }
+
+  /** Discard the pending messages, let the current one finish and join the sender. */
+  void
+  Stop()
+  {
+    {
+      std::lock_guard< std::mutex > lock( m_Mutex );
+      m_Running = false;
+      m_Queue.clear();
+    }
+    m_NotEmpty.notify_all();
+    m_Drained.notify_all();
+    if ( m_Sender.joinable() )
+    {
+      m_Sender.join();
+    }
+  }
+
+  /** Queue a message, dropping the oldest pending ones if the queue is full. */
+  void
+  Push( MessageType message )
+  {
+    {
+      std::lock_guard< std::mutex > lock( m_Mutex );
+      while ( m_Queue.size() >= m_MaxQueueLength )
+      {
+        m_Queue.pop_front();
+        ++m_NumberOfDroppedMessages;
+      }
+      m_Queue.push_back( std::move( message ) );
+    }
+    m_NotEmpty.notify_one();
+  }
+
+  /** Block until every queued message has been sent, or the sender is stopped. */
+  void
+  Flush()
+  {
+    std::unique_lock< std::mutex > lock( m_Mutex );
+    m_Drained.wait( lock, [this] { return !m_Running || ( m_Queue.empty() && !m_Busy ); } );
+  }
+
+private:
+  void
+  SenderLoop()
+  {
+    std::unique_lock< std::mutex > lock( m_Mutex );
+    while ( true )
+    {
+      m_NotEmpty.wait( lock, [this] { return !m_Running || !m_Queue.empty(); } );
+      if ( !m_Running )
+      {
+        break;
+      }
+      MessageType message = std::move( m_Queue.front() );
+      m_Queue.pop_front();
+      m_Busy = true;
+      lock.unlock();
+      try
+      {
+        message();
+      }
+      catch ( itk::ExceptionObject & e )
+      {
+        ++m_NumberOfFailedMessages;
+        std::cerr << "DebugImageViewerClient: failed to send image" << std::endl;
+        std::cerr << e.GetDescription() << std::endl;
+      }
+      catch ( std::exception & e )
+      {
+        ++m_NumberOfFailedMessages;
+        std::cerr << "DebugImageViewerClient: failed to send image" << std::endl;
+        std::cerr << e.what() << std::endl;
+      }
+      catch ( ... )
+      {
+        ++m_NumberOfFailedMessages;
+        std::cerr << "DebugImageViewerClient: failed to send image: unknown exception" << std::endl;
+      }
+      lock.lock();
+      m_Busy = false;
+      if ( m_Queue.empty() )
+      {
+        m_Drained.notify_all();
+      }
+    }
+    m_Busy = false;
+    m_Drained.notify_all();
+  }
+
+  unsigned int                 m_MaxQueueLength;
+  std::atomic< unsigned long > m_NumberOfDroppedMessages;
+  std::atomic< unsigned long > m_NumberOfFailedMessages;
+  bool                         m_Running;
+  bool                         m_Busy;
+  std::deque< MessageType >    m_Queue;
+  mutable std::mutex           m_Mutex;
+  std::condition_variable      m_NotEmpty;
+  std::condition_variable      m_Drained;
+  std::thread                  m_Sender;
+};
+
+#endif // __DebugImageSendQueue_h
@@ -22,6 +22,7 @@
 #  include "BRAINSCommonLib.h"
 
 #  ifdef USE_DebugImageViewer
+#    include "DebugImageSendQueue.h"
 #    include <string>
 #    include <itksys/SystemTools.hxx>
 #    include <vtkClientSocket.h>
@@ -30,7 +31,11 @@
 #    include <itkSpatialOrientation.h>
 #    include <itkSpatialOrientationAdapter.h>
 #    include <itkOrientImageFilter.h>
+#    include <itkShrinkImageFilter.h>
+#    include <itkImageDuplicator.h>
+#    include <algorithm>
 #    include <cstdio>
+#    include <vector>
 // #include <itkIO.h>
 // #include <itkIO2.h>
 
@@ -101,23 +106,32 @@ OrientImage( typename ImageType::Pointer & inputImage, const typename ImageType:
 }
 } // namespace DebugImageViewerUtil
 
+/** \class DebugImageViewerClient
+ * \author Hans J. Johnson
+ * \brief Streams images to a running DebugImageViewer without stalling the caller.
+ *
+ * SendImage takes a private snapshot of the image (optionally downsampled by
+ * ShrinkFactor) and hands it to a DebugImageSendQueue. The rescale to
+ * unsigned char, reorientation and socket transfer all happen on its sender
+ * thread. At most MaxQueueLength images wait for transfer; when the viewer
+ * falls behind, the oldest pending image is dropped so the compute loop never
+ * waits on the socket. The wire format is unchanged.
+ */
 class DebugImageViewerClient
 {
 public:
   DebugImageViewerClient()
-    : m_Sock( 0 )
+    : m_Sock( nullptr )
     , m_Enabled( false )
     , m_PromptUser( false )
+    , m_ShrinkFactor( 1 )
   {}
 
-  ~DebugImageViewerClient()
-  {
-    if ( m_Sock )
-    {
-      this->m_Sock->CloseSocket();
-      this->m_Sock->Delete();
-    }
-  }
+  ~DebugImageViewerClient() { this->SetEnabled( false ); }
+
+  DebugImageViewerClient( const DebugImageViewerClient & ) = delete;
+  DebugImageViewerClient &
+  operator=( const DebugImageViewerClient & ) = delete;
 
   void
   SetPromptUser( bool x )
@@ -125,22 +139,46 @@ public:
     m_PromptUser = x;
   }
 
+  /** Downsample every image by this integer factor before it is queued. */
+  void
+  SetShrinkFactor( unsigned int x )
+  {
+    m_ShrinkFactor = std::max( x, 1U );
+  }
+
+  unsigned int
+  GetShrinkFactor() const
+  {
+    return m_ShrinkFactor;
+  }
+
+  /** Number of images allowed to wait for the viewer before the oldest is dropped. */
+  void
+  SetMaxQueueLength( unsigned int x )
+  {
+    m_SendQueue.SetMaxQueueLength( x );
+  }
+
+  unsigned int
+  GetMaxQueueLength() const
+  {
+    return m_SendQueue.GetMaxQueueLength();
+  }
+
+  /** Number of images discarded because the viewer could not keep up. */
+  unsigned long
+  GetNumberOfDroppedImages() const
+  {
+    return m_SendQueue.GetNumberOfDroppedMessages();
+  }
+
   /** Send an image to the viewer */
   template < typename ImageType >
   void
   SendImage( const typename ImageType::Pointer & image, unsigned viewIndex = 0 )
   {
     this->Send< ImageType >( image, viewIndex );
-    if ( this->m_PromptUser )
-    {
-      //
-      // make sure we connect to interactive input
-      FILE * in = fopen( "/dev/tty", "r" );
-      std::cerr << ">>>>>>>>>Hit enter to continue " << std::flush;
-      char buf[256];
-      fgets( buf, 255, in );
-      fclose( in );
-    }
+    this->Prompt();
   }
 
   /** Send one component of a vector image to the viewer */
@@ -149,32 +187,41 @@ public:
   SendImage( const typename ImageType::Pointer & image, unsigned viewIndex, unsigned vectorIndex )
   {
     this->Send< ImageType >( image, viewIndex, vectorIndex );
-    if ( this->m_PromptUser )
-    {
-      //
-      // make sure we connect to interactive input
-      FILE * in = fopen( "/dev/tty", "r" );
-      std::cerr << ">>>>>>>>>Hit enter to continue " << std::flush;
-      char buf[256];
-      fgets( buf, 255, in );
-      fclose( in );
-    }
+    this->Prompt();
+  }
+
+  /** Block until every queued image has been handed to the socket. */
+  void
+  Flush()
+  {
+    m_SendQueue.Flush();
   }
 
   /** enable sending of images to the viewer */
   void
   SetEnabled( bool enabled )
   {
+    if ( enabled == this->m_Enabled )
+    {
+      return;
+    }
     this->m_Enabled = enabled;
     if ( enabled )
     {
       this->_Init();
+      return;
+    }
+    m_SendQueue.Stop();
+    if ( this->GetNumberOfDroppedImages() > 0 )
+    {
+      std::cerr << "DebugImageViewerClient: dropped " << this->GetNumberOfDroppedImages()
+                << " images because the viewer could not keep up" << std::endl;
     }
-    else if ( this->m_Sock != 0 )
+    if ( this->m_Sock != nullptr )
     {
       this->m_Sock->CloseSocket();
       this->m_Sock->Delete();
-      this->m_Sock = 0;
+      this->m_Sock = nullptr;
     }
   }
 
@@ -185,11 +232,62 @@ public:
   }
 
 private:
+  using TransferImageType = itk::Image< unsigned char, 3 >;
+
   void
   _Init()
   {
     this->m_Sock = vtkClientSocket::New();
     this->m_Sock->ConnectToServer( "localhost", 19345 );
+    m_SendQueue.Start();
+  }
+
+  void
+  Prompt()
+  {
+    if ( !this->m_PromptUser || !this->Enabled() )
+    {
+      return;
+    }
+    // the user is waiting to look at this image, so let it reach the viewer first
+    this->Flush();
+    //
+    // make sure we connect to interactive input
+    FILE * in = fopen( "/dev/tty", "r" );
+    std::cerr << ">>>>>>>>>Hit enter to continue " << std::flush;
+    char buf[256];
+    fgets( buf, 255, in );
+    fclose( in );
+  }
+
+  /** Detach the image from the caller's pipeline so it can be sent later. */
+  template < typename ImageType >
+  typename ImageType::Pointer
+  Snapshot( const typename ImageType::Pointer & image ) const
+  {
+    if ( m_ShrinkFactor > 1 )
+    {
+      using ShrinkFilterType = itk::ShrinkImageFilter< ImageType, ImageType >;
+      typename ShrinkFilterType::Pointer shrinker = ShrinkFilterType::New();
+      shrinker->SetInput( image );
+      shrinker->SetShrinkFactors( m_ShrinkFactor );
+      shrinker->Update();
+      typename ImageType::Pointer shrunk = shrinker->GetOutput();
+      shrunk->DisconnectPipeline();
+      return shrunk;
+    }
+    using DuplicatorType = itk::ImageDuplicator< ImageType >;
+    typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
+    duplicator->SetInputImage( image );
+    duplicator->Update();
+    return duplicator->GetOutput();
+  }
+
+  template < typename ImageType >
+  void
+  Enqueue( const typename ImageType::Pointer & snapshot, unsigned int viewIndex )
+  {
+    m_SendQueue.Push( [this, snapshot, viewIndex]() { this->Transfer< ImageType >( snapshot, viewIndex ); } );
   }
 
   template < typename ImageType >
@@ -200,10 +298,17 @@ private:
   void
   Send( const typename ImageType::Pointer & image, unsigned int viewIndex, unsigned int vectorIndex );
 
+  /** Runs on the sender thread. */
+  template < typename ImageType >
+  void
+  Transfer( const typename ImageType::Pointer & image, unsigned int viewIndex );
+
 private:
-  vtkClientSocket * m_Sock;
-  bool              m_Enabled;
-  bool              m_PromptUser;
+  vtkClientSocket *   m_Sock;
+  bool                m_Enabled;
+  bool                m_PromptUser;
+  unsigned int        m_ShrinkFactor;
+  DebugImageSendQueue m_SendQueue;
 };
 
 template < typename ImageType >
@@ -214,7 +319,13 @@ DebugImageViewerClient::Send( const typename ImageType::Pointer & image, unsigne
   {
     return;
   }
-  using TransferImageType = itk::Image< unsigned char, 3 >;
+  this->Enqueue< ImageType >( this->Snapshot< ImageType >( image ), viewIndex );
+}
+
+template < typename ImageType >
+void
+DebugImageViewerClient::Transfer( const typename ImageType::Pointer & image, unsigned int viewIndex )
+{
   using SizeType = TransferImageType::SizeType;
   using SpacingType = TransferImageType::SpacingType;
   using PointType = TransferImageType::PointType;
@@ -223,21 +334,13 @@ DebugImageViewerClient::Send( const typename ImageType::Pointer & image, unsigne
   TransferImageType::Pointer xferImage =
     DebugImageViewerUtil::ScaleAndCast< ImageType, TransferImageType >( image, 0, 255 );
   typename TransferImageType::DirectionType DesiredDirectionCos;
-  DesiredDirectionCos[0][0] = 1;
-  DesiredDirectionCos[0][1] = 0;
-  DesiredDirectionCos[0][2] = 0;
-  DesiredDirectionCos[1][0] = 0;
-  DesiredDirectionCos[1][1] = 1;
-  DesiredDirectionCos[1][2] = 0;
-  DesiredDirectionCos[2][0] = 0;
-  DesiredDirectionCos[2][1] = 0;
-  DesiredDirectionCos[2][2] = 1;
+  DesiredDirectionCos.SetIdentity();
   xferImage = DebugImageViewerUtil::OrientImage< TransferImageType >( xferImage, DesiredDirectionCos );
   //
   // get size
   SizeType size = xferImage->GetLargestPossibleRegion().GetSize();
 
-  unsigned int bufferSize = size[0] * size[1] * size[2] * sizeof( typename TransferImageType::PixelType );
+  const size_t bufferSize = size[0] * size[1] * size[2] * sizeof( typename TransferImageType::PixelType );
 
   // get spacing
   SpacingType spacing = xferImage->GetSpacing();
@@ -246,30 +349,32 @@ DebugImageViewerClient::Send( const typename ImageType::Pointer & image, unsigne
     itk::SpatialOrientationAdapter().FromDirectionCosines( xferImage->GetDirection() );
   // get origin
   PointType origin = xferImage->GetOrigin();
+
+  // pack the header so the whole message goes out in two socket writes
+  std::vector< char > header;
+  auto                append = [&header]( const void * data, size_t length ) {
+    const char * bytes = static_cast< const char * >( data );
+    header.insert( header.end(), bytes, bytes + length );
+  };
   for ( unsigned int i = 0; i < 3; i++ )
   {
-    this->m_Sock->Send( &size[i], sizeof( SizeType::SizeValueType ) );
+    append( &size[i], sizeof( SizeType::SizeValueType ) );
   }
   for ( unsigned int i = 0; i < 3; i++ )
   {
-    this->m_Sock->Send( &spacing[i], sizeof( SpacingType::ValueType ) );
+    append( &spacing[i], sizeof( SpacingType::ValueType ) );
   }
-  this->m_Sock->Send( &orientation, sizeof( orientation ) );
+  append( &orientation, sizeof( orientation ) );
   // send origin
   for ( unsigned int i = 0; i < 3; i++ )
   {
     double x = origin[i];
-    this->m_Sock->Send( &x, sizeof( double ) );
+    append( &x, sizeof( double ) );
   }
-  this->m_Sock->Send( &viewIndex, sizeof( viewIndex ) );
+  append( &viewIndex, sizeof( viewIndex ) );
+  this->m_Sock->Send( header.data(), static_cast< int >( header.size() ) );
   // transfer image pixels
-  this->m_Sock->Send( xferImage->GetBufferPointer(), bufferSize );
-  //   std::cerr << "DebugImageViewer: size = " << size
-  //             << " spacing = " << spacing << std::endl
-  //             << "orientation = " << orientation
-  //             << " viewIndex = " <<  " bufferSize " << bufferSize
-  //             << std::endl;
-  //   std::cerr.flush();
+  this->m_Sock->Send( xferImage->GetBufferPointer(), static_cast< int >( bufferSize ) );
 }
 
 template < typename ImageType >
@@ -293,7 +398,12 @@ DebugImageViewerClient::Send( const typename ImageType::Pointer & image, unsigne
   {
     destIt.Set( sourceIt.Get()[vectorIndex] );
   }
-  this->Send< ScalarImageType >( scalarImage, viewIndex );
+  // the extracted component is already a private copy; only shrink it if requested
+  if ( m_ShrinkFactor > 1 )
+  {
+    scalarImage = this->Snapshot< ScalarImageType >( scalarImage );
+  }
+  this->Enqueue< ScalarImageType >( scalarImage, viewIndex );
 }
 
 #  endif // USE_DebugImageViewer
@@ -201,7 +201,8 @@ GenericTransformImage( InputImageType const * const
                        typename InputImageType::PixelType                    suggestedDefaultValue, // NOTE:  This is
                                                                                                     // ignored in the
                                                                                                     // case of binary
-                                                                                                    // image!
+                                                                                                    // image, except
+                                                                                                    // for LabelVoting!
                        const std::string & interpolationMode, const bool binaryFlag );
 
 #ifndef ITK_MANUAL_INSTANTIATION
@@ -22,6 +22,7 @@
 #include <iostream>
 #include "GenericTransformImage.h"
 #include "itkResampleInPlaceImageFilter.h"
+#include "itkLabelVotingInterpolateImageFunction.h"
 #include "itkConstantBoundaryCondition.h"
 #include "itkIO.h"
 
@@ -185,10 +186,15 @@ GetInterpolatorFromString( const std::string & interpolationMode )
                                                                                  TInterpolatorPrecisionType >;
     return ( InterpolatorType::New() ).GetPointer();
   }
+  else if ( interpolationMode == "LabelVoting" )
+  {
+    using InterpolatorType = typename itk::LabelVotingInterpolateImageFunction< InputImageType, TInterpolatorPrecisionType >;
+    return ( InterpolatorType::New() ).GetPointer();
+  }
   else
   {
     std::cout << "Error: Invalid interpolation mode specified -" << interpolationMode << "- " << std::endl;
-    std::cout << "\tValid modes: NearestNeighbor, Linear, BSpline, WindowedSinc" << std::endl;
+    std::cout << "\tValid modes: NearestNeighbor, Linear, BSpline, WindowedSinc, LabelVoting" << std::endl;
   }
   return nullptr;
 }
@@ -202,7 +208,8 @@ GenericTransformImage( InputImageType const * const
                        typename InputImageType::PixelType                    suggestedDefaultValue, // NOTE:  This is
                                                                                                     // ignored in the
                                                                                                     // case of binary
-                                                                                                    // image!
+                                                                                                    // image, except
+                                                                                                    // for LabelVoting!
                        const std::string & interpolationMode, const bool binaryFlag )
 {
   // FIRST will need to convert binary image to signed distance in case
@@ -210,9 +217,27 @@ GenericTransformImage( InputImageType const * const
 
   typename InputImageType::ConstPointer PrincipalOperandImage;
 
+  // LabelVoting resamples every label of the operand in one pass, so binary
+  // images do not need the signed distance map round trip.
+  const bool labelVotingFlag = ( interpolationMode == "LabelVoting" );
+
+  if ( binaryFlag && labelVotingFlag )
+  {
+    // Vote on the 0/1 mask rather than on the raw labels, so that points
+    // outside the operand keep the caller's default value untouched.
+    using BinaryThresholdFilterType = itk::BinaryThresholdImageFilter< InputImageType, InputImageType >;
+    typename BinaryThresholdFilterType::Pointer initialFilter = BinaryThresholdFilterType::New();
+    initialFilter->SetInput( OperandImage );
+    initialFilter->SetOutsideValue( 1 );
+    initialFilter->SetInsideValue( 0 );
+    initialFilter->SetLowerThreshold( 0 );
+    initialFilter->SetUpperThreshold( 0 );
+    initialFilter->Update();
+    PrincipalOperandImage = initialFilter->GetOutput();
+  }
   // Splice in a case for dealing with binary images,
   // where signed distance maps are warped and thresholds created.
-  if ( binaryFlag )
+  else if ( binaryFlag )
   {
     if ( interpolationMode == "NearestNeighbor" )
     {
@@ -394,7 +419,7 @@ GenericTransformImage( InputImageType const * const
 
   typename InputImageType::Pointer FinalTransformedImage;
 
-  if ( binaryFlag )
+  if ( binaryFlag && !labelVotingFlag )
   {
     // A special case for dealing with binary images
     // where signed distance maps are warped and thresholds created
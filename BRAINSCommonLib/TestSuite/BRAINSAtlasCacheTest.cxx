@@ -0,0 +1,138 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "BRAINSAtlasCache.h"
+#include "itkIO.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using ImageType = itk::Image< float, 3 >;
+
+static bool
+SameImage( const ImageType * a, const ImageType * b )
+{
+  return a->GetLargestPossibleRegion() == b->GetLargestPossibleRegion() && a->GetSpacing() == b->GetSpacing() &&
+         a->GetOrigin() == b->GetOrigin() && a->GetDirection() == b->GetDirection() &&
+         std::equal( a->GetBufferPointer(),
+                     a->GetBufferPointer() + a->GetLargestPossibleRegion().GetNumberOfPixels(),
+                     b->GetBufferPointer() );
+}
+
+static std::vector< char >
+ReadFile( const std::string & fileName )
+{
+  std::ifstream in( fileName.c_str(), std::ios::binary );
+  return std::vector< char >( std::istreambuf_iterator< char >( in ), std::istreambuf_iterator< char >() );
+}
+
+int
+main( int argc, char * argv[] )
+{
+  if ( argc < 2 )
+  {
+    std::cerr << "Usage: " << argv[0] << " <outputDirectory>" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string directory = argv[1];
+  const std::string atlasFileName = directory + "/BRAINSAtlasCacheTest.nii.gz";
+  const std::string cacheDirectory = directory + "/BRAINSAtlasCacheTestCache";
+
+  ImageType::SizeType size;
+  size[0] = 31;
+  size[1] = 27;
+  size[2] = 19;
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions( size );
+  ImageType::SpacingType spacing;
+  spacing[0] = 1.0;
+  spacing[1] = 1.25;
+  spacing[2] = 0.75;
+  image->SetSpacing( spacing );
+  ImageType::PointType origin;
+  origin[0] = -12.5;
+  origin[1] = 3.0;
+  origin[2] = 100.125;
+  image->SetOrigin( origin );
+  image->Allocate();
+  for ( size_t i = 0; i < image->GetLargestPossibleRegion().GetNumberOfPixels(); ++i )
+  {
+    image->GetBufferPointer()[i] = static_cast< float >( ( i % 997 ) * 0.5 );
+  }
+  itkUtil::WriteImage< ImageType >( image, atlasFileName );
+  {
+    std::ofstream md5( ( atlasFileName + ".md5" ).c_str() );
+    md5 << "0123456789abcdef0123456789abcdef" << std::endl;
+  }
+  const std::string cacheFileName = cacheDirectory + "/0123456789abcdef0123456789abcdef_float_3D.atlascache";
+  itksys::SystemTools::RemoveADirectory( cacheDirectory );
+  BRAINSUtils::AtlasCache::SetCacheDirectory( cacheDirectory );
+
+  // The first read fills the cache, the second one only maps it.
+  const ImageType::Pointer firstRead = BRAINSUtils::AtlasCache::ReadImage< ImageType >( atlasFileName );
+  if ( !itksys::SystemTools::FileExists( cacheFileName, true ) )
+  {
+    std::cerr << "The cache entry " << cacheFileName << " was not written" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::vector< char > cacheContent = ReadFile( cacheFileName );
+  const ImageType::Pointer  secondRead = BRAINSUtils::AtlasCache::ReadImage< ImageType >( atlasFileName );
+  if ( !SameImage( image, firstRead ) || !SameImage( image, secondRead ) )
+  {
+    std::cerr << "The cached atlas did not read back identically" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Writing to a mapped image must neither change the cache nor other readers.
+  secondRead->FillBuffer( -1.0F );
+  if ( ReadFile( cacheFileName ) != cacheContent || !SameImage( image, firstRead ) )
+  {
+    std::cerr << "Writing to a cached atlas image changed the cache" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // A damaged entry is not used, the atlas is read from the file instead.
+  {
+    std::ofstream damaged( cacheFileName.c_str(), std::ios::binary | std::ios::trunc );
+    damaged << "BRAINSAtlasCache 1\nfloat\n3\n";
+  }
+  const ImageType::Pointer thirdRead = BRAINSUtils::AtlasCache::ReadImage< ImageType >( atlasFileName );
+  if ( !SameImage( image, thirdRead ) )
+  {
+    std::cerr << "A damaged cache entry was not replaced" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Without a checksum file the key comes from the file's path, size and time.
+  const std::string uncheckedFileName = directory + "/BRAINSAtlasCacheTestUnchecked.nii.gz";
+  itkUtil::WriteImage< ImageType >( image, uncheckedFileName );
+  const std::string uncheckedKey = BRAINSUtils::AtlasCache::GetContentKey( uncheckedFileName );
+  if ( uncheckedKey.size() != 32 || uncheckedKey != BRAINSUtils::AtlasCache::GetContentKey( uncheckedFileName ) ||
+       !BRAINSUtils::AtlasCache::GetContentKey( directory + "/BRAINSAtlasCacheTestMissing.nii.gz" ).empty() ||
+       !SameImage( image, BRAINSUtils::AtlasCache::ReadImage< ImageType >( uncheckedFileName ) ) )
+  {
+    std::cerr << "An atlas without a checksum file was not cached by its path" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
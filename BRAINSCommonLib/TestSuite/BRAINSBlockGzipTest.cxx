@@ -0,0 +1,202 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "BRAINSBlockGzip.h"
+#include "itkIO.h"
+#include "itk_zlib.h"
+#include "itkImageRegionConstIterator.h"
+#include <itksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using ImageType = itk::Image< float, 3 >;
+
+static int
+TestCodec( const std::string & directory )
+{
+  std::vector< char > data( 1000003 );
+  for ( size_t i = 0; i < data.size(); ++i )
+  {
+    data[i] = static_cast< char >( ( i % 7 == 0 ) ? ( i * 2654435761UL ) >> 13 : i / 1000 );
+  }
+  for ( const int level : { 0, 1, 6, 9 } )
+  {
+    std::vector< char > compressed;
+    std::vector< char > decompressed;
+    if ( !BRAINSUtils::BlockGzipCompress( data.data(), data.size(), level, compressed ) ||
+         !BRAINSUtils::IsBlockGzipStream( compressed.data(), compressed.size() ) ||
+         !BRAINSUtils::BlockGzipDecompress( compressed.data(), compressed.size(), decompressed ) ||
+         decompressed != data )
+    {
+      std::cerr << "Block gzip round trip failed at level " << level << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    // The multi-member stream must be readable by a standard gzip reader.
+    const std::string fileName = directory + "/BRAINSBlockGzipTest.gz";
+    {
+      std::ofstream out( fileName.c_str(), std::ios::binary );
+      out.write( compressed.data(), compressed.size() );
+    }
+    std::vector< char > gzipRead( data.size() + 1 );
+    gzFile              in = gzopen( fileName.c_str(), "rb" );
+    const int           readSize = gzread( in, gzipRead.data(), static_cast< unsigned int >( gzipRead.size() ) );
+    gzclose( in );
+    if ( readSize != static_cast< int >( data.size() ) || !std::equal( data.begin(), data.end(), gzipRead.begin() ) )
+    {
+      std::cerr << "gzread could not read the block gzip stream of level " << level << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    compressed[compressed.size() / 2] ^= 0x55;
+    if ( BRAINSUtils::BlockGzipDecompress( compressed.data(), compressed.size(), decompressed ) )
+    {
+      std::cerr << "A corrupt stream was not detected at level " << level << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+static ImageType::Pointer
+MakeTestImage()
+{
+  ImageType::SizeType size;
+  size[0] = 67;
+  size[1] = 53;
+  size[2] = 41;
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions( size );
+  ImageType::SpacingType spacing;
+  spacing[0] = 1.0;
+  spacing[1] = 1.5;
+  spacing[2] = 2.0;
+  image->SetSpacing( spacing );
+  image->Allocate();
+  for ( size_t i = 0; i < image->GetLargestPossibleRegion().GetNumberOfPixels(); ++i )
+  {
+    image->GetBufferPointer()[i] = static_cast< float >( ( i % 1021 ) * 0.25 );
+  }
+  return image;
+}
+
+static bool
+IsIdentical( const ImageType * image, const ImageType * readImage )
+{
+  return readImage->GetLargestPossibleRegion() == image->GetLargestPossibleRegion() &&
+         readImage->GetSpacing() == image->GetSpacing() &&
+         std::equal( image->GetBufferPointer(),
+                     image->GetBufferPointer() + image->GetLargestPossibleRegion().GetNumberOfPixels(),
+                     readImage->GetBufferPointer() );
+}
+
+static int
+TestImageRoundTrip( const std::string & fileName )
+{
+  const ImageType::Pointer image = MakeTestImage();
+  itkUtil::WriteImage< ImageType >( image, fileName );
+  std::ifstream       written( fileName.c_str(), std::ios::binary );
+  std::vector< char > prefix( 1 << 12 );
+  written.read( prefix.data(), prefix.size() );
+  const std::string prefixText( prefix.data(), static_cast< size_t >( written.gcount() ) );
+  const size_t      dataStart = ( prefixText.find( "\n\n" ) == std::string::npos ) ? 0 : prefixText.find( "\n\n" ) + 2;
+  if ( !BRAINSUtils::IsBlockGzipStream( prefix.data() + dataStart, prefixText.size() - dataStart ) )
+  {
+    std::cerr << fileName << " was not written as block gzip" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Read through the parallel path, and through the image IO's own gzip reader.
+  const ImageType::Pointer parallelRead = itkUtil::ReadImage< ImageType >( fileName );
+  using ReaderType = itk::ImageFileReader< ImageType >;
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName( fileName );
+  reader->Update();
+  for ( const ImageType * readImage : { parallelRead.GetPointer(), reader->GetOutput() } )
+  {
+    if ( !IsIdentical( image, readImage ) )
+    {
+      std::cerr << fileName << " did not read back identically" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+/** Without a writable staging directory the image IO must compress the file itself. */
+static int
+TestStagingFallback( const std::string & directory )
+{
+  std::string              temporaryDirectory;
+  const bool               hadTemporaryDirectory = itksys::SystemTools::GetEnv( "TMPDIR", temporaryDirectory );
+  const std::string        fileName = directory + "/BRAINSBlockGzipFallbackTest.nii.gz";
+  const ImageType::Pointer image = MakeTestImage();
+  itksys::SystemTools::PutEnv( "TMPDIR=" + directory + "/BRAINSBlockGzipMissingDirectory" );
+  try
+  {
+    itkUtil::WriteImage< ImageType >( image, fileName );
+  }
+  catch ( itk::ExceptionObject & err )
+  {
+    std::cerr << "Writing without a staging directory failed: " << err << std::endl;
+    return EXIT_FAILURE;
+  }
+  if ( hadTemporaryDirectory )
+  {
+    itksys::SystemTools::PutEnv( "TMPDIR=" + temporaryDirectory );
+  }
+  else
+  {
+    itksys::SystemTools::UnPutEnv( "TMPDIR" );
+  }
+
+  using ReaderType = itk::ImageFileReader< ImageType >;
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName( fileName );
+  reader->Update();
+  if ( !IsIdentical( image, reader->GetOutput() ) )
+  {
+    std::cerr << fileName << " did not read back identically" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int
+main( int argc, char * argv[] )
+{
+  if ( argc < 2 )
+  {
+    std::cerr << "Usage: " << argv[0] << " <outputDirectory>" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string directory = argv[1];
+  if ( TestCodec( directory ) != EXIT_SUCCESS ||
+       TestImageRoundTrip( directory + "/BRAINSBlockGzipTest.nii.gz" ) != EXIT_SUCCESS ||
+       TestImageRoundTrip( directory + "/BRAINSBlockGzipTest.nrrd" ) != EXIT_SUCCESS ||
+       TestStagingFallback( directory ) != EXIT_SUCCESS )
+  {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "BRAINSProfiler.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+int
+main( int, char ** )
+{
+  using BRAINSUtils::Profiler;
+  {
+    BRAINS_PROFILE_SCOPE( "NotRecorded" );
+  }
+  if ( !Profiler::GetInstance().GetStages().empty() )
+  {
+    std::cerr << "A disabled profiler recorded a stage." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Profiler::GetInstance().Enable();
+  {
+    BRAINS_PROFILE_SCOPE( "Outer" );
+    for ( int i = 0; i < 3; ++i )
+    {
+      BRAINS_PROFILE_SCOPE( "Inner" );
+    }
+  }
+  Profiler::GetInstance().Disable();
+
+  const Profiler::StageMapType stages = Profiler::GetInstance().GetStages();
+  if ( stages.size() != 2 || stages.count( "Outer" ) != 1 || stages.count( "Outer/Inner" ) != 1 )
+  {
+    std::cerr << "Expected the stages Outer and Outer/Inner." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if ( stages.at( "Outer" ).m_Calls != 1 || stages.at( "Outer/Inner" ).m_Calls != 3 )
+  {
+    std::cerr << "Wrong call counts." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if ( stages.at( "Outer" ).m_WallSeconds < stages.at( "Outer/Inner" ).m_WallSeconds )
+  {
+    std::cerr << "A stage took less time than the stages it encloses." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::ostringstream json;
+  Profiler::GetInstance().WriteJSON( json );
+  if ( json.str().find( "\"traceEvents\"" ) == std::string::npos ||
+       json.str().find( "\"path\": \"Outer/Inner\", \"calls\": 3" ) == std::string::npos )
+  {
+    std::cerr << "Unexpected JSON:" << std::endl << json.str() << std::endl;
+    return EXIT_FAILURE;
+  }
+  if ( json.str().find( "\"processCPUSeconds\"" ) == std::string::npos )
+  {
+    std::cerr << "The JSON has no process CPU time:" << std::endl << json.str() << std::endl;
+    return EXIT_FAILURE;
+  }
+  Profiler::GetInstance().Print( std::cout );
+
+  // Stages of worker threads nest under the stage that started them only
+  // when the parent path is handed over.
+  Profiler::GetInstance().Enable();
+  {
+    BRAINS_PROFILE_SCOPE( "Parallel" );
+    const std::string parentPath = Profiler::GetCurrentPath();
+    std::thread       nested( [&parentPath] {
+      const BRAINSUtils::ScopedProfileParent profileParent( parentPath );
+      BRAINS_PROFILE_SCOPE( "Task" );
+    } );
+    nested.join();
+    std::thread detached( [] { BRAINS_PROFILE_SCOPE( "Detached" ); } );
+    detached.join();
+  }
+  Profiler::GetInstance().Disable();
+  if ( !Profiler::GetCurrentPath().empty() )
+  {
+    std::cerr << "A stage is still open on the main thread." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const Profiler::StageMapType threadStages = Profiler::GetInstance().GetStages();
+  if ( threadStages.size() != 3 || threadStages.count( "Parallel" ) != 1 ||
+       threadStages.count( "Parallel/Task" ) != 1 || threadStages.count( "Detached" ) != 1 )
+  {
+    std::cerr << "Expected the stages Parallel, Parallel/Task and Detached." << std::endl;
+    Profiler::GetInstance().Print( std::cerr );
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "DebugImageSendQueue.h"
+
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+int
+main( int, char *[] )
+{
+  int status = EXIT_SUCCESS;
+
+  std::mutex         sentMutex;
+  std::vector< int > sent;
+  auto               record = [&sentMutex, &sent]( int id ) {
+    std::lock_guard< std::mutex > lock( sentMutex );
+    sent.push_back( id );
+  };
+
+  DebugImageSendQueue queue;
+  queue.SetMaxQueueLength( 2 );
+  queue.Start();
+
+  // Hold the sender inside message 0 so the following messages pile up.
+  std::promise< void > started;
+  std::promise< void > release;
+  std::shared_future< void > gate = release.get_future().share();
+  queue.Push( [&started, gate, &record]() {
+    started.set_value();
+    gate.wait();
+    record( 0 );
+  } );
+  started.get_future().wait();
+  for ( int id = 1; id <= 5; ++id )
+  {
+    queue.Push( [id, &record]() { record( id ); } );
+  }
+  release.set_value();
+  queue.Flush();
+
+  // Messages 1-3 were dropped to keep at most 2 pending; 4 and 5 ran in order.
+  const std::vector< int > expected = { 0, 4, 5 };
+  if ( sent != expected )
+  {
+    std::cerr << "Expected messages 0 4 5 to be sent, got";
+    for ( const int id : sent )
+    {
+      std::cerr << " " << id;
+    }
+    std::cerr << std::endl;
+    status = EXIT_FAILURE;
+  }
+  if ( queue.GetNumberOfDroppedMessages() != 3 )
+  {
+    std::cerr << "Expected 3 dropped messages, got " << queue.GetNumberOfDroppedMessages() << std::endl;
+    status = EXIT_FAILURE;
+  }
+
+  // A throwing message must not take the sender down.
+  queue.SetMaxQueueLength( 8 );
+  queue.Push( []() { throw std::runtime_error( "expected test failure" ); } );
+  queue.Push( []() { throw 42; } );
+  queue.Push( [&record]() { record( 6 ); } );
+  queue.Flush();
+  if ( sent.size() != 4 || sent.back() != 6 )
+  {
+    std::cerr << "The sender stopped after a failing message" << std::endl;
+    status = EXIT_FAILURE;
+  }
+  if ( queue.GetNumberOfFailedMessages() != 2 )
+  {
+    std::cerr << "Expected 2 failed messages, got " << queue.GetNumberOfFailedMessages() << std::endl;
+    status = EXIT_FAILURE;
+  }
+  if ( queue.GetNumberOfDroppedMessages() != 3 )
+  {
+    std::cerr << "Nothing should have been dropped below the queue length" << std::endl;
+    status = EXIT_FAILURE;
+  }
+
+  // Stop discards what is pending and Flush no longer waits.
+  queue.Stop();
+  queue.Push( [&record]() { record( 7 ); } );
+  queue.Flush();
+  queue.Stop();
+  if ( sent.back() == 7 )
+  {
+    std::cerr << "A message was sent after Stop" << std::endl;
+    status = EXIT_FAILURE;
+  }
+
+  return status;
+}
@@ -0,0 +1,185 @@
+#include <itkVectorImage.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+
+#include "itkDiffusionTensor3DReconstructionWithMaskImageFilter.h"
+
+#include <algorithm>
+#include <cmath>
+
+using TensorFilterType = itk::DiffusionTensor3DReconstructionWithMaskImageFilter< float, float, double >;
+using GradientImagesType = TensorFilterType::GradientImagesType;
+using TensorImageType = TensorFilterType::TensorImageType;
+using TensorPixelType = TensorFilterType::TensorPixelType;
+
+static const double BValue = 1000.0;
+
+// One baseline followed by twelve non-collinear gradient directions.
+static TensorFilterType::GradientDirectionContainerType::Pointer
+MakeGradientDirections()
+{
+  const double directions[][3] = { { 0, 0, 0 },  { 1, 0, 0 },  { 0, 1, 0 },  { 0, 0, 1 },  { 1, 1, 0 },
+                                   { 1, 0, 1 },  { 0, 1, 1 },  { 1, -1, 0 }, { 1, 0, -1 }, { 0, 1, -1 },
+                                   { 1, 1, 1 },  { -1, 1, 1 }, { 1, -1, 1 } };
+  TensorFilterType::GradientDirectionContainerType::Pointer container =
+    TensorFilterType::GradientDirectionContainerType::New();
+  unsigned int index = 0;
+  for ( const auto & d : directions )
+  {
+    TensorFilterType::GradientDirectionType direction;
+    direction[0] = d[0];
+    direction[1] = d[1];
+    direction[2] = d[2];
+    container->InsertElement( index++, direction );
+  }
+  return container;
+}
+
+// Noise free Stejskal-Tanner signals of a single tensor everywhere.
+static GradientImagesType::Pointer
+MakeDWI( const TensorPixelType & truth, const TensorFilterType::GradientDirectionContainerType * directions )
+{
+  GradientImagesType::SizeType size;
+  size.Fill( 6 );
+  GradientImagesType::Pointer dwi = GradientImagesType::New();
+  dwi->SetRegions( size );
+  dwi->SetVectorLength( directions->Size() );
+  dwi->Allocate();
+
+  GradientImagesType::PixelType signal( directions->Size() );
+  for ( unsigned int i = 0; i < directions->Size(); ++i )
+  {
+    TensorFilterType::GradientDirectionType g = directions->ElementAt( i );
+    double                                  gDg = 0.0;
+    if ( g.two_norm() > 0 )
+    {
+      g.normalize();
+      for ( unsigned int r = 0; r < 3; ++r )
+      {
+        for ( unsigned int c = 0; c < 3; ++c )
+        {
+          gDg += g[r] * truth( r, c ) * g[c];
+        }
+      }
+    }
+    signal[i] = static_cast< float >( 1000.0 * std::exp( -BValue * gDg ) );
+  }
+  dwi->FillBuffer( signal );
+  return dwi;
+}
+
+static TensorImageType::Pointer
+Reconstruct( const TensorPixelType & truth, const TensorFilterType::EstimationMethodType method,
+             const bool constrain, const unsigned int numberOfWorkUnits )
+{
+  // SetGradientImage normalizes the directions in place, so each run gets its own.
+  TensorFilterType::GradientDirectionContainerType::Pointer directions = MakeGradientDirections();
+  GradientImagesType::Pointer                               dwi = MakeDWI( truth, directions );
+
+  TensorFilterType::Pointer filter = TensorFilterType::New();
+  filter->SetGradientImage( directions, dwi );
+  filter->SetBValue( BValue );
+  filter->SetThreshold( 1 );
+  filter->SetEstimationMethod( method );
+  filter->SetConstrainPositiveDefinite( constrain );
+  filter->SetNumberOfWorkUnits( numberOfWorkUnits );
+  filter->Update();
+  return filter->GetOutput();
+}
+
+static double
+MaxTensorError( const TensorImageType * image, const TensorPixelType & truth )
+{
+  double maxError = 0.0;
+  for ( itk::ImageRegionConstIterator< TensorImageType > it( image, image->GetLargestPossibleRegion() ); !it.IsAtEnd();
+        ++it )
+  {
+    for ( unsigned int k = 0; k < 6; ++k )
+    {
+      maxError = std::max( maxError, std::abs( it.Get()[k] - truth[k] ) );
+    }
+  }
+  return maxError;
+}
+
+int
+main( int, char *[] )
+{
+  int failures = 0;
+
+  TensorPixelType truth;
+  truth( 0, 0 ) = 1.7e-3;
+  truth( 0, 1 ) = 0.1e-3;
+  truth( 0, 2 ) = -0.05e-3;
+  truth( 1, 1 ) = 0.4e-3;
+  truth( 1, 2 ) = 0.02e-3;
+  truth( 2, 2 ) = 0.3e-3;
+
+  // The linear fit must be exact for noise free data, and independent of threading.
+  TensorImageType::Pointer singleThreaded = Reconstruct( truth, TensorFilterType::LinearLeastSquares, false, 1 );
+  TensorImageType::Pointer multiThreaded = Reconstruct( truth, TensorFilterType::LinearLeastSquares, false, 8 );
+  if ( MaxTensorError( singleThreaded, truth ) > 1e-6 )
+  {
+    std::cout << "Linear least squares error " << MaxTensorError( singleThreaded, truth ) << std::endl;
+    ++failures;
+  }
+  for ( itk::ImageRegionConstIterator< TensorImageType > it1( singleThreaded, singleThreaded->GetLargestPossibleRegion() ),
+        it2( multiThreaded, multiThreaded->GetLargestPossibleRegion() );
+        !it1.IsAtEnd();
+        ++it1, ++it2 )
+  {
+    if ( it1.Get() != it2.Get() )
+    {
+      std::cout << "Multi-threaded result differs at " << it1.GetIndex() << std::endl;
+      ++failures;
+      break;
+    }
+  }
+
+  TensorImageType::Pointer weighted = Reconstruct( truth, TensorFilterType::WeightedLeastSquares, false, 4 );
+  if ( MaxTensorError( weighted, truth ) > 1e-6 )
+  {
+    std::cout << "Weighted least squares error " << MaxTensorError( weighted, truth ) << std::endl;
+    ++failures;
+  }
+
+  // A tensor with a negative eigenvalue must come out positive definite when constrained.
+  TensorPixelType indefinite( 0.0 );
+  indefinite( 0, 0 ) = 1.0e-3;
+  indefinite( 1, 1 ) = 0.5e-3;
+  indefinite( 2, 2 ) = -0.2e-3;
+  TensorImageType::Pointer unconstrained = Reconstruct( indefinite, TensorFilterType::LinearLeastSquares, false, 4 );
+  TensorImageType::Pointer constrained = Reconstruct( indefinite, TensorFilterType::LinearLeastSquares, true, 4 );
+
+  TensorImageType::IndexType center;
+  center.Fill( 3 );
+  TensorPixelType::EigenValuesArrayType unconstrainedEigenValues;
+  unconstrained->GetPixel( center ).ComputeEigenValues( unconstrainedEigenValues );
+  TensorPixelType::EigenValuesArrayType constrainedEigenValues;
+  constrained->GetPixel( center ).ComputeEigenValues( constrainedEigenValues );
+  if ( unconstrainedEigenValues[0] >= 0.0 )
+  {
+    std::cout << "Expected a negative eigenvalue without the constraint" << std::endl;
+    ++failures;
+  }
+  for ( unsigned int e = 0; e < 3; ++e )
+  {
+    if ( constrainedEigenValues[e] <= 0.0 )
+    {
+      std::cout << "Constrained eigenvalue " << e << " is " << constrainedEigenValues[e] << std::endl;
+      ++failures;
+    }
+  }
+  if ( std::abs( constrainedEigenValues[2] - 1.0e-3 ) > 1e-6 || std::abs( constrainedEigenValues[1] - 0.5e-3 ) > 1e-6 )
+  {
+    std::cout << "Constraint changed the positive eigenvalues: " << constrainedEigenValues << std::endl;
+    ++failures;
+  }
+
+  if ( failures > 0 )
+  {
+    std::cout << failures << " failures" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
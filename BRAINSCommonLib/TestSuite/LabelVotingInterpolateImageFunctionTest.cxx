@@ -0,0 +1,102 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include <itkImage.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkResampleImageFilter.h>
+#include <itkTranslationTransform.h>
+
+#include "itkLabelVotingInterpolateImageFunction.h"
+
+int
+main( int, char *[] )
+{
+  using LabelImageType = itk::Image< float, 3 >;
+  using InterpolatorType = itk::LabelVotingInterpolateImageFunction< LabelImageType, double >;
+  using ResampleFilterType = itk::ResampleImageFilter< LabelImageType, LabelImageType >;
+  using TransformType = itk::TranslationTransform< double, 3 >;
+
+  // Three slabs along x: label 0 for x < 4, label 7 for 4 <= x < 8, label 3 beyond.
+  LabelImageType::SizeType size;
+  size.Fill( 12 );
+  LabelImageType::Pointer labelImage = LabelImageType::New();
+  labelImage->SetRegions( size );
+  labelImage->Allocate();
+  for ( itk::ImageRegionIterator< LabelImageType > it( labelImage, labelImage->GetLargestPossibleRegion() );
+        !it.IsAtEnd();
+        ++it )
+  {
+    const long x = it.GetIndex()[0];
+    it.Set( ( x < 4 ) ? 0.0F : ( ( x < 8 ) ? 7.0F : 3.0F ) );
+  }
+
+  int failures = 0;
+
+  // Direct evaluation: interior points copy, boundary points vote.
+  InterpolatorType::Pointer interpolator = InterpolatorType::New();
+  interpolator->SetInputImage( labelImage );
+  InterpolatorType::ContinuousIndexType cindex;
+  cindex[1] = 5.3;
+  cindex[2] = 5.7;
+  const double probes[][2] = { { 1.5, 0 }, { 3.2, 0 }, { 3.8, 7 }, { 7.4, 7 }, { 7.6, 3 }, { 10.9, 3 }, { 11.0, 3 } };
+  for ( const auto & probe : probes )
+  {
+    cindex[0] = probe[0];
+    const double value = interpolator->EvaluateAtContinuousIndex( cindex );
+    if ( value != probe[1] )
+    {
+      std::cout << "Label vote at x=" << probe[0] << " gave " << value << " expected " << probe[1] << std::endl;
+      ++failures;
+    }
+  }
+
+  // Resampling with a sub-voxel shift must only produce labels that exist in the input.
+  TransformType::Pointer     shift = TransformType::New();
+  TransformType::OutputVectorType offset;
+  offset.Fill( 0.35 );
+  shift->SetOffset( offset );
+
+  ResampleFilterType::Pointer resampler = ResampleFilterType::New();
+  resampler->SetInput( labelImage );
+  resampler->SetTransform( shift );
+  resampler->SetInterpolator( InterpolatorType::New() );
+  resampler->SetOutputParametersFromImage( labelImage );
+  resampler->SetDefaultPixelValue( 0 );
+  resampler->Update();
+  for ( itk::ImageRegionConstIterator< LabelImageType > it( resampler->GetOutput(),
+                                                          resampler->GetOutput()->GetLargestPossibleRegion() );
+        !it.IsAtEnd();
+        ++it )
+  {
+    const float value = it.Get();
+    if ( value != 0.0F && value != 7.0F && value != 3.0F )
+    {
+      std::cout << "Invented label " << value << " at " << it.GetIndex() << std::endl;
+      ++failures;
+    }
+  }
+
+  if ( failures > 0 )
+  {
+    std::cout << "LabelVotingInterpolateImageFunctionTest FAILED with " << failures << " errors." << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "LabelVotingInterpolateImageFunctionTest PASSED." << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkMattesMutualInformationFixedBinImageToImageMetricv4.h"
+#include "itkMattesMutualInformationImageToImageMetricv4.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkTranslationTransform.h"
+#include "itkMultiThreaderBase.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+using ImageType = itk::Image< float, 3 >;
+using TransformType = itk::TranslationTransform< double, 3 >;
+using ReferenceMetricType = itk::MattesMutualInformationImageToImageMetricv4< ImageType, ImageType >;
+using FixedBinMetricType = itk::MattesMutualInformationFixedBinImageToImageMetricv4< ImageType, ImageType >;
+
+static ImageType::Pointer
+MakeImage( bool inverted )
+{
+  ImageType::SizeType size;
+  size.Fill( 32 );
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions( size );
+  image->Allocate();
+  for ( itk::ImageRegionIteratorWithIndex< ImageType > it( image, image->GetLargestPossibleRegion() ); !it.IsAtEnd();
+        ++it )
+  {
+    const ImageType::IndexType & idx = it.GetIndex();
+    const double                 r2 = ( idx[0] - 15.5 ) * ( idx[0] - 15.5 ) + ( idx[1] - 13.0 ) * ( idx[1] - 13.0 ) +
+                      ( idx[2] - 17.0 ) * ( idx[2] - 17.0 );
+    const double value = 100.0 * std::exp( -r2 / 60.0 ) + 0.5 * idx[0];
+    // A monotone intensity remapping keeps the mutual information high.
+    it.Set( static_cast< float >( inverted ? 150.0 - value : value ) );
+  }
+  return image;
+}
+
+template < typename TMetric >
+static void
+Evaluate( TMetric *                          metric,
+          const ImageType *                  fixed,
+          const ImageType *                  moving,
+          TransformType *                    transform,
+          double &                           value,
+          typename TMetric::DerivativeType & derivative )
+{
+  metric->SetNumberOfHistogramBins( 32 );
+  metric->SetUseFixedImageGradientFilter( false );
+  metric->SetUseMovingImageGradientFilter( false );
+  metric->SetFixedImage( fixed );
+  metric->SetMovingImage( moving );
+  metric->SetVirtualDomainFromImage( fixed );
+  metric->SetMovingTransform( transform );
+  metric->Initialize();
+  metric->GetValueAndDerivative( value, derivative );
+}
+
+int
+main( int, char *[] )
+{
+  ImageType::Pointer fixed = MakeImage( false );
+  ImageType::Pointer moving = MakeImage( true );
+
+  TransformType::Pointer          transform = TransformType::New();
+  TransformType::OutputVectorType offset;
+  offset[0] = 0.7;
+  offset[1] = -0.4;
+  offset[2] = 1.3;
+  transform->SetOffset( offset );
+
+  int failures = 0;
+
+  double                              referenceValue = 0.0;
+  ReferenceMetricType::DerivativeType referenceDerivative;
+  ReferenceMetricType::Pointer        reference = ReferenceMetricType::New();
+  Evaluate( reference.GetPointer(), fixed, moving, transform, referenceValue, referenceDerivative );
+
+  double                             value = 0.0;
+  FixedBinMetricType::DerivativeType derivative;
+  FixedBinMetricType::Pointer        metric = FixedBinMetricType::New();
+  Evaluate( metric.GetPointer(), fixed, moving, transform, value, derivative );
+
+  std::cout << "Mattes value " << referenceValue << " derivative " << referenceDerivative << std::endl;
+  std::cout << "Fixed-bin value " << value << " derivative " << derivative << std::endl;
+  if ( std::abs( value - referenceValue ) > 1e-3 * std::abs( referenceValue ) )
+  {
+    std::cout << "Metric value differs from MattesMutualInformationImageToImageMetricv4." << std::endl;
+    ++failures;
+  }
+  const double referenceNorm = referenceDerivative.magnitude();
+  for ( unsigned int i = 0; i < derivative.Size(); ++i )
+  {
+    if ( std::abs( derivative[i] - referenceDerivative[i] ) > 1e-2 * referenceNorm )
+    {
+      std::cout << "Derivative component " << i << " differs from the reference." << std::endl;
+      ++failures;
+    }
+  }
+
+  // The block-ordered merge must not depend on the number of threads.
+  const itk::ThreadIdType defaultThreads = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+  itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads( 1 );
+  metric->SetSamplesPerBlock( 1000 );
+  double                             singleValue = 0.0;
+  FixedBinMetricType::DerivativeType singleDerivative;
+  metric->Initialize();
+  metric->GetValueAndDerivative( singleValue, singleDerivative );
+  itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads( 7 );
+  double                             multiValue = 0.0;
+  FixedBinMetricType::DerivativeType multiDerivative;
+  metric->GetValueAndDerivative( multiValue, multiDerivative );
+  itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads( defaultThreads );
+  if ( singleValue != multiValue || singleDerivative != multiDerivative )
+  {
+    std::cout << "Results depend on the number of threads: " << singleValue << " vs " << multiValue << std::endl;
+    ++failures;
+  }
+  if ( metric->GetNumberOfValidSamples() == 0 || metric->GetNumberOfSamples() != 32 * 32 * 32 )
+  {
+    std::cout << "Unexpected sample counts." << std::endl;
+    ++failures;
+  }
+
+  if ( failures > 0 )
+  {
+    std::cout << "MattesMutualInformationFixedBinMetricTest FAILED with " << failures << " errors." << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "MattesMutualInformationFixedBinMetricTest passed." << std::endl;
+  return EXIT_SUCCESS;
+}
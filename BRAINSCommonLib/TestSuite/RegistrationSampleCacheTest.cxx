@@ -0,0 +1,130 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkRegistrationSampleCache.h"
+#include "itkImageMaskSpatialObject.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkMattesMutualInformationImageToImageMetricv4.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using ImageType = itk::Image< float, 3 >;
+using MaskImageType = itk::Image< unsigned char, 3 >;
+using MaskSpatialObjectType = itk::ImageMaskSpatialObject< 3 >;
+using SampleCacheType = itk::RegistrationSampleCache< ImageType, ImageType >;
+using RegistrationType = SampleCacheType::RegistrationType;
+using MetricType = itk::MattesMutualInformationImageToImageMetricv4< ImageType, ImageType, ImageType, double >;
+
+#define CHECK( cond )                                                                                                  \
+  if ( !( cond ) )                                                                                                     \
+  {                                                                                                                    \
+    std::cout << "FAILED line " << __LINE__ << ": " #cond << std::endl;                                                \
+    ++failures;                                                                                                        \
+  }
+
+int
+main( int, char *[] )
+{
+  ImageType::SizeType size;
+  size.Fill( 20 );
+  ImageType::Pointer fixed = ImageType::New();
+  fixed->SetRegions( size );
+  fixed->Allocate();
+  for ( itk::ImageRegionIteratorWithIndex< ImageType > it( fixed, fixed->GetLargestPossibleRegion() ); !it.IsAtEnd();
+        ++it )
+  {
+    it.Set( static_cast< float >( it.GetIndex()[0] + 2 * it.GetIndex()[1] ) );
+  }
+  std::vector< ImageType::Pointer > fixedImages( 1, fixed );
+
+  // Mask covering the x < 10 half of the image.
+  MaskImageType::Pointer maskImage = MaskImageType::New();
+  maskImage->SetRegions( size );
+  maskImage->Allocate();
+  for ( itk::ImageRegionIteratorWithIndex< MaskImageType > it( maskImage, maskImage->GetLargestPossibleRegion() );
+        !it.IsAtEnd();
+        ++it )
+  {
+    it.Set( it.GetIndex()[0] < 10 ? 1 : 0 );
+  }
+  MaskSpatialObjectType::Pointer mask = MaskSpatialObjectType::New();
+  mask->SetImage( maskImage );
+  mask->Update();
+
+  int                                         failures = 0;
+  const SampleCacheType::FixedImageMaskType * noMask = nullptr;
+  SampleCacheType::Pointer                    cache = SampleCacheType::New();
+
+  // Drawing once and asking again with identical inputs must not redraw.
+  cache->UpdateSamples( fixedImages, noMask, RegistrationType::REGULAR, 0.1 );
+  CHECK( cache->HasSamples() );
+  CHECK( cache->GetNumberOfSampleUpdates() == 1 );
+  const SampleCacheType::SampledPointSetType * firstSet = cache->GetSampledPointSet();
+  const itk::SizeValueType                     numberOfRegularSamples = firstSet->GetNumberOfPoints();
+  CHECK( numberOfRegularSamples == 800 );
+  cache->UpdateSamples( fixedImages, noMask, RegistrationType::REGULAR, 0.1 );
+  CHECK( cache->GetNumberOfSampleUpdates() == 1 );
+  CHECK( cache->GetSampledPointSet() == firstSet );
+
+  // Installing the samples on a metric replaces per-stage sampling.
+  MetricType::Pointer metric = MetricType::New();
+  CHECK( cache->ApplyToMetric( metric ) );
+  CHECK( metric->GetUseSampledPointSet() );
+  CHECK( metric->GetFixedSampledPointSet() == firstSet );
+
+  // Sampling parameters and the fixed mask invalidate the samples.
+  cache->UpdateSamples( fixedImages, noMask, RegistrationType::REGULAR, 0.2 );
+  CHECK( cache->GetNumberOfSampleUpdates() == 2 );
+  cache->UpdateSamples( fixedImages, mask, RegistrationType::REGULAR, 0.2 );
+  CHECK( cache->GetNumberOfSampleUpdates() == 3 );
+  for ( itk::SizeValueType i = 0; i < cache->GetSampledPointSet()->GetNumberOfPoints(); ++i )
+  {
+    CHECK( mask->IsInsideInWorldSpace( cache->GetSampledPointSet()->GetPoint( i ) ) );
+  }
+  cache->UpdateSamples( fixedImages, mask, RegistrationType::REGULAR, 0.2 );
+  CHECK( cache->GetNumberOfSampleUpdates() == 3 );
+  mask->Modified();
+  cache->UpdateSamples( fixedImages, mask, RegistrationType::REGULAR, 0.2 );
+  CHECK( cache->GetNumberOfSampleUpdates() == 4 );
+  cache->UpdateSamples( fixedImages, mask, RegistrationType::RANDOM, 0.2 );
+  CHECK( cache->GetNumberOfSampleUpdates() == 5 );
+  CHECK( cache->HasSamples() );
+
+  // Dense sampling leaves the metric alone.
+  cache->UpdateSamples( fixedImages, mask, RegistrationType::NONE, 1.0 );
+  CHECK( !cache->HasSamples() );
+  CHECK( !cache->ApplyToMetric( MetricType::New() ) );
+
+  // Pyramid levels are memoized until their source changes.
+  CHECK( cache->GetPyramidLevel( fixed.GetPointer(), 1, 0.0 ) == fixed );
+  ImageType::Pointer level = cache->GetPyramidLevel( fixed.GetPointer(), 2, 1.0 );
+  CHECK( level->GetLargestPossibleRegion().GetSize()[0] == 10 );
+  CHECK( cache->GetPyramidLevel( fixed.GetPointer(), 2, 1.0 ) == level );
+  fixed->Modified();
+  CHECK( cache->GetPyramidLevel( fixed.GetPointer(), 2, 1.0 ) != level );
+
+  if ( failures > 0 )
+  {
+    std::cout << "RegistrationSampleCacheTest FAILED with " << failures << " errors." << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "RegistrationSampleCacheTest passed." << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,188 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __TransformDisplacementFieldCache_h
+#define __TransformDisplacementFieldCache_h
+
+#include "itkIO.h"
+#include "TransformToDisplacementField.h"
+#include "itkDisplacementFieldTransform.h"
+
+#include <itksys/MD5.h>
+#include <itksys/SystemTools.hxx>
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+/**
+ * \author Hans J. Johnson
+ * \brief Compute the key that identifies a flattened displacement field.
+ *
+ * The key is the md5 of the transform file contents, the reference grid
+ * (size, origin, spacing, direction) and any extra qualifier (i.e. whether
+ * the transform was inverted).  Two resamplings that share a key sample the
+ * transform at exactly the same physical points and can share one field.
+ */
+inline std::string
+ComputeTransformFieldCacheKey( const std::string & transformFileName, const itk::ImageBase< 3 > * referenceImage,
+                               const std::string & qualifier )
+{
+  itksysMD5 * md5 = itksysMD5_New();
+  itksysMD5_Initialize( md5 );
+
+  std::ifstream transformStream( transformFileName.c_str(), std::ios::in | std::ios::binary );
+  if ( !transformStream.is_open() )
+  {
+    itksysMD5_Delete( md5 );
+    itkGenericExceptionMacro( << "Can not read transform file for hashing: " << transformFileName );
+  }
+  std::vector< char > buffer( 1 << 16 );
+  while ( transformStream )
+  {
+    transformStream.read( &( buffer[0] ), buffer.size() );
+    const std::streamsize numRead = transformStream.gcount();
+    if ( numRead > 0 )
+    {
+      itksysMD5_Append( md5, reinterpret_cast< const unsigned char * >( &( buffer[0] ) ), static_cast< int >( numRead ) );
+    }
+  }
+
+  std::ostringstream gridDescription;
+  gridDescription << std::setprecision( 17 );
+  gridDescription << referenceImage->GetLargestPossibleRegion().GetSize() << referenceImage->GetOrigin()
+                  << referenceImage->GetSpacing() << referenceImage->GetDirection() << qualifier;
+  const std::string gridString = gridDescription.str();
+  itksysMD5_Append( md5, reinterpret_cast< const unsigned char * >( gridString.c_str() ),
+                    static_cast< int >( gridString.size() ) );
+
+  char hexDigest[32];
+  itksysMD5_FinalizeHex( md5, hexDigest );
+  itksysMD5_Delete( md5 );
+  return std::string( hexDigest, 32 );
+}
+
+/**
+ * \author Hans J. Johnson
+ * \brief The file name used to persist a flattened field next to its transform.
+ *
+ * i.e. /path/atlasToSubject.h5 -> /path/atlasToSubject.<key>.field.nrrd
+ */
+inline std::string
+GetTransformFieldCacheFileName( const std::string & transformFileName, const std::string & cacheKey )
+{
+  const std::string transformDirectory = itksys::SystemTools::GetFilenamePath( transformFileName );
+  const std::string transformBaseName = itksys::SystemTools::GetFilenameWithoutLastExtension( transformFileName );
+  std::string       cacheFileName = transformBaseName + "." + cacheKey + ".field.nrrd";
+  if ( !transformDirectory.empty() )
+  {
+    cacheFileName = transformDirectory + "/" + cacheFileName;
+  }
+  return cacheFileName;
+}
+
+/**
+ * \author Hans J. Johnson
+ * \brief Flatten any transform (usually a rigid/affine/BSpline/displacement
+ * composite) into a single displacement field sampled on the reference grid.
+ *
+ * When persistToDisk is true the field is first looked up next to the
+ * transform file using ComputeTransformFieldCacheKey, and is written there
+ * after it has been computed so that later invocations that resample through
+ * the same transform onto the same grid only pay for a read.
+ *
+ * \param transformFileName The transform file the transform was read from
+ *        (only used for persistence; may be empty when persistToDisk is false).
+ * \param cacheQualifier Extra text folded into the cache key.
+ */
+template < typename DisplacementFieldType >
+typename DisplacementFieldType::Pointer
+FlattenTransformToDisplacementField( const itk::Transform< double, 3, 3 > * transform,
+                                     const itk::ImageBase< 3 > *            referenceImage,
+                                     const std::string &                    transformFileName,
+                                     const std::string &                    cacheQualifier,
+                                     const bool                             persistToDisk )
+{
+  std::string cacheFileName;
+  if ( persistToDisk && !transformFileName.empty() )
+  {
+    const std::string cacheKey = ComputeTransformFieldCacheKey( transformFileName, referenceImage, cacheQualifier );
+    cacheFileName = GetTransformFieldCacheFileName( transformFileName, cacheKey );
+    if ( itksys::SystemTools::FileExists( cacheFileName, true ) )
+    {
+      std::cout << "Reusing cached transform field: " << cacheFileName << std::endl;
+      try
+      {
+        return itkUtil::ReadImage< DisplacementFieldType >( cacheFileName );
+      }
+      catch ( itk::ExceptionObject & err )
+      {
+        std::cout << "WARNING: unreadable transform field cache, recomputing: " << err << std::endl;
+      }
+    }
+  }
+
+  using FieldPointerType = typename DisplacementFieldType::Pointer;
+  FieldPointerType flattenedField = TransformToDisplacementField< FieldPointerType >(
+    const_cast< itk::ImageBase< 3 > * >( referenceImage ), const_cast< itk::Transform< double, 3, 3 > * >( transform ) );
+
+  if ( !cacheFileName.empty() )
+  {
+    // Write to a process unique temporary name and rename, so that concurrent
+    // invocations never observe a partially written cache file.
+    std::ostringstream temporaryName;
+    temporaryName << cacheFileName << ".tmp" << itksys::SystemTools::GetCurrentDateTime( "%Y%m%d%H%M%S" ) << "_"
+                  << static_cast< const void * >( flattenedField.GetPointer() ) << ".nrrd";
+    try
+    {
+      itkUtil::WriteImage< DisplacementFieldType >( flattenedField, temporaryName.str() );
+      if ( !itksys::SystemTools::RenameFile( temporaryName.str(), cacheFileName ) )
+      {
+        itksys::SystemTools::RemoveFile( temporaryName.str() );
+      }
+      else
+      {
+        std::cout << "Wrote cached transform field: " << cacheFileName << std::endl;
+      }
+    }
+    catch ( itk::ExceptionObject & err )
+    {
+      // The cache is an optimization only; failure to persist is not an error.
+      std::cout << "WARNING: could not persist transform field cache: " << err << std::endl;
+      itksys::SystemTools::RemoveFile( temporaryName.str() );
+    }
+  }
+  return flattenedField;
+}
+
+/**
+ * \author Hans J. Johnson
+ * \brief Wrap a flattened field in a transform so it can be passed wherever
+ * a generic itk::Transform is expected (i.e. GenericTransformImage).
+ */
+template < typename DisplacementFieldType >
+typename itk::DisplacementFieldTransform< double, 3 >::Pointer
+MakeDisplacementFieldTransform( DisplacementFieldType * flattenedField )
+{
+  using DisplacementFieldTransformType = itk::DisplacementFieldTransform< double, 3 >;
+  typename DisplacementFieldTransformType::Pointer fieldTransform = DisplacementFieldTransformType::New();
+  fieldTransform->SetDisplacementField( flattenedField );
+  return fieldTransform;
+}
+
+#endif // __TransformDisplacementFieldCache_h
@@ -22,6 +22,8 @@
 #include "itkNumericTraits.h"
 #include "itkImageToImageFilter.h"
 
+#include <atomic>
+
 namespace brainsia
 {
 namespace Testing
@@ -36,6 +38,13 @@ using namespace itk;
  * their values with the pixel values in the neighborhood of the homologous
  * pixel in the other image.
  *
+ * The neighborhood search is only performed for voxels whose center
+ * difference already exceeds the DifferenceThreshold, so identical or nearly
+ * identical images cost one pass over the buffers.  When
+ * MaximumNumberOfPixelsWithDifferences is non-zero, all threads stop as soon
+ * as that many differing pixels have been found; the statistics and
+ * the difference image are then only valid for the visited portion.
+ *
  * \ingroup IntensityImageFilters   MultiThreaded
  * \ingroup ITKTestKernel
  */
@@ -94,6 +103,12 @@ public:
   itkSetMacro( IgnoreBoundaryPixels, bool );
   itkGetConstMacro( IgnoreBoundaryPixels, bool );
 
+  /** Set/Get the number of differing pixels at which the comparison
+   *  stops early because the result can no longer be a match.
+   *  Default is 0, which visits every pixel. */
+  itkSetMacro( MaximumNumberOfPixelsWithDifferences, SizeValueType );
+  itkGetConstMacro( MaximumNumberOfPixelsWithDifferences, SizeValueType );
+
   /** Get statistical attributes for those pixels which exceed the
    * tolerance and radius parameters */
   itkGetConstMacro( MinimumDifference, OutputPixelType );
@@ -149,6 +164,9 @@ protected:
 
   int m_ToleranceRadius;
 
+  SizeValueType                m_MaximumNumberOfPixelsWithDifferences;
+  std::atomic< SizeValueType > m_SharedNumberOfPixelsWithDifferences;
+
   Array< AccumulateType > m_ThreadDifferenceSum;
   Array< SizeValueType >  m_ThreadNumberOfPixels;
 
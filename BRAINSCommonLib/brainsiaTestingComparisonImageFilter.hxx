@@ -20,7 +20,7 @@
 
 #include "brainsiaTestingComparisonImageFilter.h"
 
-#include "itkConstNeighborhoodIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkImageRegionIterator.h"
 #include "itkNeighborhoodAlgorithm.h"
 #include "itkProgressReporter.h"
@@ -48,6 +48,8 @@ ComparisonImageFilter< TInputImage, TOutputImage >::ComparisonImageFilter()
   m_NumberOfPixelsWithDifferences = 0;
   m_IgnoreBoundaryPixels = false;
   m_VerifyInputInformation = true;
+  m_MaximumNumberOfPixelsWithDifferences = 0;
+  m_SharedNumberOfPixelsWithDifferences = 0;
 
   this->DynamicMultiThreadingOff();
 
@@ -72,6 +74,7 @@ ComparisonImageFilter< TInputImage, TOutputImage >::PrintSelf( std::ostream & os
   os << indent << "TotalDifference: " << m_TotalDifference << "\n";
   os << indent << "NumberOfPixelsWithDifferences: " << m_NumberOfPixelsWithDifferences << "\n";
   os << indent << "IgnoreBoundaryPixels: " << m_IgnoreBoundaryPixels << "\n";
+  os << indent << "MaximumNumberOfPixelsWithDifferences: " << m_MaximumNumberOfPixelsWithDifferences << "\n";
 }
 
 //----------------------------------------------------------------------------
@@ -87,6 +90,7 @@ ComparisonImageFilter< TInputImage, TOutputImage >::BeforeThreadedGenerateData()
   m_MeanDifference = NumericTraits< RealType >::ZeroValue();
   m_TotalDifference = NumericTraits< AccumulateType >::ZeroValue();
   m_NumberOfPixelsWithDifferences = 0;
+  m_SharedNumberOfPixelsWithDifferences = 0;
 
   // Resize the thread temporaries
   m_ThreadDifferenceSum.SetSize( numberOfThreads );
@@ -108,15 +112,13 @@ void
 ComparisonImageFilter< TInputImage, TOutputImage >::ThreadedGenerateData( const OutputImageRegionType & threadRegion,
                                                                           ThreadIdType                  threadId )
 {
-  using SmartIterator = ConstNeighborhoodIterator< InputImageType >;
-  using InputIterator = ImageRegionConstIterator< InputImageType >;
+  using InputIterator = ImageRegionConstIteratorWithIndex< InputImageType >;
+  using TestIterator = ImageRegionConstIterator< InputImageType >;
   using OutputIterator = ImageRegionIterator< OutputImageType >;
   using FacesCalculator = NeighborhoodAlgorithm::ImageBoundaryFacesCalculator< InputImageType >;
   using RadiusType = typename FacesCalculator::RadiusType;
   using FaceListType = typename FacesCalculator::FaceListType;
-
-  // Prepare standard boundary condition.
-  ZeroFluxNeumannBoundaryCondition< InputImageType > nbc;
+  using InputImageRegionType = typename InputImageType::RegionType;
 
   // Get a pointer to each image.
   const InputImageType * validImage = this->GetInput( 0 );
@@ -130,8 +132,10 @@ ComparisonImageFilter< TInputImage, TOutputImage >::ThreadedGenerateData( const
 
   // Create a radius of pixels.
   RadiusType                           radius;
+  bool                                 searchNeighborhood = false;
   const unsigned int                   minVoxelsNeeded = m_ToleranceRadius * 2 + 1;
-  const typename TInputImage::SizeType imageSize = validImage->GetBufferedRegion().GetSize();
+  const InputImageRegionType           bufferedRegion = testImage->GetBufferedRegion();
+  const typename TInputImage::SizeType imageSize = bufferedRegion.GetSize();
   for ( unsigned int d = 0; d < TInputImage::ImageDimension; ++d )
   {
     if ( minVoxelsNeeded < imageSize[d] )
@@ -142,49 +146,67 @@ ComparisonImageFilter< TInputImage, TOutputImage >::ThreadedGenerateData( const
     {
       radius[d] = ( ( imageSize[d] - 1 ) / 2 );
     }
+    searchNeighborhood = searchNeighborhood || ( radius[d] > 0 );
   }
 
-  // Find the data-set boundary faces.
+  // Find the data-set boundary faces.  The first face is the interior
+  // region whose neighborhoods never leave the image.
   FacesCalculator boundaryCalculator;
   FaceListType    faceList = boundaryCalculator( testImage, threadRegion, radius );
 
   // Support progress methods/callbacks.
   ProgressReporter progress( this, threadId, threadRegion.GetNumberOfPixels() );
 
+  const SizeValueType maximumDifferences = m_MaximumNumberOfPixelsWithDifferences;
+  bool                stopEarly = false;
+
   // Process the internal face and each of the boundary faces.
   for ( auto face = faceList.begin(); face != faceList.end(); ++face )
   {
-    SmartIterator  test( radius, testImage, *face ); // Iterate over test image.
-    InputIterator  valid( validImage, *face );       // Iterate over valid image.
-    OutputIterator out( outputPtr, *face );          // Iterate over output image.
-    if ( !test.GetNeedToUseBoundaryCondition() || !m_IgnoreBoundaryPixels )
+    const bool     isBoundaryFace = ( face != faceList.begin() );
+    InputIterator  valid( validImage, *face ); // Iterate over valid image.
+    TestIterator   test( testImage, *face );   // Iterate over test image.
+    OutputIterator out( outputPtr, *face );    // Iterate over output image.
+    if ( !isBoundaryFace || !m_IgnoreBoundaryPixels )
     {
-      test.OverrideBoundaryCondition( &nbc );
-
       for ( valid.GoToBegin(), test.GoToBegin(), out.GoToBegin(); !valid.IsAtEnd(); ++valid, ++test, ++out )
       {
+        if ( stopEarly )
+        {
+          out.Set( NumericTraits< OutputPixelType >::ZeroValue() );
+          progress.CompletedPixel();
+          continue;
+        }
+
         // Get the current valid pixel.
-        InputPixelType t = valid.Get();
+        const InputPixelType t = valid.Get();
 
         //  Assume a good match - so test center pixel first, for speed
-        RealType difference = static_cast< RealType >( t ) - test.GetCenterPixel();
+        RealType difference = static_cast< RealType >( t ) - test.Get();
         if ( NumericTraits< RealType >::IsNegative( difference ) )
         {
           difference = -difference;
         }
         auto minimumDifference = static_cast< OutputPixelType >( difference );
 
-        // If center pixel isn't good enough, then test the neighborhood
-        if ( minimumDifference > m_DifferenceThreshold )
+        // Only when the center pixel isn't good enough search the
+        // neighborhood.  Clipping the neighborhood to the image is
+        // equivalent to a zero flux Neumann boundary condition for a
+        // minimum search, since replicated edge pixels are already inside.
+        if ( minimumDifference > m_DifferenceThreshold && searchNeighborhood )
         {
-          unsigned int neighborhoodSize = test.Size();
-          // Find the closest-valued pixel in the neighborhood of the test
-          // image.
-          for ( unsigned int i = 0; i < neighborhoodSize; ++i )
+          InputImageRegionType neighborhoodRegion;
+          for ( unsigned int d = 0; d < TInputImage::ImageDimension; ++d )
+          {
+            neighborhoodRegion.SetIndex( d, valid.GetIndex()[d] - static_cast< IndexValueType >( radius[d] ) );
+            neighborhoodRegion.SetSize( d, 2 * radius[d] + 1 );
+          }
+          neighborhoodRegion.Crop( bufferedRegion );
+          for ( TestIterator neighbor( testImage, neighborhoodRegion ); !neighbor.IsAtEnd(); ++neighbor )
           {
             // Use the RealType for the difference to make sure we get the
             // sign.
-            RealType differenceReal = static_cast< RealType >( t ) - test.GetPixel( i );
+            RealType differenceReal = static_cast< RealType >( t ) - neighbor.Get();
             if ( NumericTraits< RealType >::IsNegative( differenceReal ) )
             {
               differenceReal = -differenceReal;
@@ -213,6 +235,11 @@ ComparisonImageFilter< TInputImage, TOutputImage >::ThreadedGenerateData( const
 
           m_ThreadMinimumDifference[threadId] = std::min( m_ThreadMinimumDifference[threadId], minimumDifference );
           m_ThreadMaximumDifference[threadId] = std::max( m_ThreadMaximumDifference[threadId], minimumDifference );
+
+          if ( maximumDifferences > 0 && ++m_SharedNumberOfPixelsWithDifferences >= maximumDifferences )
+          {
+            stopEarly = true;
+          }
         }
         else
         {
@@ -220,6 +247,12 @@ ComparisonImageFilter< TInputImage, TOutputImage >::ThreadedGenerateData( const
           out.Set( NumericTraits< OutputPixelType >::ZeroValue() );
         }
 
+        // Other threads may already have reached the failure threshold.
+        if ( maximumDifferences > 0 && m_SharedNumberOfPixelsWithDifferences >= maximumDifferences )
+        {
+          stopEarly = true;
+        }
+
         // Update progress.
         progress.CompletedPixel();
       }
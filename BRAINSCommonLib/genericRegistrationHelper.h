@@ -36,6 +36,7 @@
 #include "BRAINSCommonLib.h"
 
 #include "itkImageToImageMetricv4.h"
+#include "itkRegistrationSampleCache.h"
 #include "itkMattesMutualInformationImageToImageMetricv4.h"
 #include "itkConjugateGradientLineSearchOptimizerv4.h"
 #include "itkGradientDescentOptimizerv4.h"
@@ -428,6 +429,8 @@ public:
   using AffineRegistrationType = itk::ImageRegistrationMethodv4< FixedImageType, MovingImageType >;
   using SamplingStrategyType = typename AffineRegistrationType::MetricSamplingStrategyType;
 
+  using SampleCacheType = RegistrationSampleCache< FixedImageType, MovingImageType >;
+
   using TransformInitializerType = itk::CenteredTransformInitializer< TransformType, FixedImageType, MovingImageType >;
 
   using ResampleFilterType = itk::ResampleImageFilter< MovingImageType, FixedImageType >;
@@ -496,6 +499,17 @@ public:
   itkSetMacro( SamplingStrategy, SamplingStrategyType );
   itkGetConstMacro( SamplingStrategy, SamplingStrategyType );
 
+  /** Set/Get the number of work units of the registration method and its
+   * optimizer.  Values <= 0 leave the ITK global default in place. */
+  itkSetMacro( NumberOfThreads, int );
+  itkGetConstMacro( NumberOfThreads, int );
+
+  /** Set/Get the metric sample cache shared with the other stages of the same
+   * registration.  When set, samples are drawn once by the cache instead of
+   * once per stage by ImageRegistrationMethodv4. */
+  itkSetObjectMacro( SampleCache, SampleCacheType );
+  itkGetModifiableObjectMacro( SampleCache, SampleCacheType );
+
   /** Returns the transform resulting from the registration process  */
   const TransformOutputType *
   GetOutput() const;
@@ -555,6 +569,9 @@ private:
   bool         m_ObserveIterations;
 
   SamplingStrategyType m_SamplingStrategy;
+  int                  m_NumberOfThreads;
+
+  typename SampleCacheType::Pointer m_SampleCache;
 
   ModifiedTimeType m_InternalTransformTime;
 };
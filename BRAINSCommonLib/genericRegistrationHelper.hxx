@@ -98,6 +98,8 @@ MultiModal3DMutualRegistrationHelper< TTransformType, TOptimizer, TFixedImage, T
   , m_FinalMetricValue( 0 )
   , m_ObserveIterations( true )
   , m_SamplingStrategy( AffineRegistrationType::NONE )
+  , m_NumberOfThreads( -1 )
+  , m_SampleCache( nullptr )
   , m_InternalTransformTime( 0 )
 {
   this->SetNumberOfRequiredOutputs( 1 ); // for the Transform
@@ -312,6 +314,11 @@ MultiModal3DMutualRegistrationHelper< TTransformType, TOptimizer, TFixedImage, T
   m_Registration->SetInitialTransform( m_Transform );
   m_Registration->SetMetric( this->m_CostMetricObject );
   m_Registration->SetOptimizer( optimizer );
+  if ( this->m_NumberOfThreads > 0 )
+  {
+    m_Registration->SetNumberOfWorkUnits( this->m_NumberOfThreads );
+    optimizer->SetNumberOfWorkUnits( this->m_NumberOfThreads );
+  }
 
   ////////////////////////HARD CODED PART//////////////////////
   constexpr unsigned int numberOfLevels = 1;
@@ -359,6 +366,19 @@ MultiModal3DMutualRegistrationHelper< TTransformType, TOptimizer, TFixedImage, T
     static_cast< typename RegistrationType::MetricSamplingStrategyType >( m_SamplingStrategy ) );
   m_Registration->SetMetricSamplingPercentage( this->m_SamplingPercentage );
   m_Registration->MetricSamplingReinitializeSeed( 121212 );
+  if ( this->m_SampleCache.IsNotNull() )
+  {
+    // Reuse the sample points drawn by an earlier stage; they only change with
+    // the fixed images, the fixed mask or the sampling parameters.
+    const auto cacheStrategy = static_cast< typename SampleCacheType::SamplingStrategyType >( m_SamplingStrategy );
+    this->m_SampleCache->SetRandomSeed( 121212 );
+    this->m_SampleCache->UpdateSamples(
+      preprocessedFixedImagesList, this->m_CostMetricObject.GetPointer(), cacheStrategy, this->m_SamplingPercentage );
+    if ( this->m_SampleCache->ApplyToMetric( this->m_CostMetricObject ) )
+    {
+      m_Registration->SetMetricSamplingStrategy( RegistrationType::NONE );
+    }
+  }
 
   // Create the Command observer and register it with the optimizer.
   // INFO:  make this output optional.
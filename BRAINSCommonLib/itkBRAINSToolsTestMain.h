@@ -52,6 +52,8 @@
 #include "itksys/SystemTools.hxx"
 #include "brainsiaTestingComparisonImageFilter.h"
 #include <csignal>
+#include <cstring>
+#include <vector>
 
 #define ITK_TEST_DIMENSION_MAX 6
 
@@ -262,6 +264,39 @@ main( int ac, char * av[] )
 
 // Regression Testing Code
 
+// Stream both files in fixed size chunks and report whether they are byte for
+// byte identical.  Bit-identical outputs are by far the most common case, and
+// this avoids decompressing and comparing voxels altogether.
+bool
+RegressionTestFilesAreIdentical( const char * testFilename, const char * baselineFilename )
+{
+  if ( itksys::SystemTools::FileLength( testFilename ) != itksys::SystemTools::FileLength( baselineFilename ) )
+  {
+    return false;
+  }
+  std::ifstream testStream( testFilename, std::ios::in | std::ios::binary );
+  std::ifstream baselineStream( baselineFilename, std::ios::in | std::ios::binary );
+  if ( !testStream.is_open() || !baselineStream.is_open() )
+  {
+    return false;
+  }
+  constexpr std::streamsize chunkSize = 1 << 20;
+  std::vector< char >       testChunk( chunkSize );
+  std::vector< char >       baselineChunk( chunkSize );
+  while ( testStream && baselineStream )
+  {
+    testStream.read( &( testChunk[0] ), chunkSize );
+    baselineStream.read( &( baselineChunk[0] ), chunkSize );
+    const std::streamsize testRead = testStream.gcount();
+    if ( testRead != baselineStream.gcount() ||
+         std::memcmp( &( testChunk[0] ), &( baselineChunk[0] ), static_cast< size_t >( testRead ) ) != 0 )
+    {
+      return false;
+    }
+  }
+  return testStream.eof() && baselineStream.eof();
+}
+
 int
 RegressionTestImage( const char * testImageFilename, const char * baselineImageFilename, int reportErrors,
                      double intensityTolerance, ::itk::SizeValueType numberOfPixelsTolerance,
@@ -274,6 +309,11 @@ RegressionTestImage( const char * testImageFilename, const char * baselineImageF
   using DiffOutputType = itk::Image< unsigned char, 2 >;
   using ReaderType = itk::ImageFileReader< ImageType >;
 
+  if ( RegressionTestFilesAreIdentical( testImageFilename, baselineImageFilename ) )
+  {
+    return 0;
+  }
+
   // Read the baseline file
   ReaderType::Pointer baselineReader = ReaderType::New();
   baselineReader->SetFileName( baselineImageFilename );
@@ -287,18 +327,28 @@ RegressionTestImage( const char * testImageFilename, const char * baselineImageF
     return 1000;
   }
 
-  // Read the file generated by the test
-  ReaderType::Pointer testReader = ReaderType::New();
-  testReader->SetFileName( testImageFilename );
-  try
+  // Read the file generated by the test.  The same test image is compared
+  // against every candidate baseline, so keep the last one that was read.
+  static std::string         cachedTestImageFilename;
+  static ReaderType::Pointer cachedTestReader;
+  if ( cachedTestReader.IsNull() || cachedTestImageFilename != testImageFilename )
   {
-    testReader->UpdateLargestPossibleRegion();
-  }
-  catch ( itk::ExceptionObject & e )
-  {
-    std::cerr << "Exception detected while reading " << testImageFilename << " : " << e.GetDescription() << std::endl;
-    return 1000;
+    ReaderType::Pointer newTestReader = ReaderType::New();
+    newTestReader->SetFileName( testImageFilename );
+    try
+    {
+      newTestReader->UpdateLargestPossibleRegion();
+    }
+    catch ( itk::ExceptionObject & e )
+    {
+      std::cerr << "Exception detected while reading " << testImageFilename << " : " << e.GetDescription()
+                << std::endl;
+      return 1000;
+    }
+    cachedTestReader = newTestReader;
+    cachedTestImageFilename = testImageFilename;
   }
+  ReaderType::Pointer testReader = cachedTestReader;
 
   // The sizes of the baseline and test image must match
   ImageType::SizeType baselineSize;
@@ -314,6 +364,22 @@ RegressionTestImage( const char * testImageFilename, const char * baselineImageF
     return 1;
   }
 
+  // Exact match of the decoded buffers and geometry needs no neighborhood search
+  {
+    const ImageType * baselineImage = baselineReader->GetOutput();
+    const ImageType * testImage = testReader->GetOutput();
+    if ( baselineImage->GetBufferedRegion() == testImage->GetBufferedRegion() &&
+         baselineImage->GetOrigin() == testImage->GetOrigin() &&
+         baselineImage->GetSpacing() == testImage->GetSpacing() &&
+         baselineImage->GetDirection() == testImage->GetDirection() &&
+         std::memcmp( baselineImage->GetBufferPointer(),
+                      testImage->GetBufferPointer(),
+                      baselineImage->GetBufferedRegion().GetNumberOfPixels() * sizeof( ImageType::PixelType ) ) == 0 )
+    {
+      return 0;
+    }
+  }
+
   // Now compare the two images
   using DiffType = brainsia::Testing::ComparisonImageFilter< ImageType, ImageType >;
   DiffType::Pointer diff = DiffType::New();
@@ -321,6 +387,11 @@ RegressionTestImage( const char * testImageFilename, const char * baselineImageF
   diff->SetTestInput( testReader->GetOutput() );
   diff->SetDifferenceThreshold( intensityTolerance );
   diff->SetToleranceRadius( radiusTolerance );
+  if ( !reportErrors )
+  {
+    // Only pass/fail is needed, so stop as soon as the tolerance is exceeded.
+    diff->SetMaximumNumberOfPixelsWithDifferences( numberOfPixelsTolerance + 1 );
+  }
   diff->UpdateLargestPossibleRegion();
 
   const itk::SizeValueType status = diff->GetNumberOfPixelsWithDifferences();
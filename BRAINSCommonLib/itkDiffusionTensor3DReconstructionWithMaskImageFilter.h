@@ -74,6 +74,13 @@ namespace itk
  * \li BValue - See the documentation of SetBValue().
  * \li At least 6 gradient images must be specified for the filter to be able
  * to run.
+ * \li EstimationMethod - LinearLeastSquares (default) solves the log-linearized
+ * Stejskal-Tanner equations directly.  WeightedLeastSquares refines that
+ * estimate by weighting each measurement with its predicted squared signal,
+ * which undoes the noise amplification of the log transform at low signal.
+ * \li ConstrainPositiveDefinite - When on, the eigenvalues of each estimated
+ * tensor are clamped to a small positive fraction of its largest eigenvalue
+ * so that every output tensor is positive definite.
  *
  *
  * \par Template parameters
@@ -89,14 +96,11 @@ namespace itk
  * \li<a href="splweb.bwh.harvard.edu:8000/pages/papers/westin/ISMRM2002.pdf">[2]</a>
  * <em>A Dual Tensor Basis Solution to the Stejskal-Tanner Equations for DT-MRI</em>
  *
- * \par WARNING:
- * Although this filter has been written to support multiple threads, please
- * set the number of threads to 1.
- * \code
- *         filter->SetNumberOfWorkUnits(1);
- * \endcode
- * This is due to buggy code in netlib/dsvdc, that is called by vnl_svd.
- * (used to compute the psudo-inverse to find the dual tensor basis).
+ * \par Multi-threading
+ * The pseudo-inverse of the tensor basis (the dual tensor basis) is computed
+ * once in BeforeThreadedGenerateData.  The per voxel work is then only small
+ * matrix-vector products, so no netlib (dsvdc) code is run from the worker
+ * threads and the filter uses all available work units.
  *
  * \author Thanks to Xiaodong Tao, GE, for contributing parts of this class. Also
  * thanks to Casey Goodlet, UNC for patches to support multiple baseline images
@@ -170,6 +174,13 @@ public:
 
   using CoefficientMatrixType = vnl_matrix< double >;
 
+  /** Tensor estimation methods. */
+  typedef enum
+  {
+    LinearLeastSquares = 0,
+    WeightedLeastSquares
+  } EstimationMethodType;
+
   /** Holds each magnetic field gradient used to acquire one DWImage */
   using GradientDirectionType = vnl_vector_fixed< double, 3 >;
 
@@ -247,6 +258,15 @@ public:
 #endif
   itkGetConstReferenceMacro( BValue, TTensorPixelType );
 
+  /** How tensors are fit to the measurements, LinearLeastSquares by default. */
+  itkSetMacro( EstimationMethod, EstimationMethodType );
+  itkGetConstMacro( EstimationMethod, EstimationMethodType );
+
+  /** Project every estimated tensor onto the positive definite tensors. */
+  itkSetMacro( ConstrainPositiveDefinite, bool );
+  itkGetConstMacro( ConstrainPositiveDefinite, bool );
+  itkBooleanMacro( ConstrainPositiveDefinite );
+
 #ifdef ITK_USE_CONCEPT_CHECKING
   /** Begin concept checking */
   itkConceptMacro( ReferenceEqualityComparableCheck, (Concept::EqualityComparable< ReferencePixelType >));
@@ -268,6 +288,11 @@ protected:
   void
   ComputeTensorBasis();
 
+  /** Estimate the tensor from the log-attenuation of every gradient
+   * measurement, B[i] = -log(S_i/S_0)/b.  Thread safe. */
+  void
+  EstimateTensor( const vnl_vector< double > & B, TensorPixelType & tensor ) const;
+
   void
   BeforeThreadedGenerateData() override;
 
@@ -289,6 +314,10 @@ private:
 
   CoefficientMatrixType m_BMatrix;
 
+  /** Pseudo-inverse of the tensor basis, applied to the measurements.
+   * 6 x NumberOfGradientDirections. */
+  CoefficientMatrixType m_DualBasis;
+
   /** container to hold gradient directions */
   GradientDirectionContainerType::Pointer m_GradientDirectionContainer;
 
@@ -309,6 +338,10 @@ private:
 
   /** Mask Image */
   MaskImageType::ConstPointer m_MaskImage;
+
+  EstimationMethodType m_EstimationMethod;
+
+  bool m_ConstrainPositiveDefinite;
 };
 } // namespace itk
 
@@ -25,6 +25,8 @@
 #include "itkImageRegionIterator.h"
 #include "itkArray.h"
 #include "vnl/vnl_vector.h"
+#include <algorithm>
+#include <cmath>
 
 namespace itk
 {
@@ -38,15 +40,13 @@ DiffusionTensor3DReconstructionWithMaskImageFilter<
   , m_Threshold( NumericTraits< ReferencePixelType >::min() )
   , m_BValue( 1.0 )
   , m_GradientImageTypeEnumeration( Else )
+  , m_EstimationMethod( LinearLeastSquares )
+  , m_ConstrainPositiveDefinite( false )
 {
   // At least 1 inputs is necessary for a vector image.
   // For images added one at a time we need at least six
   this->SetNumberOfRequiredInputs( 1 );
   m_TensorBasis.set_identity();
-
-  // This is due to buggy code in netlib/dsvdc, that is called by vnl_svd.
-  // (used to compute the psudo-inverse to find the dual tensor basis).
-  this->SetNumberOfWorkUnits( 1 );
 }
 
 template < typename TReferenceImagePixelType, typename TGradientImagePixelType, typename TTensorPixelType >
@@ -108,10 +108,6 @@ DiffusionTensor3DReconstructionWithMaskImageFilter< TReferenceImagePixelType, TG
   this->ComputeTensorBasis();
 }
 
-// POTENTIAL WARNING:
-//
-// Until we fix netlib svd routines, we will need to set the number of thread
-// to 1.
 template < typename TReferenceImagePixelType, typename TGradientImagePixelType, typename TTensorPixelType >
 void
 DiffusionTensor3DReconstructionWithMaskImageFilter<
@@ -125,7 +121,6 @@ DiffusionTensor3DReconstructionWithMaskImageFilter<
   oit.GoToBegin();
 
   vnl_vector< double > B( m_NumberOfGradientDirections );
-  vnl_vector< double > D( 6 );
 
   // if a mask is present, iterate through mask image and skip zero voxels
   bool useMask( this->m_MaskImage.IsNotNull() );
@@ -211,22 +206,7 @@ DiffusionTensor3DReconstructionWithMaskImageFilter<
           ++( *gradientItContainer[i] );
         }
 
-        vnl_svd< double > pseudoInverseSolver( m_TensorBasis );
-        if ( m_NumberOfGradientDirections > 6 )
-        {
-          D = pseudoInverseSolver.solve( m_BMatrix * B );
-        }
-        else
-        {
-          D = pseudoInverseSolver.solve( B );
-        }
-
-        tensor( 0, 0 ) = D[0];
-        tensor( 0, 1 ) = D[1];
-        tensor( 0, 2 ) = D[2];
-        tensor( 1, 1 ) = D[3];
-        tensor( 1, 2 ) = D[4];
-        tensor( 2, 2 ) = D[5];
+        this->EstimateTensor( B, tensor );
       }
       else
       {
@@ -322,22 +302,7 @@ DiffusionTensor3DReconstructionWithMaskImageFilter<
           }
         }
 
-        vnl_svd< double > pseudoInverseSolver( m_TensorBasis );
-        if ( m_NumberOfGradientDirections > 6 )
-        {
-          D = pseudoInverseSolver.solve( m_BMatrix * B );
-        }
-        else
-        {
-          D = pseudoInverseSolver.solve( B );
-        }
-
-        tensor( 0, 0 ) = D[0];
-        tensor( 0, 1 ) = D[1];
-        tensor( 0, 2 ) = D[2];
-        tensor( 1, 1 ) = D[3];
-        tensor( 1, 2 ) = D[4];
-        tensor( 2, 2 ) = D[5];
+        this->EstimateTensor( B, tensor );
       }
 
       oit.Set( tensor );
@@ -397,6 +362,155 @@ DiffusionTensor3DReconstructionWithMaskImageFilter< TReferenceImagePixelType, TG
   }
 
   m_BMatrix.inplace_transpose();
+
+  // The dual tensor basis only depends on the gradient directions, so the
+  // (not thread safe) netlib svd is run once here instead of once per voxel.
+  vnl_svd< double > pseudoInverseSolver( m_TensorBasis );
+  if ( m_NumberOfGradientDirections > 6 )
+  {
+    m_DualBasis = pseudoInverseSolver.pinverse() * m_BMatrix;
+  }
+  else
+  {
+    m_DualBasis = pseudoInverseSolver.pinverse();
+  }
+}
+
+template < typename TReferenceImagePixelType, typename TGradientImagePixelType, typename TTensorPixelType >
+void
+DiffusionTensor3DReconstructionWithMaskImageFilter<
+  TReferenceImagePixelType, TGradientImagePixelType,
+  TTensorPixelType >::EstimateTensor( const vnl_vector< double > & B, TensorPixelType & tensor ) const
+{
+  vnl_vector_fixed< double, 6 > D;
+  for ( unsigned int k = 0; k < 6; ++k )
+  {
+    const double * dualRow = m_DualBasis[k];
+    double         sum = 0.0;
+    for ( unsigned int i = 0; i < m_NumberOfGradientDirections; ++i )
+    {
+      sum += dualRow[i] * B[i];
+    }
+    D[k] = sum;
+  }
+
+  if ( m_EstimationMethod == WeightedLeastSquares )
+  {
+    // One reweighting step of the linear estimate, weights are the squared
+    // signals predicted by the linear estimate (relative to the baseline).
+    // m_BMatrix holds the transposed design matrix (6 x n) at this point.
+    vnl_matrix_fixed< double, 6, 6 > normalMatrix( 0.0 );
+    vnl_vector_fixed< double, 6 >    rhs( 0.0 );
+    for ( unsigned int i = 0; i < m_NumberOfGradientDirections; ++i )
+    {
+      double predicted = 0.0;
+      for ( unsigned int k = 0; k < 6; ++k )
+      {
+        predicted += m_BMatrix[k][i] * D[k];
+      }
+      const double weight = std::exp( -2.0 * this->m_BValue * predicted );
+      for ( unsigned int k = 0; k < 6; ++k )
+      {
+        const double weightedCoefficient = weight * m_BMatrix[k][i];
+        rhs[k] += weightedCoefficient * B[i];
+        for ( unsigned int l = 0; l <= k; ++l )
+        {
+          normalMatrix[k][l] += weightedCoefficient * m_BMatrix[l][i];
+        }
+      }
+    }
+
+    // Cholesky factorization of the symmetric 6x6 normal matrix; keep the
+    // linear estimate when the weighted system is not positive definite.
+    bool positiveDefinite = true;
+    for ( unsigned int k = 0; k < 6 && positiveDefinite; ++k )
+    {
+      for ( unsigned int l = 0; l <= k; ++l )
+      {
+        double sum = normalMatrix[k][l];
+        for ( unsigned int m = 0; m < l; ++m )
+        {
+          sum -= normalMatrix[k][m] * normalMatrix[l][m];
+        }
+        if ( k == l )
+        {
+          if ( sum <= 0.0 )
+          {
+            positiveDefinite = false;
+            break;
+          }
+          normalMatrix[k][k] = std::sqrt( sum );
+        }
+        else
+        {
+          normalMatrix[k][l] = sum / normalMatrix[l][l];
+        }
+      }
+    }
+    if ( positiveDefinite )
+    {
+      for ( unsigned int k = 0; k < 6; ++k )
+      {
+        double sum = rhs[k];
+        for ( unsigned int m = 0; m < k; ++m )
+        {
+          sum -= normalMatrix[k][m] * rhs[m];
+        }
+        rhs[k] = sum / normalMatrix[k][k];
+      }
+      for ( int k = 5; k >= 0; --k )
+      {
+        double sum = rhs[k];
+        for ( unsigned int m = k + 1; m < 6; ++m )
+        {
+          sum -= normalMatrix[m][k] * rhs[m];
+        }
+        rhs[k] = sum / normalMatrix[k][k];
+      }
+      D = rhs;
+    }
+  }
+
+  tensor( 0, 0 ) = D[0];
+  tensor( 0, 1 ) = D[1];
+  tensor( 0, 2 ) = D[2];
+  tensor( 1, 1 ) = D[3];
+  tensor( 1, 2 ) = D[4];
+  tensor( 2, 2 ) = D[5];
+
+  if ( m_ConstrainPositiveDefinite )
+  {
+    typename TensorPixelType::EigenValuesArrayType   eigenValues;
+    typename TensorPixelType::EigenVectorsMatrixType eigenVectors;
+    tensor.ComputeEigenAnalysis( eigenValues, eigenVectors );
+    const double largestEigenValue = std::max( { double( eigenValues[0] ), double( eigenValues[1] ),
+                                                 double( eigenValues[2] ) } );
+    if ( largestEigenValue <= 0.0 )
+    {
+      tensor.Fill( 0.0 );
+      return;
+    }
+    // Relative floor keeps the tensor well conditioned independent of units.
+    const double minimumEigenValue = 1e-6 * largestEigenValue;
+    if ( eigenValues[0] < minimumEigenValue || eigenValues[1] < minimumEigenValue ||
+         eigenValues[2] < minimumEigenValue )
+    {
+      // Rows of eigenVectors are the eigen vectors.
+      TensorPixelType constrained( 0.0 );
+      for ( unsigned int e = 0; e < 3; ++e )
+      {
+        const double lambda = std::max( double( eigenValues[e] ), minimumEigenValue );
+        for ( unsigned int r = 0; r < 3; ++r )
+        {
+          for ( unsigned int c = r; c < 3; ++c )
+          {
+            constrained( r, c ) += lambda * eigenVectors[e][r] * eigenVectors[e][c];
+          }
+        }
+      }
+      tensor = constrained;
+    }
+  }
 }
 
 template < typename TReferenceImagePixelType, typename TGradientImagePixelType, typename TTensorPixelType >
@@ -499,6 +613,9 @@ DiffusionTensor3DReconstructionWithMaskImageFilter< TReferenceImagePixelType, TG
   os << indent << "NumberOfBaselineImages: " << m_NumberOfBaselineImages << std::endl;
   os << indent << "Threshold for reference B0 image: " << m_Threshold << std::endl;
   os << indent << "BValue: " << m_BValue << std::endl;
+  os << indent << "EstimationMethod: "
+     << ( m_EstimationMethod == WeightedLeastSquares ? "WeightedLeastSquares" : "LinearLeastSquares" ) << std::endl;
+  os << indent << "ConstrainPositiveDefinite: " << m_ConstrainPositiveDefinite << std::endl;
   if ( this->m_GradientImageTypeEnumeration == GradientIsInManyImages )
   {
     os << indent << "Gradient images have been supplied " << std::endl;
@@ -36,6 +36,7 @@
 #include "itkGDCMSeriesFileNames.h"
 #include "itkImageSeriesReader.h"
 #include "itkGDCMImageIO.h"
+#include "BRAINSBlockGzip.h"
 
 namespace itkUtil
 {
@@ -90,9 +91,17 @@ ReadImage( const std::string & fileName )
   }
   else
   {
+    // Block gzip compressed files (see BRAINSBlockGzip.h) are inflated in
+    // parallel to an uncompressed staging file, which the image IO reads.
+    // When that fails no staging file is left and the file is read as usual.
+    const std::string stagingFileName = BRAINSUtils::IsBlockGzipImageFileName( fileName )
+                                          ? BRAINSUtils::GetUncompressedStagingFileName( fileName )
+                                          : std::string();
+    const bool staged = !stagingFileName.empty() && BRAINSUtils::ReadBlockGzipImageFile( fileName, stagingFileName );
+
     using ReaderType = itk::ImageFileReader< TImage >;
     typename ReaderType::Pointer reader = ReaderType::New();
-    reader->SetFileName( fileName.c_str() );
+    reader->SetFileName( staged ? stagingFileName : fileName );
     try
     {
       reader->Update();
@@ -101,13 +110,25 @@ ReadImage( const std::string & fileName )
     {
       std::cout << "Caught an exception: " << std::endl;
       std::cout << err << " " << __FILE__ << " " << __LINE__ << std::endl;
+      if ( staged )
+      {
+        itksys::SystemTools::RemoveFile( stagingFileName );
+      }
       throw;
     }
     catch ( ... )
     {
       std::cout << "Error while reading in image" << fileName << std::endl;
+      if ( staged )
+      {
+        itksys::SystemTools::RemoveFile( stagingFileName );
+      }
       throw;
     }
+    if ( staged )
+    {
+      itksys::SystemTools::RemoveFile( stagingFileName );
+    }
     image = reader->GetOutput();
     // image->DisconnectPipeline();
     // reader->ReleaseDataFlagOn();
@@ -205,16 +226,46 @@ ReadImageCoronal( const std::string & fileName )
  * This is the prefered ABI for Writing images.
  * We know that the image is not going to change
  * so make sure that the API indicates that.
+ *
+ * ".nii.gz" and ".nrrd" files are deflated in parallel blocks with the
+ * given zlib compressionLevel (0-9, or BRAINSUtils::GetDefaultCompressionLevel()
+ * when negative); the result is standard gzip, see BRAINSBlockGzip.h.
  */
 template < typename ImageType >
 void
-WriteConstImage( const typename ImageType::ConstPointer image, const std::string & filename )
+WriteConstImage( const typename ImageType::ConstPointer image, const std::string & filename,
+                 const int compressionLevel = -1 )
 {
   using WriterType = itk::ImageFileWriter< ImageType >;
   typename WriterType::Pointer writer = WriterType::New();
-  writer->UseCompressionOn();
-  writer->SetFileName( filename.c_str() );
   writer->SetInput( image );
+  if ( BRAINSUtils::IsBlockGzipImageFileName( filename ) )
+  {
+    const std::string stagingFileName = BRAINSUtils::GetUncompressedStagingFileName( filename );
+    bool              written = false;
+    try
+    {
+      writer->SetUseCompression( false );
+      writer->SetFileName( stagingFileName );
+      writer->Update();
+      const int level = ( compressionLevel < 0 ) ? BRAINSUtils::GetDefaultCompressionLevel() : compressionLevel;
+      written = BRAINSUtils::WriteBlockGzipImageFile( stagingFileName, filename, level );
+    }
+    catch ( std::exception & err )
+    {
+      // E.g. an unwritable or full temporary directory; compressed below instead.
+      std::cout << "Could not stage " << stagingFileName << ": " << err.what() << std::endl;
+    }
+    itksys::SystemTools::RemoveFile( stagingFileName );
+    if ( written )
+    {
+      return;
+    }
+  }
+
+  // The single threaded compression of the image IO, also the fallback for block gzip.
+  writer->SetUseCompression( true );
+  writer->SetFileName( filename );
   try
   {
     writer->Update();
@@ -235,10 +286,10 @@ WriteConstImage( const typename ImageType::ConstPointer image, const std::string
  */
 template < typename ImageType >
 void
-WriteImage( const typename ImageType::Pointer image, const std::string & filename )
+WriteImage( const typename ImageType::Pointer image, const std::string & filename, const int compressionLevel = -1 )
 {
   const typename ImageType::ConstPointer temp( image.GetPointer() );
-  WriteConstImage< ImageType >( temp, filename );
+  WriteConstImage< ImageType >( temp, filename, compressionLevel );
 }
 
 /**
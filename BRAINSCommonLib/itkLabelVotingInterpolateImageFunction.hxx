@@ -0,0 +1,108 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __itkLabelVotingInterpolateImageFunction_hxx
+#define __itkLabelVotingInterpolateImageFunction_hxx
+
+#include "itkLabelVotingInterpolateImageFunction.h"
+#include "itkMath.h"
+#include <algorithm>
+
+namespace itk
+{
+template < typename TInputImage, typename TCoordRep >
+typename LabelVotingInterpolateImageFunction< TInputImage, TCoordRep >::OutputType
+LabelVotingInterpolateImageFunction< TInputImage, TCoordRep >::EvaluateAtContinuousIndex(
+  const ContinuousIndexType & index ) const
+{
+  constexpr unsigned int NumberOfNeighbors = 1U << ImageDimension;
+
+  const InputImageType * const inputImage = this->GetInputImage();
+
+  IndexType baseIndex;
+  double    distance[ImageDimension];
+  for ( unsigned int dim = 0; dim < ImageDimension; ++dim )
+  {
+    baseIndex[dim] = Math::Floor< IndexValueType >( index[dim] );
+    distance[dim] = index[dim] - static_cast< double >( baseIndex[dim] );
+  }
+
+  InputPixelType labels[NumberOfNeighbors];
+  double         weights[NumberOfNeighbors];
+  bool           interiorVoxel = true;
+  for ( unsigned int counter = 0; counter < NumberOfNeighbors; ++counter )
+  {
+    IndexType neighIndex;
+    double    overlap = 1.0;
+    for ( unsigned int dim = 0; dim < ImageDimension; ++dim )
+    {
+      if ( counter & ( 1U << dim ) )
+      {
+        neighIndex[dim] = std::min( baseIndex[dim] + 1, this->m_EndIndex[dim] );
+        overlap *= distance[dim];
+      }
+      else
+      {
+        neighIndex[dim] = std::max( baseIndex[dim], this->m_StartIndex[dim] );
+        overlap *= 1.0 - distance[dim];
+      }
+    }
+    labels[counter] = inputImage->GetPixel( neighIndex );
+    weights[counter] = overlap;
+    interiorVoxel = interiorVoxel && ( labels[counter] == labels[0] );
+  }
+
+  // Interior of a label: nearest neighbor copy.
+  if ( interiorVoxel )
+  {
+    return static_cast< OutputType >( labels[0] );
+  }
+
+  // Boundary band: partial volume vote over the distinct labels present.
+  InputPixelType bestLabel = labels[0];
+  double         bestWeight = -1.0;
+  for ( unsigned int i = 0; i < NumberOfNeighbors; ++i )
+  {
+    bool alreadyCounted = false;
+    for ( unsigned int j = 0; j < i && !alreadyCounted; ++j )
+    {
+      alreadyCounted = ( labels[j] == labels[i] );
+    }
+    if ( alreadyCounted )
+    {
+      continue;
+    }
+    double labelWeight = weights[i];
+    for ( unsigned int j = i + 1; j < NumberOfNeighbors; ++j )
+    {
+      if ( labels[j] == labels[i] )
+      {
+        labelWeight += weights[j];
+      }
+    }
+    if ( labelWeight > bestWeight )
+    {
+      bestWeight = labelWeight;
+      bestLabel = labels[i];
+    }
+  }
+  return static_cast< OutputType >( bestLabel );
+}
+} // end namespace itk
+
+#endif
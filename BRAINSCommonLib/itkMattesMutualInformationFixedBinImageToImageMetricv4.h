@@ -0,0 +1,192 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __itkMattesMutualInformationFixedBinImageToImageMetricv4_h
+#define __itkMattesMutualInformationFixedBinImageToImageMetricv4_h
+
+#include "itkImageToImageMetricv4.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace itk
+{
+/**
+ * \class MattesMutualInformationFixedBinImageToImageMetricv4
+ * \author Hans J. Johnson
+ * \brief Mattes mutual information with the fixed-image Parzen terms computed once per Initialize().
+ *
+ * The joint histogram, marginals, value and derivative follow
+ * MattesMutualInformationImageToImageMetricv4 (zero order Parzen window on the
+ * fixed side, cubic B-spline window on the moving side, two bins of padding).
+ * The differences are in how the work is organized:
+ *
+ * - The fixed image value and Parzen bin of every sample only depend on the
+ *   fixed image, the fixed mask and the sample points, so they are computed
+ *   once in Initialize() and reused by every iteration of the stage.
+ * - Each block of samples fills its own float joint histogram; the blocks are
+ *   fixed by the sample count (not by the number of threads) and are merged in
+ *   block order, so results do not depend on thread scheduling.
+ * - The derivative is computed in a second pass from the log ratio table,
+ *   instead of accumulating a bins x bins x parameters joint PDF derivative.
+ *   At most 64 work units, each summing a fixed range of blocks, hold their
+ *   own derivative and are merged in order, which bounds the memory for
+ *   BSpline transforms and keeps the result independent of the threads.
+ *
+ * Only transforms with global support are handled (Rigid, Versor, Affine and
+ * BSpline), which are the transforms BRAINSFit optimizes with this metric.
+ */
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage = TFixedImage,
+           typename TInternalComputationValueType = double,
+           typename TMetricTraits = DefaultImageToImageMetricTraitsv4< TFixedImage,
+                                                                       TMovingImage,
+                                                                       TVirtualImage,
+                                                                       TInternalComputationValueType > >
+class MattesMutualInformationFixedBinImageToImageMetricv4
+  : public ImageToImageMetricv4< TFixedImage,
+                                 TMovingImage,
+                                 TVirtualImage,
+                                 TInternalComputationValueType,
+                                 TMetricTraits >
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN( MattesMutualInformationFixedBinImageToImageMetricv4 );
+
+  /** Standard class type alias. */
+  using Self = MattesMutualInformationFixedBinImageToImageMetricv4;
+  using Superclass =
+    ImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage, TInternalComputationValueType, TMetricTraits >;
+  using Pointer = SmartPointer< Self >;
+  using ConstPointer = SmartPointer< const Self >;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro( Self );
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro( MattesMutualInformationFixedBinImageToImageMetricv4, ImageToImageMetricv4 );
+
+  using MeasureType = typename Superclass::MeasureType;
+  using DerivativeType = typename Superclass::DerivativeType;
+  using DerivativeValueType = typename Superclass::DerivativeValueType;
+  using NumberOfParametersType = typename Superclass::NumberOfParametersType;
+  using JacobianType = typename Superclass::JacobianType;
+  using VirtualPointType = typename Superclass::VirtualPointType;
+  using VirtualIndexType = typename Superclass::VirtualIndexType;
+  using FixedImagePointType = typename Superclass::FixedImagePointType;
+  using FixedImagePixelType = typename Superclass::FixedImagePixelType;
+  using MovingImagePointType = typename Superclass::MovingImagePointType;
+  using MovingImagePixelType = typename Superclass::MovingImagePixelType;
+  using MovingImageGradientType = typename Superclass::MovingImageGradientType;
+
+  static constexpr unsigned int VirtualImageDimension = Superclass::VirtualImageDimension;
+  static constexpr unsigned int MovingImageDimension = Superclass::MovingImageDimension;
+
+  using PDFValueType = TInternalComputationValueType;
+  using HistogramValueType = float;
+  using FixedBinIndexType = std::uint16_t;
+
+  /** Number of bins used for both the fixed and the moving histograms. */
+  itkSetClampMacro( NumberOfHistogramBins, SizeValueType, 5, 65534 );
+  itkGetConstMacro( NumberOfHistogramBins, SizeValueType );
+
+  /** Number of samples per histogram block.  Smaller blocks give more
+   * parallelism at the cost of more histograms to merge. */
+  itkSetClampMacro( SamplesPerBlock, SizeValueType, 1, NumericTraits< SizeValueType >::max() );
+  itkGetConstMacro( SamplesPerBlock, SizeValueType );
+
+  /** Number of samples (sampled points, or virtual domain voxels when dense). */
+  itkGetConstMacro( NumberOfSamples, SizeValueType );
+
+  /** Number of samples that mapped inside both images during the last evaluation. */
+  SizeValueType
+  GetNumberOfValidSamples() const
+  {
+    return this->m_NumberOfValidSamples;
+  }
+
+  void
+  Initialize() override;
+
+  MeasureType
+  GetValue() const override;
+
+  void
+  GetDerivative( DerivativeType & derivative ) const override;
+
+  void
+  GetValueAndDerivative( MeasureType & value, DerivativeType & derivative ) const override;
+
+protected:
+  MattesMutualInformationFixedBinImageToImageMetricv4();
+  ~MattesMutualInformationFixedBinImageToImageMetricv4() override = default;
+
+  void
+  PrintSelf( std::ostream & os, Indent indent ) const override;
+
+private:
+  static constexpr FixedBinIndexType InvalidFixedBin = std::numeric_limits< FixedBinIndexType >::max();
+
+  /** Intensity range of \a image inside \a mask (the whole buffer when \a mask is null). */
+  template < typename TImage, typename TMask >
+  static void
+  ComputeImageRange( const TImage * image, const TMask * mask, PDFValueType & minimum, PDFValueType & maximum );
+
+  /** Physical location of sample \a sample in the virtual domain. */
+  void
+  GetSamplePoint( SizeValueType sample, VirtualPointType & point ) const;
+
+  /** Fill m_JointPDF and m_MovingSampleTerms for the current transform. */
+  void
+  ComputeJointPDF() const;
+
+  /** Normalize the joint PDF, compute the marginals and return the metric value. */
+  MeasureType
+  ComputeValue( bool computeRatios ) const;
+
+  /** Second pass over the samples: accumulate the derivative using m_PRatio. */
+  void
+  ComputeDerivative( DerivativeType & derivative ) const;
+
+  SizeValueType m_NumberOfHistogramBins{ 50 };
+  SizeValueType m_SamplesPerBlock{ 4096 };
+  SizeValueType m_NumberOfSamples{ 0 };
+
+  PDFValueType m_FixedImageBinSize{ 0.0 };
+  PDFValueType m_FixedImageNormalizedMin{ 0.0 };
+  PDFValueType m_MovingImageBinSize{ 0.0 };
+  PDFValueType m_MovingImageNormalizedMin{ 0.0 };
+
+  // Per-sample fixed-side terms, computed once per Initialize().
+  std::vector< VirtualPointType >  m_SamplePoints; // empty when sampling densely
+  std::vector< FixedBinIndexType > m_FixedSampleBins;
+
+  // Per-evaluation scratch space.
+  mutable std::vector< float >                              m_MovingSampleTerms;
+  mutable std::vector< std::vector< HistogramValueType > > m_BlockHistograms;
+  mutable std::vector< PDFValueType >                       m_JointPDF;
+  mutable std::vector< PDFValueType >                       m_PRatio;
+  mutable SizeValueType                                     m_NumberOfValidSamples{ 0 };
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkMattesMutualInformationFixedBinImageToImageMetricv4.hxx"
+#endif
+
+#endif // __itkMattesMutualInformationFixedBinImageToImageMetricv4_h
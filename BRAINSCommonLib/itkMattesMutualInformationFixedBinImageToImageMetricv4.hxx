@@ -0,0 +1,507 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __itkMattesMutualInformationFixedBinImageToImageMetricv4_hxx
+#define __itkMattesMutualInformationFixedBinImageToImageMetricv4_hxx
+
+#include "itkMattesMutualInformationFixedBinImageToImageMetricv4.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkMultiThreaderBase.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace itk
+{
+namespace MattesFixedBinDetail
+{
+/** Cubic B-spline Parzen window and its derivative (BSplineKernelFunction<3>). */
+inline double
+CubicBSpline( double x )
+{
+  const double absX = std::abs( x );
+  if ( absX < 1.0 )
+  {
+    return ( 4.0 - 6.0 * absX * absX + 3.0 * absX * absX * absX ) / 6.0;
+  }
+  if ( absX < 2.0 )
+  {
+    const double t = 2.0 - absX;
+    return t * t * t / 6.0;
+  }
+  return 0.0;
+}
+
+inline double
+CubicBSplineDerivative( double x )
+{
+  const double absX = std::abs( x );
+  if ( absX < 1.0 )
+  {
+    return x * ( 1.5 * absX - 2.0 );
+  }
+  if ( absX < 2.0 )
+  {
+    const double t = 2.0 - absX;
+    return ( x < 0.0 ) ? 0.5 * t * t : -0.5 * t * t;
+  }
+  return 0.0;
+}
+} // end namespace MattesFixedBinDetail
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::
+  MattesMutualInformationFixedBinImageToImageMetricv4()
+{
+  // Gradients are taken pointwise from the moving image, as BRAINSFit
+  // configures the other mutual information metrics.
+  this->SetUseFixedImageGradientFilter( false );
+  this->SetUseMovingImageGradientFilter( false );
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+template < typename TImage, typename TMask >
+void
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::ComputeImageRange( const TImage * image,
+                                                                                         const TMask *  mask,
+                                                                                         PDFValueType & minimum,
+                                                                                         PDFValueType & maximum )
+{
+  minimum = NumericTraits< PDFValueType >::max();
+  maximum = NumericTraits< PDFValueType >::NonpositiveMin();
+  for ( ImageRegionConstIteratorWithIndex< TImage > it( image, image->GetBufferedRegion() ); !it.IsAtEnd(); ++it )
+  {
+    if ( mask != nullptr )
+    {
+      typename TImage::PointType point;
+      image->TransformIndexToPhysicalPoint( it.GetIndex(), point );
+      if ( !mask->IsInsideInWorldSpace( point ) )
+      {
+        continue;
+      }
+    }
+    const PDFValueType value = static_cast< PDFValueType >( it.Get() );
+    minimum = std::min( minimum, value );
+    maximum = std::max( maximum, value );
+  }
+  if ( minimum > maximum )
+  {
+    itkGenericExceptionMacro( << "No image voxels fall inside the mask." );
+  }
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+void
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::Initialize()
+{
+  Superclass::Initialize();
+
+  if ( this->HasLocalSupport() )
+  {
+    itkExceptionMacro( << "Transforms with local support (displacement fields) are not supported." );
+  }
+
+  // Intensity ranges and bin geometry, with two bins of padding on each side.
+  constexpr int padding = 2;
+  const auto    usableBins = static_cast< PDFValueType >( this->m_NumberOfHistogramBins - 2 * padding );
+  PDFValueType  fixedMin;
+  PDFValueType  fixedMax;
+  ComputeImageRange( this->GetFixedImage(), this->GetFixedImageMask(), fixedMin, fixedMax );
+  PDFValueType movingMin;
+  PDFValueType movingMax;
+  ComputeImageRange( this->GetMovingImage(), this->GetMovingImageMask(), movingMin, movingMax );
+
+  this->m_FixedImageBinSize =
+    std::max( ( fixedMax - fixedMin ) / usableBins, NumericTraits< PDFValueType >::epsilon() );
+  this->m_FixedImageNormalizedMin = fixedMin / this->m_FixedImageBinSize - static_cast< PDFValueType >( padding );
+  this->m_MovingImageBinSize =
+    std::max( ( movingMax - movingMin ) / usableBins, NumericTraits< PDFValueType >::epsilon() );
+  this->m_MovingImageNormalizedMin = movingMin / this->m_MovingImageBinSize - static_cast< PDFValueType >( padding );
+
+  // The samples: either the sampled point set, or every virtual domain voxel.
+  this->m_SamplePoints.clear();
+  if ( this->GetUseSampledPointSet() )
+  {
+    const auto * points = this->GetVirtualSampledPointSet()->GetPoints();
+    this->m_SamplePoints.reserve( points->Size() );
+    for ( auto pIt = points->Begin(); pIt != points->End(); ++pIt )
+    {
+      this->m_SamplePoints.push_back( pIt.Value() );
+    }
+    this->m_NumberOfSamples = this->m_SamplePoints.size();
+  }
+  else
+  {
+    this->m_NumberOfSamples = this->GetVirtualRegion().GetNumberOfPixels();
+  }
+
+  // Fixed Parzen bins never change during a stage; compute them once.
+  const auto          lastFixedBin = static_cast< OffsetValueType >( this->m_NumberOfHistogramBins ) - padding - 1;
+  const SizeValueType numberOfBlocks =
+    ( this->m_NumberOfSamples + this->m_SamplesPerBlock - 1 ) / this->m_SamplesPerBlock;
+  this->m_FixedSampleBins.assign( this->m_NumberOfSamples, FixedBinIndexType{ InvalidFixedBin } );
+  MultiThreaderBase::Pointer threader = MultiThreaderBase::New();
+  threader->ParallelizeArray(
+    0,
+    numberOfBlocks,
+    [&]( const SizeValueType block ) {
+      const SizeValueType begin = block * this->m_SamplesPerBlock;
+      const SizeValueType end = std::min( begin + this->m_SamplesPerBlock, this->m_NumberOfSamples );
+      VirtualPointType    virtualPoint;
+      FixedImagePointType mappedFixedPoint;
+      FixedImagePixelType fixedValue;
+      for ( SizeValueType sample = begin; sample < end; ++sample )
+      {
+        this->GetSamplePoint( sample, virtualPoint );
+        if ( !this->TransformAndEvaluateFixedPoint( virtualPoint, mappedFixedPoint, fixedValue ) )
+        {
+          continue;
+        }
+        const PDFValueType fixedTerm =
+          static_cast< PDFValueType >( fixedValue ) / this->m_FixedImageBinSize - this->m_FixedImageNormalizedMin;
+        auto fixedBin = static_cast< OffsetValueType >( fixedTerm );
+        fixedBin = std::min( std::max( fixedBin, static_cast< OffsetValueType >( padding ) ), lastFixedBin );
+        this->m_FixedSampleBins[sample] = static_cast< FixedBinIndexType >( fixedBin );
+      }
+    },
+    nullptr );
+
+  const SizeValueType bins = this->m_NumberOfHistogramBins;
+  this->m_MovingSampleTerms.assign( this->m_NumberOfSamples, 0.0F );
+  this->m_BlockHistograms.assign( numberOfBlocks, std::vector< HistogramValueType >( bins * bins ) );
+  this->m_JointPDF.assign( bins * bins, 0.0 );
+  this->m_PRatio.assign( bins * bins, 0.0 );
+  this->m_NumberOfValidSamples = 0;
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+void
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::GetSamplePoint( SizeValueType      sample,
+                                                                                      VirtualPointType & point ) const
+{
+  if ( !this->m_SamplePoints.empty() )
+  {
+    point = this->m_SamplePoints[sample];
+    return;
+  }
+  // Dense sampling: decompose the linear offset in the virtual region.
+  const typename Superclass::VirtualRegionType & region = this->GetVirtualRegion();
+  VirtualIndexType                               index;
+  for ( unsigned int d = 0; d < VirtualImageDimension; ++d )
+  {
+    const SizeValueType size = region.GetSize( d );
+    index[d] = region.GetIndex( d ) + static_cast< IndexValueType >( sample % size );
+    sample /= size;
+  }
+  this->TransformVirtualIndexToPhysicalPoint( index, point );
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+void
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::ComputeJointPDF() const
+{
+  constexpr int       padding = 2;
+  const SizeValueType bins = this->m_NumberOfHistogramBins;
+  const auto          lastMovingBin = static_cast< OffsetValueType >( bins ) - padding - 1;
+  const SizeValueType numberOfBlocks = this->m_BlockHistograms.size();
+  std::vector< SizeValueType > blockValidSamples( numberOfBlocks, 0 );
+
+  MultiThreaderBase::Pointer threader = MultiThreaderBase::New();
+  threader->ParallelizeArray(
+    0,
+    numberOfBlocks,
+    [&]( const SizeValueType block ) {
+      std::vector< HistogramValueType > & histogram = this->m_BlockHistograms[block];
+      std::fill( histogram.begin(), histogram.end(), 0.0F );
+      const SizeValueType  begin = block * this->m_SamplesPerBlock;
+      const SizeValueType  end = std::min( begin + this->m_SamplesPerBlock, this->m_NumberOfSamples );
+      VirtualPointType     virtualPoint;
+      MovingImagePointType mappedMovingPoint;
+      MovingImagePixelType movingValue;
+      SizeValueType        validSamples = 0;
+      for ( SizeValueType sample = begin; sample < end; ++sample )
+      {
+        float &                 movingTerm = this->m_MovingSampleTerms[sample];
+        const FixedBinIndexType fixedBin = this->m_FixedSampleBins[sample];
+        movingTerm = std::numeric_limits< float >::quiet_NaN();
+        if ( fixedBin == InvalidFixedBin )
+        {
+          continue;
+        }
+        this->GetSamplePoint( sample, virtualPoint );
+        if ( !this->TransformAndEvaluateMovingPoint( virtualPoint, mappedMovingPoint, movingValue ) )
+        {
+          continue;
+        }
+        const PDFValueType term =
+          static_cast< PDFValueType >( movingValue ) / this->m_MovingImageBinSize - this->m_MovingImageNormalizedMin;
+        auto movingBin = static_cast< OffsetValueType >( term );
+        movingBin = std::min( std::max( movingBin, static_cast< OffsetValueType >( padding ) ), lastMovingBin );
+        movingTerm = static_cast< float >( term );
+
+        HistogramValueType * row = &histogram[fixedBin * bins];
+        for ( OffsetValueType j = movingBin - 1; j <= movingBin + 2; ++j )
+        {
+          row[j] += static_cast< HistogramValueType >(
+            MattesFixedBinDetail::CubicBSpline( static_cast< double >( j ) - static_cast< double >( term ) ) );
+        }
+        ++validSamples;
+      }
+      blockValidSamples[block] = validSamples;
+    },
+    nullptr );
+
+  // Deterministic merge: always in block order, independent of the threads used.
+  std::fill( this->m_JointPDF.begin(), this->m_JointPDF.end(), 0.0 );
+  this->m_NumberOfValidSamples = 0;
+  for ( SizeValueType block = 0; block < numberOfBlocks; ++block )
+  {
+    const std::vector< HistogramValueType > & histogram = this->m_BlockHistograms[block];
+    for ( SizeValueType k = 0; k < histogram.size(); ++k )
+    {
+      this->m_JointPDF[k] += static_cast< PDFValueType >( histogram[k] );
+    }
+    this->m_NumberOfValidSamples += blockValidSamples[block];
+  }
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+typename MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                              TInternalComputationValueType,
+                                                              TMetricTraits >::MeasureType
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::ComputeValue( bool computeRatios ) const
+{
+  const SizeValueType bins = this->m_NumberOfHistogramBins;
+  const PDFValueType  pdfSum = std::accumulate( this->m_JointPDF.begin(), this->m_JointPDF.end(), PDFValueType( 0 ) );
+  if ( this->m_NumberOfValidSamples == 0 || pdfSum <= 0.0 )
+  {
+    itkWarningMacro( << "No valid samples; all samples map outside the moving image or its mask." );
+    std::fill( this->m_PRatio.begin(), this->m_PRatio.end(), 0.0 );
+    return NumericTraits< MeasureType >::max();
+  }
+
+  std::vector< PDFValueType > fixedPDF( bins, 0.0 );
+  std::vector< PDFValueType > movingPDF( bins, 0.0 );
+  for ( SizeValueType i = 0; i < bins; ++i )
+  {
+    for ( SizeValueType j = 0; j < bins; ++j )
+    {
+      PDFValueType & p = this->m_JointPDF[i * bins + j];
+      p /= pdfSum;
+      fixedPDF[i] += p;
+      movingPDF[j] += p;
+    }
+  }
+
+  constexpr PDFValueType closeToZero = 1e-16;
+  PDFValueType           sum = 0.0;
+  for ( SizeValueType i = 0; i < bins; ++i )
+  {
+    for ( SizeValueType j = 0; j < bins; ++j )
+    {
+      const PDFValueType p = this->m_JointPDF[i * bins + j];
+      PDFValueType       pRatio = 0.0;
+      if ( p > closeToZero && movingPDF[j] > closeToZero )
+      {
+        pRatio = std::log( p / movingPDF[j] );
+        if ( fixedPDF[i] > closeToZero )
+        {
+          sum += p * ( pRatio - std::log( fixedPDF[i] ) );
+        }
+      }
+      if ( computeRatios )
+      {
+        this->m_PRatio[i * bins + j] = pRatio;
+      }
+    }
+  }
+  return static_cast< MeasureType >( -sum );
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+void
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::ComputeDerivative( DerivativeType & derivative )
+  const
+{
+  const NumberOfParametersType numberOfParameters = this->GetNumberOfParameters();
+  derivative.SetSize( numberOfParameters );
+  derivative.Fill( NumericTraits< DerivativeValueType >::ZeroValue() );
+  if ( this->m_NumberOfValidSamples == 0 )
+  {
+    return;
+  }
+
+  constexpr int       padding = 2;
+  const SizeValueType bins = this->m_NumberOfHistogramBins;
+  const auto          lastMovingBin = static_cast< OffsetValueType >( bins ) - padding - 1;
+  const SizeValueType numberOfBlocks = this->m_BlockHistograms.size();
+
+  // One derivative accumulator per work unit rather than per block, which
+  // would hold numberOfBlocks x numberOfParameters values for a BSpline
+  // transform.  Every work unit sums a fixed, contiguous range of blocks in
+  // order, and the ranges only depend on the number of blocks, so the result
+  // does not depend on the number of threads either.
+  constexpr SizeValueType maximumNumberOfWorkUnits = 64;
+  const SizeValueType     numberOfWorkUnits = std::min( numberOfBlocks, maximumNumberOfWorkUnits );
+  std::vector< std::vector< PDFValueType > > workUnitDerivatives( numberOfWorkUnits );
+
+  MultiThreaderBase::Pointer threader = MultiThreaderBase::New();
+  threader->ParallelizeArray(
+    0,
+    numberOfWorkUnits,
+    [&]( const SizeValueType workUnit ) {
+      std::vector< PDFValueType > & workUnitDerivative = workUnitDerivatives[workUnit];
+      workUnitDerivative.assign( numberOfParameters, 0.0 );
+      const SizeValueType     firstBlock = workUnit * numberOfBlocks / numberOfWorkUnits;
+      const SizeValueType     endBlock = ( workUnit + 1 ) * numberOfBlocks / numberOfWorkUnits;
+      const SizeValueType     begin = firstBlock * this->m_SamplesPerBlock;
+      const SizeValueType     end = std::min( endBlock * this->m_SamplesPerBlock, this->m_NumberOfSamples );
+      VirtualPointType        virtualPoint;
+      MovingImageGradientType movingGradient;
+      JacobianType            jacobian( MovingImageDimension, numberOfParameters );
+      for ( SizeValueType sample = begin; sample < end; ++sample )
+      {
+        const float term = this->m_MovingSampleTerms[sample];
+        if ( std::isnan( term ) )
+        {
+          continue;
+        }
+        const PDFValueType * ratioRow = &this->m_PRatio[this->m_FixedSampleBins[sample] * bins];
+        auto                 movingBin = static_cast< OffsetValueType >( term );
+        movingBin = std::min( std::max( movingBin, static_cast< OffsetValueType >( padding ) ), lastMovingBin );
+
+        // d(MI)/d(moving value) for this sample, summed over the Parzen window.
+        PDFValueType weight = 0.0;
+        for ( OffsetValueType j = movingBin - 1; j <= movingBin + 2; ++j )
+        {
+          weight -= ratioRow[j] * MattesFixedBinDetail::CubicBSplineDerivative( static_cast< double >( j ) -
+                                                                                 static_cast< double >( term ) );
+        }
+        if ( weight == 0.0 )
+        {
+          continue;
+        }
+
+        this->GetSamplePoint( sample, virtualPoint );
+        const MovingImagePointType mappedMovingPoint = this->GetMovingTransform()->TransformPoint( virtualPoint );
+        this->ComputeMovingImageGradientAtPoint( mappedMovingPoint, movingGradient );
+        this->GetMovingTransform()->ComputeJacobianWithRespectToParameters( virtualPoint, jacobian );
+        for ( NumberOfParametersType par = 0; par < numberOfParameters; ++par )
+        {
+          PDFValueType innerProduct = 0.0;
+          for ( unsigned int d = 0; d < MovingImageDimension; ++d )
+          {
+            innerProduct += jacobian[d][par] * movingGradient[d];
+          }
+          workUnitDerivative[par] += weight * innerProduct;
+        }
+      }
+    },
+    nullptr );
+
+  // Merge in work unit order and apply the normalization 1 / ( binSize * N ).
+  const PDFValueType nFactor =
+    1.0 / ( this->m_MovingImageBinSize * static_cast< PDFValueType >( this->m_NumberOfValidSamples ) );
+  for ( SizeValueType workUnit = 0; workUnit < numberOfWorkUnits; ++workUnit )
+  {
+    for ( NumberOfParametersType par = 0; par < numberOfParameters; ++par )
+    {
+      derivative[par] += static_cast< DerivativeValueType >( nFactor * workUnitDerivatives[workUnit][par] );
+    }
+  }
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+typename MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                              TInternalComputationValueType,
+                                                              TMetricTraits >::MeasureType
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::GetValue() const
+{
+  this->ComputeJointPDF();
+  return this->ComputeValue( false );
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+void
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::GetDerivative( DerivativeType & derivative ) const
+{
+  MeasureType value;
+  this->GetValueAndDerivative( value, derivative );
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+void
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::GetValueAndDerivative( MeasureType & value,
+                                                                                             DerivativeType &
+                                                                                               derivative ) const
+{
+  this->ComputeJointPDF();
+  value = this->ComputeValue( true );
+  this->ComputeDerivative( derivative );
+}
+
+template < typename TFixedImage, typename TMovingImage, typename TVirtualImage, typename TInternalComputationValueType,
+           typename TMetricTraits >
+void
+MattesMutualInformationFixedBinImageToImageMetricv4< TFixedImage, TMovingImage, TVirtualImage,
+                                                     TInternalComputationValueType,
+                                                     TMetricTraits >::PrintSelf( std::ostream & os,
+                                                                                 Indent         indent ) const
+{
+  Superclass::PrintSelf( os, indent );
+  os << indent << "NumberOfHistogramBins: " << this->m_NumberOfHistogramBins << std::endl;
+  os << indent << "SamplesPerBlock: " << this->m_SamplesPerBlock << std::endl;
+  os << indent << "NumberOfSamples: " << this->m_NumberOfSamples << std::endl;
+  os << indent << "FixedImageBinSize: " << this->m_FixedImageBinSize << std::endl;
+  os << indent << "MovingImageBinSize: " << this->m_MovingImageBinSize << std::endl;
+}
+} // end namespace itk
+
+#endif // __itkMattesMutualInformationFixedBinImageToImageMetricv4_hxx
@@ -0,0 +1,197 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __itkRegistrationSampleCache_h
+#define __itkRegistrationSampleCache_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkImageRegistrationMethodv4.h"
+#include "itkImageToImageMetricv4.h"
+#include "itkObjectToObjectMultiMetricv4.h"
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+namespace itk
+{
+/**
+ * \class RegistrationSampleCache
+ * \author Hans J. Johnson
+ * \brief Fixed-image metric samples and image pyramid levels shared by all stages of one registration.
+ *
+ * BRAINSFit runs Rigid, ScaleVersor3D, ScaleSkewVersor3D, Affine and BSpline
+ * stages back to back against the same fixed image and fixed mask.  Each
+ * ImageRegistrationMethodv4 would otherwise draw the same REGULAR/RANDOM
+ * sample set again (the seed is reset to 121212 for every stage).  This cache
+ * draws the sample points once and hands the point set to every metric in
+ * the stage.
+ *
+ * The cached samples are only invalidated when the fixed images, the fixed
+ * mask, the sampling strategy, the sampling percentage or the seed change.
+ *
+ * Smoothed/shrunk pyramid levels are memoized per (source image, shrink
+ * factor, sigma) so that stages using the same schedule share them as well.
+ * Level (1, 0.0) is the source image itself.
+ */
+template < typename TFixedImage, typename TMovingImage >
+class RegistrationSampleCache : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN( RegistrationSampleCache );
+
+  /** Standard class type alias. */
+  using Self = RegistrationSampleCache;
+  using Superclass = Object;
+  using Pointer = SmartPointer< Self >;
+  using ConstPointer = SmartPointer< const Self >;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro( Self );
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro( RegistrationSampleCache, Object );
+
+  using FixedImageType = TFixedImage;
+  using FixedImagePointer = typename FixedImageType::Pointer;
+  using MovingImageType = TMovingImage;
+
+  static constexpr unsigned int FixedImageDimension = FixedImageType::ImageDimension;
+  static constexpr unsigned int MovingImageDimension = MovingImageType::ImageDimension;
+
+  using RegistrationType = ImageRegistrationMethodv4< FixedImageType, MovingImageType >;
+  using SamplingStrategyType = typename RegistrationType::MetricSamplingStrategyType;
+
+  using ImageMetricType = ImageToImageMetricv4< FixedImageType, MovingImageType, FixedImageType, double >;
+  using MultiMetricType =
+    ObjectToObjectMultiMetricv4< FixedImageDimension, MovingImageDimension, FixedImageType, double >;
+  using MetricBaseType = ObjectToObjectMetricBaseTemplate< double >;
+  using FixedImageMaskType = typename ImageMetricType::FixedImageMaskType;
+  using SampledPointSetType = typename ImageMetricType::FixedSampledPointSetType;
+  using SampledPointSetPointer = typename SampledPointSetType::Pointer;
+
+  /** Seed used for REGULAR jitter and RANDOM sampling (same as genericRegistrationHelper). */
+  itkSetMacro( RandomSeed, int );
+  itkGetConstMacro( RandomSeed, int );
+
+  /** Number of times the sample set was actually (re)drawn; for testing and profiling. */
+  itkGetConstMacro( NumberOfSampleUpdates, SizeValueType );
+
+  /** Make the cached samples valid for the given inputs. The virtual domain is
+   * the first fixed image, as it is for ImageRegistrationMethodv4 with a
+   * shrink factor of 1.  This is a no-op when nothing relevant has changed. */
+  void
+  UpdateSamples( const std::vector< FixedImagePointer > & fixedImages,
+                 const FixedImageMaskType *               fixedMask,
+                 SamplingStrategyType                     strategy,
+                 double                                   samplingPercentage );
+
+  /** Convenience overload that reads the fixed mask from the (multi) metric. */
+  void
+  UpdateSamples( const std::vector< FixedImagePointer > & fixedImages,
+                 const MetricBaseType *                   metric,
+                 SamplingStrategyType                     strategy,
+                 double                                   samplingPercentage );
+
+  /** Install the cached point set on every image metric of \a metric.
+   * Returns false (and leaves the metric untouched) for dense sampling. */
+  bool
+  ApplyToMetric( MetricBaseType * metric ) const;
+
+  /** True when a REGULAR or RANDOM sample set is available. */
+  bool
+  HasSamples() const
+  {
+    return this->m_SampledPointSet.IsNotNull();
+  }
+
+  const SampledPointSetType *
+  GetSampledPointSet() const
+  {
+    return this->m_SampledPointSet.GetPointer();
+  }
+
+  /** Return the pyramid level of \a image smoothed with \a sigma (physical
+   * units) and shrunk by \a shrinkFactor, computing it at most once. */
+  template < typename TImage >
+  typename TImage::Pointer
+  GetPyramidLevel( TImage * image, unsigned int shrinkFactor, double sigma );
+
+  /** Drop all cached samples and pyramid levels. */
+  void
+  Clear();
+
+  /** Return the fixed image mask of the first image metric in \a metric (may be nullptr). */
+  static const FixedImageMaskType *
+  GetFixedImageMaskFromMetric( const MetricBaseType * metric );
+
+protected:
+  RegistrationSampleCache();
+  ~RegistrationSampleCache() override = default;
+
+  void
+  PrintSelf( std::ostream & os, Indent indent ) const override;
+
+private:
+  struct SampleKey
+  {
+    std::vector< const FixedImageType * > m_FixedImages;
+    std::vector< ModifiedTimeType >       m_FixedImageTimes;
+    const FixedImageMaskType *            m_FixedMask{ nullptr };
+    ModifiedTimeType                      m_FixedMaskTime{ 0 };
+    SamplingStrategyType                  m_Strategy{ RegistrationType::NONE };
+    double                                m_SamplingPercentage{ 0.0 };
+    int                                   m_RandomSeed{ 0 };
+
+    bool
+    operator==( const SampleKey & other ) const
+    {
+      return m_FixedImages == other.m_FixedImages && m_FixedImageTimes == other.m_FixedImageTimes &&
+             m_FixedMask == other.m_FixedMask && m_FixedMaskTime == other.m_FixedMaskTime &&
+             m_Strategy == other.m_Strategy && m_SamplingPercentage == other.m_SamplingPercentage &&
+             m_RandomSeed == other.m_RandomSeed;
+    }
+  };
+
+  void
+  DrawSamples( const FixedImageType * virtualDomain, const FixedImageMaskType * fixedMask );
+
+  using PyramidKeyType = std::tuple< const DataObject *, unsigned int, double >;
+  struct PyramidEntry
+  {
+    DataObject::ConstPointer m_Source; // keeps the key address from being reused
+    ModifiedTimeType         m_SourceTime{ 0 };
+    DataObject::Pointer      m_Level;
+  };
+
+  int           m_RandomSeed{ 121212 };
+  SizeValueType m_NumberOfSampleUpdates{ 0 };
+  bool          m_SampleKeyValid{ false };
+
+  SampleKey                                m_SampleKey;
+  SampledPointSetPointer                   m_SampledPointSet;
+  std::map< PyramidKeyType, PyramidEntry > m_PyramidLevels;
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkRegistrationSampleCache.hxx"
+#endif
+
+#endif // __itkRegistrationSampleCache_h
@@ -0,0 +1,294 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __itkRegistrationSampleCache_hxx
+#define __itkRegistrationSampleCache_hxx
+
+#include "itkRegistrationSampleCache.h"
+#include "itkDiscreteGaussianImageFilter.h"
+#include "itkShrinkImageFilter.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRandomConstIteratorWithIndex.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace itk
+{
+template < typename TFixedImage, typename TMovingImage >
+RegistrationSampleCache< TFixedImage, TMovingImage >::RegistrationSampleCache() = default;
+
+template < typename TFixedImage, typename TMovingImage >
+const typename RegistrationSampleCache< TFixedImage, TMovingImage >::FixedImageMaskType *
+RegistrationSampleCache< TFixedImage, TMovingImage >::GetFixedImageMaskFromMetric( const MetricBaseType * metric )
+{
+  const auto * multiMetric = dynamic_cast< const MultiMetricType * >( metric );
+  if ( multiMetric != nullptr )
+  {
+    if ( multiMetric->GetNumberOfMetrics() == 0 )
+    {
+      return nullptr;
+    }
+    metric = multiMetric->GetMetricQueue()[0].GetPointer();
+  }
+  const auto * imageMetric = dynamic_cast< const ImageMetricType * >( metric );
+  return ( imageMetric != nullptr ) ? imageMetric->GetFixedImageMask() : nullptr;
+}
+
+template < typename TFixedImage, typename TMovingImage >
+void
+RegistrationSampleCache< TFixedImage, TMovingImage >::UpdateSamples(
+  const std::vector< FixedImagePointer > & fixedImages,
+  const MetricBaseType *                   metric,
+  SamplingStrategyType                     strategy,
+  double                                   samplingPercentage )
+{
+  this->UpdateSamples( fixedImages, GetFixedImageMaskFromMetric( metric ), strategy, samplingPercentage );
+}
+
+template < typename TFixedImage, typename TMovingImage >
+void
+RegistrationSampleCache< TFixedImage, TMovingImage >::UpdateSamples(
+  const std::vector< FixedImagePointer > & fixedImages,
+  const FixedImageMaskType *               fixedMask,
+  SamplingStrategyType                     strategy,
+  double                                   samplingPercentage )
+{
+  if ( fixedImages.empty() || fixedImages[0].IsNull() )
+  {
+    itkExceptionMacro( << "At least one fixed image is required to draw metric samples." );
+  }
+
+  SampleKey key;
+  for ( const auto & fixedImage : fixedImages )
+  {
+    key.m_FixedImages.push_back( fixedImage.GetPointer() );
+    key.m_FixedImageTimes.push_back( fixedImage->GetMTime() );
+  }
+  key.m_FixedMask = fixedMask;
+  key.m_FixedMaskTime = ( fixedMask != nullptr ) ? fixedMask->GetMTime() : 0;
+  key.m_Strategy = strategy;
+  key.m_SamplingPercentage = samplingPercentage;
+  key.m_RandomSeed = this->m_RandomSeed;
+
+  if ( this->m_SampleKeyValid && key == this->m_SampleKey )
+  {
+    return;
+  }
+
+  this->m_SampleKey = key;
+  this->m_SampleKeyValid = true;
+  this->m_SampledPointSet = nullptr;
+  if ( strategy == RegistrationType::NONE )
+  {
+    // Dense sampling: the metric visits every virtual domain voxel itself.
+    return;
+  }
+  if ( samplingPercentage <= 0.0 || samplingPercentage > 1.0 )
+  {
+    itkExceptionMacro( << "Sampling percentage " << samplingPercentage << " is not in (0,1]." );
+  }
+
+  this->DrawSamples( fixedImages[0].GetPointer(), fixedMask );
+  ++this->m_NumberOfSampleUpdates;
+  this->Modified();
+}
+
+template < typename TFixedImage, typename TMovingImage >
+void
+RegistrationSampleCache< TFixedImage, TMovingImage >::DrawSamples( const FixedImageType *     virtualDomain,
+                                                                   const FixedImageMaskType * fixedMask )
+{
+  // Mirrors ImageRegistrationMethodv4::SetMetricSamplePoints() for a single
+  // level with a shrink factor of 1, so results match the per-stage sampling.
+  using RandomizerType = Statistics::MersenneTwisterRandomVariateGenerator;
+  typename RandomizerType::Pointer randomizer = RandomizerType::New();
+  randomizer->SetSeed( static_cast< typename RandomizerType::IntegerType >( this->m_RandomSeed ) );
+
+  const typename FixedImageType::RegionType & region = virtualDomain->GetLargestPossibleRegion();
+  const typename FixedImageType::SpacingType  oneThirdSpacing = virtualDomain->GetSpacing() / 3.0;
+
+  SampledPointSetPointer samplePointSet = SampledPointSetType::New();
+  samplePointSet->Initialize();
+
+  using SamplePointType = typename SampledPointSetType::PointType;
+  SizeValueType index = 0;
+  const auto    addPoint = [&]( const typename FixedImageType::IndexType & voxel ) {
+    SamplePointType point;
+    virtualDomain->TransformIndexToPhysicalPoint( voxel, point );
+    // randomly perturb the point within a voxel (approximately)
+    for ( unsigned int d = 0; d < FixedImageDimension; ++d )
+    {
+      point[d] += randomizer->GetNormalVariate() * oneThirdSpacing[d];
+    }
+    if ( fixedMask == nullptr || fixedMask->IsInsideInWorldSpace( point ) )
+    {
+      samplePointSet->SetPoint( index, point );
+      ++index;
+    }
+  };
+
+  const double percentage = this->m_SampleKey.m_SamplingPercentage;
+  if ( this->m_SampleKey.m_Strategy == RegistrationType::REGULAR )
+  {
+    const auto    sampleCount = static_cast< SizeValueType >( std::ceil( 1.0 / percentage ) );
+    SizeValueType count = sampleCount; // start at sampleCount so the first voxel is used
+    for ( ImageRegionConstIteratorWithIndex< FixedImageType > it( virtualDomain, region ); !it.IsAtEnd(); ++it )
+    {
+      if ( count == sampleCount )
+      {
+        count = 0;
+        addPoint( it.GetIndex() );
+      }
+      ++count;
+    }
+  }
+  else // RANDOM
+  {
+    const auto sampleCount =
+      static_cast< SizeValueType >( static_cast< double >( region.GetNumberOfPixels() ) * percentage );
+    ImageRandomConstIteratorWithIndex< FixedImageType > it( virtualDomain, region );
+    it.ReinitializeSeed( this->m_RandomSeed );
+    it.SetNumberOfSamples( sampleCount );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+    {
+      addPoint( it.GetIndex() );
+    }
+  }
+
+  if ( index == 0 )
+  {
+    itkExceptionMacro( << "No metric samples fall inside the fixed image mask." );
+  }
+  this->m_SampledPointSet = samplePointSet;
+}
+
+template < typename TFixedImage, typename TMovingImage >
+bool
+RegistrationSampleCache< TFixedImage, TMovingImage >::ApplyToMetric( MetricBaseType * metric ) const
+{
+  if ( this->m_SampledPointSet.IsNull() || metric == nullptr )
+  {
+    return false;
+  }
+
+  std::vector< ImageMetricType * > imageMetrics;
+  auto *                           multiMetric = dynamic_cast< MultiMetricType * >( metric );
+  if ( multiMetric != nullptr )
+  {
+    for ( SizeValueType n = 0; n < multiMetric->GetNumberOfMetrics(); ++n )
+    {
+      imageMetrics.push_back( dynamic_cast< ImageMetricType * >( multiMetric->GetMetricQueue()[n].GetPointer() ) );
+    }
+  }
+  else
+  {
+    imageMetrics.push_back( dynamic_cast< ImageMetricType * >( metric ) );
+  }
+
+  for ( auto * imageMetric : imageMetrics )
+  {
+    if ( imageMetric != nullptr )
+    {
+      imageMetric->SetFixedSampledPointSet( this->m_SampledPointSet );
+      imageMetric->SetUseSampledPointSet( true );
+    }
+  }
+  return true;
+}
+
+template < typename TFixedImage, typename TMovingImage >
+template < typename TImage >
+typename TImage::Pointer
+RegistrationSampleCache< TFixedImage, TMovingImage >::GetPyramidLevel( TImage *     image,
+                                                                       unsigned int shrinkFactor,
+                                                                       double       sigma )
+{
+  if ( image == nullptr )
+  {
+    itkExceptionMacro( << "Cannot build a pyramid level from a null image." );
+  }
+  shrinkFactor = std::max( shrinkFactor, 1U );
+  if ( shrinkFactor == 1 && sigma <= 0.0 )
+  {
+    return image;
+  }
+
+  const PyramidKeyType key( image, shrinkFactor, sigma );
+  auto                 found = this->m_PyramidLevels.find( key );
+  if ( found != this->m_PyramidLevels.end() && found->second.m_SourceTime == image->GetMTime() )
+  {
+    return static_cast< TImage * >( found->second.m_Level.GetPointer() );
+  }
+
+  typename TImage::Pointer level = image;
+  if ( sigma > 0.0 )
+  {
+    using SmoothingFilterType = DiscreteGaussianImageFilter< TImage, TImage >;
+    typename SmoothingFilterType::Pointer smoother = SmoothingFilterType::New();
+    smoother->SetUseImageSpacing( true );
+    smoother->SetVariance( sigma * sigma );
+    smoother->SetMaximumError( 0.01 );
+    smoother->SetInput( level );
+    smoother->Update();
+    level = smoother->GetOutput();
+    level->DisconnectPipeline();
+  }
+  if ( shrinkFactor > 1 )
+  {
+    using ShrinkFilterType = ShrinkImageFilter< TImage, TImage >;
+    typename ShrinkFilterType::Pointer shrinker = ShrinkFilterType::New();
+    shrinker->SetShrinkFactors( shrinkFactor );
+    shrinker->SetInput( level );
+    shrinker->Update();
+    level = shrinker->GetOutput();
+    level->DisconnectPipeline();
+  }
+
+  PyramidEntry & entry = this->m_PyramidLevels[key];
+  entry.m_Source = image;
+  entry.m_SourceTime = image->GetMTime();
+  entry.m_Level = level.GetPointer();
+  return level;
+}
+
+template < typename TFixedImage, typename TMovingImage >
+void
+RegistrationSampleCache< TFixedImage, TMovingImage >::Clear()
+{
+  this->m_SampleKeyValid = false;
+  this->m_SampledPointSet = nullptr;
+  this->m_PyramidLevels.clear();
+  this->Modified();
+}
+
+template < typename TFixedImage, typename TMovingImage >
+void
+RegistrationSampleCache< TFixedImage, TMovingImage >::PrintSelf( std::ostream & os, Indent indent ) const
+{
+  Superclass::PrintSelf( os, indent );
+  os << indent << "RandomSeed: " << this->m_RandomSeed << std::endl;
+  os << indent << "NumberOfSampleUpdates: " << this->m_NumberOfSampleUpdates << std::endl;
+  os << indent << "NumberOfSamples: "
+     << ( this->m_SampledPointSet.IsNotNull() ? this->m_SampledPointSet->GetNumberOfPoints() : 0 ) << std::endl;
+  os << indent << "NumberOfPyramidLevels: " << this->m_PyramidLevels.size() << std::endl;
+}
+} // end namespace itk
+
+#endif // __itkRegistrationSampleCache_hxx
@@ -0,0 +1,145 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+// The Hough accumulator must not depend on how many work units vote into it.
+
+#include "itkImage.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "../src/itkHoughTransformRadialVotingImageFilter.h"
+
+#include <cstdlib>
+#include <iostream>
+
+constexpr unsigned int LocalImageDimension = 3;
+using InputImageType = itk::Image< short, LocalImageDimension >;
+using OutputImageType = itk::Image< double, LocalImageDimension >;
+using HoughFilterType = itk::HoughTransformRadialVotingImageFilter< InputImageType, OutputImageType >;
+
+// Two bright "eyes" of radius 12 on a dark background.
+static InputImageType::Pointer
+MakeEyesImage()
+{
+  InputImageType::SizeType size;
+  size[0] = 64;
+  size[1] = 48;
+  size[2] = 40;
+  InputImageType::Pointer image = InputImageType::New();
+  image->SetRegions( size );
+  image->Allocate();
+
+  const double centers[2][LocalImageDimension] = { { 18.0, 24.0, 20.0 }, { 45.0, 23.0, 19.0 } };
+  for ( itk::ImageRegionIteratorWithIndex< InputImageType > it( image, image->GetLargestPossibleRegion() );
+        !it.IsAtEnd();
+        ++it )
+  {
+    const InputImageType::IndexType index = it.GetIndex();
+    short                           value = 0;
+    for ( const auto & center : centers )
+    {
+      double d2 = 0;
+      for ( unsigned int i = 0; i < LocalImageDimension; ++i )
+      {
+        d2 += ( index[i] - center[i] ) * ( index[i] - center[i] );
+      }
+      if ( d2 <= 12.0 * 12.0 )
+      {
+        value = 200;
+      }
+    }
+    it.Set( value );
+  }
+  return image;
+}
+
+static HoughFilterType::Pointer
+RunHough( const InputImageType::Pointer & image, const unsigned int numberOfWorkUnits )
+{
+  HoughFilterType::Pointer houghFilter = HoughFilterType::New();
+  houghFilter->SetInput( image );
+  houghFilter->SetNumberOfSpheres( 2 );
+  houghFilter->SetMinimumRadius( 11. );
+  houghFilter->SetMaximumRadius( 13. );
+  houghFilter->SetSigmaGradient( 1. );
+  houghFilter->SetVariance( 1. );
+  houghFilter->SetSphereRadiusRatio( 1. );
+  houghFilter->SetVotingRadiusRatio( .5 );
+  houghFilter->SetThreshold( 10. );
+  houghFilter->SetOutputThreshold( .8 );
+  houghFilter->SetGradientThreshold( 0. );
+  houghFilter->SetSamplingRatio( .2 );
+  houghFilter->SetHoughEyeDetectorMode( 1 );
+  houghFilter->SetNumberOfWorkUnits( numberOfWorkUnits );
+  houghFilter->Update();
+  return houghFilter;
+}
+
+static bool
+SameVoxels( const HoughFilterType::InternalImageType * a, const HoughFilterType::InternalImageType * b )
+{
+  using IteratorType = itk::ImageRegionConstIterator< HoughFilterType::InternalImageType >;
+  IteratorType ait( a, a->GetLargestPossibleRegion() );
+  IteratorType bit( b, b->GetLargestPossibleRegion() );
+  for ( ; !ait.IsAtEnd(); ++ait, ++bit )
+  {
+    if ( ait.Get() != bit.Get() )
+    {
+      std::cerr << "Voxel " << ait.GetIndex() << " differs: " << ait.Get() << " != " << bit.Get() << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int
+main( int, char *[] )
+{
+  const InputImageType::Pointer image = MakeEyesImage();
+
+  const HoughFilterType::Pointer serial = RunHough( image, 1 );
+  const unsigned int             workUnitsToTest[] = { 2, 3, 8 };
+  for ( const unsigned int numberOfWorkUnits : workUnitsToTest )
+  {
+    const HoughFilterType::Pointer threaded = RunHough( image, numberOfWorkUnits );
+    if ( !SameVoxels( serial->GetAccumulatorImage(), threaded->GetAccumulatorImage() ) )
+    {
+      std::cerr << "Accumulator differs with " << numberOfWorkUnits << " work units" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if ( !SameVoxels( serial->GetRadiusImage(), threaded->GetRadiusImage() ) )
+    {
+      std::cerr << "Radius image differs with " << numberOfWorkUnits << " work units" << std::endl;
+      return EXIT_FAILURE;
+    }
+    const HoughFilterType::SpheresListType & serialSpheres = serial->GetSpheres();
+    const HoughFilterType::SpheresListType & threadedSpheres = threaded->GetSpheres();
+    if ( serialSpheres.size() != threadedSpheres.size() )
+    {
+      std::cerr << "Number of spheres differs with " << numberOfWorkUnits << " work units" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( serial->GetSpheres().size() != 2 )
+  {
+    std::cerr << "Expected 2 spheres, found " << serial->GetSpheres().size() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Accumulator is identical for 1, 2, 3 and 8 work units" << std::endl;
+  return EXIT_SUCCESS;
+}
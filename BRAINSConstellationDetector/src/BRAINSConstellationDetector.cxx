@@ -23,6 +23,7 @@
  */
 
 #include "BRAINSConstellationDetectorPrimary.h"
+#include "BRAINSProfiler.h"
 #include "BRAINSConstellationDetectorCLP.h"
 
 #include "BRAINSConstellationDetectorVersion.h"
@@ -38,6 +39,8 @@ main( int argc, char * argv[] )
   // when numberOfThreads is greater than 4.
   const int                                             hack_max_num_threads = std::max( 4, numberOfThreads );
   const BRAINSUtils::StackPushITKDefaultNumberOfThreads TempDefaultNumberOfThreadsHolder( hack_max_num_threads );
+  const BRAINSUtils::ProfilerSession                    profilerSession( profileOutput );
+  BRAINS_PROFILE_SCOPE( "BRAINSConstellationDetector" );
 
   const std::string Version( BCDVersionString );
   std::cout << "Run BRAINSConstellationDetector Version: " << Version << std::endl;
@@ -67,6 +67,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 
 #include "BRAINSMacro.h"
 
@@ -122,6 +123,14 @@ public:
   /** Set the filename of the model file */
   itkSetMacro( InputTemplateModel, std::string );
 
+  /** Use a model that was already read, e.g. once for a batch of subjects,
+   * instead of reading the InputTemplateModel file. */
+  void
+  SetLoadedTemplateModel( const std::shared_ptr< const landmarksConstellationModelIO > & loadedTemplateModel )
+  {
+    this->m_LoadedTemplateModel = loadedTemplateModel;
+  }
+
   /** Set MSP quality level */
   itkSetMacro( MspQualityLevel, unsigned int );
 
@@ -256,6 +265,10 @@ public:
   /** Set debugging images level */
   itkSetMacro( WritedebuggingImagesLevel, unsigned int );
 
+  /** Copy Verbose and WritedebuggingImagesLevel into the process-wide debug
+   * globals.  Turn off when several detectors run concurrently. */
+  itkSetMacro( UpdateGlobalDebugFlags, bool );
+
   /** Set branded 2D image filename */
   itkSetMacro( WriteBranded2DImage, std::string );
 
@@ -308,6 +321,8 @@ protected:
   std::string        m_BackgroundFillValueString;     // default = "0"
   std::string        m_InterpolationMode;             // default = "Linear"
 
+  std::shared_ptr< const landmarksConstellationModelIO > m_LoadedTemplateModel; // default = nullptr
+
   // a local editable copy of original input before Hough eye detector
   // Note: this->GetInput() will return a const input after Hough eye.
   SImageType::Pointer m_OriginalInputImage;
@@ -356,6 +371,7 @@ protected:
   bool         m_Debug;                     // default = false
   bool         m_Verbose;                   // default = false
   unsigned int m_WritedebuggingImagesLevel; // default = 0
+  bool         m_UpdateGlobalDebugFlags;    // default = true
   std::string  m_WriteBranded2DImage;
   std::string  m_ResultsDir; // default = "./"
 
@@ -97,6 +97,7 @@ BRAINSConstellationDetector2< TInputImage, TOutputImage >::BRAINSConstellationDe
   this->m_Debug = false;
   this->m_Verbose = false;
   this->m_WritedebuggingImagesLevel = 0;
+  this->m_UpdateGlobalDebugFlags = true;
   this->m_WriteBranded2DImage = "";
   this->m_ResultsDir = "./";
 
@@ -111,8 +112,11 @@ BRAINSConstellationDetector2< TInputImage, TOutputImage >::GenerateData()
 {
   // file pointer for opening the setup file
   // /////////////////////////////////////////////////////////////////////////////////////////////
-  LMC::globalverboseFlag = this->m_Verbose;
-  globalImagedebugLevel = this->m_WritedebuggingImagesLevel;
+  if ( this->m_UpdateGlobalDebugFlags )
+  {
+    LMC::globalverboseFlag = this->m_Verbose;
+    globalImagedebugLevel = this->m_WritedebuggingImagesLevel;
+  }
 
   // /////////////////////////////////////////////////////////////////////////////////////////////
   short BackgroundFillValue;
@@ -127,7 +131,14 @@ BRAINSConstellationDetector2< TInputImage, TOutputImage >::GenerateData()
   // /////////////////////////////////////////////////////////////////////////////////////////////
   // read information from the setup file, and initialize some variables
   landmarksConstellationModelIO myModel;
-  myModel.ReadModelFile( this->m_InputTemplateModel );
+  if ( this->m_LoadedTemplateModel != nullptr )
+  {
+    myModel = *( this->m_LoadedTemplateModel );
+  }
+  else
+  {
+    myModel.ReadModelFile( this->m_InputTemplateModel );
+  }
 
 
   if ( LMC::globalverboseFlag )
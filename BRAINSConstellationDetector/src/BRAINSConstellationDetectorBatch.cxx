@@ -0,0 +1,340 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+/*
+ * Run BRAINSConstellationDetector on every subject of a manifest.  The
+ * template and LLS models are read once and shared by all subjects, which
+ * are processed concurrently; a subject that fails is reported in the
+ * summary and does not stop the others.
+ */
+
+#include "BRAINSConstellationDetectorPrimary.h"
+#include "BRAINSProfiler.h"
+#include "BRAINSConstellationDetectorBatchCLP.h"
+
+#include "BRAINSConstellationDetectorVersion.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace
+{
+/** The output settings of one subject, one line of the manifest. */
+struct BatchSubject
+{
+  std::map< std::string, std::string > m_Columns;
+  bool                                 m_Succeeded{ false };
+  double                               m_Seconds{ 0.0 };
+  std::string                          m_Message;
+
+  std::string
+  Get( const std::string & column ) const
+  {
+    const auto it = m_Columns.find( column );
+    return ( it == m_Columns.end() ) ? std::string() : it->second;
+  }
+};
+
+const std::vector< std::string > &
+GetManifestColumns()
+{
+  static const std::vector< std::string > columns{ "inputVolume",
+                                                   "inputLandmarksEMSP",
+                                                   "outputVolume",
+                                                   "outputResampledVolume",
+                                                   "outputTransform",
+                                                   "outputLandmarksInInputSpace",
+                                                   "outputLandmarksInACPCAlignedSpace",
+                                                   "outputMRML",
+                                                   "outputVerificationScript",
+                                                   "outputUntransformedClippedVolume" };
+  return columns;
+}
+
+std::vector< std::string >
+SplitManifestLine( const std::string & line )
+{
+  std::vector< std::string > fields;
+  std::istringstream         lineStream( line );
+  std::string                field;
+  while ( std::getline( lineStream, field, ',' ) )
+  {
+    const std::string::size_type first = field.find_first_not_of( " \t\r" );
+    const std::string::size_type last = field.find_last_not_of( " \t\r" );
+    fields.push_back( ( first == std::string::npos ) ? std::string() : field.substr( first, last - first + 1 ) );
+  }
+  return fields;
+}
+
+/** Read the manifest: a header line naming the columns, then one subject per
+ * line.  Blank lines and lines starting with '#' are skipped, and relative
+ * paths are relative to the directory of the manifest. */
+bool
+ReadManifest( const std::string & manifestFileName, std::vector< BatchSubject > & subjects )
+{
+  std::ifstream manifest( manifestFileName.c_str() );
+  if ( !manifest.is_open() )
+  {
+    std::cerr << "ERROR: Can not read the manifest " << manifestFileName << std::endl;
+    return false;
+  }
+  const std::string manifestDirectory =
+    itksys::SystemTools::GetParentDirectory( itksys::SystemTools::CollapseFullPath( manifestFileName ) );
+
+  std::vector< std::string > header;
+  std::string                line;
+  unsigned int               lineNumber = 0;
+  while ( std::getline( manifest, line ) )
+  {
+    ++lineNumber;
+    const std::vector< std::string > fields = SplitManifestLine( line );
+    if ( fields.empty() || ( fields.size() == 1 && fields[0].empty() ) || fields[0].compare( 0, 1, "#" ) == 0 )
+    {
+      continue;
+    }
+    if ( header.empty() )
+    {
+      for ( const std::string & column : fields )
+      {
+        if ( std::find( GetManifestColumns().begin(), GetManifestColumns().end(), column ) ==
+             GetManifestColumns().end() )
+        {
+          std::cerr << "ERROR: Unknown manifest column \"" << column << "\"; the known columns are:";
+          for ( const std::string & known : GetManifestColumns() )
+          {
+            std::cerr << " " << known;
+          }
+          std::cerr << std::endl;
+          return false;
+        }
+      }
+      if ( std::find( fields.begin(), fields.end(), "inputVolume" ) == fields.end() )
+      {
+        std::cerr << "ERROR: The manifest has no inputVolume column" << std::endl;
+        return false;
+      }
+      header = fields;
+      continue;
+    }
+    if ( fields.size() > header.size() )
+    {
+      std::cerr << "ERROR: Line " << lineNumber << " of the manifest has more fields than its header" << std::endl;
+      return false;
+    }
+    BatchSubject subject;
+    for ( size_t i = 0; i < fields.size(); ++i )
+    {
+      if ( !fields[i].empty() )
+      {
+        subject.m_Columns[header[i]] = itksys::SystemTools::CollapseFullPath( fields[i], manifestDirectory );
+      }
+    }
+    if ( subject.Get( "inputVolume" ).empty() )
+    {
+      std::cerr << "ERROR: Line " << lineNumber << " of the manifest has no inputVolume" << std::endl;
+      return false;
+    }
+    subjects.push_back( subject );
+  }
+  return true;
+}
+} // namespace
+
+int
+main( int argc, char * argv[] )
+{
+  PARSE_ARGS;
+  FFTWInit( "" ); // Initialize for FFTW in order to improve performance of subsequent runs
+  BRAINSRegisterAlternateIO();
+
+  const BRAINSUtils::StackPushITKDefaultNumberOfThreads TempDefaultNumberOfThreadsHolder(
+    std::max( 1, numberOfThreadsPerSubject ) );
+  const BRAINSUtils::ProfilerSession profilerSession( profileOutput );
+  BRAINS_PROFILE_SCOPE( "BRAINSConstellationDetectorBatch" );
+
+  const std::string Version( BCDVersionString );
+  std::cout << "Run BRAINSConstellationDetectorBatch Version: " << Version << std::endl;
+
+  std::vector< BatchSubject > subjects;
+  if ( manifest.empty() || !ReadManifest( manifest, subjects ) )
+  {
+    std::cerr << "To run the program please specify a valid manifest." << std::endl;
+    std::cerr << "Type " << argv[0] << " -h for more help." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // set the template model and the llsModel to default
+  if ( inputTemplateModel.empty() || llsModel.empty() )
+  {
+    std::string pathOut;
+    std::string errorMsg;
+    if ( !itksys::SystemTools::FindProgramPath( argv[0], pathOut, errorMsg ) )
+    {
+      std::cerr << "Error: Input model files not found" << std::endl;
+      std::cerr << errorMsg << std::endl;
+      return EXIT_FAILURE;
+    }
+    const std::string programPath = itksys::SystemTools::GetProgramPath( pathOut.c_str() );
+    if ( inputTemplateModel.empty() )
+    {
+      inputTemplateModel = programPath + "/" + "T1.mdl";
+      std::cout << "Set inputTemplateModel to default: " << inputTemplateModel << std::endl;
+    }
+    if ( llsModel.empty() )
+    {
+      llsModel = programPath + "/" + "LLSModel.h5";
+      std::cout << "Set LLSModel to default: " << llsModel << std::endl;
+    }
+  }
+
+  std::shared_ptr< const BRAINSConstellationDetectorPrimary::SharedModels > sharedModels;
+  try
+  {
+    sharedModels = BRAINSConstellationDetectorPrimary::LoadSharedModels( inputTemplateModel, llsModel );
+  }
+  catch ( itk::ExceptionObject & err )
+  {
+    std::cerr << "Can not read the models:\n" << err << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Each subject is single threaded by default, so the subjects themselves
+  // are the unit of parallelism.
+  unsigned int numberOfWorkers = ( numberOfSubjectsInParallel > 0 )
+                                   ? static_cast< unsigned int >( numberOfSubjectsInParallel )
+                                   : std::max( 1U, std::thread::hardware_concurrency() /
+                                                     static_cast< unsigned int >( std::max( 1, numberOfThreadsPerSubject ) ) );
+  numberOfWorkers = std::min( numberOfWorkers, static_cast< unsigned int >( subjects.size() ) );
+  std::cout << "Processing " << subjects.size() << " subjects, " << numberOfWorkers << " at a time." << std::endl;
+
+  // The detector's debug globals are process wide; set them once here and
+  // keep the workers from writing them.
+  LMC::globalverboseFlag = verbose;
+  globalImagedebugLevel = 0;
+
+  std::atomic< size_t > nextSubject( 0 );
+  const auto            processSubjects = [&]() {
+    for ( size_t s = nextSubject++; s < subjects.size(); s = nextSubject++ )
+    {
+      BatchSubject & subject = subjects[s];
+      const auto     start = std::chrono::steady_clock::now();
+      try
+      {
+        BRAINSConstellationDetectorPrimary BCD;
+        BCD.SetNumberOfWorkUnits( 0 ); // Set once for the whole batch above.
+        BCD.SetSharedModels( sharedModels );
+        BCD.SetInputTemplateModel( inputTemplateModel );
+        BCD.SetLLSModel( llsModel );
+        BCD.SetAtlasVolume( atlasVolume );
+        BCD.SetAtlasLandmarks( atlasLandmarks );
+        BCD.SetAtlasLandmarkWeights( atlasLandmarkWeights );
+        BCD.SetHoughEyeDetectorMode( houghEyeDetectorMode );
+        BCD.SetMspQualityLevel( mspQualityLevel );
+        BCD.SetOtsuPercentileThreshold( otsuPercentileThreshold );
+        BCD.SetAcLowerBound( acLowerBound );
+        BCD.SetCutOutHeadInOutputVolume( cutOutHeadInOutputVolume );
+        BCD.SetRescaleIntensities( rescaleIntensities );
+        BCD.SetTrimRescaledIntensities( trimRescaledIntensities );
+        BCD.SetRescaleIntensitiesOutputRange( rescaleIntensitiesOutputRange );
+        BCD.SetBackgroundFillValueString( backgroundFillValueString );
+        BCD.SetInterpolationMode( interpolationMode );
+        BCD.SetRadiusMPJ( radiusMPJ );
+        BCD.SetRadiusAC( radiusAC );
+        BCD.SetRadiusPC( radiusPC );
+        BCD.SetRadiusVN4( radiusVN4 );
+        BCD.SetVerbose( verbose );
+        BCD.SetUpdateGlobalDebugFlags( false );
+
+        BCD.SetInputVolume( subject.Get( "inputVolume" ) );
+        BCD.SetInputLandmarksEMSP( subject.Get( "inputLandmarksEMSP" ) );
+        BCD.SetOutputVolume( subject.Get( "outputVolume" ) );
+        BCD.SetOutputResampledVolume( subject.Get( "outputResampledVolume" ) );
+        BCD.SetOutputTransform( subject.Get( "outputTransform" ) );
+        BCD.SetOutputLandmarksInInputSpace( subject.Get( "outputLandmarksInInputSpace" ) );
+        BCD.SetOutputLandmarksInACPCAlignedSpace( subject.Get( "outputLandmarksInACPCAlignedSpace" ) );
+        BCD.SetOutputMRML( subject.Get( "outputMRML" ) );
+        BCD.SetOutputVerificationScript( subject.Get( "outputVerificationScript" ) );
+        BCD.SetOutputUntransformedClippedVolume( subject.Get( "outputUntransformedClippedVolume" ) );
+
+        subject.m_Succeeded = ( BCD.Compute() == EXIT_SUCCESS );
+        if ( !subject.m_Succeeded )
+        {
+          subject.m_Message = "BRAINSConstellationDetector failed";
+        }
+      }
+      catch ( itk::ExceptionObject & err )
+      {
+        subject.m_Message = err.GetDescription();
+      }
+      catch ( std::exception & err )
+      {
+        subject.m_Message = err.what();
+      }
+      catch ( ... )
+      {
+        subject.m_Message = "Unknown exception";
+      }
+      subject.m_Seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+      std::cout << ( subject.m_Succeeded ? "DONE:   " : "FAILED: " ) << subject.Get( "inputVolume" ) << " ("
+                << subject.m_Seconds << " s) " << subject.m_Message << std::endl;
+    }
+  };
+
+  {
+    BRAINS_PROFILE_SCOPE( "ProcessSubjects" );
+    std::vector< std::thread > workers;
+    for ( unsigned int w = 1; w < numberOfWorkers; ++w )
+    {
+      workers.emplace_back( processSubjects );
+    }
+    processSubjects();
+    for ( std::thread & worker : workers )
+    {
+      worker.join();
+    }
+  }
+
+  size_t numberOfFailures = 0;
+  for ( const BatchSubject & subject : subjects )
+  {
+    numberOfFailures += subject.m_Succeeded ? 0 : 1;
+  }
+  std::cout << subjects.size() - numberOfFailures << " of " << subjects.size() << " subjects succeeded." << std::endl;
+
+  if ( !outputSummary.empty() )
+  {
+    std::ofstream summary( outputSummary.c_str() );
+    if ( !summary.is_open() )
+    {
+      std::cerr << "ERROR: Can not write the summary " << outputSummary << std::endl;
+      return EXIT_FAILURE;
+    }
+    summary << "inputVolume,status,seconds,message" << std::endl;
+    for ( const BatchSubject & subject : subjects )
+    {
+      std::string message = subject.m_Message;
+      std::replace( message.begin(), message.end(), ',', ';' );
+      std::replace( message.begin(), message.end(), '\n', ' ' );
+      summary << subject.Get( "inputVolume" ) << "," << ( subject.m_Succeeded ? "SUCCESS" : "FAILURE" ) << ","
+              << subject.m_Seconds << "," << message << std::endl;
+    }
+  }
+  return ( numberOfFailures == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
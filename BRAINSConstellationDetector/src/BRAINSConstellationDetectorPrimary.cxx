@@ -19,6 +19,31 @@
 /*
  */
 #include "BRAINSConstellationDetectorPrimary.h"
+#include "BRAINSProfiler.h"
+
+std::shared_ptr< const BRAINSConstellationDetectorPrimary::SharedModels >
+BRAINSConstellationDetectorPrimary::LoadSharedModels( const std::string & inputTemplateModel,
+                                                      const std::string & llsModel )
+{
+  BRAINS_PROFILE_SCOPE( "LoadSharedModels" );
+  const std::shared_ptr< SharedModels > sharedModels = std::make_shared< SharedModels >();
+
+  const std::shared_ptr< landmarksConstellationModelIO > templateModel =
+    std::make_shared< landmarksConstellationModelIO >();
+  templateModel->ReadModelFile( inputTemplateModel );
+  sharedModels->m_TemplateModel = templateModel;
+
+  LLSModel theModel;
+  theModel.SetFileName( llsModel );
+  if ( theModel.Read() != 0 )
+  {
+    itkGenericExceptionMacro( << "Error reading LLS Model " << llsModel );
+  }
+  sharedModels->m_LLSMeans = theModel.GetLLSMeans();
+  sharedModels->m_LLSMatrices = theModel.GetLLSMatrices();
+  sharedModels->m_SearchRadii = theModel.GetSearchRadii();
+  return sharedModels;
+}
 
 BRAINSConstellationDetectorPrimary::BRAINSConstellationDetectorPrimary()
 {
@@ -40,6 +65,7 @@ BRAINSConstellationDetectorPrimary::BRAINSConstellationDetectorPrimary()
   this->m_forceHoughEyeDetectorReportFailure = false;
   this->m_debug = false;
   this->m_verbose = false;
+  this->m_updateGlobalDebugFlags = true;
 
   this->m_inputTemplateModel = itksys::SystemTools::GetProgramPath( pathOut.c_str() ) + "/" + "T1.mdl";
   this->m_llsModel = itksys::SystemTools::GetProgramPath( pathOut.c_str() ) + "/" + "LLSModel.h5";
@@ -95,7 +121,13 @@ BRAINSConstellationDetectorPrimary ::localFindCenterHeadFunc(
 bool
 BRAINSConstellationDetectorPrimary::Compute( void )
 {
-  const BRAINSUtils::StackPushITKDefaultNumberOfThreads TempDefaultNumberOfThreadsHolder( this->m_numberOfThreads );
+  std::unique_ptr< BRAINSUtils::StackPushITKDefaultNumberOfThreads > TempDefaultNumberOfThreadsHolder;
+  if ( this->m_numberOfThreads != 0 )
+  {
+    TempDefaultNumberOfThreadsHolder.reset(
+      new BRAINSUtils::StackPushITKDefaultNumberOfThreads( this->m_numberOfThreads ) );
+  }
+  BRAINS_PROFILE_SCOPE( "Compute" );
 
   // ------------------------------------
   // Read external files
@@ -106,17 +138,26 @@ BRAINSConstellationDetectorPrimary::Compute( void )
   std::map< std::string, LandmarkIO::MatrixType > llsMatrices;
   std::map< std::string, double >                 searchRadii;
 
-  LLSModel theModel;
-
-  theModel.SetFileName( this->m_llsModel );
-  if ( theModel.Read() != 0 )
+  if ( this->m_sharedModels != nullptr )
+  {
+    llsMeans = this->m_sharedModels->m_LLSMeans;
+    llsMatrices = this->m_sharedModels->m_LLSMatrices;
+    searchRadii = this->m_sharedModels->m_SearchRadii;
+  }
+  else
   {
-    std::cerr << "Error reading LLS Model" << std::endl;
-    return EXIT_FAILURE;
+    LLSModel theModel;
+
+    theModel.SetFileName( this->m_llsModel );
+    if ( theModel.Read() != 0 )
+    {
+      std::cerr << "Error reading LLS Model" << std::endl;
+      return EXIT_FAILURE;
+    }
+    llsMeans = theModel.GetLLSMeans();
+    llsMatrices = theModel.GetLLSMatrices();
+    searchRadii = theModel.GetSearchRadii();
   }
-  llsMeans = theModel.GetLLSMeans();
-  llsMatrices = theModel.GetLLSMatrices();
-  searchRadii = theModel.GetSearchRadii();
 
   // ------------------------------------
   // load image
@@ -130,11 +171,13 @@ BRAINSConstellationDetectorPrimary::Compute( void )
   reader->SetFileName( this->m_inputVolume );
   try
   {
+    BRAINS_PROFILE_SCOPE( "ReadInputVolume" );
     reader->Update();
   }
   catch ( itk::ExceptionObject & err )
   {
     std::cerr << " Error while reading image file( s ) with ITK:\n " << err << std::endl;
+    throw;
   }
   std::cout << "Processing: " << this->m_inputVolume << std::endl;
 
@@ -251,6 +294,7 @@ BRAINSConstellationDetectorPrimary::Compute( void )
     houghEyeDetector->Setorig_lmk_CenterOfHeadMass( orig_lmks.at( "CM" ) );
     try
     {
+      BRAINS_PROFILE_SCOPE( "HoughEyeDetector" );
       houghEyeDetector->Update();
     }
     catch ( itk::ExceptionObject & excep )
@@ -367,6 +411,10 @@ BRAINSConstellationDetectorPrimary::Compute( void )
 
 
   constellation2->SetInputTemplateModel( this->m_inputTemplateModel );
+  if ( this->m_sharedModels != nullptr )
+  {
+    constellation2->SetLoadedTemplateModel( this->m_sharedModels->m_TemplateModel );
+  }
   constellation2->SetMspQualityLevel( this->m_mspQualityLevel );
   constellation2->SetOtsuPercentileThreshold( this->m_otsuPercentileThreshold );
   constellation2->SetAcLowerBound( this->m_acLowerBound );
@@ -384,6 +432,7 @@ BRAINSConstellationDetectorPrimary::Compute( void )
   constellation2->SetDebug( this->m_debug );
   constellation2->SetVerbose( this->m_verbose );
   constellation2->SetWritedebuggingImagesLevel( this->m_writedebuggingImagesLevel );
+  constellation2->SetUpdateGlobalDebugFlags( this->m_updateGlobalDebugFlags );
   constellation2->SetWriteBranded2DImage( this->m_writeBranded2DImage );
   constellation2->SetResultsDir( this->m_resultsDir );
   constellation2->SetLlsMatrices( llsMatrices );
@@ -393,7 +442,10 @@ BRAINSConstellationDetectorPrimary::Compute( void )
   constellation2->SetatlasVolume( this->m_atlasVolume );
   constellation2->SetatlasLandmarks( this->m_atlasLandmarks );
   constellation2->SetatlasLandmarkWeights( this->m_atlasLandmarkWeights );
-  constellation2->Update();
+  {
+    BRAINS_PROFILE_SCOPE( "ConstellationDetector" );
+    constellation2->Update();
+  }
 
 
   // Save landmarks in input/output or original/aligned space
@@ -410,6 +462,7 @@ BRAINSConstellationDetectorPrimary::Compute( void )
 
   // ----------------------
   // Write results to disk
+  BRAINS_PROFILE_SCOPE( "WriteOutputs" );
   std::cout << "\nWriting results to files..." << std::endl;
   if ( this->m_outputTransform.compare( "" ) != 0 )
   {
@@ -45,6 +45,7 @@
 #include <fstream>
 #include <cstring>
 #include <map>
+#include <memory>
 
 class BRAINSConstellationDetectorPrimary
 {
@@ -68,8 +69,31 @@ public:
   std::string pathOut;
   std::string errorMsg;
 
+  /** The models read from the template and LLS model files.  They are only
+   * read, so one instance can be shared by many subjects. */
+  struct SharedModels
+  {
+    std::shared_ptr< const landmarksConstellationModelIO > m_TemplateModel;
+    LLSModel::LLSMeansType                                 m_LLSMeans;
+    LLSModel::LLSMatricesType                              m_LLSMatrices;
+    LLSModel::LLSSearchRadiiType                           m_SearchRadii;
+  };
+
+  /** Read the template and LLS models once, e.g. for a batch of subjects.
+   * Throws an itk::ExceptionObject when either can not be read. */
+  static std::shared_ptr< const SharedModels >
+  LoadSharedModels( const std::string & inputTemplateModel, const std::string & llsModel );
+
   BRAINSConstellationDetectorPrimary();
 
+  /** Use models that were already read instead of reading the
+   * InputTemplateModel and LLSModel files. */
+  void
+  SetSharedModels( const std::shared_ptr< const SharedModels > & sharedModels )
+  {
+    this->m_sharedModels = sharedModels;
+  }
+
   void
   SetHoughEyeDetectorMode( int houghEyeDetectorMode )
   {
@@ -88,6 +112,8 @@ public:
     this->m_writedebuggingImagesLevel = writedebuggingImagesLevel;
   }
 
+  /** 0 leaves the ITK global default number of threads unchanged, which is
+   * required when several subjects are computed concurrently. */
   void
   SetNumberOfWorkUnits( unsigned int numberOfThreads )
   {
@@ -166,6 +192,14 @@ public:
     this->m_verbose = verbose;
   }
 
+  /** false leaves LMC::globalverboseFlag and globalImagedebugLevel unchanged,
+   * which is required when several subjects are computed concurrently. */
+  void
+  SetUpdateGlobalDebugFlags( bool updateGlobalDebugFlags )
+  {
+    this->m_updateGlobalDebugFlags = updateGlobalDebugFlags;
+  }
+
   void
   SetAtlasVolume( const std::string & atlasVolume )
   {
@@ -370,6 +404,7 @@ private:
   bool m_forceHoughEyeDetectorReportFailure; // false
   bool m_debug;                              // false
   bool m_verbose;                            // false
+  bool m_updateGlobalDebugFlags;             // true
 
   std::string m_inputTemplateModel;
   std::string m_llsModel;
@@ -399,6 +434,8 @@ private:
 
   std::string m_resultsDir; // default = "./"
 
+  std::shared_ptr< const SharedModels > m_sharedModels; // default = nullptr
+
   LandmarksMapType m_outputLandmarksInInputSpaceMap;
   LandmarksMapType m_outputLandmarksInACPCAlignedSpaceMap;
 };
@@ -0,0 +1,67 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+// This program converts a BRAINSConstellationDetector model between the
+// original stream format and the memory mappable binary (.bcdm) format.
+// The output format is chosen by the extension of the output file name.
+//
+// For use:
+//             .../BRAINSConstellationModelConverter --inputTemplateModel T1.mdl --outputTemplateModel T1.bcdm
+
+#include "landmarksConstellationModelIO.h"
+#include "BRAINSConstellationModelConverterCLP.h"
+#include <BRAINSCommonLib.h>
+
+int
+main( int argc, char * argv[] )
+{
+  PARSE_ARGS;
+  BRAINSRegisterAlternateIO();
+
+  if ( inputTemplateModel.empty() || outputTemplateModel.empty() )
+  {
+    std::cerr << "Both --inputTemplateModel and --outputTemplateModel are required" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  try
+  {
+    landmarksConstellationModelIO myModel;
+    myModel.ReadModelFile( inputTemplateModel );
+    myModel.WriteModelFile( outputTemplateModel );
+
+    if ( verifyConversion )
+    {
+      landmarksConstellationModelIO convertedModel;
+      convertedModel.ReadModelFile( outputTemplateModel );
+      if ( !( convertedModel == myModel ) )
+      {
+        std::cerr << "Converted model " << outputTemplateModel << " does not match " << inputTemplateModel
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  catch ( itk::ExceptionObject & excp )
+  {
+    std::cerr << excp << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
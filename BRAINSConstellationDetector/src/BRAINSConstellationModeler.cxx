@@ -50,6 +50,11 @@
 #include <cstring>
 #include <cmath>
 #include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 
 #include "BRAINSThreadControl.h"
 #include <itkIntensityWindowingImageFilter.h>
@@ -62,6 +67,7 @@
 #include "GenericTransformImage.h"
 
 #include "itkOrthogonalize3DRotationMatrix.h"
+#include "itkImageIOFactory.h"
 
 // //////////////////////////////////////////////////////////////
 // Computes the unbiased sample variance of a set of n observations
@@ -92,6 +98,322 @@ sample_variance( const std::vector< DType > & x, DType * mean, DType * var )
   *var = ( sum_of_sq - sum * sum / n ) / ( n - 1.0 ); // var = E[X^2]-(E[X])^2
 }
 
+// //////////////////////////////////////////////////////////////
+// Everything the model needs from one training dataset.  Filled in by
+// ProcessTrainingDataset, possibly on a worker thread, and reduced into
+// the model in dataset order so the output model does not depend on
+// the order in which datasets finish.
+// //////////////////////////////////////////////////////////////
+struct TrainingDatasetResult
+{
+  bool                  success = false;
+  std::string           errorMessage;
+  SImageType::PointType rp_InMSPAlignedSpace;
+  SImageType::PointType ac_InMSPAlignedSpace;
+  SImageType::PointType pc_InMSPAlignedSpace;
+  SImageType::PointType vn4_InMSPAlignedSpace;
+  SImageType::PointType cec_InMSPAlignedSpace;
+  SImageType::PointType cm_InMSPAlignedSpace;
+  // templates[landmarkName][rotationStep]
+  std::map< std::string, std::vector< std::vector< float > > > templates;
+};
+
+struct TrainingOptions
+{
+  bool                  rescaleIntensities;
+  double                trimRescaledIntensities;
+  std::vector< int >    rescaleIntensitiesOutputRange;
+  int                   mspQualityLevel;
+  short                 BackgroundFillValue;
+  std::string           resultsDir;
+  unsigned int          numRotationSteps;
+  float                 initialRotationAngle;
+  float                 initialRotationStep;
+};
+
+// //////////////////////////////////////////////////////////////
+// Limits the number of training datasets in flight by their estimated
+// memory footprint.  A dataset is always admitted when nothing else is
+// running so that a single oversized dataset can not deadlock training.
+// //////////////////////////////////////////////////////////////
+class TrainingMemoryBudget
+{
+public:
+  explicit TrainingMemoryBudget( const size_t limitBytes )
+    : m_LimitBytes( limitBytes )
+    , m_InUseBytes( 0 )
+  {}
+
+  void
+  Acquire( const size_t bytes )
+  {
+    std::unique_lock< std::mutex > lock( m_Mutex );
+    m_Available.wait( lock,
+                      [this, bytes] { return m_LimitBytes == 0 || m_InUseBytes == 0 || m_InUseBytes + bytes <= m_LimitBytes; } );
+    m_InUseBytes += bytes;
+  }
+
+  void
+  Release( const size_t bytes )
+  {
+    {
+      std::lock_guard< std::mutex > lock( m_Mutex );
+      m_InUseBytes -= bytes;
+    }
+    m_Available.notify_all();
+  }
+
+private:
+  const size_t            m_LimitBytes;
+  size_t                  m_InUseBytes;
+  std::mutex              m_Mutex;
+  std::condition_variable m_Available;
+};
+
+// Peak number of full size image copies alive while training one dataset:
+// the original, the remapped image, the MSP centered image (debug level
+// > 2 only), and the rotated test image plus the resampler's working copy.
+static constexpr size_t TrainingImageCopiesInFlight = 5;
+
+static size_t
+EstimateTrainingDatasetBytes( const std::string & imageFilename )
+{
+  itk::ImageIOBase::Pointer imageIO =
+    itk::ImageIOFactory::CreateImageIO( imageFilename.c_str(), itk::ImageIOFactory::ReadMode );
+  if ( imageIO.IsNull() )
+  {
+    return 0;
+  }
+  imageIO->SetFileName( imageFilename );
+  imageIO->ReadImageInformation();
+  size_t numberOfPixels = 1;
+  for ( unsigned int d = 0; d < imageIO->GetNumberOfDimensions(); ++d )
+  {
+    numberOfPixels *= imageIO->GetDimensions( d );
+  }
+  return numberOfPixels * sizeof( SImageType::PixelType ) * TrainingImageCopiesInFlight;
+}
+
+static SImageType::Pointer
+ReadAndRemapTrainingImage( const std::string & imageFilename, const TrainingOptions & options )
+{
+  // Since these are oriented images, the reorientation should not be
+  // necessary.
+  // //////////////////////////////////////////////////////////////////////////
+  SImageType::Pointer volOrig = itkUtil::ReadImage< SImageType >( imageFilename );
+  if ( volOrig.IsNull() || !options.rescaleIntensities )
+  {
+    return volOrig;
+  }
+
+  itk::StatisticsImageFilter< SImageType >::Pointer stats = itk::StatisticsImageFilter< SImageType >::New();
+  stats->SetInput( volOrig );
+  stats->Update();
+  SImageType::PixelType minPixel( stats->GetMinimum() );
+  SImageType::PixelType maxPixel( stats->GetMaximum() );
+
+  if ( options.trimRescaledIntensities > 0.0 )
+  {
+    // REFACTOR: a histogram would be traditional here, but seems
+    // over-the-top;
+    // I did this because it seemed to me if I knew mean, sigma, max and
+    // min,
+    // then I know Something about extreme outliers.
+
+    double meanOrig( stats->GetMean() );
+    double sigmaOrig( stats->GetSigma() );
+
+    // REFACTOR:  In percentiles, 0.0005 two-tailed has worked in the past.
+    // It only makes sense to trim the upper bound since the lower bound
+    // would most likely
+    // represent a large region of air around the head.  But this is not so
+    // when using a mask.
+    // For one-tailed, an error of 0.001 corresponds to 3.29052 standard
+    // deviations of normal.
+    // For one-tailed, an error of 0.0001 corresponds to 3.8906 standard
+    // deviations of normal.
+    // For one-tailed, an error of 0.00001 corresponds to 4.4172 standard
+    // deviations of normal.
+    // Naturally, the constant should default at the command line, ...
+
+    double variationBound( ( maxPixel - meanOrig ) / sigmaOrig );
+    double trimBound( variationBound - options.trimRescaledIntensities );
+    if ( trimBound > 0.0 )
+    {
+      maxPixel = static_cast< SImageType::PixelType >( maxPixel - trimBound * sigmaOrig );
+    }
+  }
+
+  itk::IntensityWindowingImageFilter< SImageType, SImageType >::Pointer remapIntensityFilter =
+    itk::IntensityWindowingImageFilter< SImageType, SImageType >::New();
+  remapIntensityFilter->SetInput( volOrig );
+  remapIntensityFilter->SetOutputMaximum( options.rescaleIntensitiesOutputRange[1] );
+  remapIntensityFilter->SetOutputMinimum( options.rescaleIntensitiesOutputRange[0] );
+  remapIntensityFilter->SetWindowMinimum( minPixel );
+  remapIntensityFilter->SetWindowMaximum( maxPixel );
+  remapIntensityFilter->Update();
+
+  return remapIntensityFilter->GetOutput();
+}
+
+// //////////////////////////////////////////////////////////////
+// Align one training dataset and extract its landmark templates.
+// Only reads shared state, so it is safe to run for several datasets
+// concurrently.
+// //////////////////////////////////////////////////////////////
+static void
+ProcessTrainingDataset( const landmarksDataSet &                                                 currentDataSet,
+                        const std::map< std::string, landmarksConstellationModelIO::IndexLocationVectorType > &
+                                                                                                 vectorIndexLocations,
+                        const TrainingOptions &                                                  options,
+                        TrainingDatasetResult &                                                  result )
+{
+  const std::string & imageFilename = currentDataSet.GetImageFilename();
+  std::cout << "PROCESSING:" << imageFilename << std::endl;
+
+  SImageType::Pointer image = ReadAndRemapTrainingImage( imageFilename, options );
+  if ( image.IsNull() )
+  {
+    result.errorMessage = "Could not open image " + imageFilename;
+    return;
+  }
+  const SImageType::PointType orig_lmk_CenterOfHeadMass = GetCenterOfHeadMass( image );
+
+  // The templates are built in the landmark defined AC-PC space below, so the
+  // reflective correlation MSP alignment only feeds the debug plane image.
+  if ( globalImagedebugLevel > 2 )
+  {
+    RigidTransformType::Pointer eyeFixed2msp_lmk_tfm = RigidTransformType::New();
+    SImageType::Pointer         volumeMSP;
+    double                      c_c = 0;
+    ComputeMSP( image, eyeFixed2msp_lmk_tfm, volumeMSP, orig_lmk_CenterOfHeadMass, options.mspQualityLevel, c_c );
+    const std::string MSP_ImagePlane( globalResultsDir + "/MSP_PLANE_" +
+                                      itksys::SystemTools::GetFilenameName( imageFilename ) );
+    CreatedebugPlaneImage( volumeMSP, MSP_ImagePlane );
+  }
+
+  SImageType::PointType origin;
+  origin.Fill( 0 );
+
+  // This section assumes that the landmarks are defined as
+  // ITK compliant physical space
+  // That are consistent with ITK images that they were collected from Dicom
+  // coordinate system
+  // No conversion is necessary
+  SImageType::PointType origRP = currentDataSet.GetNamedPoint( "RP" );
+  SImageType::PointType origAC = currentDataSet.GetNamedPoint( "AC" );
+  SImageType::PointType origPC = currentDataSet.GetNamedPoint( "PC" );
+  SImageType::PointType origVN4 = currentDataSet.GetNamedPoint( "VN4" );
+  SImageType::PointType origLE = currentDataSet.GetNamedPoint( "LE" );
+  SImageType::PointType origRE = currentDataSet.GetNamedPoint( "RE" );
+  SImageType::PointType origCEC;
+  origCEC.SetToMidPoint( origLE, origRE );
+
+  // Instead of RC method, now we compute all the ac-pc aligned transforms by estimating the plane passing through RP,
+  // AC and PC points
+  RigidTransformType::Pointer ACPC_AlignedTransform = computeTmspFromPoints( origRP, origAC, origPC, origin );
+
+  // AC-PC aligned TRANSFORM
+  VersorTransformType::Pointer finalTransform = VersorTransformType::New();
+  finalTransform->SetFixedParameters( ACPC_AlignedTransform->GetFixedParameters() );
+  itk::Versor< double >               versorRotation; // was commented before
+  const itk::Matrix< double, 3, 3 > & NewCleanedOrthogonalized =
+    itk::Orthogonalize3DRotationMatrix( ACPC_AlignedTransform->GetMatrix() );
+  versorRotation.Set( NewCleanedOrthogonalized );
+  finalTransform->SetRotation( versorRotation );
+  finalTransform->SetTranslation( ACPC_AlignedTransform->GetTranslation() );
+  // inverse transform
+  VersorTransformType::Pointer  ACPC_AlignedTransform_INV = VersorTransformType::New();
+  const SImageType::PointType & centerPoint = finalTransform->GetCenter();
+  ACPC_AlignedTransform_INV->SetCenter( centerPoint );
+  ACPC_AlignedTransform_INV->SetIdentity();
+  finalTransform->GetInverse( ACPC_AlignedTransform_INV );
+  //////////////////////////////////////////////////////////////////
+
+  // Transform points based on the new transform
+  result.cm_InMSPAlignedSpace = ACPC_AlignedTransform_INV->TransformPoint( orig_lmk_CenterOfHeadMass );
+  result.rp_InMSPAlignedSpace = ACPC_AlignedTransform_INV->TransformPoint( origRP );
+  result.ac_InMSPAlignedSpace = ACPC_AlignedTransform_INV->TransformPoint( origAC );
+  result.pc_InMSPAlignedSpace = ACPC_AlignedTransform_INV->TransformPoint( origPC );
+  result.vn4_InMSPAlignedSpace = ACPC_AlignedTransform_INV->TransformPoint( origVN4 );
+  result.cec_InMSPAlignedSpace = ACPC_AlignedTransform_INV->TransformPoint( origCEC );
+
+  if ( globalImagedebugLevel > 3 )
+  {
+    SImageType::Pointer volumeACPC_Aligned =
+      TransformResample< SImageType, SImageType >( image.GetPointer(),
+                                                   image.GetPointer(),
+                                                   options.BackgroundFillValue,
+                                                   GetInterpolatorFromString< SImageType >( "Linear" ).GetPointer(),
+                                                   ACPC_AlignedTransform.GetPointer() );
+
+    itkUtil::WriteImage< SImageType >( volumeACPC_Aligned,
+                                       options.resultsDir + "/ACPC_Aligned_" +
+                                         itksys::SystemTools::GetFilenameName( imageFilename ) );
+    MakeLabelImage( volumeACPC_Aligned,
+                    result.rp_InMSPAlignedSpace,
+                    result.ac_InMSPAlignedSpace,
+                    result.pc_InMSPAlignedSpace,
+                    result.vn4_InMSPAlignedSpace,
+                    options.resultsDir + "/Mask_Resampled_" + itksys::SystemTools::GetFilenameName( imageFilename ) );
+  }
+
+  // Build template for each landmark
+  for ( landmarksDataSet::const_iterator it = currentDataSet.begin(); it != currentDataSet.end(); ++it )
+  {
+    std::cout << "Training template for " << it->first << std::endl;
+    const auto locationsIt = vectorIndexLocations.find( it->first );
+    if ( locationsIt == vectorIndexLocations.end() )
+    {
+      result.errorMessage = "Attempt to access an undefined landmark template for " + it->first;
+      return;
+    }
+    const landmarksConstellationModelIO::IndexLocationVectorType & indexLocations = locationsIt->second;
+
+    const SImageType::PointType origPoint = it->second;
+    const SImageType::PointType transformedPoint = ACPC_AlignedTransform_INV->TransformPoint( origPoint );
+
+    std::vector< std::vector< float > > & landmarkTemplates = result.templates[it->first];
+    landmarkTemplates.resize( options.numRotationSteps );
+    for ( unsigned int currentAngle = 0; currentAngle < options.numRotationSteps; currentAngle++ )
+    {
+      // //////  create a rotation about the center with respect to the
+      // current test rotation angle
+      const float degree_current_angle = options.initialRotationAngle + options.initialRotationStep * currentAngle;
+      const float current_angle = degree_current_angle * itk::Math::pi / 180;
+
+      RigidTransformType::Pointer Point_Rotate = RigidTransformType::New();
+      Point_Rotate->SetCenter( transformedPoint );
+      Point_Rotate->SetRotation( current_angle, 0, 0 );
+
+      SImageType::Pointer image_TestRotated =
+        CreateTestCenteredRotatedImage2( ACPC_AlignedTransform, origPoint, image, Point_Rotate );
+      if ( globalImagedebugLevel > 5 )
+      {
+        std::stringstream s( "" );
+        s << "image_" << it->first << "_TestRotated_" << current_angle << "_";
+        const std::string rotatedName =
+          options.resultsDir + "/" + s.str().c_str() + itksys::SystemTools::GetFilenameName( imageFilename );
+        std::cout << "Writing file: " << rotatedName << std::endl;
+        itkUtil::WriteImage< SImageType >( image_TestRotated, rotatedName );
+      }
+
+      // The following 3 function calls may be a performance problem,
+      // and it should be  straight forward to refactor this into a single function
+      // extractZeroMeanNormalizedVector that has the same signature as extractArray, but has many fewer
+      // loop iterations.
+      LinearInterpolatorType::Pointer imInterp = LinearInterpolatorType::New();
+      imInterp->SetInputImage( image_TestRotated );
+      std::vector< float > & currentTemplate = landmarkTemplates[currentAngle];
+      currentTemplate.resize( indexLocations.size() );
+      extractArray( imInterp, transformedPoint, indexLocations, currentTemplate );
+      removeVectorMean( currentTemplate );
+      normalizeVector( currentTemplate );
+    }
+  }
+  result.success = true;
+}
+
 //
 //
 // ===========================================================================
@@ -148,13 +470,6 @@ main( int argc, char * argv[] )
   // NOTE:  only 2 coords need after projection into MSP, but using 3 to keep
   // math simple.
   // May need to change all index to get y and z (which is currently coded as coord index 0 and 1
-  std::vector< SImageType::PointType > rp_InMSPAlignedSpace( myModel.GetNumDataSets() );
-  std::vector< SImageType::PointType > ac_InMSPAlignedSpace( myModel.GetNumDataSets() );
-  std::vector< SImageType::PointType > pc_InMSPAlignedSpace( myModel.GetNumDataSets() );
-  std::vector< SImageType::PointType > vn4_InMSPAlignedSpace( myModel.GetNumDataSets() );
-  std::vector< SImageType::PointType > cec_InMSPAlignedSpace( myModel.GetNumDataSets() );
-  std::vector< SImageType::PointType > cm_InMSPAlignedSpace( myModel.GetNumDataSets() );
-
   std::ofstream MSPOptFile;
   std::string   newOptimizedLandmarksTrainingFile;
   if ( saveOptimizedLandmarks )
@@ -189,236 +504,126 @@ main( int argc, char * argv[] )
   }
   // //////////////////////////////////////////////////////////////////////////
   const unsigned int & mDefNumDataSets = mDef.GetNumDataSets();
-  for ( unsigned int currentDataset = 0; currentDataset < mDefNumDataSets; ++currentDataset )
+
+  TrainingOptions trainingOptions;
+  trainingOptions.rescaleIntensities = rescaleIntensities;
+  trainingOptions.trimRescaledIntensities = trimRescaledIntensities;
+  trainingOptions.rescaleIntensitiesOutputRange = rescaleIntensitiesOutputRange;
+  trainingOptions.mspQualityLevel = mspQualityLevel;
+  trainingOptions.BackgroundFillValue = BackgroundFillValue;
+  trainingOptions.resultsDir = resultsDir;
+  trainingOptions.numRotationSteps = myModel.GetNumRotationSteps();
+  trainingOptions.initialRotationAngle = myModel.GetInitialRotationAngle();
+  trainingOptions.initialRotationStep = myModel.GetInitialRotationStep();
+
+  // Datasets are independent, so they are processed on a bounded pool of
+  // workers.  Each result lands in its own slot and is reduced below in
+  // dataset order, which keeps the model identical for any concurrency.
+  std::vector< TrainingDatasetResult > datasetResults( mDefNumDataSets );
   {
-    std::cout << "====================================================================================" << std::endl;
-    std::cout << "PROCESSING:" << mDef[currentDataset].GetImageFilename() << std::endl;
-    // Since these are oriented images, the reorientation should not be
-    // necessary.
-    // //////////////////////////////////////////////////////////////////////////
-    SImageType::Pointer volOrig = itkUtil::ReadImage< SImageType >( mDef[currentDataset].GetImageFilename() );
-    if ( volOrig.IsNull() )
-    {
-      printf( "\nCould not open image %s, aborting ...\n\n", mDef[currentDataset].GetImageFilename().c_str() );
-      return EXIT_FAILURE;
-    }
-    SImageType::Pointer image;
+    const unsigned int numberOfWorkers =
+      std::max( 1U, std::min( static_cast< unsigned int >( std::max( numberOfConcurrentDatasets, 1 ) ), mDefNumDataSets ) );
 
-    if ( rescaleIntensities == true )
-    {
-      itk::StatisticsImageFilter< SImageType >::Pointer stats = itk::StatisticsImageFilter< SImageType >::New();
-      stats->SetInput( volOrig );
-      stats->Update();
-      SImageType::PixelType minPixel( stats->GetMinimum() );
-      SImageType::PixelType maxPixel( stats->GetMaximum() );
+    // Divide the ITK thread budget between the concurrent datasets.
+    const int itkThreadsPerDataset = std::max(
+      1, static_cast< int >( itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads() ) / static_cast< int >( numberOfWorkers ) );
+    const BRAINSUtils::StackPushITKDefaultNumberOfThreads perDatasetThreadsHolder( itkThreadsPerDataset );
 
-      if ( trimRescaledIntensities > 0.0 )
+    TrainingMemoryBudget memoryBudget( static_cast< size_t >( std::max( trainingMemoryLimitMB, 0 ) ) * 1024 * 1024 );
+    std::atomic< unsigned int > nextDataset( 0 );
+
+    auto trainingWorker = [&]() {
+      for ( unsigned int currentDataset = nextDataset++; currentDataset < mDefNumDataSets;
+            currentDataset = nextDataset++ )
       {
-        // REFACTOR: a histogram would be traditional here, but seems
-        // over-the-top;
-        // I did this because it seemed to me if I knew mean, sigma, max and
-        // min,
-        // then I know Something about extreme outliers.
-
-        double meanOrig( stats->GetMean() );
-        double sigmaOrig( stats->GetSigma() );
-
-        // REFACTOR:  In percentiles, 0.0005 two-tailed has worked in the past.
-        // It only makes sense to trim the upper bound since the lower bound
-        // would most likely
-        // represent a large region of air around the head.  But this is not so
-        // when using a mask.
-        // For one-tailed, an error of 0.001 corresponds to 3.29052 standard
-        // deviations of normal.
-        // For one-tailed, an error of 0.0001 corresponds to 3.8906 standard
-        // deviations of normal.
-        // For one-tailed, an error of 0.00001 corresponds to 4.4172 standard
-        // deviations of normal.
-        // Naturally, the constant should default at the command line, ...
-
-        double variationBound( ( maxPixel - meanOrig ) / sigmaOrig );
-        double trimBound( variationBound - trimRescaledIntensities );
-        if ( trimBound > 0.0 )
+        const std::string & imageFilename = mDef[currentDataset].GetImageFilename();
+        size_t              datasetBytes = 0;
+        try
+        {
+          datasetBytes = EstimateTrainingDatasetBytes( imageFilename );
+        }
+        catch ( ... )
+        {
+          // Unreadable images are reported by ProcessTrainingDataset.
+        }
+        memoryBudget.Acquire( datasetBytes );
+        try
         {
-          maxPixel = static_cast< SImageType::PixelType >( maxPixel - trimBound * sigmaOrig );
+          ProcessTrainingDataset(
+            mDef[currentDataset], myModel.m_VectorIndexLocations, trainingOptions, datasetResults[currentDataset] );
         }
+        catch ( itk::ExceptionObject & excp )
+        {
+          std::ostringstream msg;
+          msg << excp;
+          datasetResults[currentDataset].errorMessage = msg.str();
+        }
+        catch ( std::exception & excp )
+        {
+          datasetResults[currentDataset].errorMessage = excp.what();
+        }
+        catch ( ... )
+        {
+          datasetResults[currentDataset].errorMessage = "Unknown exception";
+        }
+        memoryBudget.Release( datasetBytes );
       }
+    };
 
-      itk::IntensityWindowingImageFilter< SImageType, SImageType >::Pointer remapIntensityFilter =
-        itk::IntensityWindowingImageFilter< SImageType, SImageType >::New();
-      remapIntensityFilter->SetInput( volOrig );
-      remapIntensityFilter->SetOutputMaximum( rescaleIntensitiesOutputRange[1] );
-      remapIntensityFilter->SetOutputMinimum( rescaleIntensitiesOutputRange[0] );
-      remapIntensityFilter->SetWindowMinimum( minPixel );
-      remapIntensityFilter->SetWindowMaximum( maxPixel );
-      remapIntensityFilter->Update();
-
-      image = remapIntensityFilter->GetOutput();
+    if ( numberOfWorkers == 1 )
+    {
+      trainingWorker();
     }
     else
     {
-      image = volOrig;
+      std::vector< std::thread > workers;
+      for ( unsigned int w = 0; w < numberOfWorkers; ++w )
+      {
+        workers.emplace_back( trainingWorker );
+      }
+      for ( auto & worker : workers )
+      {
+        worker.join();
+      }
     }
+  }
 
-    SImageType::PointType origin;
-    origin.Fill( 0 );
-
-    // This section assumes that the landmarks are defined as
-    // ITK compliant physical space
-    // That are consistent with ITK images that they were collected from Dicom
-    // coordinate system
-    // No conversion is necessary
-    SImageType::PointType origRP = mDef[currentDataset].GetNamedPoint( "RP" );
-    SImageType::PointType origAC = mDef[currentDataset].GetNamedPoint( "AC" );
-    SImageType::PointType origPC = mDef[currentDataset].GetNamedPoint( "PC" );
-    SImageType::PointType origVN4 = mDef[currentDataset].GetNamedPoint( "VN4" );
-    SImageType::PointType origLE = mDef[currentDataset].GetNamedPoint( "LE" );
-    SImageType::PointType origRE = mDef[currentDataset].GetNamedPoint( "RE" );
-    SImageType::PointType origCEC;
-    origCEC.SetToMidPoint( origLE, origRE );
-
-    SImageType::PointType orig_lmk_CenterOfHeadMass = GetCenterOfHeadMass( image );
-
-    // original input volume from the training set
-    // transforms image to MSP aligned voxel lattice
-    RigidTransformType::Pointer eyeFixed2msp_lmk_tfm = RigidTransformType::New();
-    SImageType::Pointer         volumeMSP;
-    double                      c_c = 0;
-
-    ComputeMSP( image, eyeFixed2msp_lmk_tfm, volumeMSP, orig_lmk_CenterOfHeadMass, mspQualityLevel, c_c );
-
-    if ( globalImagedebugLevel > 2 )
-    {
-      const std::string MSP_ImagePlane(
-        globalResultsDir + "/MSP_PLANE_" +
-        itksys::SystemTools::GetFilenameName( mDef[currentDataset].GetImageFilename() ) );
-      CreatedebugPlaneImage( volumeMSP, MSP_ImagePlane );
-    }
+  if ( saveOptimizedLandmarks )
+  {
+    MSPOptFile.close();
+  }
 
-    // Compute the transform from original space to the AC-PC aligned space using Reflective Correlation method
-    //    RigidTransformType::Pointer invTmsp = RigidTransformType::New();
-    //    eyeFixed2msp_lmk_tfm->GetInverse(invTmsp);
-
-    // Instead of RC method, now we compute all the ac-pc aligned transforms by estimating the plane passing through RP,
-    // AC and PC points
-    RigidTransformType::Pointer ACPC_AlignedTransform = computeTmspFromPoints( origRP, origAC, origPC, origin );
-
-    // We cannot easily compute the Inverse transform by the following to lines, we need to use versor for percise
-    // transformation
-    //    RigidTransformType::Pointer ACPC_AlignedTransform_INV = RigidTransformType::New();
-    //    ACPC_AlignedTransform_INV->GetInverse(ACPC_AlignedTransform);
-
-    // AC-PC aligned TRANSFORM
-    VersorTransformType::Pointer finalTransform = VersorTransformType::New();
-    finalTransform->SetFixedParameters( ACPC_AlignedTransform->GetFixedParameters() );
-    itk::Versor< double >               versorRotation; // was commented before
-    const itk::Matrix< double, 3, 3 > & NewCleanedOrthogonalized =
-      itk::Orthogonalize3DRotationMatrix( ACPC_AlignedTransform->GetMatrix() );
-    versorRotation.Set( NewCleanedOrthogonalized );
-    finalTransform->SetRotation( versorRotation );
-    finalTransform->SetTranslation( ACPC_AlignedTransform->GetTranslation() );
-    // inverse transform
-    VersorTransformType::Pointer  ACPC_AlignedTransform_INV = VersorTransformType::New();
-    const SImageType::PointType & centerPoint = finalTransform->GetCenter();
-    ACPC_AlignedTransform_INV->SetCenter( centerPoint );
-    ACPC_AlignedTransform_INV->SetIdentity();
-    finalTransform->GetInverse( ACPC_AlignedTransform_INV );
-    //////////////////////////////////////////////////////////////////
-
-    // Transform points based on the new transform
-    cm_InMSPAlignedSpace[currentDataset] = ACPC_AlignedTransform_INV->TransformPoint( orig_lmk_CenterOfHeadMass );
-    rp_InMSPAlignedSpace[currentDataset] = ACPC_AlignedTransform_INV->TransformPoint( origRP );
-    ac_InMSPAlignedSpace[currentDataset] = ACPC_AlignedTransform_INV->TransformPoint( origAC );
-    pc_InMSPAlignedSpace[currentDataset] = ACPC_AlignedTransform_INV->TransformPoint( origPC );
-    vn4_InMSPAlignedSpace[currentDataset] = ACPC_AlignedTransform_INV->TransformPoint( origVN4 );
-    cec_InMSPAlignedSpace[currentDataset] = ACPC_AlignedTransform_INV->TransformPoint( origCEC );
-
-    if ( globalImagedebugLevel > 3 )
+  // Reduce the per-dataset results into the model in dataset order.
+  std::vector< SImageType::PointType > rp_InMSPAlignedSpace( myModel.GetNumDataSets() );
+  std::vector< SImageType::PointType > ac_InMSPAlignedSpace( myModel.GetNumDataSets() );
+  std::vector< SImageType::PointType > pc_InMSPAlignedSpace( myModel.GetNumDataSets() );
+  std::vector< SImageType::PointType > vn4_InMSPAlignedSpace( myModel.GetNumDataSets() );
+  std::vector< SImageType::PointType > cec_InMSPAlignedSpace( myModel.GetNumDataSets() );
+  std::vector< SImageType::PointType > cm_InMSPAlignedSpace( myModel.GetNumDataSets() );
+  for ( unsigned int currentDataset = 0; currentDataset < mDefNumDataSets; ++currentDataset )
+  {
+    TrainingDatasetResult & result = datasetResults[currentDataset];
+    if ( !result.success )
     {
-      const SImageType::PointType finalRP = ACPC_AlignedTransform_INV->TransformPoint( origRP );
-      const SImageType::PointType finalAC = ACPC_AlignedTransform_INV->TransformPoint( origAC );
-      const SImageType::PointType finalPC = ACPC_AlignedTransform_INV->TransformPoint( origPC );
-      const SImageType::PointType finalVN4 = ACPC_AlignedTransform_INV->TransformPoint( origVN4 );
-
-      SImageType::Pointer volumeACPC_Aligned =
-        TransformResample< SImageType, SImageType >( image.GetPointer(),
-                                                     image.GetPointer(),
-                                                     BackgroundFillValue,
-                                                     GetInterpolatorFromString< SImageType >( "Linear" ).GetPointer(),
-                                                     ACPC_AlignedTransform.GetPointer() );
-
-      itkUtil::WriteImage< SImageType >(
-        volumeACPC_Aligned,
-        resultsDir + "/ACPC_Aligned_" +
-          itksys::SystemTools::GetFilenameName( mDef[currentDataset].GetImageFilename() ) );
-      MakeLabelImage( volumeACPC_Aligned,
-                      finalRP,
-                      finalAC,
-                      finalPC,
-                      finalVN4,
-                      resultsDir + "/Mask_Resampled_" +
-                        itksys::SystemTools::GetFilenameName( mDef[currentDataset].GetImageFilename() ) );
+      std::cerr << "\nFailed to train from " << mDef[currentDataset].GetImageFilename() << ": " << result.errorMessage
+                << "\naborting ...\n"
+                << std::endl;
+      return EXIT_FAILURE;
     }
-
-    // Build template for each landmark
-    for ( std::map< std::string, SImageType::PointType >::iterator it = mDef[currentDataset].begin();
-          it != mDef[currentDataset].end();
-          ++it )
+    rp_InMSPAlignedSpace[currentDataset] = result.rp_InMSPAlignedSpace;
+    ac_InMSPAlignedSpace[currentDataset] = result.ac_InMSPAlignedSpace;
+    pc_InMSPAlignedSpace[currentDataset] = result.pc_InMSPAlignedSpace;
+    vn4_InMSPAlignedSpace[currentDataset] = result.vn4_InMSPAlignedSpace;
+    cec_InMSPAlignedSpace[currentDataset] = result.cec_InMSPAlignedSpace;
+    cm_InMSPAlignedSpace[currentDataset] = result.cm_InMSPAlignedSpace;
+    for ( auto & landmarkTemplates : result.templates )
     {
-      std::cout << "Training template for " << it->first << std::endl;
-      const SImageType::PointType origPoint = it->second;
-      const SImageType::PointType transformedPoint = ACPC_AlignedTransform_INV->TransformPoint( origPoint );
-      /* PRINT FOR TEST /////////////////////////////////////////////
-          std::cout << "original point: " << it->second << std::endl;
-          std::cout << "transformed point: " << transformedPoint << std::endl;
-      /////////////////////////////////////////////////////////////*/
       for ( unsigned int currentAngle = 0; currentAngle < myModel.GetNumRotationSteps(); currentAngle++ )
       {
-        // //////  create a rotation about the center with respect to the
-        // current test rotation angle
-        const float degree_current_angle =
-          myModel.GetInitialRotationAngle() + myModel.GetInitialRotationStep() * currentAngle;
-        const float current_angle = degree_current_angle * itk::Math::pi / 180;
-
-        RigidTransformType::Pointer Point_Rotate = RigidTransformType::New();
-        Point_Rotate->SetCenter( transformedPoint );
-        Point_Rotate->SetRotation( current_angle, 0, 0 );
-
-        SImageType::Pointer image_TestRotated =
-          CreateTestCenteredRotatedImage2( ACPC_AlignedTransform, origPoint, image, Point_Rotate );
-        if ( globalImagedebugLevel > 5 )
-        {
-          std::stringstream s( "" );
-          s << "image_" << it->first << "_TestRotated_" << current_angle << "_";
-          const std::string rotatedName =
-            resultsDir + "/" + s.str().c_str() +
-            itksys::SystemTools::GetFilenameName( mDef[currentDataset].GetImageFilename() );
-          std::cout << "Writing file: " << rotatedName << std::endl;
-          itkUtil::WriteImage< SImageType >( image_TestRotated, rotatedName );
-        }
-
-        // The following 3 function calls may be a performance problem,
-        // and it should be  straight forward to refactor this into a single function
-        // extractZeroMeanNormalizedVector that has the same signature as extractArray, but has many fewer
-        // loop iterations.
-        LinearInterpolatorType::Pointer imInterp = LinearInterpolatorType::New();
-        imInterp->SetInputImage( image_TestRotated );
-        // Resize the model internal vector.
-        myModel.AccessTemplate( it->first, currentDataset, currentAngle )
-          .resize( myModel.m_VectorIndexLocations[it->first].size() );
-        extractArray( imInterp,
-                      transformedPoint,
-                      myModel.m_VectorIndexLocations[it->first],
-                      myModel.AccessTemplate( it->first, currentDataset, currentAngle ) );
-        removeVectorMean( myModel.AccessTemplate( it->first, currentDataset, currentAngle ) );
-        normalizeVector( myModel.AccessTemplate( it->first, currentDataset, currentAngle ) );
+        myModel.AccessTemplate( landmarkTemplates.first, currentDataset, currentAngle )
+          .swap( landmarkTemplates.second[currentAngle] );
       }
     }
-
-    if ( saveOptimizedLandmarks )
-    {
-      MSPOptFile.close();
-    }
   }
 
   /* PRINT FOR TEST ////////////////////////////////////////////
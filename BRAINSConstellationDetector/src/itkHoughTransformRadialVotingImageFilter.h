@@ -69,6 +69,8 @@
 #include "itkAddImageFilter.h"
 #include "itkImageRegionIterator.h"
 
+#include <vector>
+
 namespace itk
 {
 /**
@@ -218,7 +220,8 @@ public:
   itkSetMacro( Variance, double );
   itkGetConstMacro( Variance, double );
 
-  /** Set the number of threads */
+  /** Unused, the filter uses the ProcessObject NumberOfWorkUnits.
+   * The result does not depend on the number of work units. */
   itkSetMacro( NbOfThreads, unsigned int );
   itkGetConstMacro( NbOfThreads, unsigned int );
 
@@ -268,6 +271,28 @@ protected:
   // -- Add by Wei Lu
   int m_HoughEyeDetectorMode;
 
+  /** A voxel that casts votes around its estimated sphere center. */
+  struct VotingSeed
+  {
+    InternalIndexType center;
+    InternalIndexType centerToVoter;
+  };
+  std::vector< VotingSeed > m_VotingSeeds;
+
+  /** Precomputed Gaussian vote weights of the (box shaped) voting region. */
+  std::vector< double >  m_VotingWeightStamp;
+  InternalIndexType      m_VotingRadius;
+  InternalSizeType       m_VotingSize;
+  InternalSizeType       m_VotingStampStride;
+
+  /** Precompute the vote weights for every offset in the voting region. */
+  void
+  ComputeVotingStamp();
+
+  /** Compute the gradients and select the voting voxels. */
+  void
+  ComputeVotingSeeds();
+
   /** Method for evaluating the implicit function over the image. */
   void
   BeforeThreadedGenerateData() override;
@@ -62,8 +62,9 @@
 #include "itkHoughTransformRadialVotingImageFilter.h"
 
 #include "itkDiscreteGaussianImageFilter.h"
-#include "itkGaussianDerivativeImageFunction.h"
 #include "itkGaussianDistribution.h"
+#include "itkGaussianDerivativeImageFunction.h"
+#include "itkMultiThreaderBase.h"
 
 
 namespace itk
@@ -88,11 +89,9 @@ HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::HoughTransfo
   , m_AllSeedsProcessed( false )
   , m_HoughEyeDetectorMode( 0 )
 {
-  // Limiting the Hough Filter to run with single thread.
-  // In a single threaded status, the increment of run time for this filter is not tremendous in compare with
-  // the total run time of the BCD
-  this->SetNumberOfWorkUnits( 1 );
-  this->DynamicMultiThreadingOff(); // NEEDED FOR ITKv5 backwards compatibility
+  // Each work unit owns a piece of the accumulator (see ThreadedGenerateData),
+  // so the static region split is what keeps the votes race free.
+  this->DynamicMultiThreadingOff();
 }
 
 template < typename TInputImage, typename TOutputImage >
@@ -147,146 +146,235 @@ HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::BeforeThread
   m_RadiusImage->SetRegions( inputImage->GetLargestPossibleRegion() );
   m_RadiusImage->Allocate(true);
   m_RadiusImage->FillBuffer( 0 );
+
+  this->ComputeVotingStamp();
+  this->ComputeVotingSeeds();
 }
 
 template < typename TInputImage, typename TOutputImage >
 void
-HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::AfterThreadedGenerateData()
+HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::ComputeVotingStamp()
 {
-  ComputeMeanRadiusImage();
-  ComputeSpheres();
+  const InputSpacingType spacing = this->GetInput()->GetSpacing();
 
-  using CasterType = itk::CastImageFilter<InternalImageType, TOutputImage>;
-  typename CasterType::Pointer cif = CasterType::New();
-  cif->SetInput(this->m_AccumulatorImage);
-  cif->Update();
-  typename TOutputImage::Pointer output_image_copy = cif->GetOutput();
-  this->GraftOutput(output_image_copy);
+  using GaussianFunctionType = itk::Statistics::GaussianDistribution;
+  typename GaussianFunctionType::Pointer GaussianFunction = GaussianFunctionType::New();
+
+  const InputCoordType averageRadius = 0.5 * ( m_MinimumRadius + m_MaximumRadius );
+  const InputCoordType averageRadius2 = averageRadius * averageRadius;
+
+  // The voting box is centered on the estimated sphere center, so the
+  // Gaussian weight of every box voxel only depends on its offset.
+  SizeValueType numberOfStampVoxels = 1;
+  for ( unsigned int i = 0; i < ImageDimension; i++ )
+  {
+    const InputCoordType rad = m_VotingRadiusRatio * m_MinimumRadius / spacing[i];
+    m_VotingRadius[i] = static_cast< InternalIndexValueType >( rad );
+    m_VotingSize[i] = 1 + 2 * static_cast< InternalSizeValueType >( rad );
+    m_VotingStampStride[i] = numberOfStampVoxels;
+    numberOfStampVoxels *= m_VotingSize[i];
+  }
+
+  m_VotingWeightStamp.resize( numberOfStampVoxels );
+  for ( SizeValueType linear = 0; linear < numberOfStampVoxels; ++linear )
+  {
+    double d2 = 0;
+    for ( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+      const InternalIndexValueType offset =
+        static_cast< InternalIndexValueType >( ( linear / m_VotingStampStride[i] ) % m_VotingSize[i] ) -
+        m_VotingRadius[i];
+      d2 += itk::Math::sqr( static_cast< double >( offset ) * spacing[i] );
+    }
+    m_VotingWeightStamp[linear] = GaussianFunction->EvaluatePDF( std::sqrt( d2 ), 0, averageRadius2 );
+  }
 }
 
 template < typename TInputImage, typename TOutputImage >
 void
-HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::ThreadedGenerateData(
-  const OutputImageRegionType & windowRegion, ThreadIdType /* threadId -- Not used */ )
-
+HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::ComputeVotingSeeds()
 {
-  // Get the input and output pointers
   const InputImageConstPointer inputImage = this->GetInput();
   const InputSpacingType       spacing = inputImage->GetSpacing();
-
-  using GaussianFunctionType = itk::Statistics::GaussianDistribution;
-  using GaussianFunctionPointer = typename GaussianFunctionType::Pointer;
+  const InputRegionType        inputRegion = inputImage->GetRequestedRegion();
 
   using DoGFunctionType = GaussianDerivativeImageFunction< InputImageType, InputCoordType >;
   typedef typename DoGFunctionType::Pointer    DoGFunctionPointer;
   typedef typename DoGFunctionType::VectorType DoGVectorType;
 
-  DoGFunctionPointer DoGFunction = DoGFunctionType::New();
-  DoGFunction->SetUseImageSpacing( true );
+  m_VotingSeeds.clear();
 
-  DoGFunction->SetInputImage( inputImage );
-  DoGFunction->SetSigma( m_SigmaGradient );
+  // Only voxels above the intensity threshold can vote.
+  std::vector< InputIndexType > candidates;
+  for ( ImageRegionConstIteratorWithIndex< InputImageType > it( inputImage, inputRegion ); !it.IsAtEnd(); ++it )
+  {
+    if ( it.Get() > m_Threshold )
+    {
+      candidates.push_back( it.GetIndex() );
+    }
+  }
+  if ( candidates.empty() )
+  {
+    return;
+  }
 
-  GaussianFunctionPointer GaussianFunction = GaussianFunctionType::New();
+  // The gradients are independent per voxel, so they are evaluated in
+  // parallel.  GaussianDerivativeImageFunction is not thread safe, so each
+  // block of candidates gets its own instance.
+  std::vector< DoGVectorType > gradients( candidates.size() );
+  const SizeValueType          numberOfCandidates = candidates.size();
+  const SizeValueType          numberOfBlocks =
+    std::min< SizeValueType >( numberOfCandidates, std::max( 1U, this->GetNumberOfWorkUnits() ) );
+  const SizeValueType        blockSize = ( numberOfCandidates + numberOfBlocks - 1 ) / numberOfBlocks;
+  MultiThreaderBase::Pointer threader = MultiThreaderBase::New();
+  threader->SetNumberOfWorkUnits( this->GetNumberOfWorkUnits() );
+  threader->ParallelizeArray(
+    0,
+    numberOfBlocks,
+    [&]( const SizeValueType block ) {
+      DoGFunctionPointer DoGFunction = DoGFunctionType::New();
+      DoGFunction->SetUseImageSpacing( true );
+      DoGFunction->SetInputImage( inputImage );
+      DoGFunction->SetSigma( m_SigmaGradient );
+      const SizeValueType end = std::min( ( block + 1 ) * blockSize, numberOfCandidates );
+      for ( SizeValueType c = block * blockSize; c < end; ++c )
+      {
+        gradients[c] = DoGFunction->EvaluateAtIndex( candidates[c] );
+      }
+    },
+    nullptr );
 
   const InputCoordType averageRadius = 0.5 * ( m_MinimumRadius + m_MaximumRadius );
-  const InputCoordType averageRadius2 = averageRadius * averageRadius;
-
-  ImageRegionConstIteratorWithIndex< InputImageType > image_it( inputImage, windowRegion );
-  image_it.GoToBegin();
 
+  // Seeds are selected in raster order over the whole image, so the
+  // sampling (and therefore the result) does not depend on the threading.
   const unsigned int sampling = static_cast< unsigned int >( 1. / m_SamplingRatio );
   unsigned int       counter = 1;
+  for ( SizeValueType c = 0; c < numberOfCandidates; ++c )
+  {
+    DoGVectorType & grad = gradients[c];
 
-  InternalRegionType region;
-  while ( !image_it.IsAtEnd() )
+    // if the gradient is not flat
+    const typename DoGVectorType::ValueType norm2 = grad.GetSquaredNorm();
+    if ( !( norm2 > m_GradientThreshold ) )
+    {
+      continue;
+    }
+    if ( counter++ % sampling != 0 )
+    {
+      continue;
+    }
+    // Normalization
+    if ( norm2 != 0 )
+    {
+      const typename DoGVectorType::ValueType inv_norm = 1.0 / std::sqrt( norm2 );
+      for ( unsigned int i = 0; i < ImageDimension; i++ )
+      {
+        grad[i] *= inv_norm;
+      }
+    }
+
+    const InputIndexType & index = candidates[c];
+    VotingSeed             seed;
+    InternalRegionType     votingRegion;
+    for ( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+      // for T1, T2 images
+      if ( m_HoughEyeDetectorMode == 1 )
+      {
+        seed.center[i] = index[i] + static_cast< InternalIndexValueType >( averageRadius * grad[i] / spacing[i] );
+      }
+      else
+      { // for PD image
+        seed.center[i] = index[i] - static_cast< InternalIndexValueType >( averageRadius * grad[i] / spacing[i] );
+      }
+      seed.centerToVoter[i] = seed.center[i] - index[i];
+      votingRegion.SetIndex( i, seed.center[i] - m_VotingRadius[i] );
+    }
+    votingRegion.SetSize( m_VotingSize );
+    if ( inputRegion.IsInside( votingRegion ) )
+    {
+      m_VotingSeeds.push_back( seed );
+    }
+  }
+}
+
+template < typename TInputImage, typename TOutputImage >
+void
+HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::ThreadedGenerateData(
+  const OutputImageRegionType & windowRegion, ThreadIdType /* threadId -- Not used */ )
+{
+  // Owner computes: this work unit only writes the accumulator voxels inside
+  // windowRegion, but it visits every seed in the same (raster) order, so the
+  // sum at each voxel is formed in the same order for any number of threads.
+  const InputSpacingType spacing = this->GetInput()->GetSpacing();
+
+  std::vector< double > axisDistance2[ImageDimension];
+  for ( unsigned int i = 0; i < ImageDimension; i++ )
   {
-    if ( image_it.Get() > m_Threshold )
+    axisDistance2[i].resize( m_VotingSize[i] );
+  }
+
+  for ( const VotingSeed & seed : m_VotingSeeds )
+  {
+    InternalRegionType votingRegion;
+    for ( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+      votingRegion.SetIndex( i, seed.center[i] - m_VotingRadius[i] );
+    }
+    votingRegion.SetSize( m_VotingSize );
+    const InternalIndexType votingStart = votingRegion.GetIndex();
+    if ( !votingRegion.Crop( windowRegion ) )
     {
-      const Index< ImageDimension > index = image_it.GetIndex();
-      DoGVectorType                 grad = DoGFunction->EvaluateAtIndex( index );
+      continue;
+    }
 
-      // if the gradient is not flat
-      typename DoGVectorType::ValueType norm2 = grad.GetSquaredNorm();
+    // Squared distance to the voting voxel, separated per axis.
+    for ( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+      for ( InternalSizeValueType k = 0; k < m_VotingSize[i]; ++k )
+      {
+        const InternalIndexValueType offset =
+          static_cast< InternalIndexValueType >( k ) - m_VotingRadius[i] + seed.centerToVoter[i];
+        axisDistance2[i][k] = itk::Math::sqr( static_cast< InputCoordType >( offset ) * spacing[i] );
+      }
+    }
 
-      if ( norm2 > m_GradientThreshold )
+    ImageRegionIteratorWithIndex< InternalImageType > It1( m_AccumulatorImage, votingRegion );
+    ImageRegionIterator< InternalImageType >          It2( m_RadiusImage, votingRegion );
+    for ( ; !It1.IsAtEnd(); ++It1, ++It2 )
+    {
+      const InternalIndexType indexAtVote = It1.GetIndex();
+      SizeValueType           stampIndex = 0;
+      InputCoordType          distance2 = 0;
+      for ( unsigned int i = 0; i < ImageDimension; i++ )
       {
-        if ( counter % sampling == 0 )
-        {
-          // Normalization
-          if ( norm2 != 0 )
-          {
-            const typename DoGVectorType::ValueType inv_norm = 1.0 / std::sqrt( norm2 );
-            for ( unsigned int i = 0; i < ImageDimension; i++ )
-            {
-              grad[i] *= inv_norm;
-            }
-          }
-          Index< ImageDimension > center;
-          {
-            InternalIndexType start;
-            InternalSizeType  size;
-            for ( unsigned int i = 0; i < ImageDimension; i++ )
-            {
-              // for T1, T2 images
-              if ( m_HoughEyeDetectorMode == 1 )
-              {
-                center[i] = index[i] + static_cast< InternalIndexValueType >( averageRadius * grad[i] / spacing[i] );
-              }
-              else
-              { // for PD image
-                center[i] = index[i] - static_cast< InternalIndexValueType >( averageRadius * grad[i] / spacing[i] );
-              }
-
-              const InputCoordType rad = m_VotingRadiusRatio * m_MinimumRadius / spacing[i];
-              start[i] = center[i] - static_cast< InternalIndexValueType >( rad );
-              size[i] = 1 + 2 * static_cast< InternalSizeValueType >( rad );
-            }
-            region.SetSize( size );
-            region.SetIndex( start );
-          }
-
-          if ( inputImage->GetRequestedRegion().IsInside( region ) )
-          {
-            ImageRegionIteratorWithIndex< InternalImageType > It1( m_AccumulatorImage, region );
-
-            ImageRegionIterator< InternalImageType > It2( m_RadiusImage, region );
-
-            It1.GoToBegin();
-            It2.GoToBegin();
-            while ( !It1.IsAtEnd() )
-            {
-              assert( !It2.IsAtEnd() );
-              const Index< ImageDimension > indexAtVote = It1.GetIndex();
-              InputCoordType                distance = 0;
-              double                        d = 0;
-              for ( unsigned int i = 0; i < ImageDimension; i++ )
-              {
-                d += itk::Math::sqr( static_cast< double >( indexAtVote[i] - center[i] ) * spacing[i] );
-                distance += itk::Math::sqr( static_cast< InputCoordType >( indexAtVote[i] - index[i] ) * spacing[i] );
-              }
-              d = std::sqrt( d );
-              distance = std::sqrt( distance );
-
-              // Apply a normal distribution weight;
-              const double weight = GaussianFunction->EvaluatePDF( d, 0, averageRadius2 );
-              double       distweight( distance * weight );
-
-              It1.Set( It1.Get() + weight );
-              It2.Set( It2.Get() + distweight );
-
-              ++It1;
-              ++It2;
-            }
-          }
-        } // end counter
-        counter++;
-      } // end gradient threshold
-    }   // end intensity threshold
-    ++image_it;
+        const SizeValueType k = static_cast< SizeValueType >( indexAtVote[i] - votingStart[i] );
+        stampIndex += k * m_VotingStampStride[i];
+        distance2 += axisDistance2[i][k];
+      }
+      const double weight = m_VotingWeightStamp[stampIndex];
+      It1.Set( It1.Get() + weight );
+      It2.Set( It2.Get() + std::sqrt( distance2 ) * weight );
+    }
   }
 }
 
+template < typename TInputImage, typename TOutputImage >
+void
+HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::AfterThreadedGenerateData()
+{
+  ComputeMeanRadiusImage();
+  ComputeSpheres();
+
+  using CasterType = itk::CastImageFilter<InternalImageType, TOutputImage>;
+  typename CasterType::Pointer cif = CasterType::New();
+  cif->SetInput(this->m_AccumulatorImage);
+  cif->Update();
+  typename TOutputImage::Pointer output_image_copy = cif->GetOutput();
+  this->GraftOutput(output_image_copy);
+}
+
 template < typename TInputImage, typename TOutputImage >
 void
 HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::ComputeMeanRadiusImage()
@@ -423,6 +511,7 @@ HoughTransformRadialVotingImageFilter< TInputImage, TOutputImage >::PrintSelf( s
   os << "NbOfThreads: " << m_NbOfThreads << std::endl;
   os << "All Seeds Processed: " << m_AllSeedsProcessed << std::endl;
   os << "HoughEyeDetectorMode: " << m_HoughEyeDetectorMode << std::endl;
+  os << "Number Of Voting Seeds: " << m_VotingSeeds.size() << std::endl;
 
   os << "Radius Image Information : " << m_RadiusImage << std::endl;
 }
@@ -31,6 +31,8 @@
 #include "BRAINSHoughEyeDetector.h"
 
 #include <BRAINSFitHelper.h>
+#include "BRAINSProfiler.h"
+#include "BRAINSAtlasCache.h"
 #include "itkLandmarkBasedTransformInitializer.h"
 
 std::string
@@ -85,13 +87,11 @@ landmarksConstellationDetector::ComputeFinalRefinedACPCAlignedTransform( SImageT
   // START BRAINSFit alternative
   if ( !this->m_atlasVolume.empty() )
   {
-    using AtlasReaderType = itk::ImageFileReader< SImageType >;
-    AtlasReaderType::Pointer atlasReader = AtlasReaderType::New();
-    atlasReader->SetFileName( this->m_atlasVolume );
+    SImageType::Pointer atlasImage;
     std::cout << "read atlas: " << this->m_atlasVolume << std::endl;
     try
     {
-      atlasReader->Update();
+      atlasImage = BRAINSUtils::AtlasCache::ReadImage< SImageType >( this->m_atlasVolume );
     }
     catch ( itk::ExceptionObject & err )
     {
@@ -182,7 +182,7 @@ landmarksConstellationDetector::ComputeFinalRefinedACPCAlignedTransform( SImageT
 
     {
       CastFilterType::Pointer fixedCastFilter = CastFilterType::New();
-      fixedCastFilter->SetInput( atlasReader->GetOutput() );
+      fixedCastFilter->SetInput( atlasImage );
       fixedCastFilter->Update();
       brainsFitHelper->SetFixedVolume( fixedCastFilter->GetOutput() );
 
@@ -216,7 +216,7 @@ landmarksConstellationDetector::ComputeFinalRefinedACPCAlignedTransform( SImageT
       {
         using ROIAutoType = itk::BRAINSROIAutoImageFilter< SImageType, itk::Image< unsigned char, 3 > >;
         ROIAutoType::Pointer ROIFilter = ROIAutoType::New();
-        ROIFilter->SetInput( atlasReader->GetOutput() );
+        ROIFilter->SetInput( atlasImage );
         ROIFilter->SetClosingSize( ROIAutoClosingSize );
         ROIFilter->SetDilateSize( ROIAutoDilateSize );
         ROIFilter->Update();
@@ -284,6 +284,7 @@ landmarksConstellationDetector::FindCandidatePoints(
   const std::vector< std::vector< float > > &                    TemplateMean,
   const landmarksConstellationModelIO::IndexLocationVectorType & model, double & cc_Max, const std::string & mapID )
 {
+  BRAINS_PROFILE_SCOPE( "FindCandidatePoints" );
   cc_Max = -123456789.0;
 
   LinearInterpolatorType::Pointer imInterp = LinearInterpolatorType::New();
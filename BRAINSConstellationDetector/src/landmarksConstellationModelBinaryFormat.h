@@ -0,0 +1,241 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+/*
+ * On disk layout of the binary (.bcdm) constellation model.
+ *
+ *   BinaryModelHeader                          (offset 0)
+ *   BinaryModelLandmarkEntry[numLandmarks]     (offset header.indexTableOffset)
+ *   per landmark, 64 byte aligned:
+ *     float templateMeans[numRotationSteps][templateLength]
+ *     float spectra[spectraLength]             (optional)
+ *
+ * All values are stored in the byte order of the writer; the endianTag lets
+ * a reader reject a file written on a machine of the other byte order
+ * (regenerate it with BRAINSConstellationModelConverter).  Every section is
+ * aligned so that templates can be used straight from a read-only memory
+ * mapping that is shared by all processes reading the same model.
+ */
+
+#ifndef landmarksConstellationModelBinaryFormat_h
+#define landmarksConstellationModelBinaryFormat_h
+
+#include "itkMacro.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined( _WIN32 )
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace BinaryConstellationModel
+{
+constexpr char          Magic[8] = { 'B', 'C', 'D', 'M', 'O', 'D', 'E', 'L' };
+constexpr std::uint32_t FormatVersion = 1;
+constexpr std::uint32_t EndianTag = 0x01020304;
+constexpr std::uint64_t SectionAlignment = 64;
+constexpr unsigned int  MaxNameLength = 32;
+constexpr unsigned int  MaxVersionLength = 32;
+
+/** Fixed size file header, followed by the landmark index table. */
+struct BinaryModelHeader
+{
+  char          magic[8];
+  std::uint32_t formatVersion;
+  std::uint32_t endianTag;
+  char          bcdVersion[MaxVersionLength];
+  std::uint32_t numLandmarks;
+  std::uint32_t searchboxDims;
+  float         resolutionUnits;
+  std::uint32_t numDataSets;
+  std::uint32_t numRotationSteps;
+  float         initialRotationAngle;
+  float         initialRotationStep;
+  float         RPPC_to_RPAC_angleMean;
+  float         RPAC_over_RPPCMean;
+  std::uint32_t reserved0;
+  double        RPtoPCMean[3];
+  double        CMtoRPMean[3];
+  double        RPtoVN4Mean[3];
+  double        RPtoCECMean[3];
+  double        RPtoACMean[3];
+  std::uint64_t indexTableOffset;
+  std::uint64_t fileSize;
+};
+
+/** One index table entry per landmark. Offsets are from the start of file. */
+struct BinaryModelLandmarkEntry
+{
+  char          name[MaxNameLength];
+  float         radius;
+  float         height;
+  std::uint32_t numRotationSteps;
+  std::uint32_t templateLength;
+  std::uint64_t templateMeansOffset;
+  // Optional precomputed spectra of the template means, 0 when absent.
+  std::uint64_t spectraOffset;
+  std::uint64_t spectraLength;
+};
+
+inline std::uint64_t
+AlignOffset( const std::uint64_t offset )
+{
+  return ( offset + SectionAlignment - 1 ) / SectionAlignment * SectionAlignment;
+}
+
+inline bool
+HasBinaryModelMagic( const std::string & filename )
+{
+  std::ifstream input( filename.c_str(), std::ios::in | std::ios::binary );
+  char          magic[sizeof( Magic )];
+  input.read( magic, sizeof( magic ) );
+  return input.gcount() == sizeof( magic ) && std::memcmp( magic, Magic, sizeof( Magic ) ) == 0;
+}
+
+/**
+ * \author Hans J. Johnson
+ * \brief A read-only memory mapping of a whole model file.
+ *
+ * Pages are only read from disk when a landmark is first used, and are
+ * shared through the page cache by every process that maps the same model.
+ */
+class MappedModelFile
+{
+public:
+  explicit MappedModelFile( const std::string & filename )
+  {
+#if defined( _WIN32 )
+    m_File = CreateFileA(
+      filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if ( m_File == INVALID_HANDLE_VALUE )
+    {
+      itkGenericExceptionMacro( << "Can't read " << filename );
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx( m_File, &fileSize );
+    m_Size = static_cast< size_t >( fileSize.QuadPart );
+    m_Mapping = CreateFileMappingA( m_File, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    if ( m_Mapping != nullptr )
+    {
+      m_Data = static_cast< const char * >( MapViewOfFile( m_Mapping, FILE_MAP_READ, 0, 0, 0 ) );
+    }
+    if ( m_Data == nullptr )
+    {
+      this->Unmap();
+      itkGenericExceptionMacro( << "Can't memory map " << filename );
+    }
+#else
+    const int fd = open( filename.c_str(), O_RDONLY );
+    if ( fd < 0 )
+    {
+      itkGenericExceptionMacro( << "Can't read " << filename );
+    }
+    struct stat fileStatus;
+    if ( fstat( fd, &fileStatus ) != 0 )
+    {
+      close( fd );
+      itkGenericExceptionMacro( << "Can't stat " << filename );
+    }
+    m_Size = static_cast< size_t >( fileStatus.st_size );
+    void * mapped = mmap( nullptr, m_Size, PROT_READ, MAP_SHARED, fd, 0 );
+    // The mapping stays valid after the descriptor is closed.
+    close( fd );
+    if ( mapped == MAP_FAILED )
+    {
+      itkGenericExceptionMacro( << "Can't memory map " << filename );
+    }
+    m_Data = static_cast< const char * >( mapped );
+#endif
+  }
+
+  ~MappedModelFile() { this->Unmap(); }
+
+  MappedModelFile( const MappedModelFile & ) = delete;
+  MappedModelFile &
+  operator=( const MappedModelFile & ) = delete;
+
+  size_t
+  GetSize() const
+  {
+    return m_Size;
+  }
+
+  /** Pointer to count objects of T at offset, after bounds checking. */
+  template < typename T >
+  const T *
+  GetPointer( const std::uint64_t offset, const std::uint64_t count = 1 ) const
+  {
+    if ( offset > m_Size || count > ( m_Size - offset ) / sizeof( T ) )
+    {
+      itkGenericExceptionMacro( << "Binary model file is truncated or corrupt" );
+    }
+    return reinterpret_cast< const T * >( m_Data + offset );
+  }
+
+private:
+  void
+  Unmap()
+  {
+#if defined( _WIN32 )
+    if ( m_Data != nullptr )
+    {
+      UnmapViewOfFile( m_Data );
+    }
+    if ( m_Mapping != nullptr )
+    {
+      CloseHandle( m_Mapping );
+    }
+    if ( m_File != INVALID_HANDLE_VALUE )
+    {
+      CloseHandle( m_File );
+    }
+    m_Mapping = nullptr;
+    m_File = INVALID_HANDLE_VALUE;
+#else
+    if ( m_Data != nullptr )
+    {
+      munmap( const_cast< char * >( m_Data ), m_Size );
+    }
+#endif
+    m_Data = nullptr;
+  }
+
+  const char * m_Data = nullptr;
+  size_t       m_Size = 0;
+#if defined( _WIN32 )
+  HANDLE m_File = INVALID_HANDLE_VALUE;
+  HANDLE m_Mapping = nullptr;
+#endif
+};
+
+} // namespace BinaryConstellationModel
+
+#endif // landmarksConstellationModelBinaryFormat_h
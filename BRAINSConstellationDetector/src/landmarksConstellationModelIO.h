@@ -28,6 +28,7 @@
 #include "landmarksConstellationCommon.h"
 #include "landmarksConstellationTrainingDefinitionIO.h"
 #include "landmarksConstellationModelBase.h"
+#include "landmarksConstellationModelBinaryFormat.h"
 
 #include "itkByteSwapper.h"
 #include "itkIO.h"
@@ -38,6 +39,9 @@
 #include <cmath>
 #include <cstring>
 #include <map>
+#include <memory>
+
+#include <itksys/SystemTools.hxx>
 
 #include "BRAINSConstellationDetectorVersion.h"
 
@@ -259,12 +263,26 @@ public:
   const Float2DVectorType &
   GetTemplateMeans( const std::string & name )
   {
+    this->LoadMappedTemplateMeans( name );
     return this->m_TemplateMeans[name];
   }
 
+  /** Files ending in .bcdm are written in the memory mappable binary
+   * format, everything else in the original stream format. */
+  static bool
+  IsBinaryModelFileName( const std::string & filename )
+  {
+    return itksys::SystemTools::LowerCase( itksys::SystemTools::GetFilenameLastExtension( filename ) ) == ".bcdm";
+  }
+
   void
   WriteModelFile( const std::string & filename )
   {
+    if ( IsBinaryModelFileName( filename ) )
+    {
+      this->WriteBinaryModelFile( filename );
+      return;
+    }
     //
     //
     // //////////////////////////////////////////////////////////////////////////
@@ -310,9 +328,7 @@ public:
 #endif
       for ( it2 = this->m_TemplateMeansComputed.begin(); it2 != this->m_TemplateMeansComputed.end(); ++it2 )
       {
-        ComputeAllMeans( this->m_TemplateMeans[it2->first], this->m_Templates[it2->first] );
-        this->Write( output, this->m_TemplateMeans[it2->first] );
-        this->WritedebugMeanImages( it2->first );
+        this->Write( output, this->GetTemplateMeansForWriting( it2->first ) );
       }
 
 #ifdef __USE_OFFSET_DEBUGGING_CODE__
@@ -388,6 +404,11 @@ public:
     //
     //
     // //////////////////////////////////////////////////////////////////////////
+    if ( BinaryConstellationModel::HasBinaryModelMagic( filename ) )
+    {
+      this->ReadBinaryModelFile( filename );
+      return;
+    }
 
     std::ifstream input( filename.c_str() ); // open setup file for reading
 
@@ -507,6 +528,182 @@ public:
     input.close();
   }
 
+  /**
+   * Write the model in the binary format described in
+   * landmarksConstellationModelBinaryFormat.h.
+   */
+  void
+  WriteBinaryModelFile( const std::string & filename )
+  {
+    using namespace BinaryConstellationModel;
+
+    BinaryModelHeader header;
+    std::memset( &header, 0, sizeof( header ) );
+    std::memcpy( header.magic, Magic, sizeof( Magic ) );
+    header.formatVersion = FormatVersion;
+    header.endianTag = EndianTag;
+    std::strncpy( header.bcdVersion, BCDVersionString, MaxVersionLength - 1 );
+    header.numLandmarks = static_cast< std::uint32_t >( this->m_TemplateMeansComputed.size() );
+    header.searchboxDims = this->GetSearchboxDims();
+    header.resolutionUnits = this->GetResolutionUnits();
+    header.numDataSets = this->GetNumDataSets();
+    header.numRotationSteps = this->GetNumRotationSteps();
+    header.initialRotationAngle = this->GetInitialRotationAngle();
+    header.initialRotationStep = this->GetInitialRotationStep();
+    header.RPPC_to_RPAC_angleMean = this->m_RPPC_to_RPAC_angleMean;
+    header.RPAC_over_RPPCMean = this->m_RPAC_over_RPPCMean;
+    for ( unsigned int i = 0; i < 3; ++i )
+    {
+      header.RPtoPCMean[i] = this->m_RPtoXMean["PC"][i];
+      header.CMtoRPMean[i] = this->m_CMtoRPMean[i];
+      header.RPtoVN4Mean[i] = this->m_RPtoXMean["VN4"][i];
+      header.RPtoCECMean[i] = this->m_RPtoCECMean[i];
+      header.RPtoACMean[i] = this->m_RPtoXMean["AC"][i];
+    }
+    header.indexTableOffset = AlignOffset( sizeof( BinaryModelHeader ) );
+
+    // Lay out the index table and the template sections.
+    std::vector< BinaryModelLandmarkEntry >       entries;
+    std::vector< const Float2DVectorType * >      means;
+    std::map< std::string, bool >::const_iterator it2;
+    std::uint64_t                                 offset =
+      AlignOffset( header.indexTableOffset + header.numLandmarks * sizeof( BinaryModelLandmarkEntry ) );
+    for ( it2 = this->m_TemplateMeansComputed.begin(); it2 != this->m_TemplateMeansComputed.end(); ++it2 )
+    {
+      if ( it2->first.size() >= MaxNameLength )
+      {
+        itkGenericExceptionMacro( << "Landmark name too long for binary model: " << it2->first );
+      }
+      const Float2DVectorType & landmarkMeans = this->GetTemplateMeansForWriting( it2->first );
+
+      BinaryModelLandmarkEntry entry;
+      std::memset( &entry, 0, sizeof( entry ) );
+      std::strncpy( entry.name, it2->first.c_str(), MaxNameLength - 1 );
+      entry.radius = this->GetRadius( it2->first );
+      entry.height = this->GetHeight( it2->first );
+      entry.numRotationSteps = static_cast< std::uint32_t >( landmarkMeans.size() );
+      entry.templateLength = landmarkMeans.empty() ? 0 : static_cast< std::uint32_t >( landmarkMeans[0].size() );
+      entry.templateMeansOffset = offset;
+      offset = AlignOffset( offset + static_cast< std::uint64_t >( entry.numRotationSteps ) * entry.templateLength *
+                                       sizeof( float ) );
+      entries.push_back( entry );
+      means.push_back( &landmarkMeans );
+    }
+    header.fileSize = offset;
+
+    std::ofstream output( filename.c_str(), std::ios::out | std::ios::binary );
+    if ( !output.is_open() )
+    {
+      itkGenericExceptionMacro( << "Can't write " << filename );
+    }
+    const std::vector< char > padding( SectionAlignment, 0 );
+    auto                      padTo = [&output, &padding]( const std::uint64_t target ) {
+      const std::uint64_t current = static_cast< std::uint64_t >( output.tellp() );
+      output.write( &( padding[0] ), static_cast< std::streamsize >( target - current ) );
+    };
+
+    output.write( reinterpret_cast< const char * >( &header ), sizeof( header ) );
+    padTo( header.indexTableOffset );
+    for ( const auto & entry : entries )
+    {
+      output.write( reinterpret_cast< const char * >( &entry ), sizeof( entry ) );
+    }
+    for ( size_t landmark = 0; landmark < entries.size(); ++landmark )
+    {
+      padTo( entries[landmark].templateMeansOffset );
+      for ( const auto & angleMean : *means[landmark] )
+      {
+        if ( angleMean.size() != entries[landmark].templateLength )
+        {
+          itkGenericExceptionMacro( << "Inconsistent template length for " << entries[landmark].name );
+        }
+        output.write( reinterpret_cast< const char * >( angleMean.data() ),
+                      static_cast< std::streamsize >( angleMean.size() * sizeof( float ) ) );
+      }
+    }
+    padTo( header.fileSize );
+    if ( !output.good() )
+    {
+      itkGenericExceptionMacro( << "Write failed for " << filename );
+    }
+  }
+
+  /**
+   * Map a binary model file.  Only the header and index table are read
+   * here; the template means of a landmark are copied out of the mapping
+   * the first time that landmark is requested.
+   */
+  void
+  ReadBinaryModelFile( const std::string & filename )
+  {
+    using namespace BinaryConstellationModel;
+
+    std::shared_ptr< MappedModelFile > mappedModel = std::make_shared< MappedModelFile >( filename );
+    const BinaryModelHeader &          header = *( mappedModel->GetPointer< BinaryModelHeader >( 0 ) );
+    if ( header.endianTag != EndianTag )
+    {
+      itkGenericExceptionMacro( << filename << " was written on a machine with a different byte order.\n"
+                                << "Regenerate it with BRAINSConstellationModelConverter." );
+    }
+    if ( header.formatVersion != FormatVersion || header.fileSize != mappedModel->GetSize() )
+    {
+      itkGenericExceptionMacro( << "Unsupported or truncated binary model file " << filename );
+    }
+    const std::string Version( header.bcdVersion, strnlen( header.bcdVersion, MaxVersionLength ) );
+    std::cout << "Input model file version: " << Version << std::endl;
+    if ( Version.compare( BCDVersionString ) != 0 )
+    {
+      itkGenericExceptionMacro( << "Input model file is outdated.\n"
+                                << "Input model file version: " << Version
+                                << ", Required version: " << BCDVersionString << std::endl );
+    }
+
+    this->m_SearchboxDims = header.searchboxDims;
+    this->m_ResolutionUnits = header.resolutionUnits;
+    this->m_NumDataSets = header.numDataSets;
+    this->m_NumRotationSteps = header.numRotationSteps;
+    this->m_InitialRotationAngle = header.initialRotationAngle;
+    this->m_InitialRotationStep = header.initialRotationStep;
+    this->m_RPPC_to_RPAC_angleMean = header.RPPC_to_RPAC_angleMean;
+    this->m_RPAC_over_RPPCMean = header.RPAC_over_RPPCMean;
+    for ( unsigned int i = 0; i < 3; ++i )
+    {
+      this->m_RPtoXMean["PC"][i] = header.RPtoPCMean[i];
+      this->m_CMtoRPMean[i] = header.CMtoRPMean[i];
+      this->m_RPtoXMean["VN4"][i] = header.RPtoVN4Mean[i];
+      this->m_RPtoCECMean[i] = header.RPtoCECMean[i];
+      this->m_RPtoXMean["AC"][i] = header.RPtoACMean[i];
+    }
+
+    std::cout << "NumberOfDataSets: " << this->m_NumDataSets << std::endl;
+    std::cout << "SearchBoxDims: " << this->m_SearchboxDims << std::endl;
+    std::cout << "ResolutionUnits: " << this->m_ResolutionUnits << std::endl;
+    std::cout << "NumberOfRotationSteps: " << this->m_NumRotationSteps << std::endl;
+
+    const BinaryModelLandmarkEntry * entries =
+      mappedModel->GetPointer< BinaryModelLandmarkEntry >( header.indexTableOffset, header.numLandmarks );
+    for ( unsigned int landmark = 0; landmark < header.numLandmarks; ++landmark )
+    {
+      const BinaryModelLandmarkEntry & entry = entries[landmark];
+      const std::string                name( entry.name, strnlen( entry.name, MaxNameLength ) );
+      this->m_Radius[name] = entry.radius;
+      this->m_Height[name] = entry.height;
+      this->m_TemplateMeansComputed[name] = true;
+      defineTemplateIndexLocations( entry.radius, entry.height, this->m_VectorIndexLocations[name] );
+      if ( entry.numRotationSteps != this->m_NumRotationSteps ||
+           entry.templateLength != this->m_VectorIndexLocations[name].size() )
+      {
+        itkGenericExceptionMacro( << "Template size mismatch for " << name << " in " << filename );
+      }
+      // Validate the section now so that lazy loading can not fail later.
+      mappedModel->GetPointer< float >( entry.templateMeansOffset,
+                                        static_cast< std::uint64_t >( entry.numRotationSteps ) * entry.templateLength );
+      this->m_TemplateMeans.erase( name );
+      this->m_MappedLandmarkEntries[name] = entry;
+    }
+    this->m_MappedModel = mappedModel;
+  }
+
   class debugImageDescriptor
   {
   public:
@@ -700,8 +897,9 @@ public:
     {
       if ( ( NE( this->GetRadius( it2->first ), other.GetRadius( it2->first ) ) ) ||
            ( NE( this->GetHeight( it2->first ), other.GetHeight( it2->first ) ) ) ||
-           ( NE(
-             it2->first + " template mean", this->m_TemplateMeans[it2->first], other.m_TemplateMeans[it2->first] ) ) )
+           ( NE( it2->first + " template mean",
+                 this->GetTemplateMeans( it2->first ),
+                 other.GetTemplateMeans( it2->first ) ) ) )
       {
         return false;
       }
@@ -726,6 +924,40 @@ public:
 private:
   bool m_Swapped;
 
+  /** Template means of a trained model are computed from its templates,
+   * those of a model that was read in come from the file. */
+  const Float2DVectorType &
+  GetTemplateMeansForWriting( const std::string & name )
+  {
+    if ( this->m_Templates.find( name ) != this->m_Templates.end() )
+    {
+      ComputeAllMeans( this->m_TemplateMeans[name], this->m_Templates[name] );
+      this->WritedebugMeanImages( name );
+      return this->m_TemplateMeans[name];
+    }
+    return this->GetTemplateMeans( name );
+  }
+
+  void
+  LoadMappedTemplateMeans( const std::string & name )
+  {
+    auto entryIt = this->m_MappedLandmarkEntries.find( name );
+    if ( entryIt == this->m_MappedLandmarkEntries.end() )
+    {
+      return;
+    }
+    const BinaryConstellationModel::BinaryModelLandmarkEntry & entry = entryIt->second;
+    const float *                                              data = this->m_MappedModel->GetPointer< float >(
+      entry.templateMeansOffset, static_cast< std::uint64_t >( entry.numRotationSteps ) * entry.templateLength );
+    Float2DVectorType & means = this->m_TemplateMeans[name];
+    means.resize( entry.numRotationSteps );
+    for ( unsigned int angle = 0; angle < entry.numRotationSteps; ++angle )
+    {
+      means[angle].assign( data + angle * entry.templateLength, data + ( angle + 1 ) * entry.templateLength );
+    }
+    this->m_MappedLandmarkEntries.erase( entryIt );
+  }
+
   template < typename T >
   void
   Write( std::ofstream & f, T var )
@@ -818,6 +1050,11 @@ private:
   SImageType::PointType::VectorType m_CMtoRPMean;
   float                             m_RPPC_to_RPAC_angleMean;
   float                             m_RPAC_over_RPPCMean;
+
+  // Set when the model was read from a binary file; landmarks still in
+  // m_MappedLandmarkEntries have not been copied out of the mapping yet.
+  std::shared_ptr< BinaryConstellationModel::MappedModelFile >                m_MappedModel;
+  std::map< std::string, BinaryConstellationModel::BinaryModelLandmarkEntry > m_MappedLandmarkEntries;
 };
 
 #endif // landmarksConstellationModelIO_h
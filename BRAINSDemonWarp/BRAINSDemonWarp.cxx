@@ -19,6 +19,7 @@
 #include "BRAINSDemonWarpCommonLibWin32Header.h"
 #include "BRAINSCommonLibWin32Header.h"
 #include "BRAINSThreadControl.h"
+#include "BRAINSProfiler.h"
 #include "BRAINSDemonWarpCLP.h"
 
 #include "BRAINSDemonWarpTemplates.h"
@@ -38,13 +39,17 @@ int
 main( int argc, char * argv[] )
 {
   struct BRAINSDemonWarpAppParameters command;
+  std::string                          profileOutputFileName;
 
   {
     PARSE_ARGS;
+    profileOutputFileName = profileOutput;
     BRAINSRegisterAlternateIO();
     const BRAINSUtils::StackPushITKDefaultNumberOfThreads TempDefaultNumberOfThreadsHolder( numberOfThreads );
 
 #ifdef USE_DebugImageViewer
+    DebugImageDisplaySender.SetShrinkFactor( static_cast< unsigned int >( std::max( debugImageShrinkFactor, 1 ) ) );
+    DebugImageDisplaySender.SetMaxQueueLength( static_cast< unsigned int >( std::max( debugImageMaxQueueLength, 1 ) ) );
     DebugImageDisplaySender.SetEnabled( UseDebugImageViewer );
     DebugImageDisplaySender.SetPromptUser( PromptAfterImageSend );
 #endif
@@ -104,6 +109,9 @@ main( int argc, char * argv[] )
     }
   }
 
+  const BRAINSUtils::ProfilerSession profilerSession( profileOutputFileName );
+  BRAINS_PROFILE_SCOPE( "BRAINSDemonWarp" );
+
   //  bool debug=true;
   if ( command.outputDebug )
   {
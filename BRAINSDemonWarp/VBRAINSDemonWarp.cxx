@@ -37,6 +37,8 @@ main( int argc, char * argv[] )
     BRAINSRegisterAlternateIO();
     const BRAINSUtils::StackPushITKDefaultNumberOfThreads TempDefaultNumberOfThreadsHolder( numberOfThreads );
 #ifdef USE_DebugImageViewer
+    DebugImageDisplaySender.SetShrinkFactor( static_cast< unsigned int >( std::max( debugImageShrinkFactor, 1 ) ) );
+    DebugImageDisplaySender.SetMaxQueueLength( static_cast< unsigned int >( std::max( debugImageMaxQueueLength, 1 ) ) );
     DebugImageDisplaySender.SetEnabled( UseDebugImageViewer );
 #endif
 
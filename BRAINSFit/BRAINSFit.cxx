@@ -21,6 +21,7 @@
 #include "itkExtractImageFilter.h"
 #include "BRAINSCommonLib.h"
 #include "BRAINSThreadControl.h"
+#include "BRAINSProfiler.h"
 #include "BRAINSFitHelper.h"
 #include "BRAINSFitCLP.h"
 
@@ -123,6 +124,8 @@ main( int argc, char * argv[] )
   using GenericTransformType = itk::Transform< double, 3, 3 >;
 
   const BRAINSUtils::StackPushITKDefaultNumberOfThreads TempDefaultNumberOfThreadsHolder( numberOfThreads );
+  const BRAINSUtils::ProfilerSession                    profilerSession( profileOutput );
+  BRAINS_PROFILE_SCOPE( "BRAINSFit" );
   if ( debugLevel > 1 )
   {
     std::cout << "Number Of Threads used: " << numberOfThreads << std::endl;
@@ -164,6 +167,12 @@ main( int argc, char * argv[] )
       }
     }
   }
+  if ( numberOfBSplineGridLevels < 1 )
+  {
+    std::cout << "numberOfBSplineGridLevels = " << numberOfBSplineGridLevels
+              << " is invalid.  At least one BSpline grid level is required." << std::endl;
+    return EXIT_FAILURE;
+  }
 
   std::vector< std::string > localTransformType;
   // See if the individual boolean registration options are being used.  If any
@@ -489,6 +498,7 @@ main( int argc, char * argv[] )
     myHelper->SetCostFunctionConvergenceFactor( costFunctionConvergenceFactor );
     myHelper->SetProjectedGradientTolerance( projectedGradientTolerance );
     myHelper->SetMaxBSplineDisplacement( maxBSplineDisplacement );
+    myHelper->SetNumberOfBSplineGridLevels( numberOfBSplineGridLevels );
     myHelper->SetDisplayDeformedImage( UseDebugImageViewer );
     myHelper->SetPromptUserAfterDisplay( PromptAfterImageSend );
     myHelper->SetDebugLevel( debugLevel );
@@ -510,6 +520,7 @@ main( int argc, char * argv[] )
     }
     try
     {
+      BRAINS_PROFILE_SCOPE( "Register" );
       myHelper->Update();
     }
     catch ( itk::ExceptionObject & err )
@@ -544,6 +555,7 @@ main( int argc, char * argv[] )
       using VectorPixelType = itk::Vector< VectorComponentType, 3 >;
       using DisplacementFieldType = itk::Image< VectorPixelType, 3 >;
 
+      BRAINS_PROFILE_SCOPE( "ResampleOutputVolume" );
       resampledImage = GenericTransformImage< MovingVolumeType, FixedVolumeType, DisplacementFieldType >(
         preprocessedMovingVolume,
         extractFixedVolume,
@@ -585,6 +597,7 @@ main( int argc, char * argv[] )
 
   if ( outputVolume.size() > 0 )
   {
+    BRAINS_PROFILE_SCOPE( "WriteOutputVolume" );
     //      std::cout << "=========== resampledImage :\n" <<
     // resampledImage->GetDirection() << std::endl;
     // Set in PARSEARGS const bool scaleOutputValues=false;//INFO: Make this a
@@ -27,19 +27,13 @@ Minimal Input Example:
 =========================================================================*/
 
 #include "BRAINSMush.h"
+#include "BRAINSMushBitPackedMask.h"
 #include "BRAINSMushCLP.h"
 #include "BRAINSThreadControl.h"
-#include "itkBinaryDilateImageFilter.h"
-#include "itkBinaryErodeImageFilter.h"
-#include "itkBinaryThresholdImageFilter.h"
-#include "itkConnectedComponentImageFilter.h"
-#include "itkConnectedThresholdImageFilter.h"
+#include "itkCompensatedSummation.h"
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 #include "itkImageRegionIterator.h"
-#include "itkLabelStatisticsImageFilter.h"
-#include "itkRelabelComponentImageFilter.h"
-#include "itkThresholdImageFilter.h"
 
 #include "itkLargestForegroundFilledMaskImageFilter.h"
 
@@ -164,6 +158,110 @@ main( int argc, char ** argv )
   // End of Output
 }
 
+namespace
+{
+/** Voxels of image with lower <= value <= upper, as itk::BinaryThresholdImageFilter. */
+template < typename TImage >
+BitPackedMask
+ThresholdToBitPackedMask( const TImage * image, const typename TImage::PixelType lower,
+                          const typename TImage::PixelType upper )
+{
+  const MaskImageType::SizeType size = image->GetBufferedRegion().GetSize();
+  BitPackedMask                 mask( size );
+  const typename TImage::PixelType * const buffer = image->GetBufferPointer();
+
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  threader->ParallelizeArray( 0,
+                              size[2],
+                              [&]( const itk::SizeValueType z ) {
+                                for ( itk::SizeValueType y = 0; y < size[1]; ++y )
+                                {
+                                  const typename TImage::PixelType * line = buffer + ( z * size[1] + y ) * size[0];
+                                  BitPackedMask::WordType *           row = mask.GetRow( y, z );
+                                  for ( itk::SizeValueType x = 0; x < size[0]; ++x )
+                                  {
+                                    if ( lower <= line[x] && line[x] <= upper )
+                                    {
+                                      row[x / BitPackedMask::WordBits] |= BitPackedMask::WordType( 1 )
+                                                                         << ( x % BitPackedMask::WordBits );
+                                    }
+                                  }
+                                }
+                              },
+                              nullptr );
+  return mask;
+}
+
+/** A 0/1 mask image on the grid of referenceImage. */
+MaskImageType::Pointer
+BitPackedMaskToImage( const BitPackedMask & mask, const ImageType * referenceImage )
+{
+  MaskImageType::Pointer maskImage = MaskImageType::New();
+  maskImage->CopyInformation( referenceImage );
+  maskImage->SetRegions( referenceImage->GetBufferedRegion() );
+  maskImage->Allocate();
+
+  const MaskImageType::SizeType size = mask.GetSize();
+  MaskPixelType * const         buffer = maskImage->GetBufferPointer();
+
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  threader->ParallelizeArray( 0,
+                              size[2],
+                              [&]( const itk::SizeValueType z ) {
+                                for ( itk::SizeValueType y = 0; y < size[1]; ++y )
+                                {
+                                  MaskPixelType * line = buffer + ( z * size[1] + y ) * size[0];
+                                  for ( itk::SizeValueType x = 0; x < size[0]; ++x )
+                                  {
+                                    line[x] = mask.GetBit( x, y, z ) ? 1 : 0;
+                                  }
+                                }
+                              },
+                              nullptr );
+  return maskImage;
+}
+
+/** Mean of image over the voxels of mask, 0 for an empty mask. */
+double
+MeanInsideBitPackedMask( const ImageType * image, const BitPackedMask & mask )
+{
+  const MaskImageType::SizeType size = mask.GetSize();
+  const PixelType * const       buffer = image->GetBufferPointer();
+
+  using CompensatedSummationType = itk::CompensatedSummation< double >;
+  std::vector< CompensatedSummationType > sliceSums( size[2] );
+  std::vector< itk::SizeValueType >       sliceCounts( size[2], 0 );
+
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  threader->ParallelizeArray( 0,
+                              size[2],
+                              [&]( const itk::SizeValueType z ) {
+                                for ( itk::SizeValueType y = 0; y < size[1]; ++y )
+                                {
+                                  const PixelType * line = buffer + ( z * size[1] + y ) * size[0];
+                                  for ( itk::SizeValueType x = 0; x < size[0]; ++x )
+                                  {
+                                    if ( mask.GetBit( x, y, z ) )
+                                    {
+                                      sliceSums[z] += line[x];
+                                      ++sliceCounts[z];
+                                    }
+                                  }
+                                }
+                              },
+                              nullptr );
+
+  CompensatedSummationType sum;
+  itk::SizeValueType       count = 0;
+  for ( itk::SizeValueType z = 0; z < size[2]; ++z )
+  {
+    sum += sliceSums[z].GetSum();
+    count += sliceCounts[z];
+  }
+  return ( count == 0 ) ? 0.0 : sum.GetSum() / count;
+}
+} // namespace
+
 void
 GenerateBrainVolume( ImageType::Pointer & firstImage, ImageType::Pointer & secondImage,
                      MaskImageType::Pointer & maskImage, std::string inputMaskVolume, double desiredMean,
@@ -270,85 +368,15 @@ GenerateBrainVolume( ImageType::Pointer & firstImage, ImageType::Pointer & secon
   else
   {
     /* ------------------------------------------------------------------------------------
-     * Binary erosion to generate initial brain mask
-     */
-
-    /* ------------------------------------------------------------------------------------
-     * Perform binary threshold on image
+     * Obtain mean of image over the brain core (label 1 of the mask); calculate
+     * lower and upper bounds.
+     *
+     * NOTE: This used to erode the thresholded mask by 7 voxels first, but with
+     * the default erode value (the maximum of the pixel type) that erosion never
+     * changed a 0/1 mask, so the mean is taken over the mask directly.
      */
-    std::cout << "---------------------------------------------------" << std::endl;
-    std::cout << "Performing Initial Binary Threshold..." << std::endl;
-    std::cout << "---------------------------------------------------" << std::endl << std::endl;
-    using BinaryThresholdMaskFilterType = itk::BinaryThresholdImageFilter< MaskImageType, MaskImageType >;
-    BinaryThresholdMaskFilterType::Pointer threshToBrainCoreMask = BinaryThresholdMaskFilterType::New();
-    threshToBrainCoreMask->SetInput( maskImage );
-    threshToBrainCoreMask->SetLowerThreshold( 1 );
-    threshToBrainCoreMask->SetUpperThreshold( 1 );
-    threshToBrainCoreMask->SetInsideValue( 1 );
-    threshToBrainCoreMask->SetOutsideValue( 0 );
-
-    try
-    {
-      threshToBrainCoreMask->Update();
-    }
-    catch ( itk::ExceptionObject & excp )
-    {
-      std::cerr << "Exception caught ! " << std::endl;
-      std::cerr << excp << std::endl;
-      // return EXIT_FAILURE;
-    }
-
-    using binaryErodeFilterType = itk::BinaryErodeImageFilter< MaskImageType, MaskImageType, StructuringElementType >;
-
-    int erosionValue = 7;
-    std::cout << "---------------------------------------------------" << std::endl;
-    std::cout << "Beginning initial erosion..." << std::endl;
-    std::cout << "Eroding by: " << erosionValue << std::endl;
-    std::cout << "---------------------------------------------------" << std::endl << std::endl;
-
-    binaryErodeFilterType::Pointer initialMaskImage = binaryErodeFilterType::New();
-
-    StructuringElementType structuringElement;
-    structuringElement.SetRadius( erosionValue );
-    structuringElement.CreateStructuringElement();
-    initialMaskImage->SetKernel( structuringElement );
-    initialMaskImage->SetInput( threshToBrainCoreMask->GetOutput() );
-
-    // Templating requires different writer to output mask images (type short
-    // for initialMaskImage vs type float for mixtureImage)
-
-    try
-    {
-      initialMaskImage->Update();
-    }
-    catch ( itk::ExceptionObject & exp )
-    {
-      std::cerr << "Exception caught !" << std::endl;
-      std::cerr << exp << std::endl;
-    }
-
-    /* ------------------------------------------------------------------------------------
-     * Obtain mean of image; calculate lower and upper bounds
-     */
-
-    using LabelFilterType = itk::LabelStatisticsImageFilter< ImageType, MaskImageType >;
-    LabelFilterType::Pointer labelFilter = LabelFilterType::New();
-    labelFilter->SetInput( mixtureImage );
-    labelFilter->SetLabelInput( initialMaskImage->GetOutput() );
-
-    try
-    {
-      labelFilter->Update();
-    }
-    catch ( itk::ExceptionObject & excp )
-    {
-      std::cerr << "Exception caught ! " << std::endl;
-      std::cerr << excp << std::endl;
-      // return EXIT_FAILURE;
-    }
-
-    // using StatisticRealType = LabelFilterType::RealType;
-    mean = labelFilter->GetMean( 1 );
+    const BitPackedMask brainCoreMask = ThresholdToBitPackedMask< MaskImageType >( maskImage, 1, 1 );
+    mean = MeanInsideBitPackedMask( mixtureImage, brainCoreMask );
 
     // these definitions use magic numbers obtained through manual thresholding
     // and experimentation
@@ -364,35 +392,10 @@ GenerateBrainVolume( ImageType::Pointer & firstImage, ImageType::Pointer & secon
             << std::endl;
 
   /* ------------------------------------------------------------------------------------
-   * Perform binary threshold on image
+   * The mask refinement (threshold, erode, largest connected component,
+   * dilate) runs on bit packed masks, one bit per voxel, instead of a chain of
+   * full size short images.
    */
-  std::cout << "---------------------------------------------------" << std::endl;
-  std::cout << "Performing Initial Binary Threshold..." << std::endl;
-  std::cout << "---------------------------------------------------" << std::endl << std::endl;
-  using BinaryThresholdFilterType = itk::BinaryThresholdImageFilter< ImageType, MaskImageType >;
-  BinaryThresholdFilterType::Pointer threshToHeadMask = BinaryThresholdFilterType::New();
-  threshToHeadMask->SetInput( mixtureImage );
-  threshToHeadMask->SetLowerThreshold( lower );
-  threshToHeadMask->SetUpperThreshold( upper );
-  threshToHeadMask->SetInsideValue( 1 );
-  threshToHeadMask->SetOutsideValue( 0 );
-
-  try
-  {
-    threshToHeadMask->Update();
-  }
-  catch ( itk::ExceptionObject & excp )
-  {
-    std::cerr << "Exception caught ! " << std::endl;
-    std::cerr << excp << std::endl;
-    // return EXIT_FAILURE;
-  }
-
-  using BinaryDilateFilterType = itk::BinaryDilateImageFilter< MaskImageType, MaskImageType, StructuringElementType >;
-
-  using BinaryImageErodeFilterType =
-    itk::BinaryErodeImageFilter< MaskImageType, MaskImageType, StructuringElementType >;
-
   double ClosingSize = 6;
 
   const ImageType::SpacingType & spacing = mixtureImage->GetSpacing();
@@ -405,66 +408,23 @@ GenerateBrainVolume( ImageType::Pointer & firstImage, ImageType::Pointer & secon
   int          MinimumObjectSize = static_cast< int >( ClosingElementVolume / VoxelVolume );
 
   // Define binary erosion and dilation structuring element
-  StructuringElementType           ball;
   StructuringElementType::SizeType ballSize;
   for ( int d = 0; d < 3; d++ )
   {
     ballSize[d] = static_cast< int >( ( 0.5 * ClosingSize ) / spacing[d] );
   }
-  ball.SetRadius( ballSize );
-  ball.CreateStructuringElement();
-
-  /* ------------------------------------------------------------------------------------
-   * Binary erosion
-   */
-  std::cout << "---------------------------------------------------" << std::endl;
-  std::cout << "Eroding largest filled region..." << std::endl;
-  std::cout << "---------------------------------------------------" << std::endl << std::endl;
-  BinaryImageErodeFilterType::Pointer binaryErodeFilter = BinaryImageErodeFilterType::New();
-  binaryErodeFilter->SetErodeValue( 1 );
-  binaryErodeFilter->SetKernel( ball );
-
-  /* ------------------------------------------------------------------------------------
-   * Update the ITK pipeline
-   */
-  try
-  {
-    MaskImageType::Pointer thresholdOutput = threshToHeadMask->GetOutput();
-    thresholdOutput->DisconnectPipeline();
-
-    binaryErodeFilter->SetInput( thresholdOutput );
-    binaryErodeFilter->Update();
-  }
-  catch ( itk::ExceptionObject & exp )
-  {
-    std::cerr << "Exception caught !" << std::endl;
-    std::cerr << exp << std::endl;
-  }
 
   /* ------------------------------------------------------------------------------------
-   * Perform binary threshold on image
+   * Perform binary threshold on image and erode it
    */
   std::cout << "---------------------------------------------------" << std::endl;
-  std::cout << "Performing Special Binary Threshold..." << std::endl;
+  std::cout << "Thresholding and eroding..." << std::endl;
   std::cout << "---------------------------------------------------" << std::endl << std::endl;
-  using BinaryThresholdMaskFilterType = itk::BinaryThresholdImageFilter< MaskImageType, MaskImageType >;
-  BinaryThresholdMaskFilterType::Pointer threshToBrainCoreMask = BinaryThresholdMaskFilterType::New();
-  threshToBrainCoreMask->SetInput( binaryErodeFilter->GetOutput() );
-  threshToBrainCoreMask->SetLowerThreshold( 1 );
-  threshToBrainCoreMask->SetUpperThreshold( 1 );
-  threshToBrainCoreMask->SetInsideValue( 1 );
-  threshToBrainCoreMask->SetOutsideValue( 0 );
-
-  try
-  {
-    threshToBrainCoreMask->Update();
-  }
-  catch ( itk::ExceptionObject & excp )
-  {
-    std::cerr << "Exception caught ! " << std::endl;
-    std::cerr << excp << std::endl;
-    // return EXIT_FAILURE;
-  }
+  BitPackedMask brainMask = BitPackedMorphology(
+    ThresholdToBitPackedMask< ImageType >(
+      mixtureImage, static_cast< PixelType >( lower ), static_cast< PixelType >( upper ) ),
+    ballSize,
+    true );
 
   /* ------------------------------------------------------------------------------------
    * Obtain Largest region filled mask
@@ -472,64 +432,13 @@ GenerateBrainVolume( ImageType::Pointer & firstImage, ImageType::Pointer & secon
   std::cout << "---------------------------------------------------" << std::endl;
   std::cout << "Obtaining Largest Filled Region..." << std::endl;
   std::cout << "---------------------------------------------------" << std::endl << std::endl;
-
-  using ConnectedComponentFilterType = itk::ConnectedComponentImageFilter< MaskImageType, MaskImageType >;
-  using RelabelComponentFilterType = itk::RelabelComponentImageFilter< MaskImageType, MaskImageType >;
-  using ThresholdFilterType = itk::ThresholdImageFilter< MaskImageType >;
-
-  ConnectedComponentFilterType::Pointer filter = ConnectedComponentFilterType::New();
-  RelabelComponentFilterType::Pointer   relabel = RelabelComponentFilterType::New();
-
-  ThresholdFilterType::Pointer LargestFilter = ThresholdFilterType::New();
-  LargestFilter->SetOutsideValue( 0 );
-  LargestFilter->ThresholdAbove( 1 );
-  LargestFilter->ThresholdBelow( 1 );
-
-  /* ------------------------------------------------------------------------------------
-   * Update the ITK pipeline
-   */
-
-  try
+  if ( MinimumObjectSize > 0 )
   {
-    {
-      MaskImageType::Pointer threshToBrainCoreOutput = threshToBrainCoreMask->GetOutput();
-      threshToBrainCoreOutput->DisconnectPipeline();
-
-      filter->SetInput( threshToBrainCoreOutput ); // ConnectedComponentFilter
-      filter->Update();
-    }
-
-    {
-      MaskImageType::Pointer filterOutput = filter->GetOutput();
-      filterOutput->DisconnectPipeline();
-
-      relabel->SetInput( filterOutput );
-
-      if ( MinimumObjectSize > 0 )
-      {
-        relabel->SetMinimumObjectSize( MinimumObjectSize );
-        std::cerr << "MinimumObjectSize: " << MinimumObjectSize << std::endl;
-      }
-
-      relabel->Update();
-
-      unsigned short numObjects = relabel->GetNumberOfObjects();
-      std::cout << "Removed " << numObjects - 1 << " smaller objects." << std::endl << std::endl;
-    }
-
-    {
-      MaskImageType::Pointer relabelOutput = relabel->GetOutput();
-      relabelOutput->DisconnectPipeline();
-
-      LargestFilter->SetInput( relabelOutput );
-      LargestFilter->Update();
-    }
-  }
-  catch ( itk::ExceptionObject & exp )
-  {
-    std::cerr << "Exception caught !" << std::endl;
-    std::cerr << exp << std::endl;
+    std::cerr << "MinimumObjectSize: " << MinimumObjectSize << std::endl;
   }
+  std::size_t numObjects = 0;
+  brainMask = BitPackedLargestComponent( brainMask, std::max( MinimumObjectSize, 0 ), numObjects );
+  std::cout << "Removed " << static_cast< int >( numObjects ) - 1 << " smaller objects." << std::endl << std::endl;
 
   /* ------------------------------------------------------------------------------------
    * Binary dilation
@@ -537,53 +446,9 @@ GenerateBrainVolume( ImageType::Pointer & firstImage, ImageType::Pointer & secon
   std::cout << "---------------------------------------------------" << std::endl;
   std::cout << "Dilating largest filled region..." << std::endl;
   std::cout << "---------------------------------------------------" << std::endl << std::endl;
-  BinaryDilateFilterType::Pointer binaryDilateFilter = BinaryDilateFilterType::New();
-  binaryDilateFilter->SetDilateValue( 1 );
-  binaryDilateFilter->SetKernel( ball );
-
-  /* ------------------------------------------------------------------------------------
-   * Update the ITK pipeline
-   */
-  try
-  {
-    MaskImageType::Pointer largestFilterOutput = LargestFilter->GetOutput();
-    largestFilterOutput->DisconnectPipeline();
-
-    binaryDilateFilter->SetInput( largestFilterOutput );
-    binaryDilateFilter->Update();
-  }
-  catch ( itk::ExceptionObject & exp )
-  {
-    std::cerr << "Exception caught !" << std::endl;
-    std::cerr << exp << std::endl;
-  }
-
-  /* ------------------------------------------------------------------------------------
-   * Perform binary threshold on image
-   */
-  std::cout << "---------------------------------------------------" << std::endl;
-  std::cout << "Performing Special Binary Threshold..." << std::endl;
-  std::cout << "---------------------------------------------------" << std::endl << std::endl;
-  BinaryThresholdMaskFilterType::Pointer threshToClosureMask = BinaryThresholdMaskFilterType::New();
-  threshToClosureMask->SetInput( binaryDilateFilter->GetOutput() );
-  threshToClosureMask->SetLowerThreshold( 1 );
-  threshToClosureMask->SetUpperThreshold( 1 );
-  threshToClosureMask->SetInsideValue( 1 );
-  threshToClosureMask->SetOutsideValue( 0 );
-
-  try
-  {
-    threshToClosureMask->Update();
-  }
-  catch ( itk::ExceptionObject & excp )
-  {
-    std::cerr << "Exception caught ! " << std::endl;
-    std::cerr << excp << std::endl;
-    // return EXIT_FAILURE;
-  }
+  brainMask = BitPackedMorphology( brainMask, ballSize, false );
 
-  MaskImageType::Pointer dilatedOutput = threshToClosureMask->GetOutput();
-  dilatedOutput->DisconnectPipeline();
+  MaskImageType::Pointer dilatedOutput = BitPackedMaskToImage( brainMask, mixtureImage );
 
   // resultImage = FindLargestForgroundFilledMask<MaskImageType>( dilatedOutput,
   //                                                               0,
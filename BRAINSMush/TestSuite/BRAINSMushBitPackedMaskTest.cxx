@@ -0,0 +1,222 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "../BRAINSMushBitPackedMask.h"
+
+#include "itkBinaryBallStructuringElement.h"
+#include "itkBinaryDilateImageFilter.h"
+#include "itkBinaryErodeImageFilter.h"
+#include "itkBinaryThresholdImageFilter.h"
+#include "itkConnectedComponentImageFilter.h"
+#include "itkImage.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkRelabelComponentImageFilter.h"
+
+#include <cstdlib>
+#include <iostream>
+
+// Compare the bit-packed erosion, dilation and largest component of
+// BRAINSMush against the ITK binary morphology and connected component
+// filters they replace, on a small mask whose rows span two 64 bit words.
+
+namespace
+{
+using MaskImageType = itk::Image< signed short, 3 >;
+using LabelImageType = itk::Image< unsigned int, 3 >;
+using StructuringElementType = itk::BinaryBallStructuringElement< MaskImageType::PixelType, 3 >;
+
+/** Three blocks of different sizes, a thin bar and a few isolated voxels. */
+MaskImageType::Pointer
+CreateMaskImage()
+{
+  MaskImageType::SizeType size;
+  size[0] = 71;
+  size[1] = 19;
+  size[2] = 13;
+  MaskImageType::Pointer image = MaskImageType::New();
+  image->SetRegions( size );
+  image->Allocate();
+  image->FillBuffer( 0 );
+
+  const auto fillBox = [&image]( const unsigned int x0, const unsigned int x1, const unsigned int y0,
+                                 const unsigned int y1, const unsigned int z0, const unsigned int z1 ) {
+    MaskImageType::IndexType index;
+    for ( index[2] = z0; index[2] <= static_cast< itk::IndexValueType >( z1 ); ++index[2] )
+    {
+      for ( index[1] = y0; index[1] <= static_cast< itk::IndexValueType >( y1 ); ++index[1] )
+      {
+        for ( index[0] = x0; index[0] <= static_cast< itk::IndexValueType >( x1 ); ++index[0] )
+        {
+          image->SetPixel( index, 1 );
+        }
+      }
+    }
+  };
+  // the largest block crosses the word boundary at x = 64 and touches the border
+  fillBox( 50, 70, 2, 14, 0, 9 );
+  fillBox( 3, 20, 3, 12, 2, 10 );
+  fillBox( 25, 32, 10, 18, 4, 8 );
+  fillBox( 0, 45, 16, 16, 11, 11 );
+  fillBox( 40, 40, 5, 5, 5, 5 );
+  fillBox( 63, 64, 17, 17, 12, 12 );
+  return image;
+}
+
+BitPackedMask
+ToBitPackedMask( const MaskImageType * image )
+{
+  BitPackedMask                                           mask( image->GetBufferedRegion().GetSize() );
+  itk::ImageRegionConstIteratorWithIndex< MaskImageType > it( image, image->GetBufferedRegion() );
+  for ( ; !it.IsAtEnd(); ++it )
+  {
+    if ( it.Get() != 0 )
+    {
+      const MaskImageType::IndexType index = it.GetIndex();
+      mask.SetBit( index[0], index[1], index[2] );
+    }
+  }
+  return mask;
+}
+
+bool
+CompareMasks( const BitPackedMask & mask, const MaskImageType * image, const char * name )
+{
+  unsigned int                                            mismatches = 0;
+  itk::ImageRegionConstIteratorWithIndex< MaskImageType > it( image, image->GetBufferedRegion() );
+  for ( ; !it.IsAtEnd(); ++it )
+  {
+    const MaskImageType::IndexType index = it.GetIndex();
+    if ( mask.GetBit( index[0], index[1], index[2] ) != ( it.Get() != 0 ) )
+    {
+      ++mismatches;
+    }
+  }
+  if ( mismatches != 0 )
+  {
+    std::cerr << name << ": " << mismatches << " voxels differ from the ITK filter" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool
+TestMorphology( const MaskImageType::Pointer & image, const StructuringElementType::SizeType & radius )
+{
+  StructuringElementType ball;
+  ball.SetRadius( radius );
+  ball.CreateStructuringElement();
+
+  using ErodeFilterType = itk::BinaryErodeImageFilter< MaskImageType, MaskImageType, StructuringElementType >;
+  ErodeFilterType::Pointer erode = ErodeFilterType::New();
+  erode->SetInput( image );
+  erode->SetErodeValue( 1 );
+  erode->SetKernel( ball );
+  erode->Update();
+
+  using DilateFilterType = itk::BinaryDilateImageFilter< MaskImageType, MaskImageType, StructuringElementType >;
+  DilateFilterType::Pointer dilate = DilateFilterType::New();
+  dilate->SetInput( image );
+  dilate->SetDilateValue( 1 );
+  dilate->SetKernel( ball );
+  dilate->Update();
+
+  const BitPackedMask mask = ToBitPackedMask( image );
+  bool                passed = true;
+  passed &= CompareMasks( BitPackedMorphology( mask, radius, true ), erode->GetOutput(), "erosion" );
+  passed &= CompareMasks( BitPackedMorphology( mask, radius, false ), dilate->GetOutput(), "dilation" );
+  if ( !passed )
+  {
+    std::cerr << "  with radius " << radius << std::endl;
+  }
+  return passed;
+}
+
+bool
+TestLargestComponent( const MaskImageType::Pointer & image, const std::size_t minimumObjectSize )
+{
+  using ConnectedComponentFilterType = itk::ConnectedComponentImageFilter< MaskImageType, LabelImageType >;
+  ConnectedComponentFilterType::Pointer connected = ConnectedComponentFilterType::New();
+  connected->SetInput( image );
+  connected->FullyConnectedOff();
+
+  using RelabelFilterType = itk::RelabelComponentImageFilter< LabelImageType, LabelImageType >;
+  RelabelFilterType::Pointer relabel = RelabelFilterType::New();
+  relabel->SetInput( connected->GetOutput() );
+  relabel->SetMinimumObjectSize( minimumObjectSize );
+
+  using ThresholdFilterType = itk::BinaryThresholdImageFilter< LabelImageType, MaskImageType >;
+  ThresholdFilterType::Pointer threshold = ThresholdFilterType::New();
+  threshold->SetInput( relabel->GetOutput() );
+  threshold->SetLowerThreshold( 1 );
+  threshold->SetUpperThreshold( 1 );
+  threshold->SetInsideValue( 1 );
+  threshold->SetOutsideValue( 0 );
+  threshold->Update();
+
+  std::size_t         numberOfObjects = 0;
+  const BitPackedMask largest =
+    BitPackedLargestComponent( ToBitPackedMask( image ), minimumObjectSize, numberOfObjects );
+
+  bool passed = CompareMasks( largest, threshold->GetOutput(), "largest component" );
+  if ( numberOfObjects != relabel->GetNumberOfObjects() )
+  {
+    std::cerr << "largest component: " << numberOfObjects << " objects, expected " << relabel->GetNumberOfObjects()
+              << std::endl;
+    passed = false;
+  }
+  if ( !passed )
+  {
+    std::cerr << "  with minimum object size " << minimumObjectSize << std::endl;
+  }
+  return passed;
+}
+} // namespace
+
+int
+main( int, char *[] )
+{
+  const MaskImageType::Pointer image = CreateMaskImage();
+
+  bool                             passed = true;
+  StructuringElementType::SizeType radius;
+  radius.Fill( 0 );
+  passed &= TestMorphology( image, radius );
+  radius.Fill( 1 );
+  passed &= TestMorphology( image, radius );
+  radius[0] = 3;
+  radius[1] = 2;
+  radius[2] = 1;
+  passed &= TestMorphology( image, radius );
+  // wider than a word shift of the packed rows
+  radius[0] = 5;
+  radius[1] = 4;
+  radius[2] = 3;
+  passed &= TestMorphology( image, radius );
+
+  passed &= TestLargestComponent( image, 0 );
+  passed &= TestLargestComponent( image, 100 );
+  // larger than every component: the output is empty
+  passed &= TestLargestComponent( image, 100000 );
+
+  if ( !passed )
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "BitPackedMask matches the ITK binary filters" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -145,7 +145,9 @@ public:
   unsigned int
   GetNumberOfValues() const override;
 
-  /** Initialize */
+  /** Collect the statistics of the voxels of label in one multi-threaded
+   * pass.  Sums are compensated, and per slice partial sums are reduced in
+   * slice order, so the statistics do not depend on the number of threads. */
   void
   Initialize( short label );
 
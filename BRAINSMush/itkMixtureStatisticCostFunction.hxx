@@ -36,7 +36,10 @@
 #define _itkMixtureStatisticCostFunction_hxx
 
 #include "itkMixtureStatisticCostFunction.h"
+#include "itkCompensatedSummation.h"
+#include "itkMultiThreaderBase.h"
 #include <cassert>
+#include <vector>
 
 namespace itk
 {
@@ -112,38 +115,82 @@ MixtureStatisticCostFunction< TFirstImage, TSecondImage >::Initialize( short lab
   m_MeasurePointer->SetSize( 2 );
 
   // measure each image and each squared image within the mask
-
-  using FirstConstIteratorType = typename itk::ImageRegionConstIterator< typename Self::FirstImageType >;
-  FirstConstIteratorType firstIt( m_FirstImage, m_FirstImage->GetRequestedRegion() );
-
-  using SecondConstIteratorType = typename itk::ImageRegionConstIterator< typename Self::SecondImageType >;
-  SecondConstIteratorType secondIt( m_SecondImage, m_SecondImage->GetRequestedRegion() );
-
-  using MaskConstIteratorType = typename itk::ImageRegionConstIterator< typename Self::ImageMaskType >;
-  MaskConstIteratorType maskIt( m_ImageMask, m_ImageMask->GetRequestedRegion() );
-
-  m_NumberOfMaskVoxels = 0.0;
-  m_SumOfFirstMaskVoxels = 0.0;
-  m_SumOfSecondMaskVoxels = 0.0;
-  m_SumSquaresOfFirstMaskVoxels = 0.0;
-  m_SumSquaresOfSecondMaskVoxels = 0.0;
-  m_SumOfFirstTimesSecondMaskVoxels = 0.0;
-  for ( maskIt.GoToBegin(), firstIt.GoToBegin(), secondIt.GoToBegin(); !maskIt.IsAtEnd();
-        ++maskIt, ++firstIt, ++secondIt )
+  using CompensatedSummationType = CompensatedSummation< double >;
+  struct SliceSumsType
+  {
+    SizeValueType            numberOfVoxels{ 0 };
+    CompensatedSummationType sumOfFirst;
+    CompensatedSummationType sumOfSecond;
+    CompensatedSummationType sumSquaresOfFirst;
+    CompensatedSummationType sumSquaresOfSecond;
+    CompensatedSummationType sumOfFirstTimesSecond;
+  };
+
+  const typename FirstImageType::RegionType firstRegion = m_FirstImage->GetRequestedRegion();
+  const SecondImageRegionType               secondRegion = m_SecondImage->GetRequestedRegion();
+  const typename ImageMaskType::RegionType  maskRegion = m_ImageMask->GetRequestedRegion();
+
+  // One work item per slice of the slowest varying dimension.
+  constexpr unsigned int       SliceDimension = ImageMaskType::ImageDimension - 1;
+  const SizeValueType          numberOfSlices = maskRegion.GetSize( SliceDimension );
+  std::vector< SliceSumsType > sliceSums( numberOfSlices );
+
+  MultiThreaderBase::Pointer threader = MultiThreaderBase::New();
+  threader->ParallelizeArray(
+    0,
+    numberOfSlices,
+    [&]( const SizeValueType slice ) {
+      typename FirstImageType::RegionType firstSlice = firstRegion;
+      firstSlice.SetIndex( SliceDimension, firstRegion.GetIndex( SliceDimension ) + slice );
+      firstSlice.SetSize( SliceDimension, 1 );
+      SecondImageRegionType secondSlice = secondRegion;
+      secondSlice.SetIndex( SliceDimension, secondRegion.GetIndex( SliceDimension ) + slice );
+      secondSlice.SetSize( SliceDimension, 1 );
+      typename ImageMaskType::RegionType maskSlice = maskRegion;
+      maskSlice.SetIndex( SliceDimension, maskRegion.GetIndex( SliceDimension ) + slice );
+      maskSlice.SetSize( SliceDimension, 1 );
+
+      ImageRegionConstIterator< FirstImageType >  firstIt( m_FirstImage, firstSlice );
+      ImageRegionConstIterator< SecondImageType > secondIt( m_SecondImage, secondSlice );
+      ImageRegionConstIterator< ImageMaskType >   maskIt( m_ImageMask, maskSlice );
+
+      SliceSumsType & sums = sliceSums[slice];
+      for ( ; !maskIt.IsAtEnd(); ++maskIt, ++firstIt, ++secondIt )
+      {
+        if ( maskIt.Get() == label )
+        {
+          const double firstValue = firstIt.Get();
+          const double secondValue = secondIt.Get();
+
+          sums.numberOfVoxels += 1;
+          sums.sumOfFirst += firstValue;
+          sums.sumOfSecond += secondValue;
+          sums.sumSquaresOfFirst += firstValue * firstValue;
+          sums.sumSquaresOfSecond += secondValue * secondValue;
+          sums.sumOfFirstTimesSecond += firstValue * secondValue;
+        }
+      }
+    },
+    nullptr );
+
+  // Reduce in slice order so that the result does not depend on the threading.
+  SliceSumsType totals;
+  for ( const SliceSumsType & sums : sliceSums )
   {
-    if ( maskIt.Get() == label )
-    {
-      FirstImagePixelType  firstValue = firstIt.Get();
-      SecondImagePixelType secondValue = secondIt.Get();
-
-      m_NumberOfMaskVoxels += 1.0;
-      m_SumOfFirstMaskVoxels += firstValue;
-      m_SumOfSecondMaskVoxels += secondValue;
-      m_SumSquaresOfFirstMaskVoxels += firstValue * firstValue;
-      m_SumSquaresOfSecondMaskVoxels += secondValue * secondValue;
-      m_SumOfFirstTimesSecondMaskVoxels += firstValue * secondValue;
-    }
+    totals.numberOfVoxels += sums.numberOfVoxels;
+    totals.sumOfFirst += sums.sumOfFirst.GetSum();
+    totals.sumOfSecond += sums.sumOfSecond.GetSum();
+    totals.sumSquaresOfFirst += sums.sumSquaresOfFirst.GetSum();
+    totals.sumSquaresOfSecond += sums.sumSquaresOfSecond.GetSum();
+    totals.sumOfFirstTimesSecond += sums.sumOfFirstTimesSecond.GetSum();
   }
+
+  m_NumberOfMaskVoxels = static_cast< double >( totals.numberOfVoxels );
+  m_SumOfFirstMaskVoxels = totals.sumOfFirst.GetSum();
+  m_SumOfSecondMaskVoxels = totals.sumOfSecond.GetSum();
+  m_SumSquaresOfFirstMaskVoxels = totals.sumSquaresOfFirst.GetSum();
+  m_SumSquaresOfSecondMaskVoxels = totals.sumSquaresOfSecond.GetSum();
+  m_SumOfFirstTimesSecondMaskVoxels = totals.sumOfFirstTimesSecond.GetSum();
 }
 
 template < typename TFirstImage, typename TSecondImage >
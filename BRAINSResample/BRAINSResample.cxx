@@ -44,6 +44,7 @@
 #include "GenericTransformImage.h"
 
 #include "TransformToDisplacementField.h"
+#include "TransformDisplacementFieldCache.h"
 #include "itkGridForwardWarpImageFilterNew.h"
 #include "itkBSplineKernelFunction.h"
 
@@ -241,6 +242,28 @@ main( int argc, char * argv[] )
       }
     }
 
+    // Flatten the transform chain into one displacement field on the reference
+    // grid, so that each output voxel costs one field lookup instead of a walk
+    // through every transform in the composite.
+    DisplacementFieldType::Pointer FlattenedDisplacementField;
+    if ( cacheTransformField && useTransform && warpTransform != "Identity" )
+    {
+      if ( interpolationMode == "ResampleInPlace" )
+      {
+        std::cout << "WARNING: cacheTransformField is ignored for ResampleInPlace interpolation." << std::endl;
+      }
+      else
+      {
+        FlattenedDisplacementField = FlattenTransformToDisplacementField< DisplacementFieldType >(
+          genericTransform.GetPointer(),
+          ReferenceImage.GetPointer(),
+          warpTransform,
+          inverseTransform ? "inverse" : "forward",
+          persistTransformFieldCache );
+        genericTransform = MakeDisplacementFieldTransform< DisplacementFieldType >( FlattenedDisplacementField );
+      }
+    }
+
     TBRAINSResampleInternalImageType::Pointer TransformedImage =
       GenericTransformImage< TBRAINSResampleInternalImageType,
                              TBRAINSResampleInternalImageType,
@@ -264,7 +287,12 @@ main( int argc, char * argv[] )
 
       DisplacementFieldType::Pointer DisplacementField;
       // create the grid
-      if ( useTransform )
+      if ( FlattenedDisplacementField.IsNotNull() )
+      {
+        // The flattened field is already sampled on the output grid.
+        DisplacementField = FlattenedDisplacementField;
+      }
+      else if ( useTransform )
       { // HACK:  Need to make handeling of transforms more elegant as is done
         // in BRAINSFitHelper.
         using ConverterType = itk::TransformToDisplacementFieldFilter< DisplacementFieldType, double >;
@@ -0,0 +1,217 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include <itkImage.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkLineIterator.h>
+
+#include "itkGridForwardWarpImageFilterNew.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+constexpr unsigned int Dimension = 3;
+using DisplacementType = itk::Vector< float, Dimension >;
+using DisplacementFieldType = itk::Image< DisplacementType, Dimension >;
+using GridImageType = itk::Image< unsigned char, Dimension >;
+using GridFilterType = itk::GridForwardWarpImageFilterNew< DisplacementFieldType, GridImageType >;
+
+// A smooth field of a few voxels, on an anisotropic grid with a non zero
+// origin, so warped grid lines cross the slab boundaries in both directions.
+static DisplacementFieldType::Pointer
+MakeDisplacementField()
+{
+  DisplacementFieldType::SizeType size;
+  size[0] = 23;
+  size[1] = 19;
+  size[2] = 29;
+  DisplacementFieldType::SpacingType spacing;
+  spacing[0] = 1.0;
+  spacing[1] = 1.5;
+  spacing[2] = 0.75;
+  DisplacementFieldType::PointType origin;
+  origin[0] = -10.0;
+  origin[1] = 4.0;
+  origin[2] = 2.5;
+
+  DisplacementFieldType::Pointer field = DisplacementFieldType::New();
+  field->SetRegions( size );
+  field->SetSpacing( spacing );
+  field->SetOrigin( origin );
+  field->Allocate();
+  for ( itk::ImageRegionIteratorWithIndex< DisplacementFieldType > it( field, field->GetLargestPossibleRegion() );
+        !it.IsAtEnd();
+        ++it )
+  {
+    const DisplacementFieldType::IndexType index = it.GetIndex();
+    DisplacementType                       displacement;
+    displacement[0] = 2.5f * std::sin( 0.3 * index[2] ) * std::cos( 0.2 * index[1] );
+    displacement[1] = 3.0f * std::cos( 0.25 * index[0] + 0.1 * index[2] );
+    displacement[2] = 4.0f * std::sin( 0.2 * index[0] ) * std::sin( 0.35 * index[1] );
+    it.Set( displacement );
+  }
+  return field;
+}
+
+// The single threaded forward warp: draw each visible grid line from its
+// mapped start point to its mapped end point.
+static GridImageType::Pointer
+SerialGridWarp( const DisplacementFieldType * field, const GridFilterType::GridSpacingType & gridSpacing )
+{
+  GridImageType::Pointer output = GridImageType::New();
+  output->SetRegions( field->GetLargestPossibleRegion() );
+  output->CopyInformation( field );
+  output->Allocate();
+  output->FillBuffer( 0 );
+
+  // Displace the physical point of a field index, except along collapsed axes.
+  auto mapIndex = [&]( const DisplacementFieldType::IndexType & index, GridImageType::IndexType & mapped ) -> bool {
+    GridImageType::PointType point;
+    output->TransformIndexToPhysicalPoint( index, point );
+    const DisplacementType displacement = field->GetPixel( index );
+    for ( unsigned int j = 0; j < Dimension; ++j )
+    {
+      if ( gridSpacing[j] != 0 )
+      {
+        point[j] += displacement[j];
+      }
+    }
+    return output->TransformPhysicalPointToIndex( point, mapped );
+  };
+
+  for ( itk::ImageRegionIteratorWithIndex< GridImageType > it( output, output->GetLargestPossibleRegion() );
+        !it.IsAtEnd();
+        ++it )
+  {
+    const GridImageType::IndexType index = it.GetIndex();
+    bool                           onGrid = true;
+    for ( unsigned int dim = 0; dim < Dimension; ++dim )
+    {
+      onGrid = onGrid && ( gridSpacing[dim] == 0 || index[dim] % std::abs( gridSpacing[dim] ) == 0 );
+    }
+    GridImageType::IndexType refIndex;
+    if ( !onGrid || !mapIndex( index, refIndex ) )
+    {
+      continue;
+    }
+    for ( unsigned int dim = 0; dim < Dimension; ++dim )
+    {
+      GridImageType::IndexType nextIndex = index;
+      nextIndex[dim] += gridSpacing[dim];
+      GridImageType::IndexType targetIndex;
+      if ( gridSpacing[dim] <= 0 || !field->GetBufferedRegion().IsInside( nextIndex ) ||
+           !mapIndex( nextIndex, targetIndex ) )
+      {
+        continue;
+      }
+      for ( itk::LineIterator< GridImageType > lineIt( output, refIndex, targetIndex ); !lineIt.IsAtEnd(); ++lineIt )
+      {
+        lineIt.Set( 1 );
+      }
+    }
+  }
+  return output;
+}
+
+static GridImageType::Pointer
+ThreadedGridWarp( const DisplacementFieldType *            field,
+                  const GridFilterType::GridSpacingType & gridSpacing,
+                  const unsigned int                      numberOfWorkUnits )
+{
+  GridFilterType::Pointer filter = GridFilterType::New();
+  filter->SetInput( field );
+  filter->SetGridPixelSpacing( gridSpacing );
+  filter->SetNumberOfWorkUnits( numberOfWorkUnits );
+  filter->Update();
+  return filter->GetOutput();
+}
+
+// Returns the number of pixels that differ, or -1 if the images do not overlap.
+static long
+CountDifferences( const GridImageType * expected, const GridImageType * actual )
+{
+  if ( expected->GetLargestPossibleRegion() != actual->GetLargestPossibleRegion() )
+  {
+    return -1;
+  }
+  long differences = 0;
+  for ( itk::ImageRegionConstIterator< GridImageType > e( expected, expected->GetLargestPossibleRegion() ),
+        a( actual, actual->GetLargestPossibleRegion() );
+        !e.IsAtEnd();
+        ++e, ++a )
+  {
+    differences += ( e.Get() != a.Get() );
+  }
+  return differences;
+}
+
+int
+main( int, char *[] )
+{
+  int failures = 0;
+
+  DisplacementFieldType::Pointer field = MakeDisplacementField();
+
+  // A full 3D grid, and a view with a collapsed y axis and hidden z lines.
+  GridFilterType::GridSpacingType fullGrid;
+  fullGrid.Fill( 4 );
+  GridFilterType::GridSpacingType planeGrid;
+  planeGrid[0] = 3;
+  planeGrid[1] = 0;
+  planeGrid[2] = -5;
+
+  for ( const auto & gridSpacing : { fullGrid, planeGrid } )
+  {
+    GridImageType::Pointer reference = SerialGridWarp( field, gridSpacing );
+
+    long foreground = 0;
+    for ( itk::ImageRegionConstIterator< GridImageType > it( reference, reference->GetLargestPossibleRegion() );
+          !it.IsAtEnd();
+          ++it )
+    {
+      foreground += it.Get();
+    }
+    if ( foreground == 0 )
+    {
+      std::cout << "Grid spacing " << gridSpacing << " draws no lines" << std::endl;
+      ++failures;
+    }
+
+    // One slab per work unit, including more work units than slices.
+    for ( const unsigned int numberOfWorkUnits : { 1u, 2u, 5u, 8u, 64u } )
+    {
+      GridImageType::Pointer threaded = ThreadedGridWarp( field, gridSpacing, numberOfWorkUnits );
+      const long             differences = CountDifferences( reference, threaded );
+      if ( differences != 0 )
+      {
+        std::cout << "Grid spacing " << gridSpacing << " with " << numberOfWorkUnits << " work units differs in "
+                  << differences << " pixels" << std::endl;
+        ++failures;
+      }
+    }
+  }
+
+  if ( failures > 0 )
+  {
+    std::cout << failures << " failures" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
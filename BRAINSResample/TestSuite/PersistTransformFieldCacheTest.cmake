@@ -0,0 +1,61 @@
+#
+# Resample twice through the same composite transform with
+# --persistTransformFieldCache.  The first run must write the flattened
+# field next to the transform, the second run must reuse it, and both
+# runs must produce byte identical output.
+
+# work on a private copy so the cache lands in the build tree and
+# does not survive from a previous ctest run
+file(REMOVE_RECURSE ${TEST_TEMP_DIR})
+file(MAKE_DIRECTORY ${TEST_TEMP_DIR})
+get_filename_component(transform_name ${TEST_TRANSFORM} NAME)
+set(cached_transform ${TEST_TEMP_DIR}/${transform_name})
+configure_file(${TEST_TRANSFORM} ${cached_transform} COPYONLY)
+
+foreach(run first second)
+  set(command_line
+    ${TEST_PROGRAM}
+    --inputVolume ${TEST_INPUT}
+    --referenceVolume ${TEST_REFERENCE}
+    --outputVolume ${TEST_TEMP_DIR}/${run}.nii
+    --pixelType short
+    --cacheTransformField
+    --persistTransformFieldCache
+    --warpTransform ${cached_transform}
+  )
+
+  message("Running ${command_line}")
+
+  execute_process(COMMAND ${command_line}
+    RESULT_VARIABLE TEST_RESULT
+    OUTPUT_VARIABLE ${run}_output
+    ERROR_VARIABLE ${run}_output
+  )
+  message("${${run}_output}")
+
+  if(TEST_RESULT)
+    message(FATAL_ERROR "${TEST_PROGRAM} ${run} run failed")
+  endif()
+endforeach()
+
+if(NOT first_output MATCHES "Wrote cached transform field")
+  message(FATAL_ERROR "Failed: first run did not persist the transform field")
+endif()
+if(first_output MATCHES "Reusing cached transform field")
+  message(FATAL_ERROR "Failed: first run found a stale transform field cache")
+endif()
+if(NOT second_output MATCHES "Reusing cached transform field")
+  message(FATAL_ERROR "Failed: second run did not reuse the transform field cache")
+endif()
+
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files
+  ${TEST_TEMP_DIR}/first.nii ${TEST_TEMP_DIR}/second.nii
+  RESULT_VARIABLE TEST_RESULT
+)
+
+if(TEST_RESULT)
+  message(FATAL_ERROR
+    "Failed: ${TEST_TEMP_DIR}/second.nii doesn't match ${TEST_TEMP_DIR}/first.nii")
+endif()
+
+message("Passed")
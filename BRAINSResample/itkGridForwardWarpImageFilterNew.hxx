@@ -38,11 +38,15 @@
 
 #include "itkGridForwardWarpImageFilterNew.h"
 
-#include "itkImageRegionIteratorWithIndex.h"
-#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkNumericTraits.h"
 #include "itkProgressReporter.h"
 #include "itkLineIterator.h"
+#include "itkMultiThreaderBase.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 namespace itk
 {
@@ -79,7 +83,11 @@ GridForwardWarpImageFilterNew< TDisplacementField, TOutputImage >::PrintSelf( st
 }
 
 /**
- * Compute the output for the region specified by outputRegionForThread.
+ * Warp the grid in two passes. The field is split into one slab per work
+ * unit along its slowest axis and each slab collects the warped grid segments
+ * that start in it. The segments are then rasterized in parallel, each work
+ * unit only setting the output pixels inside its own slab, so no two threads
+ * touch the same pixel.
  */
 template < typename TDisplacementField, typename TOutputImage >
 void
@@ -95,24 +103,17 @@ GridForwardWarpImageFilterNew< TDisplacementField, TOutputImage >::GenerateData(
   outputPtr->Allocate();
   outputPtr->FillBuffer( m_BackgroundValue );
 
-  // const IndexType FirstIndex = fieldPtr->GetRequestedRegion().GetIndex();
-  // const IndexType OnePastValidIndex = fieldPtr->GetRequestedRegion().GetIndex() +
-  // fieldPtr->GetRequestedRegion().GetSize();
-
-  // iterator for the output image
-  using OutputImageIteratorWithIndex = ImageRegionIteratorWithIndex< OutputImageType >;
-  OutputImageIteratorWithIndex iter( outputPtr, outputPtr->GetRequestedRegion() );
+  const OutputImageRegionType region = outputPtr->GetRequestedRegion();
 
   // iterator for the deformation field
-  using DeformationFieldIterator = ImageRegionConstIterator< DisplacementFieldType >;
-  DeformationFieldIterator fieldIt( fieldPtr, outputPtr->GetRequestedRegion() );
+  using DeformationFieldIterator = ImageRegionConstIteratorWithIndex< DisplacementFieldType >;
 
   // Bresenham line iterator
   using LineIteratorType = LineIterator< OutputImageType >;
 
-  IndexType index;
-  IndexType refIndex;
-  IndexType targetIndex;
+  // A warped grid line from its mapped start index to its mapped end index
+  using SegmentType = std::pair< IndexType, IndexType >;
+
   // ContinuousIndex<float, ImageDimension> contindex;
   unsigned int nonZeroGridDirections = 0;
   for ( unsigned int q = 0; q < ImageDimension; q++ )
@@ -122,51 +123,84 @@ GridForwardWarpImageFilterNew< TDisplacementField, TOutputImage >::GenerateData(
       nonZeroGridDirections++;
     }
   }
-  for ( iter.GoToBegin(), fieldIt.GoToBegin(); !iter.IsAtEnd(); ++iter, ++fieldIt )
-  {
-    index = iter.GetIndex();
 
-    unsigned int numGridIntersect = 0;
-    for ( unsigned int dim = 0; dim < ImageDimension; dim++ )
-    {
-      numGridIntersect +=
-        ( ( m_GridPixelSpacing[dim] != 0 ) && ( ( index[dim] % std::abs( m_GridPixelSpacing[dim] ) ) == 0 ) );
-    }
-    if ( numGridIntersect == nonZeroGridDirections ) // else do nothing!
-    {
-      // we are on a grid refPoint => transform it
-      typename TOutputImage::PointType refPoint;
-      outputPtr->TransformIndexToPhysicalPoint( index, refPoint );
-      // compute the mapped refPoint
+  constexpr unsigned int     slabAxis = ImageDimension - 1;
+  const IndexValueType       slabStart = region.GetIndex( slabAxis );
+  const SizeValueType        slabExtent = region.GetSize( slabAxis );
+  MultiThreaderBase *        threader = this->GetMultiThreader();
+  const SizeValueType        requestedSlabs =
+    std::max< SizeValueType >( 1, std::min< SizeValueType >( slabExtent, this->GetNumberOfWorkUnits() ) );
+  const SizeValueType slabSize = ( slabExtent + requestedSlabs - 1 ) / requestedSlabs;
+  const SizeValueType numberOfSlabs = ( slabExtent + slabSize - 1 ) / slabSize;
+  auto                slabRegion = [&]( const SizeValueType slab ) -> OutputImageRegionType {
+    OutputImageRegionType subRegion = region;
+    subRegion.SetIndex( slabAxis, slabStart + static_cast< IndexValueType >( slab * slabSize ) );
+    subRegion.SetSize( slabAxis, std::min( slabSize, slabExtent - slab * slabSize ) );
+    return subRegion;
+  };
+
+  // Pass 1: map every visible grid line that starts in a slab.
+  std::vector< std::vector< SegmentType > > slabSegments( numberOfSlabs );
+  threader->ParallelizeArray(
+    0,
+    numberOfSlabs,
+    [&]( const SizeValueType slab ) {
+      std::vector< SegmentType > & segments = slabSegments[slab];
+      IndexType                    index;
+      IndexType                    refIndex;
+      IndexType                    targetIndex;
+      for ( DeformationFieldIterator fieldIt( fieldPtr, slabRegion( slab ) ); !fieldIt.IsAtEnd(); ++fieldIt )
       {
-        // get the required displacement
-        DisplacementType displacement = fieldIt.Get();
-        for ( unsigned int j = 0; j < ImageDimension; j++ )
+        index = fieldIt.GetIndex();
+
+        unsigned int numGridIntersect = 0;
+        for ( unsigned int dim = 0; dim < ImageDimension; dim++ )
         {
-          if ( m_GridPixelSpacing[j] != 0 ) // Do not compute offsets for
-                                            // collapsed dimensions
+          numGridIntersect +=
+            ( ( m_GridPixelSpacing[dim] != 0 ) && ( ( index[dim] % std::abs( m_GridPixelSpacing[dim] ) ) == 0 ) );
+        }
+        if ( numGridIntersect != nonZeroGridDirections ) // else do nothing!
+        {
+          continue;
+        }
+        // we are on a grid refPoint => transform it
+        typename TOutputImage::PointType refPoint;
+        outputPtr->TransformIndexToPhysicalPoint( index, refPoint );
+        // compute the mapped refPoint
+        {
+          // get the required displacement
+          DisplacementType displacement = fieldIt.Get();
+          for ( unsigned int j = 0; j < ImageDimension; j++ )
           {
-            refPoint[j] += displacement[j];
+            if ( m_GridPixelSpacing[j] != 0 ) // Do not compute offsets for
+                                              // collapsed dimensions
+            {
+              refPoint[j] += displacement[j];
+            }
           }
-          // else refPoint[j]=refPoint[j];
         }
-      }
-      const bool inside = outputPtr->TransformPhysicalPointToIndex( refPoint, refIndex );
-      if ( inside )
-      {
+        const bool inside = outputPtr->TransformPhysicalPointToIndex( refPoint, refIndex );
+        if ( !inside )
+        {
+          continue;
+        }
         // We know the current grid refPoint is inside
         // we will check if the grid points that are above are also inside
-        // In such a case we draw a Bresenham line
+        // In such a case we record a Bresenham line
         for ( unsigned int dim = 0; dim < ImageDimension; dim++ )
         {
           if ( m_GridPixelSpacing[dim] <= 0 ) // Don't do invisible direction
           {
-            // targetIndex[dim]=targetIndex[dim];//Leave as same value
             continue;
           }
           targetIndex = index;
           targetIndex[dim] += m_GridPixelSpacing[dim]; // For non-collapsed
                                                        // dimension.
+          // The last grid line along an axis has no end point in the field.
+          if ( !fieldPtr->GetBufferedRegion().IsInside( targetIndex ) )
+          {
+            continue;
+          }
           // compute the mapped targetPoint
           typename TOutputImage::PointType targetPoint;
           outputPtr->TransformIndexToPhysicalPoint( targetIndex, targetPoint );
@@ -180,23 +214,58 @@ GridForwardWarpImageFilterNew< TDisplacementField, TOutputImage >::GenerateData(
               {
                 targetPoint[j] += targetDisplacement[j];
               }
-              // else targetPoint[j]=targetPoint[j];
             }
           }
           const bool targetIn = outputPtr->TransformPhysicalPointToIndex( targetPoint, targetIndex );
           if ( targetIn )
           {
-            for ( LineIteratorType lineIter( outputPtr, refIndex, targetIndex ); !lineIter.IsAtEnd(); ++lineIter )
-            {
-              {
-                lineIter.Set( m_ForegroundValue );
-              }
-            }
+            segments.emplace_back( refIndex, targetIndex );
           }
         } // end for loop for radiating lines in each direction
       }
+    },
+    nullptr );
+
+  // Every pixel of a Bresenham line lies between its end points along the
+  // slab axis, so a segment only needs to be drawn by the slabs it spans.
+  std::vector< std::vector< const SegmentType * > > slabDraws( numberOfSlabs );
+  for ( const auto & segments : slabSegments )
+  {
+    for ( const SegmentType & segment : segments )
+    {
+      const auto low = static_cast< SizeValueType >(
+        std::min( segment.first[slabAxis], segment.second[slabAxis] ) - slabStart );
+      const auto high = static_cast< SizeValueType >(
+        std::max( segment.first[slabAxis], segment.second[slabAxis] ) - slabStart );
+      for ( SizeValueType slab = low / slabSize; slab <= high / slabSize; ++slab )
+      {
+        slabDraws[slab].push_back( &segment );
+      }
     }
   }
+
+  // Pass 2: rasterize, each slab writing only its own pixels.
+  threader->ParallelizeArray(
+    0,
+    numberOfSlabs,
+    [&]( const SizeValueType slab ) {
+      const OutputImageRegionType subRegion = slabRegion( slab );
+      const IndexValueType        first = subRegion.GetIndex( slabAxis );
+      const IndexValueType        last = first + static_cast< IndexValueType >( subRegion.GetSize( slabAxis ) ) - 1;
+      for ( const SegmentType * segment : slabDraws[slab] )
+      {
+        for ( LineIteratorType lineIter( outputPtr, segment->first, segment->second ); !lineIter.IsAtEnd();
+              ++lineIter )
+        {
+          const IndexValueType position = lineIter.GetIndex()[slabAxis];
+          if ( position >= first && position <= last )
+          {
+            lineIter.Set( m_ForegroundValue );
+          }
+        }
+      }
+    },
+    nullptr );
   // ProgressReporter progress(this, 0, numiter+1, numiter+1);
 }
 } // end namespace itk
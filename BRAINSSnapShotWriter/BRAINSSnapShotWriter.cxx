@@ -27,9 +27,15 @@
 #include "itkFlipImageFilter.h"
 #include "itkLabelOverlayImageFilter.h"
 #include "itkComposeImageFilter.h"
-#include "itkResampleImageFilter.h"
-#include "itkNearestNeighborInterpolateImageFunction.h"
+#include "itkImageRegionIterator.h"
+#include "itkMultiThreaderBase.h"
+#include "itksys/SystemTools.hxx"
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <thread>
 
 #include "BRAINSSnapShotWriterCLP.h"
 
@@ -43,20 +49,43 @@ using IndexType = std::vector< int >;
 using PercentIndexType = std::vector< int >;
 using PhysicalPointIndexType = std::vector< float >;
 
-constexpr size_t NN_INTERP = 0;
-constexpr size_t LINEAR_INTERP = 1;
+/* type definition */
+using Image3DVolumeType = itk::Image< double, 3 >;
+using Image2DVolumeType = itk::Image< double, 2 >;
+using Image3DBinaryType = itk::Image< unsigned char, 3 >;
+
+using OutputGreyImageType = itk::Image< unsigned char, 2 >;
+
+using RGBPixelType = itk::RGBPixel< unsigned char >;
+using OutputRGBImageType = itk::Image< RGBPixelType, 2 >;
+
+/** The planes and slices shared by every montage of a run. */
+struct SliceSelection
+{
+  std::vector< int >     m_PlaneDirection;
+  IndexType              m_Index;
+  PercentIndexType       m_Percent;
+  PhysicalPointIndexType m_PhysicalPoint;
+};
+
+/** The inputs and output of one montage. */
+struct SnapShotRequest
+{
+  std::vector< std::string > m_InputVolumes;
+  std::vector< std::string > m_InputBinaryVolumes;
+  std::string                m_OutputFilename;
+};
 
 template < typename TImageType >
 ExtractIndexType
-GetSliceIndexToExtract( typename TImageType::Pointer referenceImage, std::vector< int > planes,
+GetSliceIndexToExtract( const TImageType * referenceImage, std::vector< int > planes,
                         IndexType inputSliceToExtractInIndex, PercentIndexType inputSliceToExtractInPercent,
                         PhysicalPointIndexType inputSliceToExtractInPhysicalPoint )
 {
   if ( inputSliceToExtractInIndex.empty() && inputSliceToExtractInPercent.empty() &&
        inputSliceToExtractInPhysicalPoint.empty() )
   {
-    std::cout << "ERROR:: one of input index has to be entered " << std::endl;
-    exit( EXIT_FAILURE );
+    itkGenericExceptionMacro( << "ERROR:: one of input index has to be entered " );
   }
 
   ExtractIndexType sliceIndexToExtract;
@@ -90,10 +119,10 @@ GetSliceIndexToExtract( typename TImageType::Pointer referenceImage, std::vector
     {
       if ( inputSliceToExtractInPercent[i] < 0.0F || inputSliceToExtractInPercent[i] > 100.0F )
       {
-        std::cout << "ERROR: Percent has to be between 0 and 100 " << std::endl;
-        exit( EXIT_FAILURE );
+        itkGenericExceptionMacro( << "ERROR: Percent has to be between 0 and 100 " );
       }
-      unsigned int size = ( referenceImage->GetBufferedRegion() ).GetSize()[planes[i]];
+      // Only the image information is available here, not the pixel buffer.
+      unsigned int size = ( referenceImage->GetLargestPossibleRegion() ).GetSize()[planes[i]];
       unsigned int index = static_cast< unsigned int >( (float)inputSliceToExtractInPercent[i] / 100.0F ) * size;
 
       std::cout << inputSliceToExtractInPercent[i] << "-->" << index << std::endl;
@@ -105,120 +134,54 @@ GetSliceIndexToExtract( typename TImageType::Pointer referenceImage, std::vector
 }
 
 /*
- * change orientation
+ * Open a volume and flip it to the display orientation.  Only the image
+ * information is read here; the pixels are read slice by slice when
+ * ExtractSlice requests them, so only the displayed slices are decoded by
+ * ImageIOs that support streamed reading (nifti, nrrd, meta, ...).
  */
 template < typename TImageType >
-// input parameter type
-typename TImageType::Pointer
-ChangeOrientOfImage( typename TImageType::Pointer imageVolume, itk::FixedArray< bool, 3 > flipAxes )
+typename itk::FlipImageFilter< TImageType >::Pointer
+OpenOrientedVolume( const std::string & filename )
 {
+  using ReaderType = itk::ImageFileReader< TImageType >;
   using FlipImageFilterType = itk::FlipImageFilter< TImageType >;
 
-  typename FlipImageFilterType::Pointer flipFilter = FlipImageFilterType::New();
+  typename ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName( filename );
 
-  flipFilter->SetInput( imageVolume );
+  itk::FixedArray< bool, 3 > flipAxes;
+  flipAxes[0] = 0;
+  flipAxes[1] = 0;
+  flipAxes[2] = 1;
+  typename FlipImageFilterType::Pointer flipFilter = FlipImageFilterType::New();
+  flipFilter->SetInput( reader->GetOutput() );
   flipFilter->SetFlipAxes( flipAxes );
   try
   {
-    flipFilter->Update();
+    flipFilter->UpdateOutputInformation();
   }
-  catch ( ... )
+  catch ( itk::ExceptionObject & e )
   {
-    std::cout << "ERROR: Fail to flip the image " << std::endl;
+    itkGenericExceptionMacro( << "ERROR:  Could not read image " << filename << ".\n" << e.GetDescription() );
   }
-
-  return flipFilter->GetOutput();
+  // The filter is returned rather than its output: the pipeline has to stay
+  // connected for ExtractSlice to stream from the reader.
+  return flipFilter;
 }
 
 /*
  * template reading function
  */
-template < typename TStringVectorType, // input parameter type
-           typename TReaderType,       // reader type
-           typename TImageVectorType >
-// return type
-TImageVectorType
-ReadImageVolumes( TStringVectorType filenameVector, const size_t interpType )
+template < typename TImageType >
+std::vector< typename itk::FlipImageFilter< TImageType >::Pointer >
+OpenImageVolumes( const std::vector< std::string > & filenameVector )
 {
-  using ReaderPointer = typename TReaderType::Pointer;
-  using OutputImagePointerType = typename TReaderType::OutputImageType::Pointer;
-  using OutImageType = typename TReaderType::OutputImageType;
-  using ResampleType = itk::ResampleImageFilter< OutImageType, OutImageType >;
-
-  using NNIterpType = itk::NearestNeighborInterpolateImageFunction< OutImageType, double >;
-  typename NNIterpType::Pointer myNNIterp = NNIterpType::New();
-  using LinearIterpType = itk::LinearInterpolateImageFunction< OutImageType, double >;
-  typename LinearIterpType::Pointer myLinearIterp = LinearIterpType::New();
-  using TransformType = itk::IdentityTransform< double, 3 >;
-  typename TransformType::Pointer myIdentityTransform = TransformType::New();
-
-  TImageVectorType imageVector;
+  std::vector< typename itk::FlipImageFilter< TImageType >::Pointer > imageVector;
   for ( unsigned int i = 0; i < filenameVector.size(); i++ )
   {
-    std::cout << "Reading image " << i + 1 << ": " << filenameVector[i] << "...\n";
-
-    ReaderPointer reader = TReaderType::New();
-    reader->SetFileName( filenameVector[i].c_str() );
-
-    try
-    {
-      reader->Update();
-    }
-    catch ( ... )
-    {
-      std::cout << "ERROR:  Could not read image " << filenameVector[i] << "." << std::endl;
-      exit( EXIT_FAILURE );
-    }
-
-    OutputImagePointerType image = reader->GetOutput();
-
-    itk::FixedArray< bool, 3 > flipAxes;
-    flipAxes[0] = 0;
-    flipAxes[1] = 0;
-    flipAxes[2] = 1;
-    OutputImagePointerType orientedImage = ChangeOrientOfImage< OutImageType >( image, flipAxes );
-    if ( i > 0 )
-    {
-      typename ResampleType::Pointer resampler = ResampleType::New();
-      resampler->SetTransform( myIdentityTransform );
-
-      if ( interpType == NN_INTERP )
-      {
-        myNNIterp->SetInputImage( orientedImage );
-        // resampler->SetInterpolator(myNNIterp);
-      }
-      else
-      {
-        myLinearIterp->SetInputImage( orientedImage );
-        // resampler->SetInterpolator(myLinearIterp);
-      }
-      resampler->SetNumberOfWorkUnits( 1 );
-      resampler->SetInput( orientedImage );
-      resampler->SetReferenceImage( imageVector[0] );
-      // std::cout << orientedImage << std::endl;
-      // std::cout << "XXXXXXXXXXXXXXX" << std::endl;
-      // std::cout << imageVector[0] << std::endl;
-#if 0 // Need to debug why this is not working
-      try {/
-
-      resampler->Update();
-      }
-      catch(...)
-      {
-        std::cout << "ERROR:  Could not resample image " << filenameVector[i] << "." << std::endl;
-        exit(EXIT_FAILURE);
-      }
-      imageVector.push_back(resampler->GetOutput());
-#else
-      imageVector.push_back( orientedImage );
-#endif
-    }
-    else
-    {
-      imageVector.push_back( orientedImage );
-    }
+    std::cout << "Opening image " << i + 1 << ": " << filenameVector[i] << "...\n";
+    imageVector.push_back( OpenOrientedVolume< TImageType >( filenameVector[i] ) );
   }
-
   return imageVector;
 }
 
@@ -231,15 +194,16 @@ ExtractSlice( typename TInputImageType::Pointer inputImage, int plane, int slice
 {
   if ( plane < 0 || plane > 3 )
   {
-    std::cout << "ERROR: Extracting plane should be between 0 and 2(0,1,or 2)" << std::endl;
-    exit( EXIT_FAILURE );
+    itkGenericExceptionMacro( << "ERROR: Extracting plane should be between 0 and 2(0,1,or 2)" );
   }
   /* extract 2D plain */
   using ExtractVolumeFilterType = itk::Testing::ExtractSliceImageFilter< TInputImageType, TOutputImageType >;
 
   typename ExtractVolumeFilterType::Pointer extractVolumeFilter = ExtractVolumeFilterType::New();
 
-  typename TInputImageType::RegionType region = inputImage->GetBufferedRegion();
+  // The input is not buffered yet; the extraction region becomes the
+  // requested region that is streamed from the file.
+  typename TInputImageType::RegionType region = inputImage->GetLargestPossibleRegion();
 
   typename TInputImageType::SizeType size = region.GetSize();
   size[plane] = 0;
@@ -285,113 +249,65 @@ Rescale( const typename TInputImage::Pointer inputImage, const int min, const in
 }
 
 /*
- * main
+ * combine binary slices: a single binary keeps its label values, otherwise
+ * each binary gets its 1-based position as label (label color zero is grey).
  */
-
-int
-main( int argc, char ** argv )
+OutputGreyImageType::Pointer
+CombineBinarySlices( const std::vector< OutputGreyImageType::Pointer > & binarySlices )
 {
-  PARSE_ARGS;
-  BRAINSRegisterAlternateIO();
-
-  if ( inputVolumes.empty() )
-  {
-    std::cout << "Input image volume is required " << std::endl;
-    exit( EXIT_FAILURE );
-  }
-  if ( inputPlaneDirection.size() == 0 )
-  {
-    std::cout << "Input Plane Direction is required " << std::endl;
-    exit( EXIT_FAILURE );
-  }
-  if ( inputSliceToExtractInIndex.size() == 0 && inputSliceToExtractInPercent.size() == 0 &&
-       inputSliceToExtractInPhysicalPoint.size() )
+  OutputGreyImageType::Pointer labelSlice = OutputGreyImageType::New();
+  labelSlice->CopyInformation( binarySlices[0] );
+  labelSlice->SetRegions( binarySlices[0]->GetBufferedRegion() );
+  labelSlice->Allocate();
+  labelSlice->FillBuffer( 0 );
+
+  itk::ImageRegionIterator< OutputGreyImageType > labelIterator( labelSlice, labelSlice->GetBufferedRegion() );
+  for ( ; !labelIterator.IsAtEnd(); ++labelIterator )
   {
-    std::cout << "At least one of input Slice to Extract has to be specified." << std::endl;
-    exit( EXIT_FAILURE );
+    const OutputGreyImageType::IndexType index = labelIterator.GetIndex();
+    if ( binarySlices.size() == 1 )
+    {
+      labelIterator.Set( binarySlices[0]->GetPixel( index ) );
+      continue;
+    }
+    for ( unsigned int i = 0; i < binarySlices.size(); i++ )
+    {
+      if ( binarySlices[i]->GetPixel( index ) > 0 )
+      {
+        labelIterator.Set( i + 1 );
+      }
+    }
   }
+  return labelSlice;
+}
 
-  if ( inputPlaneDirection.size() != inputSliceToExtractInIndex.size() &&
-       inputPlaneDirection.size() != inputSliceToExtractInPercent.size() &&
-       inputPlaneDirection.size() != inputSliceToExtractInPhysicalPoint.size() )
+/*
+ * Render one montage: one row per plane, one column per input volume.
+ * Errors are thrown so that a batch can report them per montage.
+ */
+void
+WriteSnapShot( const SnapShotRequest & request, const SliceSelection & slices )
+{
+  if ( request.m_InputVolumes.empty() )
   {
-    std::cout << "Number of input slice number should be equal input plane direction." << std::endl;
-    exit( EXIT_FAILURE );
+    itkGenericExceptionMacro( << "Input image volume is required " );
   }
+  const size_t numberOfImgs = request.m_InputVolumes.size();
 
-  const size_t numberOfImgs = inputVolumes.size();
-
-  /* type definition */
-  using Image3DVolumeType = itk::Image< double, 3 >;
-  using Image2DVolumeType = itk::Image< double, 2 >;
-  using Image3DBinaryType = itk::Image< unsigned char, 3 >;
-
-  using ImageFilenameVectorType = std::vector< std::string >;
-  using Image3DVolumeVectorType = std::vector< Image3DVolumeType::Pointer >;
-  using Image3DBinaryVectorType = std::vector< Image3DBinaryType::Pointer >;
-
-  using Image3DVolumeReaderType = itk::ImageFileReader< Image3DVolumeType >;
-
-  using Image3DBinaryReaderType = itk::ImageFileReader< Image3DBinaryType >;
-
-  using OutputGreyImageType = itk::Image< unsigned char, 2 >;
-
-  using RGBPixelType = itk::RGBPixel< unsigned char >;
-  using OutputRGBImageType = itk::Image< RGBPixelType, 2 >;
-
-  /* read in image volumes */
-  Image3DVolumeVectorType image3DVolumes =
-    ReadImageVolumes< ImageFilenameVectorType, Image3DVolumeReaderType, Image3DVolumeVectorType >( inputVolumes,
-                                                                                                   LINEAR_INTERP );
+  /* open image volumes, read in slice by slice below */
+  const std::vector< itk::FlipImageFilter< Image3DVolumeType >::Pointer > image3DVolumes =
+    OpenImageVolumes< Image3DVolumeType >( request.m_InputVolumes );
 
-  /* read in binary volumes */
-  Image3DBinaryVectorType image3DBinaries =
-    ReadImageVolumes< ImageFilenameVectorType, Image3DBinaryReaderType, Image3DBinaryVectorType >( inputBinaryVolumes,
-                                                                                                   NN_INTERP );
+  /* open binary volumes */
+  const std::vector< itk::FlipImageFilter< Image3DBinaryType >::Pointer > image3DBinaries =
+    OpenImageVolumes< Image3DBinaryType >( request.m_InputBinaryVolumes );
 
-  ExtractIndexType extractingSlices = GetSliceIndexToExtract< Image3DVolumeType >( image3DVolumes[0],
-                                                                                   inputPlaneDirection,
-                                                                                   inputSliceToExtractInIndex,
-                                                                                   inputSliceToExtractInPercent,
-                                                                                   inputSliceToExtractInPhysicalPoint );
+  ExtractIndexType extractingSlices = GetSliceIndexToExtract< Image3DVolumeType >( image3DVolumes[0]->GetOutput(),
+                                                                                   slices.m_PlaneDirection,
+                                                                                   slices.m_Index,
+                                                                                   slices.m_Percent,
+                                                                                   slices.m_PhysicalPoint );
 
-  /* combine binary images */
-  Image3DVolumeType::Pointer labelMap = Image3DVolumeType::New();
-  if ( !image3DBinaries.empty() )
-  {
-    labelMap->CopyInformation( image3DBinaries[0] );
-    labelMap->SetRegions( image3DVolumes[0]->GetBufferedRegion() );
-    labelMap->Allocate();
-
-    itk::ImageRegionIterator< Image3DVolumeType > binaryIterator( labelMap, labelMap->GetBufferedRegion() );
-
-    itk::ImageRegionIterator< Image3DBinaryType > labelIterator( image3DBinaries[0],
-                                                                 image3DBinaries[0]->GetBufferedRegion() );
-
-    while ( !binaryIterator.IsAtEnd() && !labelIterator.IsAtEnd() )
-    {
-      /** itereate one image */
-      binaryIterator.Set( 0 );
-      if ( image3DBinaries.size() == 1 )
-      {
-        binaryIterator.Set( labelIterator.Value() ); // label color zero is grey
-        ++labelIterator;
-      }
-      else
-      {
-        for ( unsigned int i = 0; i < image3DBinaries.size(); i++ )
-        {
-          Image3DBinaryType::IndexType index = binaryIterator.GetIndex();
-          if ( image3DBinaries[i]->GetPixel( index ) > 0 )
-          {
-            binaryIterator.Set( i + 1 ); // label color zero is grey
-          }
-        }
-      }
-      /** add each binary values */
-      ++binaryIterator;
-    }
-  }
   /* compose color image */
   using LabelOverlayFilter =
     itk::LabelOverlayImageFilter< OutputGreyImageType, OutputGreyImageType, OutputRGBImageType >;
@@ -401,40 +317,41 @@ main( int argc, char ** argv )
   using OutputRGBImageVectorType = std::vector< OutputRGBImageType::Pointer >;
 
   OutputRGBImageVectorType rgbSlices;
-  for ( unsigned int plane = 0; plane < inputPlaneDirection.size(); plane++ )
+  for ( unsigned int plane = 0; plane < slices.m_PlaneDirection.size(); plane++ )
   {
+    /* combine binary slices; this plane's slice of every binary is shared by all columns */
+    OutputGreyImageType::Pointer labelSlice;
+    if ( !image3DBinaries.empty() )
+    {
+      std::vector< OutputGreyImageType::Pointer > binarySlices;
+      for ( unsigned int b = 0; b < image3DBinaries.size(); b++ )
+      {
+        binarySlices.push_back( ExtractSlice< Image3DBinaryType, OutputGreyImageType >(
+          image3DBinaries[b]->GetOutput(), slices.m_PlaneDirection[plane], extractingSlices[plane] ) );
+      }
+      labelSlice = CombineBinarySlices( binarySlices );
+    }
+
     for ( unsigned int i = 0; i < numberOfImgs; i++ )
     {
       /** get slicer */
-      Image3DVolumeType::Pointer current3DImage = image3DVolumes[i];
+      Image3DVolumeType::Pointer current3DImage = image3DVolumes[i]->GetOutput();
       Image2DVolumeType::Pointer imageSlice = ExtractSlice< Image3DVolumeType, Image2DVolumeType >(
-        current3DImage, inputPlaneDirection[plane], extractingSlices[plane] );
+        current3DImage, slices.m_PlaneDirection[plane], extractingSlices[plane] );
 
       OutputGreyImageType::Pointer greyScaleSlice =
         Rescale< Image2DVolumeType, OutputGreyImageType >( imageSlice, 0, 255 );
 
       /** binaries */
-      OutputGreyImageType::Pointer labelSlice;
-      if ( !image3DBinaries.empty() )
+      if ( labelSlice.IsNotNull() )
       {
         /** rgb creator */
         LabelOverlayFilter::Pointer rgbComposer = LabelOverlayFilter::New();
 
-        labelSlice = ExtractSlice< Image3DVolumeType, OutputGreyImageType >(
-          labelMap, inputPlaneDirection[plane], extractingSlices[plane] );
         rgbComposer->SetLabelImage( labelSlice );
         rgbComposer->SetInput( greyScaleSlice );
         rgbComposer->SetOpacity( .5F );
-        try
-        {
-          rgbComposer->Update();
-        }
-        catch ( itk::ExceptionObject & e )
-        {
-          std::cout << "ERROR:  Could not update image." << std::endl;
-          std::cout << "ERROR:  " << e.what() << std::endl;
-          exit( EXIT_FAILURE );
-        }
+        rgbComposer->Update();
 
         rgbSlices.push_back( rgbComposer->GetOutput() );
       }
@@ -445,17 +362,8 @@ main( int argc, char ** argv )
         rgbComposer->SetInput1( greyScaleSlice );
         rgbComposer->SetInput2( greyScaleSlice );
         rgbComposer->SetInput3( greyScaleSlice );
+        rgbComposer->Update();
 
-        try
-        {
-          rgbComposer->Update();
-        }
-        catch ( itk::ExceptionObject & e )
-        {
-          std::cout << "ERROR:  Could not update image." << std::endl;
-          std::cout << "ERROR:  " << e.what() << std::endl;
-          exit( EXIT_FAILURE );
-        }
         rgbSlices.push_back( rgbComposer->GetOutput() );
       }
     }
@@ -477,7 +385,6 @@ main( int argc, char ** argv )
   {
     for ( unsigned int i = 0; i < numberOfImgs; i++ )
     {
-      OutputRGBImageType::Pointer img = rgbSlices[i + plane * numberOfImgs];
       tileFilter->SetInput( i + plane * numberOfImgs, rgbSlices[i + plane * numberOfImgs] );
     }
   }
@@ -488,16 +395,223 @@ main( int argc, char ** argv )
   RGBFileWriterType::Pointer rgbFileWriter = RGBFileWriterType::New();
 
   rgbFileWriter->SetInput( tileFilter->GetOutput() );
-  rgbFileWriter->SetFileName( outputFilename );
+  rgbFileWriter->SetFileName( request.m_OutputFilename );
+  rgbFileWriter->Update();
+}
 
-  try
+std::vector< std::string >
+SplitField( const std::string & text, const char separator )
+{
+  std::vector< std::string > fields;
+  std::istringstream         textStream( text );
+  std::string                field;
+  while ( std::getline( textStream, field, separator ) )
   {
-    rgbFileWriter->Update();
+    const std::string::size_type first = field.find_first_not_of( " \t\r" );
+    const std::string::size_type last = field.find_last_not_of( " \t\r" );
+    fields.push_back( ( first == std::string::npos ) ? std::string() : field.substr( first, last - first + 1 ) );
   }
-  catch ( itk::ExceptionObject & e )
+  return fields;
+}
+
+/*
+ * Read the batch manifest: a header line naming the columns outputFilename,
+ * inputVolumes and (optionally) inputBinaryVolumes, then one montage per
+ * line.  Several volumes in one field are separated by ';'.  Lines starting
+ * with '#' are skipped and relative paths are relative to the manifest.
+ */
+bool
+ReadBatchManifest( const std::string & manifestFileName, std::vector< SnapShotRequest > & requests )
+{
+  std::ifstream manifest( manifestFileName.c_str() );
+  if ( !manifest.is_open() )
+  {
+    std::cerr << "ERROR: Can not read the manifest " << manifestFileName << std::endl;
+    return false;
+  }
+  const std::string manifestDirectory =
+    itksys::SystemTools::GetParentDirectory( itksys::SystemTools::CollapseFullPath( manifestFileName ) );
+  const auto toPaths = [&manifestDirectory]( const std::string & field ) -> std::vector< std::string > {
+    std::vector< std::string > paths;
+    for ( const std::string & path : SplitField( field, ';' ) )
+    {
+      if ( !path.empty() )
+      {
+        paths.push_back( itksys::SystemTools::CollapseFullPath( path, manifestDirectory ) );
+      }
+    }
+    return paths;
+  };
+
+  std::vector< std::string > header;
+  std::string                line;
+  unsigned int               lineNumber = 0;
+  while ( std::getline( manifest, line ) )
+  {
+    ++lineNumber;
+    if ( line.find_first_not_of( " \t\r" ) == std::string::npos || line[line.find_first_not_of( " \t" )] == '#' )
+    {
+      continue;
+    }
+    const std::vector< std::string > fields = SplitField( line, ',' );
+    if ( header.empty() )
+    {
+      header = fields;
+      for ( const std::string & column : header )
+      {
+        if ( column != "outputFilename" && column != "inputVolumes" && column != "inputBinaryVolumes" )
+        {
+          std::cerr << "ERROR: Unknown manifest column \"" << column
+                    << "\"; the known columns are outputFilename, inputVolumes and inputBinaryVolumes" << std::endl;
+          return false;
+        }
+      }
+      continue;
+    }
+    if ( fields.size() > header.size() )
+    {
+      std::cerr << "ERROR: Line " << lineNumber << " of the manifest has more fields than its header" << std::endl;
+      return false;
+    }
+    SnapShotRequest request;
+    for ( size_t i = 0; i < fields.size(); ++i )
+    {
+      if ( header[i] == "outputFilename" && !fields[i].empty() )
+      {
+        request.m_OutputFilename = itksys::SystemTools::CollapseFullPath( fields[i], manifestDirectory );
+      }
+      else if ( header[i] == "inputVolumes" )
+      {
+        request.m_InputVolumes = toPaths( fields[i] );
+      }
+      else if ( header[i] == "inputBinaryVolumes" )
+      {
+        request.m_InputBinaryVolumes = toPaths( fields[i] );
+      }
+    }
+    if ( request.m_OutputFilename.empty() || request.m_InputVolumes.empty() )
+    {
+      std::cerr << "ERROR: Line " << lineNumber << " of the manifest needs an outputFilename and inputVolumes"
+                << std::endl;
+      return false;
+    }
+    requests.push_back( request );
+  }
+  return true;
+}
+
+/*
+ * main
+ */
+
+int
+main( int argc, char ** argv )
+{
+  PARSE_ARGS;
+  BRAINSRegisterAlternateIO();
+
+  std::vector< SnapShotRequest > requests;
+  if ( !inputBatchManifest.empty() )
+  {
+    if ( !ReadBatchManifest( inputBatchManifest, requests ) )
+    {
+      exit( EXIT_FAILURE );
+    }
+  }
+  else
+  {
+    if ( inputVolumes.empty() )
+    {
+      std::cout << "Input image volume is required " << std::endl;
+      exit( EXIT_FAILURE );
+    }
+    SnapShotRequest request;
+    request.m_InputVolumes = inputVolumes;
+    request.m_InputBinaryVolumes = inputBinaryVolumes;
+    request.m_OutputFilename = outputFilename;
+    requests.push_back( request );
+  }
+  if ( inputPlaneDirection.size() == 0 )
+  {
+    std::cout << "Input Plane Direction is required " << std::endl;
+    exit( EXIT_FAILURE );
+  }
+  if ( inputSliceToExtractInIndex.size() == 0 && inputSliceToExtractInPercent.size() == 0 &&
+       inputSliceToExtractInPhysicalPoint.size() )
+  {
+    std::cout << "At least one of input Slice to Extract has to be specified." << std::endl;
+    exit( EXIT_FAILURE );
+  }
+
+  if ( inputPlaneDirection.size() != inputSliceToExtractInIndex.size() &&
+       inputPlaneDirection.size() != inputSliceToExtractInPercent.size() &&
+       inputPlaneDirection.size() != inputSliceToExtractInPhysicalPoint.size() )
+  {
+    std::cout << "Number of input slice number should be equal input plane direction." << std::endl;
+    exit( EXIT_FAILURE );
+  }
+
+  SliceSelection slices;
+  slices.m_PlaneDirection = inputPlaneDirection;
+  slices.m_Index = inputSliceToExtractInIndex;
+  slices.m_Percent = inputSliceToExtractInPercent;
+  slices.m_PhysicalPoint = inputSliceToExtractInPhysicalPoint;
+
+  // Each montage only touches a few small 2D images, so the montages
+  // themselves are the unit of parallelism in a batch.
+  unsigned int numberOfWorkers =
+    ( numberOfThreads > 0 ) ? static_cast< unsigned int >( numberOfThreads ) : std::thread::hardware_concurrency();
+  numberOfWorkers = std::max( 1U, std::min( numberOfWorkers, static_cast< unsigned int >( requests.size() ) ) );
+  if ( numberOfWorkers > 1 )
+  {
+    itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads( 1 );
+    std::cout << "Rendering " << requests.size() << " montages, " << numberOfWorkers << " at a time." << std::endl;
+  }
+
+  std::atomic< size_t > nextRequest( 0 );
+  std::atomic< size_t > numberOfFailures( 0 );
+  const auto            renderRequests = [&]() {
+    for ( size_t r = nextRequest++; r < requests.size(); r = nextRequest++ )
+    {
+      try
+      {
+        WriteSnapShot( requests[r], slices );
+      }
+      catch ( itk::ExceptionObject & e )
+      {
+        ++numberOfFailures;
+        std::cout << "ERROR:  Could not write " << requests[r].m_OutputFilename << "." << std::endl;
+        std::cout << "ERROR:  " << e.what() << std::endl;
+      }
+      catch ( std::exception & e )
+      {
+        // E.g. std::bad_alloc; an exception escaping a worker thread would terminate the batch.
+        ++numberOfFailures;
+        std::cout << "ERROR:  Could not write " << requests[r].m_OutputFilename << "." << std::endl;
+        std::cout << "ERROR:  " << e.what() << std::endl;
+      }
+      catch ( ... )
+      {
+        ++numberOfFailures;
+        std::cout << "ERROR:  Could not write " << requests[r].m_OutputFilename << "." << std::endl;
+      }
+    }
+  };
+
+  std::vector< std::thread > workers;
+  for ( unsigned int w = 1; w < numberOfWorkers; ++w )
+  {
+    workers.emplace_back( renderRequests );
+  }
+  renderRequests();
+  for ( std::thread & worker : workers )
+  {
+    worker.join();
+  }
+
+  if ( numberOfFailures > 0 )
   {
-    std::cout << "ERROR:  Could not write image." << std::endl;
-    std::cout << "ERROR:  " << e.what() << std::endl;
+    std::cout << numberOfFailures << " of " << requests.size() << " montages failed." << std::endl;
     exit( EXIT_FAILURE );
   }
   return EXIT_SUCCESS;
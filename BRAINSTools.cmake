@@ -237,6 +237,10 @@ if(USE_ITKMatlabIO)
   add_subdirectory(ITKMatlabIO)
 endif()
 
+if(USE_BRAINSToolsBenchmarks)
+  add_subdirectory(Benchmarks)
+endif()
+
 include(${CMAKE_CURRENT_LIST_DIR}/cpack_brainstools.cmake)
 # Name of data management target
 if(${CMAKE_PROJECT_NAME} STREQUAL "BRAINSTools")
@@ -0,0 +1,620 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+/*
+ * Author: Hans J. Johnson
+ *
+ * A reproducible benchmark suite for the hot paths of BRAINSTools.  Every
+ * kernel runs on synthetic phantoms (see SyntheticPhantoms.h) that are
+ * bit-identical on every machine and for every thread count, so a change in
+ * the reported times is a change in the code or the machine, never in the
+ * data.
+ */
+#include "BRAINSToolsBenchmarksConfig.h"
+#include "BenchmarkHarness.h"
+#include "SyntheticPhantoms.h"
+
+#include "BRAINSToolsBenchmarksCLP.h"
+#include "BRAINSThreadControl.h"
+#include "BRAINSProfiler.h"
+#include "BRAINSToolsVersion.h"
+#include "GenericTransformImage.h"
+#include "itkBRAINSROIAutoImageFilter.h"
+#include "itkDiffusionTensor3DReconstructionWithMaskImageFilter.h"
+
+#include "itkAffineTransform.h"
+#include "itkVersorRigid3DTransform.h"
+#include "itkMattesMutualInformationImageToImageMetricv4.h"
+#include "itkDiffeomorphicDemonsRegistrationFilter.h"
+
+#ifdef BRAINSToolsBenchmarks_USE_BRAINSABC
+#  include "BRAINSABCUtilities.h"
+#  include "ComputeDistributions.h"
+#  include "EMSegmentationFilter.h"
+#  include "LLSBiasCorrector.h"
+#  include "tbb/task_arena.h"
+#endif
+
+#ifdef BRAINSToolsBenchmarks_USE_GTRACT
+#  include "itkDtiFreeTrackingFilter.h"
+#  include "itkTensorFractionalAnisotropyImageFilter.h"
+#endif
+
+#include <algorithm>
+#include <iostream>
+
+using namespace BRAINSBenchmarks;
+
+using DisplacementFieldType = itk::Image< itk::Vector< float, 3 >, 3 >;
+using RigidTransformType = itk::VersorRigid3DTransform< double >;
+
+/** The rigid motion between the fixed and moving phantoms of the registration kernels. */
+static RigidTransformType::Pointer
+MakeMisalignment()
+{
+  RigidTransformType::Pointer transform = RigidTransformType::New();
+  RigidTransformType::AxisType axis;
+  axis[0] = 0.2;
+  axis[1] = 0.3;
+  axis[2] = 1.0;
+  transform->SetRotation( axis, 5.0 * itk::Math::pi / 180.0 );
+  RigidTransformType::OutputVectorType translation;
+  translation[0] = 4.0;
+  translation[1] = -3.0;
+  translation[2] = 2.0;
+  transform->SetTranslation( translation );
+  return transform;
+}
+
+static TimedBody
+PrepareForegroundMask( const unsigned int size )
+{
+  const PhantomImageType::Pointer t1 = MakeHeadPhantom( size, T1Contrast(), 1 );
+  return [t1]( unsigned int ) {
+    using ROIAutoType = itk::BRAINSROIAutoImageFilter< PhantomImageType, PhantomLabelImageType >;
+    ROIAutoType::Pointer ROIFilter = ROIAutoType::New();
+    ROIFilter->SetInput( t1 );
+    ROIFilter->SetOtsuPercentileThreshold( 0.01 );
+    ROIFilter->SetClosingSize( 9.0 );
+    ROIFilter->SetThresholdCorrectionFactor( 1.0 );
+    ROIFilter->SetDilateSize( 0.0 );
+    ROIFilter->Update();
+  };
+}
+
+static TimedBody
+PrepareResampleLinear( const unsigned int size )
+{
+  const PhantomImageType::Pointer t1 = MakeHeadPhantom( size, T1Contrast(), 1 );
+
+  using AffineTransformType = itk::AffineTransform< double, 3 >;
+  AffineTransformType::Pointer affine = AffineTransformType::New();
+  affine->SetMatrix( MakeMisalignment()->GetMatrix() );
+  affine->SetOffset( MakeMisalignment()->GetOffset() );
+  affine->Scale( 1.05 );
+  const itk::Transform< double, 3, 3 >::ConstPointer transform = affine.GetPointer();
+
+  return [t1, transform]( unsigned int ) {
+    GenericTransformImage< PhantomImageType, PhantomImageType, DisplacementFieldType >(
+      t1.GetPointer(), t1.GetPointer(), transform, 0.0F, "Linear", false );
+  };
+}
+
+static TimedBody
+PrepareMattesMutualInformation( const unsigned int size )
+{
+  const PhantomImageType::Pointer fixed = MakeHeadPhantom( size, T1Contrast(), 1 );
+  const PhantomImageType::Pointer moving = MakeHeadPhantom( size, T2Contrast(), 2, MakeMisalignment() );
+
+  // The metric value and gradient, evaluated for a fixed sequence of rigid
+  // transforms, are the inner loop of every BRAINSFit rigid registration;
+  // timing them instead of a whole registration keeps the amount of work
+  // independent of optimizer convergence.
+  return [fixed, moving]( unsigned int threads ) {
+    using MetricType = itk::MattesMutualInformationImageToImageMetricv4< PhantomImageType, PhantomImageType >;
+    RigidTransformType::Pointer transform = RigidTransformType::New();
+    MetricType::Pointer         metric = MetricType::New();
+    metric->SetFixedImage( fixed );
+    metric->SetMovingImage( moving );
+    metric->SetMovingTransform( transform );
+    metric->SetNumberOfHistogramBins( 50 );
+    metric->SetMaximumNumberOfWorkUnits( threads );
+    metric->Initialize();
+
+    RigidTransformType::ParametersType parameters = transform->GetParameters();
+    MetricType::MeasureType            value;
+    MetricType::DerivativeType         derivative;
+    for ( unsigned int evaluation = 0; evaluation < 10; ++evaluation )
+    {
+      parameters[2] = 0.005 * evaluation;
+      parameters[3] = 0.5 * evaluation;
+      transform->SetParameters( parameters );
+      metric->GetValueAndDerivative( value, derivative );
+    }
+  };
+}
+
+static TimedBody
+PrepareDiffeomorphicDemons( const unsigned int size )
+{
+  const PhantomImageType::Pointer fixed = MakeHeadPhantom( size, T1Contrast(), 1 );
+  const PhantomImageType::Pointer moving = MakeHeadPhantom( size, T1Contrast(), 2, MakeMisalignment() );
+
+  return [fixed, moving]( unsigned int ) {
+    using DemonsFilterType =
+      itk::DiffeomorphicDemonsRegistrationFilter< PhantomImageType, PhantomImageType, DisplacementFieldType >;
+    DemonsFilterType::Pointer demons = DemonsFilterType::New();
+    demons->SetFixedImage( fixed );
+    demons->SetMovingImage( moving );
+    demons->SetNumberOfIterations( 10 );
+    demons->SetStandardDeviations( 1.0 );
+    demons->Update();
+  };
+}
+
+static TimedBody
+PrepareTensorEstimation( const unsigned int size )
+{
+  const double                               bValue = 1000.0;
+  const std::vector< GradientDirectionType > directions = MakeGradientDirections();
+  const DWIImageType::Pointer                dwi = MakeDiffusionPhantom( size, directions, bValue, 3 );
+
+  return [dwi, directions, bValue]( unsigned int ) {
+    using TensorFilterType = itk::DiffusionTensor3DReconstructionWithMaskImageFilter< float, float, double >;
+    // SetGradientImage normalizes the directions in place, so each run gets its own.
+    TensorFilterType::GradientDirectionContainerType::Pointer container =
+      TensorFilterType::GradientDirectionContainerType::New();
+    for ( unsigned int i = 0; i < directions.size(); ++i )
+    {
+      container->InsertElement( i, directions[i] );
+    }
+    TensorFilterType::Pointer filter = TensorFilterType::New();
+    filter->SetGradientImage( container, dwi );
+    filter->SetBValue( bValue );
+    filter->SetThreshold( 50 );
+    filter->SetEstimationMethod( TensorFilterType::WeightedLeastSquares );
+    filter->Update();
+  };
+}
+
+#ifdef BRAINSToolsBenchmarks_USE_BRAINSABC
+/** The two channel subject images, class posteriors and masks of the BRAINSABC kernels. */
+struct EMPhantom
+{
+  MapOfFloatImageVectors                        m_Images;
+  std::vector< PhantomImageType::Pointer >      m_Posteriors;
+  std::vector< PhantomLabelImageType::Pointer > m_CandidateRegions;
+  PhantomLabelImageType::Pointer                m_BrainMask;
+  PhantomLabelImageType::Pointer                m_HeadMask;
+};
+
+static PhantomLabelImageType::Pointer
+ThresholdLabels( const PhantomLabelImageType * labels, const unsigned char lower, const unsigned char upper )
+{
+  PhantomLabelImageType::Pointer mask = PhantomLabelImageType::New();
+  mask->CopyInformation( labels );
+  mask->SetRegions( labels->GetLargestPossibleRegion() );
+  mask->Allocate();
+  const size_t numberOfVoxels = labels->GetLargestPossibleRegion().GetNumberOfPixels();
+  for ( size_t i = 0; i < numberOfVoxels; ++i )
+  {
+    const unsigned char label = labels->GetBufferPointer()[i];
+    mask->GetBufferPointer()[i] = ( label >= lower && label <= upper ) ? 1 : 0;
+  }
+  return mask;
+}
+
+static EMPhantom
+MakeEMPhantom( const unsigned int size )
+{
+  EMPhantom                    phantom;
+  const PhantomLabelImageType::Pointer labels = MakePhantomLabels( size );
+  phantom.m_Images["T1"].push_back( MakeHeadPhantom( size, T1Contrast(), 1 ) );
+  phantom.m_Images["T2"].push_back( MakeHeadPhantom( size, T2Contrast(), 2 ) );
+  phantom.m_Posteriors = MakePhantomPosteriors( labels, 2.0 );
+  phantom.m_CandidateRegions.push_back( ThresholdLabels( labels, PhantomBackground, PhantomScalp ) );
+  phantom.m_CandidateRegions.push_back( ThresholdLabels( labels, PhantomCSF, PhantomCSF ) );
+  phantom.m_CandidateRegions.push_back( ThresholdLabels( labels, PhantomGrayMatter, PhantomGrayMatter ) );
+  phantom.m_CandidateRegions.push_back( ThresholdLabels( labels, PhantomWhiteMatter, PhantomWhiteMatter ) );
+  phantom.m_BrainMask = ThresholdLabels( labels, PhantomCSF, PhantomWhiteMatter );
+  phantom.m_HeadMask = ThresholdLabels( labels, PhantomScalp, PhantomWhiteMatter );
+  return phantom;
+}
+
+static TimedBody
+PrepareEMClassStatistics( const unsigned int size )
+{
+  const EMPhantom phantom = MakeEMPhantom( size );
+  return [phantom]( unsigned int threads ) {
+    tbb::task_arena arena( static_cast< int >( threads ) );
+    arena.execute( [&phantom] {
+      std::vector< RegionStats > classStatistics;
+      CombinedComputeDistributions< CorrectIntensityImageType, PhantomImageType, RegionStats::MatrixType >(
+        phantom.m_CandidateRegions, phantom.m_Images, phantom.m_Posteriors, classStatistics, 0, false );
+    } );
+  };
+}
+
+/** Exposes the per-voxel kernels of EMSegmentationFilter, so that they can be
+ * timed without an atlas and a whole EM loop. */
+class EMKernelsFilter : public EMSegmentationFilter< FloatImageType, FloatImageType >
+{
+public:
+  using Self = EMKernelsFilter;
+  using Superclass = EMSegmentationFilter< FloatImageType, FloatImageType >;
+  using Pointer = itk::SmartPointer< Self >;
+
+  itkNewMacro( Self );
+
+  using Superclass::ComputeOnePosterior;
+  using Superclass::kNNCore;
+
+protected:
+  EMKernelsFilter() = default;
+};
+
+static TimedBody
+PrepareEMPosteriors( const unsigned int size )
+{
+  const EMPhantom            phantom = MakeEMPhantom( size );
+  std::vector< RegionStats > classStatistics;
+  CombinedComputeDistributions< CorrectIntensityImageType, PhantomImageType, RegionStats::MatrixType >(
+    phantom.m_CandidateRegions, phantom.m_Images, phantom.m_Posteriors, classStatistics, 0, false );
+  EMKernelsFilter::QuantizedProbabilityImageListType priors;
+  priors.Store( phantom.m_Posteriors );
+
+  return [phantom, classStatistics, priors]( unsigned int threads ) {
+    tbb::task_arena arena( static_cast< int >( threads ) );
+    arena.execute( [&] {
+      // ComputeOnePosterior takes the class means by reference, so each run gets its own.
+      std::vector< RegionStats >     statistics( classStatistics );
+      const EMKernelsFilter::Pointer filter = EMKernelsFilter::New();
+      for ( size_t iclass = 0; iclass < statistics.size(); ++iclass )
+      {
+        filter->ComputeOnePosterior(
+          1.0, priors, iclass, statistics[iclass].m_Covariance, statistics[iclass].m_Means, phantom.m_Images );
+      }
+    } );
+  };
+}
+
+/** The training samples, labels and test matrix of the kNN posteriors, built the
+ * way EMSegmentationFilter::ComputekNNPosteriors does: the normalized
+ * intensities followed by one indicator feature per class. */
+struct KNNPhantom
+{
+  EMKernelsFilter::SampleType::Pointer m_TrainSamples;
+  vnl_vector< FloatingPrecision >      m_TrainLabels;
+  vnl_matrix< FloatingPrecision >      m_TestMatrix;
+  unsigned int                         m_NumberOfClasses;
+};
+
+static KNNPhantom
+MakeKNNPhantom( const unsigned int size )
+{
+  const EMPhantom                        phantom = MakeEMPhantom( size );
+  const std::vector< bool >              classIsForeground = { false, true, true, true };
+  const size_t                           numberOfClasses = phantom.m_Posteriors.size();
+  std::vector< FloatImageType::Pointer > normalizedImages;
+  for ( const auto & modality : phantom.m_Images )
+  {
+    for ( const auto & image : modality.second )
+    {
+      normalizedImages.push_back( NormalizeInputIntensityImage< FloatImageType >( image ) );
+    }
+  }
+  const size_t numberOfFeatures = normalizedImages.size() + numberOfClasses;
+  const size_t numberOfVoxels = phantom.m_BrainMask->GetLargestPossibleRegion().GetNumberOfPixels();
+
+  KNNPhantom knn;
+  knn.m_NumberOfClasses = static_cast< unsigned int >( numberOfClasses );
+  knn.m_TestMatrix.set_size( numberOfVoxels, numberOfFeatures );
+  for ( size_t v = 0; v < numberOfVoxels; ++v )
+  {
+    size_t mostLikelyClass = 0;
+    for ( size_t c = 1; c < numberOfClasses; ++c )
+    {
+      if ( phantom.m_Posteriors[c]->GetBufferPointer()[v] >
+           phantom.m_Posteriors[mostLikelyClass]->GetBufferPointer()[v] )
+      {
+        mostLikelyClass = c;
+      }
+    }
+    size_t feature = 0;
+    for ( const auto & image : normalizedImages )
+    {
+      knn.m_TestMatrix( v, feature++ ) = image->GetBufferPointer()[v];
+    }
+    for ( size_t c = 0; c < numberOfClasses; ++c )
+    {
+      knn.m_TestMatrix( v, feature++ ) = ( phantom.m_Posteriors[c]->GetBufferPointer()[v] > 0.01 &&
+                                           classIsForeground[c] == classIsForeground[mostLikelyClass] )
+                                           ? 1
+                                           : 0;
+    }
+  }
+
+  // Up to 75 training samples per class, spread evenly over its candidate region.
+  constexpr size_t      samplesPerClass = 75;
+  std::vector< size_t > sampleVoxels;
+  std::vector< size_t > sampleClasses;
+  for ( size_t c = 0; c < numberOfClasses; ++c )
+  {
+    std::vector< size_t > regionVoxels;
+    for ( size_t v = 0; v < numberOfVoxels; ++v )
+    {
+      if ( phantom.m_CandidateRegions[c]->GetBufferPointer()[v] != 0 )
+      {
+        regionVoxels.push_back( v );
+      }
+    }
+    const size_t numberOfSamples = std::min( samplesPerClass, regionVoxels.size() );
+    for ( size_t i = 0; i < numberOfSamples; ++i )
+    {
+      sampleVoxels.push_back( regionVoxels[i * regionVoxels.size() / numberOfSamples] );
+      sampleClasses.push_back( c );
+    }
+  }
+  knn.m_TrainSamples = EMKernelsFilter::SampleType::New();
+  knn.m_TrainSamples->SetMeasurementVectorSize( numberOfFeatures );
+  knn.m_TrainLabels.set_size( sampleVoxels.size() );
+  for ( size_t i = 0; i < sampleVoxels.size(); ++i )
+  {
+    EMKernelsFilter::MeasurementVectorType sample( numberOfFeatures );
+    for ( size_t f = 0; f < numberOfFeatures; ++f )
+    {
+      sample[f] = knn.m_TestMatrix( sampleVoxels[i], f );
+    }
+    knn.m_TrainSamples->PushBack( sample );
+    knn.m_TrainLabels( i ) = sampleClasses[i];
+  }
+  return knn;
+}
+
+static TimedBody
+PrepareKNNPosteriors( const unsigned int size )
+{
+  const KNNPhantom knn = MakeKNNPhantom( size );
+  // The number of neighbours EMSegmentationFilter::ComputekNNPosteriors uses.
+  const unsigned int K = std::min< unsigned int >( 60, knn.m_TrainSamples->Size() );
+
+  return [knn, K]( unsigned int threads ) {
+    tbb::task_arena arena( static_cast< int >( threads ) );
+    arena.execute( [&] {
+      vnl_matrix< FloatingPrecision > likelihoods( knn.m_TestMatrix.rows(), knn.m_NumberOfClasses, 0 );
+      const EMKernelsFilter::Pointer  filter = EMKernelsFilter::New();
+      filter->kNNCore( knn.m_TrainSamples.GetPointer(), knn.m_TrainLabels, knn.m_TestMatrix, likelihoods, K );
+    } );
+  };
+}
+
+static TimedBody
+PrepareLLSBiasCorrection( const unsigned int size )
+{
+  const EMPhantom phantom = MakeEMPhantom( size );
+  return [phantom]( unsigned int threads ) {
+    tbb::task_arena arena( static_cast< int >( threads ) );
+    arena.execute( [&phantom] {
+      using BiasCorrectorType = LLSBiasCorrector< CorrectIntensityImageType, PhantomImageType >;
+      BiasCorrectorType::Pointer biascorr = BiasCorrectorType::New();
+      biascorr->SetMaxDegree( 4 );
+      biascorr->SetSampleSpacing( 1 );
+      biascorr->SetWorkingSpacing( 2.0 );
+      biascorr->SetForegroundBrainMask( phantom.m_BrainMask );
+      biascorr->SetAllTissueMask( phantom.m_HeadMask );
+      biascorr->SetProbabilities( phantom.m_Posteriors, phantom.m_CandidateRegions );
+      biascorr->SetInputImages( phantom.m_Images );
+      biascorr->CorrectImages( 0 );
+    } );
+  };
+}
+#endif
+
+#ifdef BRAINSToolsBenchmarks_USE_GTRACT
+static TimedBody
+PrepareFiberTracking( const unsigned int size )
+{
+  using TensorImageType = itk::Image< itk::DiffusionTensor3D< double >, 3 >;
+  using TrackingFilterType = itk::DtiFreeTrackingFilter< TensorImageType, PhantomImageType, PhantomLabelImageType >;
+
+  const double                               bValue = 1000.0;
+  const std::vector< GradientDirectionType > directions = MakeGradientDirections();
+  const DWIImageType::Pointer                dwi = MakeDiffusionPhantom( size, directions, bValue, 3 );
+
+  using TensorFilterType = itk::DiffusionTensor3DReconstructionWithMaskImageFilter< float, float, double >;
+  TensorFilterType::GradientDirectionContainerType::Pointer container =
+    TensorFilterType::GradientDirectionContainerType::New();
+  for ( unsigned int i = 0; i < directions.size(); ++i )
+  {
+    container->InsertElement( i, directions[i] );
+  }
+  TensorFilterType::Pointer tensorFilter = TensorFilterType::New();
+  tensorFilter->SetGradientImage( container, dwi );
+  tensorFilter->SetBValue( bValue );
+  tensorFilter->SetThreshold( 50 );
+  tensorFilter->Update();
+  const TensorImageType::Pointer tensors = tensorFilter->GetOutput();
+
+  using FAFilterType = itk::TensorFractionalAnisotropyImageFilter< TensorImageType, PhantomImageType >;
+  FAFilterType::Pointer faFilter = FAFilterType::New();
+  faFilter->SetInput( tensors );
+  faFilter->Update();
+  const PhantomImageType::Pointer anisotropy = faFilter->GetOutput();
+
+  // Seeds in the white matter of the central axial slice.
+  const PhantomLabelImageType::Pointer labels = MakePhantomLabels( size );
+  const PhantomLabelImageType::Pointer seeds = PhantomLabelImageType::New();
+  seeds->CopyInformation( labels );
+  seeds->SetRegions( labels->GetLargestPossibleRegion() );
+  seeds->Allocate();
+  seeds->FillBuffer( 0 );
+  PhantomLabelImageType::IndexType index;
+  index[2] = size / 2;
+  for ( index[1] = 0; index[1] < static_cast< itk::IndexValueType >( size ); ++index[1] )
+  {
+    for ( index[0] = 0; index[0] < static_cast< itk::IndexValueType >( size ); ++index[0] )
+    {
+      seeds->SetPixel( index, labels->GetPixel( index ) == PhantomWhiteMatter ? 1 : 0 );
+    }
+  }
+
+  // gtractFiberTracking tracks in voxel coordinates.
+  PhantomImageType::SpacingType unitSpacing;
+  unitSpacing.Fill( 1.0 );
+  PhantomImageType::PointType zeroOrigin;
+  zeroOrigin.Fill( 0.0 );
+  tensors->SetSpacing( unitSpacing );
+  tensors->SetOrigin( zeroOrigin );
+  anisotropy->SetSpacing( unitSpacing );
+  anisotropy->SetOrigin( zeroOrigin );
+  seeds->SetSpacing( unitSpacing );
+  seeds->SetOrigin( zeroOrigin );
+
+  // The defaults of gtractFiberTracking.
+  return [tensors, anisotropy, seeds]( unsigned int ) {
+    TrackingFilterType::Pointer tracking = TrackingFilterType::New();
+    tracking->SetTensorImage( tensors );
+    tracking->SetAnisotropyImage( anisotropy );
+    tracking->SetStartingRegion( seeds );
+    tracking->SetCurvatureThreshold( 45.0 );
+    tracking->SetMaximumLength( 125.0 );
+    tracking->SetMinimumLength( 0.0 );
+    tracking->SetStepSize( 1.0 );
+    tracking->SetTendG( 0.5 );
+    tracking->SetTendF( 0.5 );
+    tracking->SetUseTend( false );
+    tracking->SetUseLoopDetection( false );
+    tracking->SetSeedThreshold( 0.4 );
+    tracking->SetAnisotropyThreshold( 0.2 );
+    tracking->Update();
+  };
+}
+#endif
+
+static std::vector< BenchmarkKernel >
+RegisteredKernels()
+{
+  std::vector< BenchmarkKernel > kernels;
+  kernels.push_back( { "ForegroundMask", "BRAINSROIAuto foreground mask generation", PrepareForegroundMask } );
+  kernels.push_back( { "ResampleLinear", "GenericTransformImage affine resampling, linear interpolation",
+                       PrepareResampleLinear } );
+  kernels.push_back( { "MattesMutualInformation", "10 Mattes MI value and gradient evaluations of a rigid transform",
+                       PrepareMattesMutualInformation } );
+  kernels.push_back(
+    { "DiffeomorphicDemons", "10 iterations of diffeomorphic demons registration", PrepareDiffeomorphicDemons } );
+  kernels.push_back(
+    { "TensorEstimation", "Weighted least squares diffusion tensor estimation", PrepareTensorEstimation } );
+#ifdef BRAINSToolsBenchmarks_USE_BRAINSABC
+  kernels.push_back(
+    { "EMClassStatistics", "BRAINSABC class means and covariances of two channels", PrepareEMClassStatistics } );
+  kernels.push_back(
+    { "EMPosteriors", "BRAINSABC EM posteriors of four classes from two channels", PrepareEMPosteriors } );
+  kernels.push_back( { "KNNPosteriors", "BRAINSABC kNN likelihoods of every voxel, 75 training samples per class",
+                       PrepareKNNPosteriors } );
+  kernels.push_back(
+    { "LLSBiasCorrection", "BRAINSABC degree 4 polynomial bias field correction", PrepareLLSBiasCorrection } );
+#endif
+#ifdef BRAINSToolsBenchmarks_USE_GTRACT
+  kernels.push_back( { "FiberTracking", "GTRACT free tracking from the white matter of the central slice",
+                       PrepareFiberTracking } );
+#endif
+  return kernels;
+}
+
+int
+main( int argc, char * argv[] )
+{
+  PARSE_ARGS;
+
+  const std::vector< BenchmarkKernel > kernels = RegisteredKernels();
+  if ( listKernels )
+  {
+    for ( const auto & kernel : kernels )
+    {
+      std::cout << kernel.m_Name << ": " << kernel.m_Description << std::endl;
+    }
+    return EXIT_SUCCESS;
+  }
+  for ( const auto & name : kernelNames )
+  {
+    const bool known = std::any_of( kernels.begin(), kernels.end(),
+                                    [&name]( const BenchmarkKernel & kernel ) { return kernel.m_Name == name; } );
+    if ( !known )
+    {
+      std::cerr << "Unknown kernel " << name << ", see --listKernels" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if ( imageSizes.empty() || threadCounts.empty() ||
+       *std::min_element( imageSizes.begin(), imageSizes.end() ) < 8 ||
+       *std::min_element( threadCounts.begin(), threadCounts.end() ) < 1 )
+  {
+    std::cerr << "--imageSizes must be at least 8 and --threadCounts at least 1" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector< BenchmarkResult > results;
+  for ( const auto & kernel : kernels )
+  {
+    if ( !kernelNames.empty() &&
+         std::find( kernelNames.begin(), kernelNames.end(), kernel.m_Name ) == kernelNames.end() )
+    {
+      continue;
+    }
+    for ( const int size : imageSizes )
+    {
+      // The phantoms are built once per size and are not part of the timing.
+      const TimedBody body = kernel.m_Prepare( size );
+      for ( const int threads : threadCounts )
+      {
+        const BRAINSUtils::StackPushITKDefaultNumberOfThreads TempDefaultNumberOfThreadsHolder( threads );
+        const long startRSS = BRAINSUtils::Profiler::GetPeakResidentSetSizeKiB();
+        BenchmarkResult result = TimeKernel( kernel.m_Name, size, threads, repetitions, body );
+        result.m_PeakRSSGrowthKiB = BRAINSUtils::Profiler::GetPeakResidentSetSizeKiB() - startRSS;
+        std::cout << result.GetName() << ": median " << result.m_MedianSeconds << " s (min " << result.m_MinSeconds
+                  << " s, max " << result.m_MaxSeconds << " s)" << std::endl;
+        results.push_back( result );
+      }
+    }
+  }
+
+  if ( !outputJSON.empty() && !WriteJSON( outputJSON, BRAINSTools::Version::ExtendedVersionString(), results ) )
+  {
+    std::cerr << "Could not write " << outputJSON << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if ( !baselineJSON.empty() )
+  {
+    std::map< std::string, double > baseline;
+    if ( !ReadBaseline( baselineJSON, baseline ) )
+    {
+      std::cerr << "Could not read any results from " << baselineJSON << std::endl;
+      return EXIT_FAILURE;
+    }
+    const unsigned int regressions =
+      CompareToBaseline( results, baseline, tolerance, minimumDifference, allowMissingBaseline, std::cout );
+    if ( regressions > 0 )
+    {
+      std::cerr << regressions << " kernels are more than " << 100.0 * tolerance
+                << "% slower than the baseline or have no baseline entry" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __BenchmarkHarness_h
+#define __BenchmarkHarness_h
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace BRAINSBenchmarks
+{
+/**
+ * \author Hans J. Johnson
+ * \brief The timing of one kernel at one image size and thread count.
+ */
+struct BenchmarkResult
+{
+  std::string  m_Kernel;
+  unsigned int m_Size{ 0 };
+  unsigned int m_Threads{ 0 };
+  unsigned int m_Repetitions{ 0 };
+  double       m_MinSeconds{ 0.0 };
+  double       m_MedianSeconds{ 0.0 };
+  double       m_MaxSeconds{ 0.0 };
+  /** Growth of the peak resident set size of the process during the runs. */
+  long m_PeakRSSGrowthKiB{ 0 };
+
+  /** The name used to match a result against a stored baseline. */
+  std::string
+  GetName() const
+  {
+    std::ostringstream name;
+    name << m_Kernel << "/size=" << m_Size << "/threads=" << m_Threads;
+    return name.str();
+  }
+};
+
+/** The timed part of a kernel; it is called with the thread count of the run. */
+using TimedBody = std::function< void( unsigned int ) >;
+/** Builds the inputs of a kernel for one image size (untimed) and returns its timed part. */
+using PrepareFunction = std::function< TimedBody( unsigned int ) >;
+
+/**
+ * \author Hans J. Johnson
+ * \brief A named benchmark kernel.
+ */
+struct BenchmarkKernel
+{
+  std::string     m_Name;
+  std::string     m_Description;
+  PrepareFunction m_Prepare;
+};
+
+/**
+ * \author Hans J. Johnson
+ * \brief Runs a body once untimed, then the requested number of times, and
+ * reports the minimum, median and maximum wall time.
+ */
+inline BenchmarkResult
+TimeKernel( const std::string & kernel, const unsigned int size, const unsigned int threads,
+            const unsigned int repetitions, const TimedBody & body )
+{
+  body( threads );
+
+  std::vector< double > seconds;
+  for ( unsigned int r = 0; r < std::max( repetitions, 1U ); ++r )
+  {
+    const auto start = std::chrono::steady_clock::now();
+    body( threads );
+    seconds.push_back( std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count() );
+  }
+  std::sort( seconds.begin(), seconds.end() );
+
+  BenchmarkResult result;
+  result.m_Kernel = kernel;
+  result.m_Size = size;
+  result.m_Threads = threads;
+  result.m_Repetitions = static_cast< unsigned int >( seconds.size() );
+  result.m_MinSeconds = seconds.front();
+  result.m_MaxSeconds = seconds.back();
+  const size_t middle = seconds.size() / 2;
+  result.m_MedianSeconds =
+    ( seconds.size() % 2 == 1 ) ? seconds[middle] : 0.5 * ( seconds[middle - 1] + seconds[middle] );
+  return result;
+}
+
+/**
+ * Write the results as JSON.  Every result is written on a line of its own
+ * so that ReadBaseline can read the file back without a JSON library.
+ */
+inline bool
+WriteJSON( const std::string & fileName, const std::string & version, const std::vector< BenchmarkResult > & results )
+{
+  std::ofstream out( fileName.c_str() );
+  if ( !out.is_open() )
+  {
+    return false;
+  }
+  out << "{" << std::endl;
+  out << "  \"suite\": \"BRAINSToolsBenchmarks\"," << std::endl;
+  out << "  \"version\": \"" << version << "\"," << std::endl;
+  out << "  \"results\": [" << std::endl;
+  out << std::setprecision( 9 );
+  for ( size_t i = 0; i < results.size(); ++i )
+  {
+    const BenchmarkResult & r = results[i];
+    out << "    { \"name\": \"" << r.GetName() << "\", \"kernel\": \"" << r.m_Kernel << "\", \"size\": " << r.m_Size
+        << ", \"threads\": " << r.m_Threads << ", \"repetitions\": " << r.m_Repetitions
+        << ", \"minSeconds\": " << r.m_MinSeconds << ", \"medianSeconds\": " << r.m_MedianSeconds
+        << ", \"maxSeconds\": " << r.m_MaxSeconds << ", \"peakRSSGrowthKiB\": " << r.m_PeakRSSGrowthKiB << " }"
+        << ( i + 1 < results.size() ? "," : "" ) << std::endl;
+  }
+  out << "  ]" << std::endl;
+  out << "}" << std::endl;
+  return out.good();
+}
+
+/**
+ * Read the median time of every result of a file written by WriteJSON,
+ * keyed by BenchmarkResult::GetName().  Returns false when the file can not
+ * be read or holds no results.
+ */
+inline bool
+ReadBaseline( const std::string & fileName, std::map< std::string, double > & baseline )
+{
+  std::ifstream in( fileName.c_str() );
+  if ( !in.is_open() )
+  {
+    return false;
+  }
+  const std::string nameKey = "\"name\": \"";
+  const std::string medianKey = "\"medianSeconds\": ";
+  std::string       line;
+  while ( std::getline( in, line ) )
+  {
+    const size_t namePos = line.find( nameKey );
+    const size_t medianPos = line.find( medianKey );
+    if ( namePos == std::string::npos || medianPos == std::string::npos )
+    {
+      continue;
+    }
+    const size_t nameBegin = namePos + nameKey.size();
+    const size_t nameEnd = line.find( '"', nameBegin );
+    if ( nameEnd == std::string::npos )
+    {
+      continue;
+    }
+    baseline[line.substr( nameBegin, nameEnd - nameBegin )] =
+      std::strtod( line.c_str() + medianPos + medianKey.size(), nullptr );
+  }
+  return !baseline.empty();
+}
+
+/**
+ * Compare results against a baseline.  A result regresses when its median is
+ * more than (1 + tolerance) times the baseline median and also slower by more
+ * than minimumDifference seconds, so that timer noise on very short kernels
+ * is not reported.  A result without a baseline entry also fails unless
+ * allowMissingBaseline is set, so that a baseline that no longer covers the
+ * suite is not silently passed.  Returns the number of failures.
+ */
+inline unsigned int
+CompareToBaseline( const std::vector< BenchmarkResult > & results, const std::map< std::string, double > & baseline,
+                   const double tolerance, const double minimumDifference, const bool allowMissingBaseline,
+                   std::ostream & os )
+{
+  const std::streamsize precision = os.precision();
+  unsigned int          regressions = 0;
+  for ( const auto & r : results )
+  {
+    const auto it = baseline.find( r.GetName() );
+    if ( it == baseline.end() )
+    {
+      if ( !allowMissingBaseline )
+      {
+        ++regressions;
+      }
+      os << ( allowMissingBaseline ? "NO BASELINE  " : "MISSING      " ) << r.GetName() << " median "
+         << r.m_MedianSeconds << " s" << std::endl;
+      continue;
+    }
+    const double reference = it->second;
+    const double ratio = ( reference > 0.0 ) ? r.m_MedianSeconds / reference : 1.0;
+    const bool   regressed =
+      ( r.m_MedianSeconds > reference * ( 1.0 + tolerance ) ) && ( r.m_MedianSeconds - reference > minimumDifference );
+    if ( regressed )
+    {
+      ++regressions;
+    }
+    os << ( regressed ? "REGRESSION   " : "OK           " ) << r.GetName() << " median " << r.m_MedianSeconds
+       << " s, baseline " << reference << " s, ratio " << std::setprecision( 3 ) << ratio
+       << std::setprecision( precision ) << std::endl;
+  }
+  return regressions;
+}
+} // namespace BRAINSBenchmarks
+
+#endif // __BenchmarkHarness_h
@@ -0,0 +1,340 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef __SyntheticPhantoms_h
+#define __SyntheticPhantoms_h
+
+#include "itkImage.h"
+#include "itkVectorImage.h"
+#include "itkTransform.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkSmoothingRecursiveGaussianImageFilter.h"
+#include "vnl/vnl_vector_fixed.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace BRAINSBenchmarks
+{
+using PhantomImageType = itk::Image< float, 3 >;
+using PhantomLabelImageType = itk::Image< unsigned char, 3 >;
+using DWIImageType = itk::VectorImage< float, 3 >;
+using GradientDirectionType = vnl_vector_fixed< double, 3 >;
+
+/** The tissues of the analytic head phantom. */
+enum PhantomTissue
+{
+  PhantomBackground = 0,
+  PhantomScalp,
+  PhantomCSF,
+  PhantomGrayMatter,
+  PhantomWhiteMatter,
+  NumberOfPhantomTissues
+};
+
+/** Mean intensity of each PhantomTissue. */
+using PhantomContrast = std::vector< float >;
+
+inline PhantomContrast
+T1Contrast()
+{
+  return PhantomContrast{ 0.0F, 500.0F, 250.0F, 650.0F, 900.0F };
+}
+
+inline PhantomContrast
+T2Contrast()
+{
+  return PhantomContrast{ 0.0F, 400.0F, 1000.0F, 700.0F, 500.0F };
+}
+
+/**
+ * A hash of (seed, voxel offset) to 64 random bits (splitmix64).  The noise
+ * of a voxel depends only on its offset, so the phantoms are bit-identical
+ * for any number of threads and any region splitting, unlike a stateful
+ * generator such as the one of itk::RandomImageSource.
+ */
+inline uint64_t
+HashVoxel( const uint64_t seed, const uint64_t offset )
+{
+  uint64_t z = seed + 0x9E3779B97F4A7C15ULL * ( offset + 1 );
+  z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+  z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+  return z ^ ( z >> 31 );
+}
+
+/** Approximately standard normal noise: the centered sum of four uniform variates. */
+inline double
+NoiseSample( const uint64_t seed, const uint64_t offset )
+{
+  const uint64_t bits = HashVoxel( seed, offset );
+  double         sum = 0.0;
+  for ( unsigned int k = 0; k < 4; ++k )
+  {
+    sum += static_cast< double >( ( bits >> ( 16 * k ) ) & 0xFFFF ) / 65535.0;
+  }
+  return ( sum - 2.0 ) * std::sqrt( 3.0 );
+}
+
+/** The tissue at a physical point (mm) of a head centered at the origin. */
+inline PhantomTissue
+PhantomTissueAt( const itk::Point< double, 3 > & p )
+{
+  auto ellipsoid = [&p]( const double cx, const double rx, const double ry, const double rz ) -> double {
+    const double x = ( p[0] - cx ) / rx;
+    const double y = p[1] / ry;
+    const double z = p[2] / rz;
+    return x * x + y * y + z * z;
+  };
+  if ( ellipsoid( 0.0, 80.0, 95.0, 85.0 ) > 1.0 )
+  {
+    return PhantomBackground;
+  }
+  if ( ellipsoid( 0.0, 72.0, 87.0, 77.0 ) > 1.0 )
+  {
+    return PhantomScalp;
+  }
+  if ( ellipsoid( 0.0, 68.0, 83.0, 73.0 ) > 1.0 || ellipsoid( -9.0, 5.0, 20.0, 9.0 ) <= 1.0 ||
+       ellipsoid( 9.0, 5.0, 20.0, 9.0 ) <= 1.0 )
+  {
+    return PhantomCSF;
+  }
+  // A folded gray/white boundary, so that the tissue borders are not all smooth ellipsoids.
+  const double folding = 0.12 * std::sin( 0.21 * p[0] ) * std::sin( 0.17 * p[1] ) * std::sin( 0.19 * p[2] );
+  if ( ellipsoid( 0.0, 56.0, 70.0, 60.0 ) > 1.0 + folding )
+  {
+    return PhantomGrayMatter;
+  }
+  return PhantomWhiteMatter;
+}
+
+/** An empty cubic grid of size^3 voxels covering a 240 mm field of view centered at the origin. */
+template < typename TImage >
+typename TImage::Pointer
+MakePhantomGrid( const unsigned int size )
+{
+  typename TImage::SizeType imageSize;
+  imageSize.Fill( size );
+  typename TImage::SpacingType spacing;
+  spacing.Fill( 240.0 / size );
+  typename TImage::PointType origin;
+  origin.Fill( -120.0 + 0.5 * spacing[0] );
+
+  typename TImage::Pointer image = TImage::New();
+  image->SetRegions( imageSize );
+  image->SetSpacing( spacing );
+  image->SetOrigin( origin );
+  return image;
+}
+
+/**
+ * The tissue labels of the phantom.  When transform is given the phantom
+ * is sampled at transform( x ), i.e. it is the phantom moved by the inverse
+ * of transform.
+ */
+inline PhantomLabelImageType::Pointer
+MakePhantomLabels( const unsigned int size, const itk::Transform< double, 3, 3 > * transform = nullptr )
+{
+  PhantomLabelImageType::Pointer labels = MakePhantomGrid< PhantomLabelImageType >( size );
+  labels->Allocate();
+  for ( itk::ImageRegionIteratorWithIndex< PhantomLabelImageType > it( labels, labels->GetLargestPossibleRegion() );
+        !it.IsAtEnd();
+        ++it )
+  {
+    PhantomLabelImageType::PointType p;
+    labels->TransformIndexToPhysicalPoint( it.GetIndex(), p );
+    if ( transform != nullptr )
+    {
+      p = transform->TransformPoint( p );
+    }
+    it.Set( static_cast< unsigned char >( PhantomTissueAt( p ) ) );
+  }
+  return labels;
+}
+
+/**
+ * A head phantom with the given contrast, a smooth multiplicative bias
+ * field of relative amplitude biasAmplitude, and deterministic noise with a
+ * standard deviation of noiseFraction times the white matter intensity.
+ */
+inline PhantomImageType::Pointer
+MakeHeadPhantom( const unsigned int size, const PhantomContrast & contrast, const uint64_t seed,
+                 const itk::Transform< double, 3, 3 > * transform = nullptr, const double noiseFraction = 0.03,
+                 const double biasAmplitude = 0.1 )
+{
+  const PhantomLabelImageType::Pointer labels = MakePhantomLabels( size, transform );
+  PhantomImageType::Pointer            image = MakePhantomGrid< PhantomImageType >( size );
+  image->Allocate();
+
+  const double noiseSigma = noiseFraction * contrast[PhantomWhiteMatter];
+  uint64_t     offset = 0;
+  for ( itk::ImageRegionIteratorWithIndex< PhantomImageType > it( image, image->GetLargestPossibleRegion() );
+        !it.IsAtEnd();
+        ++it, ++offset )
+  {
+    PhantomImageType::PointType p;
+    image->TransformIndexToPhysicalPoint( it.GetIndex(), p );
+    const double bias = 1.0 + biasAmplitude * ( p[0] / 120.0 + 0.5 * ( p[2] / 120.0 ) * ( p[2] / 120.0 ) );
+    const double value = contrast[labels->GetPixel( it.GetIndex() )] * bias + noiseSigma * NoiseSample( seed, offset );
+    it.Set( static_cast< float >( std::max( value, 0.0 ) ) );
+  }
+  return image;
+}
+
+/**
+ * Soft class posteriors of the phantom: the background (including the
+ * scalp), CSF, gray matter and white matter indicator images smoothed by a
+ * Gaussian of sigma millimeters and normalized to sum to one.
+ */
+inline std::vector< PhantomImageType::Pointer >
+MakePhantomPosteriors( const PhantomLabelImageType * labels, const double sigma )
+{
+  const unsigned char                      classOfTissue[NumberOfPhantomTissues] = { 0, 0, 1, 2, 3 };
+  const unsigned int                       numberOfClasses = 4;
+  std::vector< PhantomImageType::Pointer > posteriors;
+  for ( unsigned int c = 0; c < numberOfClasses; ++c )
+  {
+    PhantomImageType::Pointer indicator = PhantomImageType::New();
+    indicator->CopyInformation( labels );
+    indicator->SetRegions( labels->GetLargestPossibleRegion() );
+    indicator->Allocate();
+    itk::ImageRegionConstIterator< PhantomLabelImageType > lit( labels, labels->GetLargestPossibleRegion() );
+    itk::ImageRegionIterator< PhantomImageType >           iit( indicator, indicator->GetLargestPossibleRegion() );
+    for ( ; !lit.IsAtEnd(); ++lit, ++iit )
+    {
+      iit.Set( classOfTissue[lit.Get()] == c ? 1.0F : 0.0F );
+    }
+
+    using SmoothingFilterType = itk::SmoothingRecursiveGaussianImageFilter< PhantomImageType, PhantomImageType >;
+    SmoothingFilterType::Pointer smoother = SmoothingFilterType::New();
+    smoother->SetInput( indicator );
+    smoother->SetSigma( sigma );
+    smoother->Update();
+    posteriors.push_back( smoother->GetOutput() );
+  }
+
+  const size_t numberOfVoxels = labels->GetLargestPossibleRegion().GetNumberOfPixels();
+  for ( size_t i = 0; i < numberOfVoxels; ++i )
+  {
+    double sum = 0.0;
+    for ( unsigned int c = 0; c < numberOfClasses; ++c )
+    {
+      float & value = posteriors[c]->GetBufferPointer()[i];
+      value = std::max( value, 0.0F );
+      sum += value;
+    }
+    for ( unsigned int c = 0; c < numberOfClasses; ++c )
+    {
+      posteriors[c]->GetBufferPointer()[i] =
+        ( sum > 0.0 ) ? static_cast< float >( posteriors[c]->GetBufferPointer()[i] / sum ) : ( c == 0 ? 1.0F : 0.0F );
+    }
+  }
+  return posteriors;
+}
+
+/** One baseline followed by twelve non-collinear gradient directions. */
+inline std::vector< GradientDirectionType >
+MakeGradientDirections()
+{
+  const double directions[][3] = { { 0, 0, 0 },  { 1, 0, 0 },  { 0, 1, 0 },  { 0, 0, 1 },  { 1, 1, 0 },
+                                   { 1, 0, 1 },  { 0, 1, 1 },  { 1, -1, 0 }, { 1, 0, -1 }, { 0, 1, -1 },
+                                   { 1, 1, 1 },  { -1, 1, 1 }, { 1, -1, 1 } };
+  std::vector< GradientDirectionType > result;
+  for ( const auto & d : directions )
+  {
+    result.push_back( GradientDirectionType( d[0], d[1], d[2] ) );
+  }
+  return result;
+}
+
+/**
+ * Stejskal-Tanner signals of the head phantom.  White matter holds a
+ * prolate tensor whose principal direction circles the z axis; the other
+ * tissues are isotropic.  Deterministic noise of noiseFraction times the
+ * unweighted signal is added to every gradient.
+ */
+inline DWIImageType::Pointer
+MakeDiffusionPhantom( const unsigned int size, const std::vector< GradientDirectionType > & directions,
+                      const double bValue, const uint64_t seed, const double noiseFraction = 0.02 )
+{
+  const PhantomLabelImageType::Pointer labels = MakePhantomLabels( size );
+  DWIImageType::Pointer                dwi = MakePhantomGrid< DWIImageType >( size );
+  dwi->SetVectorLength( directions.size() );
+  dwi->Allocate();
+
+  const double baseline[NumberOfPhantomTissues] = { 0.0, 400.0, 1000.0, 700.0, 500.0 };
+  const double isotropic[NumberOfPhantomTissues] = { 0.0, 0.5e-3, 3.0e-3, 0.8e-3, 0.0 };
+  const double parallel = 1.7e-3;
+  const double perpendicular = 0.3e-3;
+
+  std::vector< GradientDirectionType > unitDirections( directions );
+  for ( auto & g : unitDirections )
+  {
+    if ( g.two_norm() > 0.0 )
+    {
+      g.normalize();
+    }
+  }
+
+  DWIImageType::PixelType signal( directions.size() );
+  uint64_t                offset = 0;
+  for ( itk::ImageRegionIteratorWithIndex< DWIImageType > it( dwi, dwi->GetLargestPossibleRegion() ); !it.IsAtEnd();
+        ++it, ++offset )
+  {
+    const unsigned char     tissue = labels->GetPixel( it.GetIndex() );
+    DWIImageType::PointType p;
+    dwi->TransformIndexToPhysicalPoint( it.GetIndex(), p );
+    GradientDirectionType fiber( -p[1], p[0], 0.0 );
+    if ( fiber.two_norm() > 0.0 )
+    {
+      fiber.normalize();
+    }
+    else
+    {
+      fiber = GradientDirectionType( 1.0, 0.0, 0.0 );
+    }
+    for ( unsigned int i = 0; i < unitDirections.size(); ++i )
+    {
+      const GradientDirectionType & g = unitDirections[i];
+      double                        gDg = 0.0;
+      if ( g.two_norm() > 0.0 )
+      {
+        if ( tissue == PhantomWhiteMatter )
+        {
+          const double cosine = dot_product( g, fiber );
+          gDg = perpendicular + ( parallel - perpendicular ) * cosine * cosine;
+        }
+        else
+        {
+          gDg = isotropic[tissue];
+        }
+      }
+      const double noise = noiseFraction * baseline[PhantomCSF] *
+                           NoiseSample( seed, offset * unitDirections.size() + i );
+      signal[i] = static_cast< float >( std::abs( baseline[tissue] * std::exp( -bValue * gDg ) + noise ) );
+    }
+    it.Set( signal );
+  }
+  return dwi;
+}
+} // namespace BRAINSBenchmarks
+
+#endif // __SyntheticPhantoms_h
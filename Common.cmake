@@ -153,6 +153,7 @@ cmake_dependent_option(USE_ITKMatlabIO "Build ITKMatlabIO" ${BUILD_FOR_DASHBOARD
 mark_as_superbuild(VARS USE_ITKMatlabIO:BOOL PROJECTS ${LOCAL_PROJECT_NAME} )
 bt_option(USE_BRAINSMush                     "Build BRAINSMush"                     ${BUILD_FOR_DASHBOARD})
 bt_option(USE_BRAINSMultiModeSegment         "Build BRAINSMultiModeSegment"         ${BUILD_FOR_DASHBOARD})
+bt_option(USE_BRAINSToolsBenchmarks          "Build BRAINSToolsBenchmarks"          OFF)
 
 ## These are not yet ready for prime time.
 ## INFO: Move to ARCHIVE directory
@@ -0,0 +1,128 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+// Pair two small synthetic tracts whose fiber distances are known in closed form.
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <vtkCellArray.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkPolyLine.h>
+#include <vtkSmartPointer.h>
+
+#include "gtractFiberTractComparison.h"
+
+namespace
+{
+constexpr unsigned int NumberOfPoints = 5;
+
+struct StraightFiber
+{
+  double xStart; // the fiber runs along x from xStart to xStart + NumberOfPoints - 1
+  double y;
+  double z;
+};
+
+vtkSmartPointer< vtkPolyData >
+MakeTract( const std::vector< StraightFiber > & fibers )
+{
+  vtkSmartPointer< vtkPoints >    points = vtkSmartPointer< vtkPoints >::New();
+  vtkSmartPointer< vtkCellArray > lines = vtkSmartPointer< vtkCellArray >::New();
+  for ( const StraightFiber & fiber : fibers )
+  {
+    vtkSmartPointer< vtkPolyLine > line = vtkSmartPointer< vtkPolyLine >::New();
+    line->GetPointIds()->SetNumberOfIds( NumberOfPoints );
+    for ( unsigned int i = 0; i < NumberOfPoints; ++i )
+    {
+      line->GetPointIds()->SetId( i, points->InsertNextPoint( fiber.xStart + i, fiber.y, fiber.z ) );
+    }
+    lines->InsertNextCell( line );
+  }
+  vtkSmartPointer< vtkPolyData > tract = vtkSmartPointer< vtkPolyData >::New();
+  tract->SetPoints( points );
+  tract->SetLines( lines );
+  return tract;
+}
+
+struct ExpectedPairing
+{
+  vtkIdType closestCellId;
+  double    distance;
+};
+
+bool
+CheckPairings( const char * metricName, const PackedFiberBundle & test, const PackedFiberBundle & standard,
+               const std::vector< ExpectedPairing > & expected )
+{
+  const FiberTractComparator        comparator( standard, FiberDistanceMetricFromString( metricName ) );
+  const std::vector< FiberPairing > pairings = comparator.PairOffFibers( test );
+  bool                              passed = pairings.size() == expected.size();
+  for ( std::size_t f = 0; passed && f < pairings.size(); ++f )
+  {
+    if ( pairings[f].cellId != static_cast< vtkIdType >( f ) ||
+         pairings[f].closestCellId != expected[f].closestCellId ||
+         std::abs( pairings[f].distance - expected[f].distance ) > 1e-12 )
+    {
+      std::cerr << metricName << ": test fiber " << pairings[f].cellId << " paired with " << pairings[f].closestCellId
+                << " at " << pairings[f].distance << ", expected " << expected[f].closestCellId << " at "
+                << expected[f].distance << std::endl;
+      passed = false;
+    }
+  }
+  return passed;
+}
+} // namespace
+
+int
+main( int, char *[] )
+{
+  // Standard tract: two parallel fibers 10 apart in y.
+  const vtkSmartPointer< vtkPolyData > standardTract = MakeTract( { { 0, 0, 0 }, { 0, 10, 0 } } );
+  // Test tract:
+  //  0: standard fiber 0 moved 1 in y
+  //  1: standard fiber 1 moved 1 along its own direction
+  //  2: moved 4 in y and 3 in z from standard fiber 0 (5 away)
+  //  3: half way between both standard fibers, the tie goes to the lower cell
+  const vtkSmartPointer< vtkPolyData > testTract = MakeTract( { { 0, 1, 0 }, { 1, 10, 0 }, { 0, 4, 3 }, { 0, 5, 0 } } );
+
+  const PackedFiberBundle standardFibers( standardTract, NumberOfPoints );
+  const PackedFiberBundle testFibers( testTract, NumberOfPoints );
+
+  bool passed = true;
+  // Every point of test fiber 1 is 1 away from its counterpart.
+  passed &= CheckPairings( "MeanCorrespondingPoint", testFibers, standardFibers,
+                           { { 0, 1.0 }, { 1, 1.0 }, { 0, 5.0 }, { 0, 5.0 } } );
+  // Only the last point of test fiber 1 has no standard point on top of it.
+  passed &= CheckPairings( "MeanClosestPoint", testFibers, standardFibers,
+                           { { 0, 1.0 }, { 1, 1.0 / NumberOfPoints }, { 0, 5.0 }, { 0, 5.0 } } );
+  // The unmatched end points of both fibers are 1 away from the other fiber.
+  passed &=
+    CheckPairings( "Hausdorff", testFibers, standardFibers, { { 0, 1.0 }, { 1, 1.0 }, { 0, 5.0 }, { 0, 5.0 } } );
+
+  if ( !passed )
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "All fiber distance metrics paired the synthetic tracts as expected" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -42,7 +42,6 @@
 #include <vtkPointData.h>
 #include <vtkLookupTable.h>
 #include <vtkCellArray.h>
-#include <vtkIdList.h>
 #include <vtkPolyData.h>
 #include <vtkPolyDataWriter.h>
 #include <vtkPolyDataReader.h>
@@ -58,63 +57,28 @@
 // ////////////////////////////////////////////////////////////////////////
 
 #include "compareTractInclusionCLP.h"
+#include "gtractFiberTractComparison.h"
 #include "BRAINSThreadControl.h"
 #include <BRAINSCommonLib.h>
 
 double
-PairOffFibers( vtkPolyData * resampledTestFibers, vtkPolyData * resampledStandardFibers, int numberOfPoints )
+PairOffFibers( const PackedFiberBundle & testFibers, const PackedFiberBundle & standardFibers,
+               const FiberDistanceMetricType metric )
 {
-  double maxDistances = 0.0;
+  const FiberTractComparator        comparator( standardFibers, metric );
+  const std::vector< FiberPairing > pairings = comparator.PairOffFibers( testFibers );
 
-  for ( int j = 0; j < resampledTestFibers->GetNumberOfCells(); j++ )
+  double maxDistances = 0.0;
+  for ( const FiberPairing & pairing : pairings )
   {
-    if ( resampledTestFibers->GetCellType( j ) == VTK_POLY_LINE )
+    std::cout << "Pairing test fiber " << pairing.cellId << " with standard fiber " << pairing.closestCellId
+              << " at distance " << pairing.distance << "\n";
+    if ( maxDistances < pairing.distance )
     {
-      vtkIdList * testPointList = vtkIdList::New();
-      resampledTestFibers->GetCellPoints( j, testPointList );
-      double minDist = 1E200;
-      int    closestK = -1;
-      for ( int k = 0; k < resampledStandardFibers->GetNumberOfCells(); k++ )
-      {
-        if ( resampledStandardFibers->GetCellType( k ) == VTK_POLY_LINE )
-        {
-          vtkIdList * standardPointList = vtkIdList::New();
-          resampledStandardFibers->GetCellPoints( k, standardPointList );
-          double sumDist = 0.0;
-          for ( int i = 0; i < numberOfPoints; i++ )
-          {
-            double testPoint[3];
-            resampledTestFibers->GetPoint( testPointList->GetId( i ), testPoint );
-
-            double standardPoint[3];
-            resampledStandardFibers->GetPoint( standardPointList->GetId( i ), standardPoint );
-
-            double sumSquares = 0.0;
-            for ( int p = 0; p < 3; p++ )
-            {
-              double edge = testPoint[p] - standardPoint[p];
-              sumSquares += edge * edge;
-            }
-            sumDist += std::sqrt( sumSquares );
-          }
-
-          double dist = ( sumDist / numberOfPoints );
-          if ( dist < minDist )
-          {
-            minDist = dist;
-            closestK = k;
-          }
-        }
-      }
-
-      std::cout << "Pairing test fiber " << j << " with standard fiber " << closestK << " at distance " << minDist
-                << std::endl;
-      if ( maxDistances < minDist )
-      {
-        maxDistances = minDist;
-      }
+      maxDistances = pairing.distance;
     }
   }
+  std::cout << std::flush;
   return maxDistances;
 }
 
@@ -135,7 +99,15 @@ main( int argc, char * argv[] )
     std::cout << "Test For Tract Bijection: " << testForBijection << std::endl;
     std::cout << "Test For Tract Cardinality Agreement: " << testForFiberCardinality << std::endl;
     std::cout << "Number Of Guide Fiber Points: " << numberOfPoints << std::endl;
+    std::cout << "Fiber Distance Metric: " << distanceMetric << std::endl;
+  }
+
+  if ( numberOfPoints < 1 )
+  {
+    std::cerr << "ERROR: numberOfPoints must be at least 1" << std::endl;
+    return EXIT_FAILURE;
   }
+  const FiberDistanceMetricType metric = FiberDistanceMetricFromString( distanceMetric );
 
   vtkPolyData * testFiberTract;
   if ( writeXMLPolyDataFile )
@@ -207,7 +179,10 @@ main( int argc, char * argv[] )
 
   vtkPolyData * resampledStandardFibers = standardSpline->GetOutput();
 
-  double maxDistances = PairOffFibers( resampledTestFibers, resampledStandardFibers, numberOfPoints );
+  const PackedFiberBundle packedTestFibers( resampledTestFibers, numberOfPoints );
+  const PackedFiberBundle packedStandardFibers( resampledStandardFibers, numberOfPoints );
+
+  double maxDistances = PairOffFibers( packedTestFibers, packedStandardFibers, metric );
   std::cout << "Maximum distance to standard fibers from all test fibers was " << maxDistances
             << " which is required to be <= " << closeness << std::endl;
   if ( !( maxDistances <= closeness ) ) // Also fails on nan
@@ -220,7 +195,7 @@ main( int argc, char * argv[] )
 
   if ( testForBijection )
   {
-    maxDistances = PairOffFibers( resampledStandardFibers, resampledTestFibers, numberOfPoints );
+    maxDistances = PairOffFibers( packedStandardFibers, packedTestFibers, metric );
     std::cout << "Maximum distance to test fibers from all standard fibers was " << maxDistances
               << " which is required to be <= " << closeness << std::endl;
     if ( !( maxDistances <= closeness ) ) // Also fails on nan
@@ -317,8 +317,12 @@ main( int argc, char * argv[] )
   TensorFilterType::Pointer tensorFilter = TensorFilterType::New();
   tensorFilter->SetGradientImage( gradientDirectionContainer, indexImageToVectorImageFilter->GetOutput() );
   tensorFilter->SetThreshold( backgroundSuppressingThreshold );
-  tensorFilter->SetBValue( BValue );       /* Required */
-  tensorFilter->SetNumberOfWorkUnits( 1 ); /* Required */
+  tensorFilter->SetBValue( BValue ); /* Required */
+  if ( tensorEstimationMethod == "WLS" )
+  {
+    tensorFilter->SetEstimationMethod( TensorFilterType::WeightedLeastSquares );
+  }
+  tensorFilter->SetConstrainPositiveDefinite( constrainPositiveDefinite );
   if ( maskImage.IsNotNull() )
   {
     tensorFilter->SetMaskImage( maskImage );
@@ -0,0 +1,438 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+/*=========================================================================
+
+ Program:   GTRACT (Guided Tensor Restore Anatomical Connectivity Tractography)
+ Language:  C++
+
+   Copyright (c) University of Iowa Department of Radiology. All rights reserved.
+   See GTRACT-Copyright.txt or http://mri.radiology.uiowa.edu/copyright/GTRACT-Copyright.txt
+   for details.
+
+      This software is distributed WITHOUT ANY WARRANTY; without even
+      the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+      PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "gtractFiberTractComparison.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+
+#include <vtkCellType.h>
+#include <vtkIdList.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+
+#include "itkMacro.h"
+#include "itkMultiThreaderBase.h"
+
+namespace
+{
+/** Number of standard fibers in a leaf of the bounding volume hierarchy. */
+constexpr std::size_t FibersPerLeaf = 4;
+
+/** Number of points evaluated between two early termination checks. */
+constexpr unsigned int PointBlockSize = 8;
+
+/** Distance reported when there is no fiber to pair with. */
+constexpr double NoFiberDistance = 1E200;
+
+/** Lower bounds are shrunk by this factor before pruning, so that rounding in
+ *  the bound never discards a pair whose computed distance ties the best one. */
+constexpr double LowerBoundSlack = 1.0 - 1E-9;
+
+inline double
+BoundsDistance( const double * a, const double * b )
+{
+  double sumSquares = 0.0;
+  for ( unsigned int axis = 0; axis < 3; ++axis )
+  {
+    const double gap = std::max( { 0.0, a[axis] - b[axis + 3], b[axis] - a[axis + 3] } );
+    sumSquares += gap * gap;
+  }
+  return std::sqrt( sumSquares );
+}
+
+inline double
+PointDistance( const double * a, const double * b )
+{
+  double sumSquares = 0.0;
+  for ( unsigned int axis = 0; axis < 3; ++axis )
+  {
+    const double edge = a[axis] - b[axis];
+    sumSquares += edge * edge;
+  }
+  return std::sqrt( sumSquares );
+}
+
+inline void
+MergeBounds( double * bounds, const double * other )
+{
+  for ( unsigned int axis = 0; axis < 3; ++axis )
+  {
+    bounds[axis] = std::min( bounds[axis], other[axis] );
+    bounds[axis + 3] = std::max( bounds[axis + 3], other[axis + 3] );
+  }
+}
+
+inline void
+InitializeBounds( double * bounds )
+{
+  for ( unsigned int axis = 0; axis < 3; ++axis )
+  {
+    bounds[axis] = std::numeric_limits< double >::max();
+    bounds[axis + 3] = std::numeric_limits< double >::lowest();
+  }
+}
+
+/** Squared distance from (px,py,pz) to the closest of the n points xs,ys,zs. */
+inline double
+ClosestSquaredDistance( const double px, const double py, const double pz, const double * xs, const double * ys,
+                        const double * zs, const unsigned int n )
+{
+  double minimum = std::numeric_limits< double >::max();
+  for ( unsigned int j = 0; j < n; ++j )
+  {
+    const double dx = px - xs[j];
+    const double dy = py - ys[j];
+    const double dz = pz - zs[j];
+    minimum = std::min( minimum, dx * dx + dy * dy + dz * dz );
+  }
+  return minimum;
+}
+} // namespace
+
+FiberDistanceMetricType
+FiberDistanceMetricFromString( const std::string & metricName )
+{
+  if ( metricName == "MeanCorrespondingPoint" )
+  {
+    return FiberDistanceMetricType::MeanCorrespondingPoint;
+  }
+  if ( metricName == "MeanClosestPoint" )
+  {
+    return FiberDistanceMetricType::MeanClosestPoint;
+  }
+  if ( metricName == "Hausdorff" )
+  {
+    return FiberDistanceMetricType::Hausdorff;
+  }
+  itkGenericExceptionMacro( << "Unknown fiber distance metric: " << metricName );
+}
+
+PackedFiberBundle::PackedFiberBundle( vtkPolyData * fibers, unsigned int numberOfPoints )
+  : m_NumberOfPoints( numberOfPoints )
+{
+  if ( numberOfPoints == 0 )
+  {
+    return;
+  }
+  vtkSmartPointer< vtkIdList > pointList = vtkSmartPointer< vtkIdList >::New();
+  const vtkIdType              numberOfCells = fibers->GetNumberOfCells();
+  m_CellIds.reserve( numberOfCells );
+  m_Coordinates.reserve( static_cast< std::size_t >( numberOfCells ) * 3 * numberOfPoints );
+  m_Bounds.reserve( static_cast< std::size_t >( numberOfCells ) * 6 );
+  m_Centroids.reserve( static_cast< std::size_t >( numberOfCells ) * 3 );
+
+  for ( vtkIdType cellId = 0; cellId < numberOfCells; ++cellId )
+  {
+    if ( fibers->GetCellType( cellId ) != VTK_POLY_LINE )
+    {
+      continue;
+    }
+    fibers->GetCellPoints( cellId, pointList );
+    if ( pointList->GetNumberOfIds() < static_cast< vtkIdType >( numberOfPoints ) )
+    {
+      continue;
+    }
+
+    const std::size_t coordinateStart = m_Coordinates.size();
+    m_Coordinates.resize( coordinateStart + 3 * numberOfPoints );
+    double bounds[6];
+    InitializeBounds( bounds );
+    double centroid[3] = { 0.0, 0.0, 0.0 };
+    for ( unsigned int i = 0; i < numberOfPoints; ++i )
+    {
+      double point[3];
+      fibers->GetPoint( pointList->GetId( i ), point );
+      for ( unsigned int axis = 0; axis < 3; ++axis )
+      {
+        m_Coordinates[coordinateStart + axis * numberOfPoints + i] = point[axis];
+        bounds[axis] = std::min( bounds[axis], point[axis] );
+        bounds[axis + 3] = std::max( bounds[axis + 3], point[axis] );
+        centroid[axis] += point[axis];
+      }
+    }
+    m_CellIds.push_back( cellId );
+    m_Bounds.insert( m_Bounds.end(), bounds, bounds + 6 );
+    for ( unsigned int axis = 0; axis < 3; ++axis )
+    {
+      m_Centroids.push_back( centroid[axis] / numberOfPoints );
+    }
+  }
+}
+
+FiberTractComparator::FiberTractComparator( const PackedFiberBundle & standardFibers, FiberDistanceMetricType metric )
+  : m_StandardFibers( standardFibers )
+  , m_Metric( metric )
+{
+  const std::size_t numberOfFibers = m_StandardFibers.GetNumberOfFibers();
+  m_FiberOrder.resize( numberOfFibers );
+  for ( std::size_t f = 0; f < numberOfFibers; ++f )
+  {
+    m_FiberOrder[f] = f;
+  }
+  if ( numberOfFibers > 0 )
+  {
+    m_Nodes.reserve( 2 * ( numberOfFibers / FibersPerLeaf + 1 ) );
+    this->BuildNode( 0, numberOfFibers );
+  }
+}
+
+std::size_t
+FiberTractComparator::BuildNode( std::size_t first, std::size_t last )
+{
+  const std::size_t nodeIndex = m_Nodes.size();
+  m_Nodes.emplace_back();
+
+  Node node;
+  InitializeBounds( node.bounds );
+  double centroidBounds[6];
+  InitializeBounds( centroidBounds );
+  for ( std::size_t k = first; k < last; ++k )
+  {
+    const std::size_t f = m_FiberOrder[k];
+    MergeBounds( node.bounds, m_StandardFibers.GetBounds( f ) );
+    const double * centroid = m_StandardFibers.GetCentroid( f );
+    const double   centroidAsBounds[6] = { centroid[0], centroid[1], centroid[2],
+                                         centroid[0], centroid[1], centroid[2] };
+    MergeBounds( centroidBounds, centroidAsBounds );
+  }
+
+  if ( last - first <= FibersPerLeaf )
+  {
+    node.left = first;
+    node.right = 0;
+    node.count = last - first;
+    m_Nodes[nodeIndex] = node;
+    return nodeIndex;
+  }
+
+  // Median split along the axis where the fiber centroids spread the most.
+  unsigned int splitAxis = 0;
+  for ( unsigned int axis = 1; axis < 3; ++axis )
+  {
+    if ( centroidBounds[axis + 3] - centroidBounds[axis] >
+         centroidBounds[splitAxis + 3] - centroidBounds[splitAxis] )
+    {
+      splitAxis = axis;
+    }
+  }
+  const std::size_t middle = first + ( last - first ) / 2;
+  std::nth_element( m_FiberOrder.begin() + first,
+                    m_FiberOrder.begin() + middle,
+                    m_FiberOrder.begin() + last,
+                    [this, splitAxis]( const std::size_t a, const std::size_t b ) {
+                      const double ca = m_StandardFibers.GetCentroid( a )[splitAxis];
+                      const double cb = m_StandardFibers.GetCentroid( b )[splitAxis];
+                      return ca < cb || ( ca == cb && a < b );
+                    } );
+
+  node.count = 0;
+  node.left = this->BuildNode( first, middle );
+  node.right = this->BuildNode( middle, last );
+  m_Nodes[nodeIndex] = node;
+  return nodeIndex;
+}
+
+double
+FiberTractComparator::ComputeScore( const PackedFiberBundle & testFibers, std::size_t testFiber,
+                                    std::size_t standardFiber, double scoreLimit ) const
+{
+  const unsigned int n = testFibers.GetNumberOfPoints();
+  const double *     tx = testFibers.GetCoordinates( testFiber, 0 );
+  const double *     ty = testFibers.GetCoordinates( testFiber, 1 );
+  const double *     tz = testFibers.GetCoordinates( testFiber, 2 );
+  const double *     sx = m_StandardFibers.GetCoordinates( standardFiber, 0 );
+  const double *     sy = m_StandardFibers.GetCoordinates( standardFiber, 1 );
+  const double *     sz = m_StandardFibers.GetCoordinates( standardFiber, 2 );
+
+  switch ( m_Metric )
+  {
+    case FiberDistanceMetricType::MeanCorrespondingPoint:
+    {
+      double sumDist = 0.0;
+      double blockDistances[PointBlockSize];
+      for ( unsigned int start = 0; start < n; start += PointBlockSize )
+      {
+        const unsigned int blockLength = std::min( PointBlockSize, n - start );
+        for ( unsigned int i = 0; i < blockLength; ++i )
+        {
+          const double dx = tx[start + i] - sx[start + i];
+          const double dy = ty[start + i] - sy[start + i];
+          const double dz = tz[start + i] - sz[start + i];
+          blockDistances[i] = std::sqrt( dx * dx + dy * dy + dz * dz );
+        }
+        // Summed in point order, so the distance does not depend on the blocking.
+        for ( unsigned int i = 0; i < blockLength; ++i )
+        {
+          sumDist += blockDistances[i];
+        }
+        if ( sumDist > scoreLimit )
+        {
+          break;
+        }
+      }
+      return sumDist;
+    }
+    case FiberDistanceMetricType::MeanClosestPoint:
+    {
+      double sumDist = 0.0;
+      for ( unsigned int i = 0; i < n; ++i )
+      {
+        sumDist += std::sqrt( ClosestSquaredDistance( tx[i], ty[i], tz[i], sx, sy, sz, n ) );
+        if ( sumDist > scoreLimit )
+        {
+          break;
+        }
+      }
+      return sumDist;
+    }
+    case FiberDistanceMetricType::Hausdorff:
+    {
+      double maximumSquared = 0.0;
+      const double scoreLimitSquared = scoreLimit * scoreLimit;
+      for ( unsigned int i = 0; i < n && maximumSquared <= scoreLimitSquared; ++i )
+      {
+        maximumSquared = std::max( maximumSquared, ClosestSquaredDistance( tx[i], ty[i], tz[i], sx, sy, sz, n ) );
+      }
+      for ( unsigned int j = 0; j < n && maximumSquared <= scoreLimitSquared; ++j )
+      {
+        maximumSquared = std::max( maximumSquared, ClosestSquaredDistance( sx[j], sy[j], sz[j], tx, ty, tz, n ) );
+      }
+      if ( maximumSquared > scoreLimitSquared )
+      {
+        return std::numeric_limits< double >::infinity();
+      }
+      return std::sqrt( maximumSquared );
+    }
+  }
+  return std::numeric_limits< double >::max();
+}
+
+FiberPairing
+FiberTractComparator::PairOffFiber( const PackedFiberBundle & testFibers, std::size_t testFiber ) const
+{
+  const unsigned int n = testFibers.GetNumberOfPoints();
+  // Distances are bounded in score units: the mean metrics score the sum of n distances.
+  const double scoreScale = ( m_Metric == FiberDistanceMetricType::Hausdorff ) ? 1.0 : static_cast< double >( n );
+  const double boundScale = scoreScale * LowerBoundSlack;
+
+  const double * testBounds = testFibers.GetBounds( testFiber );
+  const double * testCentroid = testFibers.GetCentroid( testFiber );
+
+  double      bestScore = std::numeric_limits< double >::infinity();
+  std::size_t bestFiber = std::numeric_limits< std::size_t >::max();
+
+  using QueueEntryType = std::pair< double, std::size_t >;
+  std::priority_queue< QueueEntryType, std::vector< QueueEntryType >, std::greater< QueueEntryType > > queue;
+  if ( !m_Nodes.empty() )
+  {
+    queue.emplace( BoundsDistance( testBounds, m_Nodes[0].bounds ) * boundScale, 0 );
+  }
+  while ( !queue.empty() )
+  {
+    const QueueEntryType entry = queue.top();
+    queue.pop();
+    if ( entry.first > bestScore )
+    {
+      break;
+    }
+    const Node & node = m_Nodes[entry.second];
+    if ( node.right == 0 )
+    {
+      for ( std::size_t k = node.left; k < node.left + node.count; ++k )
+      {
+        const std::size_t f = m_FiberOrder[k];
+        double            lowerBound = BoundsDistance( testBounds, m_StandardFibers.GetBounds( f ) );
+        if ( m_Metric == FiberDistanceMetricType::MeanCorrespondingPoint )
+        {
+          // The mean of the point distances is at least the distance of the means.
+          lowerBound = std::max( lowerBound, PointDistance( testCentroid, m_StandardFibers.GetCentroid( f ) ) );
+        }
+        if ( lowerBound * boundScale > bestScore )
+        {
+          continue;
+        }
+        const double score = this->ComputeScore( testFibers, testFiber, f, bestScore );
+        if ( score < bestScore || ( score == bestScore && f < bestFiber ) )
+        {
+          bestScore = score;
+          bestFiber = f;
+        }
+      }
+    }
+    else
+    {
+      for ( const std::size_t child : { node.left, node.right } )
+      {
+        const double childBound = BoundsDistance( testBounds, m_Nodes[child].bounds ) * boundScale;
+        if ( childBound <= bestScore )
+        {
+          queue.emplace( childBound, child );
+        }
+      }
+    }
+  }
+
+  FiberPairing pairing;
+  pairing.cellId = testFibers.GetCellId( testFiber );
+  if ( bestFiber == std::numeric_limits< std::size_t >::max() )
+  {
+    pairing.closestCellId = -1;
+    pairing.distance = NoFiberDistance;
+  }
+  else
+  {
+    pairing.closestCellId = m_StandardFibers.GetCellId( bestFiber );
+    pairing.distance = bestScore / scoreScale;
+  }
+  return pairing;
+}
+
+std::vector< FiberPairing >
+FiberTractComparator::PairOffFibers( const PackedFiberBundle & testFibers ) const
+{
+  std::vector< FiberPairing > pairings( testFibers.GetNumberOfFibers() );
+
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  threader->ParallelizeArray( 0,
+                              pairings.size(),
+                              [&]( const itk::SizeValueType testFiber ) {
+                                pairings[testFiber] = this->PairOffFiber( testFibers, testFiber );
+                              },
+                              nullptr );
+  return pairings;
+}
@@ -0,0 +1,183 @@
+/*=========================================================================
+ *
+ *  Copyright SINAPSE: Scalable Informatics for Neuroscience, Processing and Software Engineering
+ *            The University of Iowa
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+/*=========================================================================
+
+ Program:   GTRACT (Guided Tensor Restore Anatomical Connectivity Tractography)
+ Language:  C++
+
+   Copyright (c) University of Iowa Department of Radiology. All rights reserved.
+   See GTRACT-Copyright.txt or http://mri.radiology.uiowa.edu/copyright/GTRACT-Copyright.txt
+   for details.
+
+      This software is distributed WITHOUT ANY WARRANTY; without even
+      the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+      PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+/** \
+ *   This file implements the fiber to fiber pairing used to compare two tracts.
+ *   Fibers are packed into contiguous arrays, candidate pairs are pruned with a
+ *   bounding volume hierarchy over the fibers, and the surviving pairs are
+ *   evaluated with an early terminating distance kernel.
+ */
+#ifndef __gtractFiberTractComparison_h
+#define __gtractFiberTractComparison_h
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+#include <vtkType.h>
+
+#include "gtractCommonWin32.h"
+
+class vtkPolyData;
+
+/** The distance used to pair a fiber with the closest fiber of another tract.
+ *
+ *  MeanCorrespondingPoint: mean distance between the i'th points of both
+ *                          (equally resampled) fibers.
+ *  MeanClosestPoint:       mean over the points of the first fiber of the
+ *                          distance to the closest point of the second fiber.
+ *  Hausdorff:              symmetric Hausdorff distance between the points
+ *                          of both fibers.
+ */
+enum class FiberDistanceMetricType
+{
+  MeanCorrespondingPoint,
+  MeanClosestPoint,
+  Hausdorff
+};
+
+extern GTRACT_COMMON_EXPORT FiberDistanceMetricType
+                            FiberDistanceMetricFromString( const std::string & metricName );
+
+/** \class PackedFiberBundle
+ *  The first numberOfPoints points of every poly line of a vtkPolyData, stored
+ *  as one x, y and z array per fiber (structure of arrays) in a single
+ *  contiguous buffer, together with the bounding box and centroid of every
+ *  fiber.  Cells that are not poly lines, or that have fewer points, are skipped.
+ */
+class GTRACT_COMMON_EXPORT PackedFiberBundle
+{
+public:
+  PackedFiberBundle( vtkPolyData * fibers, unsigned int numberOfPoints );
+
+  std::size_t
+  GetNumberOfFibers() const
+  {
+    return m_CellIds.size();
+  }
+
+  unsigned int
+  GetNumberOfPoints() const
+  {
+    return m_NumberOfPoints;
+  }
+
+  /** The cell of the vtkPolyData that fiber f was packed from. */
+  vtkIdType
+  GetCellId( std::size_t f ) const
+  {
+    return m_CellIds[f];
+  }
+
+  /** The x, y and z coordinates of fiber f, each GetNumberOfPoints() long. */
+  const double *
+  GetCoordinates( std::size_t f, unsigned int axis ) const
+  {
+    return &( m_Coordinates[( f * 3 + axis ) * m_NumberOfPoints] );
+  }
+
+  /** Bounding box of fiber f as { xmin, ymin, zmin, xmax, ymax, zmax }. */
+  const double *
+  GetBounds( std::size_t f ) const
+  {
+    return &( m_Bounds[f * 6] );
+  }
+
+  const double *
+  GetCentroid( std::size_t f ) const
+  {
+    return &( m_Centroids[f * 3] );
+  }
+
+private:
+  unsigned int             m_NumberOfPoints;
+  std::vector< vtkIdType > m_CellIds;
+  std::vector< double >    m_Coordinates;
+  std::vector< double >    m_Bounds;
+  std::vector< double >    m_Centroids;
+};
+
+/** The closest fiber found for one fiber of a tract. */
+struct FiberPairing
+{
+  vtkIdType cellId;        // cell of the fiber being paired
+  vtkIdType closestCellId; // closest cell in the other tract, -1 if none
+  double    distance;
+};
+
+/** \class FiberTractComparator
+ *  Pairs every fiber of a test bundle with the closest fiber of a standard
+ *  bundle.  A bounding volume hierarchy over the standard fibers is searched
+ *  best first, so only fibers whose bounding box (and, for corresponding
+ *  points, centroid) lower bound can beat the current best are evaluated.
+ *  Test fibers are paired in parallel with the ITK global thread pool.
+ *  Ties are resolved to the lowest standard cell, so the result is the same
+ *  as an exhaustive comparison in cell order.
+ */
+class GTRACT_COMMON_EXPORT FiberTractComparator
+{
+public:
+  FiberTractComparator( const PackedFiberBundle & standardFibers, FiberDistanceMetricType metric );
+
+  std::vector< FiberPairing >
+  PairOffFibers( const PackedFiberBundle & testFibers ) const;
+
+private:
+  struct Node
+  {
+    double      bounds[6];
+    std::size_t left;  // child nodes, or first fiber for leaves
+    std::size_t right; // 0 for leaves
+    std::size_t count; // number of fibers of a leaf
+  };
+
+  std::size_t
+  BuildNode( std::size_t first, std::size_t last );
+
+  FiberPairing
+  PairOffFiber( const PackedFiberBundle & testFibers, std::size_t testFiber ) const;
+
+  /** Returns the unnormalized score of the pair (the summed distances for the
+   *  mean metrics), or a value larger than scoreLimit as soon as it is known
+   *  to exceed scoreLimit. */
+  double
+  ComputeScore( const PackedFiberBundle & testFibers, std::size_t testFiber, std::size_t standardFiber,
+                double scoreLimit ) const;
+
+  const PackedFiberBundle & m_StandardFibers;
+  FiberDistanceMetricType   m_Metric;
+  std::vector< std::size_t > m_FiberOrder;
+  std::vector< Node >        m_Nodes;
+};
+
+#endif // __gtractFiberTractComparison_h
@@ -47,10 +47,12 @@
 #include "itkMetaDataObject.h"
 #include "itkProgressAccumulator.h"
 #include "itkMedianImageFilter.h"
+#include "itkMultiThreaderBase.h"
 
 #include "itkComputeDiffusionTensorImageFilter.h"
 #include "algo.h"
 
+#include <algorithm>
 #include <iostream>
 
 namespace itk
@@ -112,82 +114,148 @@ ComputeDiffusionTensorImageFilter ::Update()
   m_Output->SetOrigin( TensorOrigin );
   m_Output->Allocate();
 
-  using ADCIteratorType = itk::ImageLinearConstIteratorWithIndex< InputImageType >;
-  ADCIteratorType ADC_It( m_InternalImage, m_InternalImage->GetRequestedRegion() );
+  // The log-linear fit over the b-steps is linear in the log signals, so
+  // My_lsf( m_BValues, y ) with y(0) = 0 reduces to a fixed set of weights
+  // that only depend on the b-values.
+  const unsigned int numberOfFitPoints = m_BValues.size();
+  if ( static_cast< int >( numberOfFitPoints ) != m_NumberOfBSteps + 1 )
+  {
+    itkExceptionMacro( << "Expected " << m_NumberOfBSteps + 1 << " b-values but got " << numberOfFitPoints );
+  }
+  double sumX = 0.0;  // c in My_lsf
+  double sumXX = 0.0; // b in My_lsf
+  for ( unsigned int i = 0; i < numberOfFitPoints; i++ )
+  {
+    sumX += m_BValues( i );
+    sumXX += m_BValues( i ) * m_BValues( i );
+  }
+  const double denominator = sumXX / sumX - sumX / numberOfFitPoints;
+  m_BStepWeights.resize( m_NumberOfBSteps );
+  for ( int step = 0; step < m_NumberOfBSteps; step++ )
+  {
+    m_BStepWeights[step] =
+      static_cast< float >( ( m_BValues( step + 1 ) / sumX - 1.0 / numberOfFitPoints ) / denominator );
+  }
+
+  const TMatrix mMatrix = Matrix_Inverse( m_DiffusionDirections );
+  m_TensorWeights.resize( 6 * m_NumberOfDirections );
+  for ( unsigned int k = 0; k < 6; k++ )
+  {
+    for ( int direction = 0; direction < m_NumberOfDirections; direction++ )
+    {
+      m_TensorWeights[k * m_NumberOfDirections + direction] = mMatrix( k, direction );
+    }
+  }
+
+  if ( m_MaskImage.IsNotNull() && m_MaskImage->GetLargestPossibleRegion().GetSize() != TensorSize )
+  {
+    itkExceptionMacro( << "Mask size " << m_MaskImage->GetLargestPossibleRegion().GetSize()
+                       << " does not match image size " << TensorSize );
+  }
+
+  // Scan lines are independent; each work unit fits whole lines straight
+  // out of the input buffer and writes straight into the output buffer.
+  OutputImageRegionType lineRegion = TensorRegion;
+  lineRegion.SetSize( 0, 1 );
+  const SizeValueType lineLength = TensorSize[0];
+  MultiThreaderBase::Pointer threader = MultiThreaderBase::New();
+  threader->ParallelizeImageRegion< 3 >(
+    lineRegion,
+    [this, lineLength]( const OutputImageRegionType & lines ) {
+      std::vector< float >                                 logSignals;
+      ImageRegionConstIteratorWithIndex< OutputImageType > lineIt( m_Output, lines );
+      for ( lineIt.GoToBegin(); !lineIt.IsAtEnd(); ++lineIt )
+      {
+        this->ComputeTensorLine( lineIt.GetIndex(), lineLength, logSignals );
+      }
+    },
+    nullptr );
+
+  itk::Point< double, 3 > fixedOrigin = m_Output->GetOrigin();
+  fixedOrigin.GetVnlVector().fill( 0.0 );
+  m_Output->SetOrigin( fixedOrigin );
+  m_Output->SetMetaDataDictionary( m_Input->GetMetaDataDictionary() );
+}
 
-  ADC_It.SetDirection( 3 );
-  ADC_It.GoToBegin();
-  TMatrix mMatrix = Matrix_Inverse( m_DiffusionDirections );
+void
+ComputeDiffusionTensorImageFilter ::ComputeTensorLine( const OutputImageIndexType & lineStart,
+                                                       const SizeValueType          lineLength,
+                                                       std::vector< float > &       logSignals ) const
+{
+  OutputPixelType * outputLine = m_Output->GetBufferPointer() + m_Output->ComputeOffset( lineStart );
+  OutputPixelType   zeroTensor;
+  zeroTensor.Fill( 0 );
+  std::fill( outputLine, outputLine + lineLength, zeroTensor );
 
-  while ( !ADC_It.IsAtEnd() )
+  // Background lines are skipped entirely.
+  const MaskImageType::PixelType * maskLine = nullptr;
+  if ( m_MaskImage.IsNotNull() )
   {
-    /* Get the index & value for B0 */
-    ADC_It.GoToBeginOfLine();
-    float ADC0 = (float)ADC_It.Get();
-    ADCIndex = ADC_It.GetIndex();
-    for ( int i = 0; i < 3; i++ )
+    maskLine = m_MaskImage->GetBufferPointer() + m_MaskImage->ComputeOffset( lineStart );
+    if ( std::all_of( maskLine, maskLine + lineLength, []( MaskImageType::PixelType v ) { return v == 0; } ) )
     {
-      TensorIndex[i] = ADCIndex[i];
+      return;
     }
+  }
 
-    OutputPixelType currentVoxel;
-    currentVoxel.Fill( 0 );
+  // In the 4D input the signals of one volume are contiguous along x, and
+  // consecutive volumes are one 3D volume apart.
+  InputImageIndexType inputIndex;
+  for ( unsigned int i = 0; i < 3; i++ )
+  {
+    inputIndex[i] = lineStart[i];
+  }
+  inputIndex[3] = m_InternalImage->GetBufferedRegion().GetIndex()[3];
+  const InputImagePixelType * b0Line = m_InternalImage->GetBufferPointer() + m_InternalImage->ComputeOffset( inputIndex );
+  const OffsetValueType       volumeStride = m_InternalImage->GetOffsetTable()[3];
+
+  const int numberOfSignals = m_NumberOfDirections * m_NumberOfBSteps;
+  logSignals.resize( static_cast< size_t >( numberOfSignals ) );
+  for ( SizeValueType x = 0; x < lineLength; x++ )
+  {
+    const float ADC0 = static_cast< float >( b0Line[x] );
+    if ( !( ADC0 > m_BackgroundThreshold ) || ( maskLine != nullptr && maskLine[x] == 0 ) )
+    {
+      continue;
+    }
 
-    if ( ADC0 > m_BackgroundThreshold )
+    bool validSignals = true;
+    for ( int i = 0; i < numberOfSignals; i++ )
     {
-      ++ADC_It;
-      TVector temp( m_NumberOfBSteps * m_NumberOfDirections );
-      for ( int i = 0; i < m_NumberOfBSteps * m_NumberOfDirections; i++ )
+      const float signal = static_cast< float >( b0Line[x + ( i + 1 ) * volumeStride] );
+      if ( signal == 0 )
       {
-        temp( i ) = (float)ADC_It.Get();
-        ++ADC_It;
+        validSignals = false;
+        break;
       }
+      logSignals[i] = std::log( signal / ADC0 );
+    }
+    if ( !validSignals )
+    {
+      continue;
+    }
 
-      // ////////////////////////////////////////////////////////////////////////
-      TVector ADCm( m_NumberOfDirections );
-      TVector Ln_ADCs( m_NumberOfBSteps + 1 );
-      Ln_ADCs( 0 ) = 0;
-      bool ErrFlg = false;
-      for ( int direction = 0; direction < m_NumberOfDirections; direction++ )
+    float ADC[6] = { 0, 0, 0, 0, 0, 0 };
+    for ( int direction = 0; direction < m_NumberOfDirections; direction++ )
+    {
+      const float * directionLogs = &( logSignals[direction * m_NumberOfBSteps] );
+      float         slope = 0.0F;
+      for ( int step = 0; step < m_NumberOfBSteps; step++ )
       {
-        for ( int step = 0; step < m_NumberOfBSteps; step++ )
-        {
-          float tempflt;
-          tempflt = temp( direction * m_NumberOfBSteps + step );
-
-          if ( tempflt == 0 )
-          {
-            ErrFlg = true;
-            break;
-          }
-          Ln_ADCs( step + 1 ) = std::log( tempflt / ADC0 );
-        }
-        if ( ErrFlg )
-        {
-          break;
-        }
-        ADCm( direction ) = -1 * My_lsf( m_BValues, Ln_ADCs );
+        slope += m_BStepWeights[step] * directionLogs[step];
       }
-      if ( !ErrFlg )
+      const float   ADCm = -slope;
+      const float * tensorColumn = &( m_TensorWeights[direction] );
+      for ( unsigned int k = 0; k < 6; k++ )
       {
-        TVector ADCe = mMatrix * ADCm;
-        currentVoxel.SetVnlVector( ADCe );
+        ADC[k] += tensorColumn[k * m_NumberOfDirections] * ADCm;
       }
-      m_Output->SetPixel( TensorIndex, currentVoxel );
     }
-    else
+    for ( unsigned int k = 0; k < 6; k++ )
     {
-      m_Output->SetPixel( TensorIndex, currentVoxel );
+      outputLine[x][k] = ADC[k];
     }
-    // ////////////////////////////////////////////////////////////////////////
-
-    ADC_It.NextLine();
   }
-
-  itk::Point< double, 3 > fixedOrigin = m_Output->GetOrigin();
-  fixedOrigin.GetVnlVector().fill( 0.0 );
-  m_Output->SetOrigin( fixedOrigin );
-  m_Output->SetMetaDataDictionary( m_Input->GetMetaDataDictionary() );
 }
 } // end namespace itk
 #endif
@@ -46,6 +46,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 namespace itk
 {
@@ -101,6 +102,9 @@ public:
   using OutputImageSpacingType = OutputImageType::SpacingType;
   using OutputImagePointType = OutputImageType::PointType;
 
+  /** Optional mask, voxels outside the mask get a zero tensor */
+  using MaskImageType = itk::Image< unsigned char, 3 >;
+
   /** ImageDimension constants * /
   static constexpr unsigned int InputImageDimension = TInputImage::ImageDimension;
   static constexpr unsigned int OutputImageDimension = TOutputImage::ImageDimension;
@@ -123,6 +127,7 @@ public:
   /* SetInput and GetOutput Macros */
   itkSetObjectMacro( Input, InputImageType );
   itkGetConstObjectMacro( Output, OutputImageType );
+  itkSetConstObjectMacro( MaskImage, MaskImageType );
 
   itkSetMacro( UseMedianFilter, bool );
   itkSetMacro( MedianFilterSize, InputImageSizeType );
@@ -148,6 +153,11 @@ protected:
   ~ComputeDiffusionTensorImageFilter() override {}
 
 private:
+  /** Fit the tensors of every voxel of one scan line (along x) of the output. */
+  void
+  ComputeTensorLine( const OutputImageIndexType & lineStart, const SizeValueType lineLength,
+                     std::vector< float > & logSignals ) const;
+
   void
   computVoxelIsotropy();
 
@@ -163,6 +173,14 @@ private:
 
   InputImagePointer m_InternalImage;
 
+  MaskImageType::ConstPointer m_MaskImage;
+
+  // Precomputed fit, see Update():
+  // ADC(direction) = -sum_step m_BStepWeights[step] * log(S(direction, step) / S0)
+  // tensor[k] = sum_direction m_TensorWeights[k * NumberOfDirections + direction] * ADC(direction)
+  std::vector< float > m_BStepWeights;
+  std::vector< float > m_TensorWeights;
+
   bool               m_UseMedianFilter;
   InputImageSizeType m_MedianFilterSize;
   int                m_BackgroundThreshold;
@@ -2,6 +2,8 @@
 
 #include "itkMetaDataObject.h"
 #include "itkImageFileReader.h"
+#include "itkMultiThreaderBase.h"
+#include "itkVectorImage.h"
 #include "itkNrrdImageIOFactory.h"
 #include <iomanip>
 #include "nrrdCommon.h"
@@ -74,101 +76,8 @@ ITKToMType< itk::VariableLengthVector< float > >()
   return mxSINGLE_CLASS;
 }
 
-/** In order to use Reorganize below in a template function, there
- * needs to be a valid template function for the compiler to
- * instantiate even if it isn't going to be used
- */
-template < typename ImageType1, typename ImageType2 >
-void
-Reorganize( typename ImageType1::Pointer &, typename ImageType2::Pointer & )
-{
-  itkGenericExceptionMacro( << "Should never Instantiate this template function" );
-}
-
-/** Go from a Vector Image to a 4D image */
-template < typename TPixel >
-void Reorganize( typename itk::VectorImage< TPixel, 3 >::Pointer & vecImage,
-                 typename itk::Image< TPixel, 4 >::Pointer &       scalarImage )
-{
-  using TVecImage = itk::VectorImage< TPixel, 3 >;
-  using TScalarImage = itk::Image< TPixel, 4 >;
-  //
-  // this does a full, correct job of creating the corresponding 4D
-  // image from the 3D Vector Image, even though all we care about in
-  // this context is the reorganization of the voxels.
-  const typename TVecImage::SizeType vecImageSize = vecImage->GetLargestPossibleRegion().GetSize();
-  typename TScalarImage::SizeType    size;
-
-  const typename TVecImage::SpacingType vecSpacing = vecImage->GetSpacing();
-  typename TScalarImage::SpacingType    spacing;
-
-  const typename TVecImage::PointType vecOrigin = vecImage->GetOrigin();
-  typename TScalarImage::PointType    origin;
-
-  const typename TVecImage::DirectionType vecDirections = vecImage->GetDirection();
-  typename TScalarImage::DirectionType    directions;
-
-  for ( unsigned int i = 0; i < TScalarImage::ImageDimension; ++i )
-  {
-    if ( i < TVecImage::ImageDimension )
-    {
-      size[i] = vecImageSize[i];
-      spacing[i] = vecSpacing[i];
-      origin[i] = vecOrigin[i];
-    }
-    else
-    {
-      size[i] = vecImage->GetNumberOfComponentsPerPixel();
-      spacing[i] = 1.0;
-      origin[i] = 0.0;
-    }
-    for ( unsigned int j = 0; j < TScalarImage::ImageDimension; ++j )
-    {
-      if ( i < TVecImage::ImageDimension && j < TVecImage::ImageDimension )
-      {
-        directions( i, j ) = vecDirections( i, j );
-      }
-      else
-      {
-        directions( i, j ) = i == j ? 1.0 : 0.0;
-      }
-    }
-  }
-  scalarImage = TScalarImage::New();
-  scalarImage->SetRegions( size );
-  scalarImage->SetOrigin( origin );
-  scalarImage->SetSpacing( spacing );
-  scalarImage->SetDirection( directions );
-  scalarImage->Allocate();
-
-  typename TVecImage::IndexType    vecIndex;
-  typename TScalarImage::IndexType volIndex;
-
-  using IndexValueType = typename TScalarImage::IndexType::IndexValueType;
-
-  // convert from vector image to 4D volume image
-  for ( volIndex[3] = 0; volIndex[3] < static_cast< IndexValueType >( size[3] ); ++volIndex[3] )
-  {
-    for ( volIndex[2] = 0; volIndex[2] < static_cast< IndexValueType >( size[2] ); ++volIndex[2] )
-    {
-      vecIndex[2] = volIndex[2];
-      for ( volIndex[1] = 0; volIndex[1] < static_cast< IndexValueType >( size[1] ); ++volIndex[1] )
-      {
-        vecIndex[1] = volIndex[1];
-        for ( volIndex[0] = 0; volIndex[0] < static_cast< IndexValueType >( size[0] ); ++volIndex[0] )
-        {
-          vecIndex[0] = volIndex[0];
-          scalarImage->SetPixel( volIndex, vecImage->GetPixel( vecIndex )[volIndex[3]] );
-        }
-      }
-    }
-  }
-} // end reorganize
-
-/** Copy image data. In order for C++ function signature matching to
- * work properly, the function is templated over type, and it needs to
- * be repeated for every possible vector image type, since template
- * functions need to be fully specified.
+/** Copy image data.  ITK and matlab both store the first index fastest,
+ * so a scalar image is a single contiguous copy.
  */
 template < typename TImage >
 void
@@ -179,15 +88,44 @@ CopyImageData( typename TImage::Pointer & im, void * target, unsigned long numPi
   std::copy( data, data + numPixels, static_cast< PixelType * >( target ) );
 }
 
+/** A vector image keeps the components of a voxel together, while matlab
+ * stores the components as the slowest (4th) axis.  Permute with one
+ * strided pass per component, the components in parallel; every pass
+ * writes a contiguous block of the matlab array.
+ */
+template < typename TPixel >
+void
+CopyVectorImageData( const itk::VectorImage< TPixel, 3 > * im, void * target, unsigned long numPixels )
+{
+  const unsigned int numComponents = im->GetNumberOfComponentsPerPixel();
+  const size_t       numVoxels = numPixels / numComponents;
+  const TPixel *     source = im->GetBufferPointer();
+  TPixel *           destination = static_cast< TPixel * >( target );
+
+  itk::MultiThreaderBase::Pointer mt = itk::MultiThreaderBase::New();
+  mt->ParallelizeArray( 0,
+                        numComponents,
+                        [&]( const itk::SizeValueType component ) {
+                          const TPixel * in = source + component;
+                          TPixel *       out = destination + component * numVoxels;
+                          for ( size_t voxel = 0; voxel < numVoxels; ++voxel, in += numComponents )
+                          {
+                            out[voxel] = *in;
+                          }
+                        },
+                        nullptr );
+}
+
+/** In order for C++ function signature matching to work properly, the
+ * vector image copies need to be repeated for every possible vector image
+ * type, since template functions need to be fully specified.
+ */
 template <>
 void
 CopyImageData< itk::VectorImage< double, 3 > >( itk::VectorImage< double, 3 >::Pointer & im, void * target,
                                                 unsigned long numPixels )
 {
-  using ScalarImageType = itk::Image< double, 4 >;
-  ScalarImageType::Pointer newImage;
-  Reorganize< double >( im, newImage );
-  CopyImageData< ScalarImageType >( newImage, target, numPixels );
+  CopyVectorImageData< double >( im.GetPointer(), target, numPixels );
 }
 
 template <>
@@ -195,10 +133,7 @@ void
 CopyImageData< itk::VectorImage< float, 3 > >( itk::VectorImage< float, 3 >::Pointer & im, void * target,
                                                unsigned long numPixels )
 {
-  using ScalarImageType = itk::Image< float, 4 >;
-  ScalarImageType::Pointer newImage;
-  Reorganize< float >( im, newImage );
-  CopyImageData< ScalarImageType >( newImage, target, numPixels );
+  CopyVectorImageData< float >( im.GetPointer(), target, numPixels );
 }
 
 template <>
@@ -206,19 +141,50 @@ void
 CopyImageData< itk::VectorImage< short, 3 > >( itk::VectorImage< short, 3 >::Pointer & im, void * target,
                                                unsigned long numPixels )
 {
-  using ScalarImageType = itk::Image< short, 4 >;
-  ScalarImageType::Pointer newImage;
-  Reorganize< short >( im, newImage );
-  CopyImageData< ScalarImageType >( newImage, target, numPixels );
+  CopyVectorImageData< short >( im.GetPointer(), target, numPixels );
+}
+
+/** Read the voxels of the image described by \a reader into \a target.
+ * When the file already stores the matlab type with one component per
+ * voxel, the layouts match and the ImageIO decodes straight into the
+ * matlab array; no ITK buffer is allocated.  Otherwise the reader converts
+ * the pixels and they are copied (or permuted) into place.
+ */
+template < typename TImage >
+void
+ReadImageData( itk::ImageFileReader< TImage > * reader, void * target, unsigned long numPixels )
+{
+  using InternalPixelType = typename TImage::InternalPixelType;
+  itk::ImageIOBase * imageIO = reader->GetImageIO();
+  if ( imageIO->GetNumberOfComponents() == 1 && imageIO->GetNumberOfDimensions() == TImage::ImageDimension &&
+       imageIO->GetComponentType() == itk::ImageIOBase::MapPixelType< InternalPixelType >::CType )
+  {
+    const typename TImage::SizeType size = reader->GetOutput()->GetLargestPossibleRegion().GetSize();
+    itk::ImageIORegion              ioRegion( TImage::ImageDimension );
+    for ( unsigned int axIdx = 0; axIdx < TImage::ImageDimension; ++axIdx )
+    {
+      ioRegion.SetIndex( axIdx, 0 );
+      ioRegion.SetSize( axIdx, size[axIdx] );
+    }
+    imageIO->SetIORegion( ioRegion );
+    imageIO->Read( target );
+    return;
+  }
+  reader->Update();
+  typename TImage::Pointer im = reader->GetOutput();
+  CopyImageData< TImage >( im, target, numPixels );
 }
 
 // build the matlab DWI image structure. This should work as well for non-DWI images
 template < typename TImage >
 void
-BuildMatlabStruct( mxArray *& structMx, typename TImage::Pointer im )
+BuildMatlabStruct( mxArray *& structMx, itk::ImageFileReader< TImage > * reader )
 {
 
   using ImageType = TImage;
+  // Only the image information has been read so far; the voxels are read
+  // into the matlab array below.
+  typename ImageType::Pointer im = reader->GetOutput();
   using PixelType = typename TImage::PixelType;
   const itk::MetaDataDictionary & thisDic = im->GetMetaDataDictionary();
 
@@ -330,8 +296,8 @@ BuildMatlabStruct( mxArray *& structMx, typename TImage::Pointer im )
   const mxClassID mtype = ITKToMType< PixelType >(); // work needed here
 
   mxArray * data = mxCreateNumericArray( numMxDimensions, sizeI, mtype, mxREAL );
-  // copy voxels from ITK image to matlab matrix
-  CopyImageData< ImageType >( im, mxGetData( data ), numPixels );
+  // read voxels into the matlab matrix
+  ReadImageData< ImageType >( reader, mxGetData( data ), numPixels );
 
   // add voxel data to matlab struct
   mxSetFieldByNumber( structMx, 0, FIELDNAME_INDEX_data, data );
@@ -555,7 +521,7 @@ LoadDWIImage( const std::string & filename, mxArray *& structMx )
   reader->SetFileName( filename );
   try
   {
-    reader->Update();
+    reader->UpdateOutputInformation();
   }
   catch ( itk::ExceptionObject & e )
   {
@@ -563,8 +529,7 @@ LoadDWIImage( const std::string & filename, mxArray *& structMx )
     mexErrMsgTxt( msg.c_str() );
     return; // add by Hui Xie on Nov 3th, 2016
   }
-  typename ImageType::Pointer im = reader->GetOutput();
-  BuildMatlabStruct< ImageType >( structMx, im );
+  BuildMatlabStruct< ImageType >( structMx, reader.GetPointer() );
 }
 
 void
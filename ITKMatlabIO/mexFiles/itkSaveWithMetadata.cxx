@@ -219,14 +219,19 @@ WriteITKImageFromMatlabStructure( const MatlabStructManager & msm, const char *
     ComponentsPerPixel = mSize[ImageType::ImageDimension];
     SetNumberOfComponentsPerPixel< ImageType >( im, ComponentsPerPixel );
   }
-  im->Allocate();
   const mxArray * const dataMx = msm.GetField( "data" );
   // Note: Matlab returns the internal value types, not a vector of those types.
-  const typename TImage::InternalPixelType * voxels =
+  // The matlab array already has the ITK layout (first index fastest) and the
+  // pixel type was chosen from its class, so the image adopts the matlab
+  // buffer in place; the writer only reads it and the container never frees it.
+  typename TImage::InternalPixelType * voxels =
     static_cast< typename TImage::InternalPixelType * >( mxGetData( dataMx ) );
+  const size_t numElements = mxGetNumberOfElements( dataMx );
+  if ( numElements < numPixels * ComponentsPerPixel )
   {
-    std::copy( voxels, voxels + numPixels * ComponentsPerPixel, im->GetBufferPointer() );
+    mexErrMsgTxt( "itkSaveWithMetaData: data is smaller than its dimensions" );
   }
+  im->GetPixelContainer()->SetImportPointer( voxels, numElements, false );
 
   itk::MetaDataDictionary & thisDic = im->GetMetaDataDictionary();
 